@@ -30,9 +30,16 @@ check_znver_1_2() {
 # Set the file CPU x86_64 architecture
 set_arch_x86_64() {
   if check_flags 'avx512vnni' 'avx512dq' 'avx512f' 'avx512bw' 'avx512vl'; then
-    true_arch='x86-64-vnni256'
+    # Sapphire Rapids and later (with AMX) keep their clock with 512 bit operands
+    if check_flags 'amxtile'; then
+      true_arch='x86-64-vnni512'
+    else
+      true_arch='x86-64-vnni256'
+    fi
   elif check_flags 'avx512f' 'avx512bw'; then
     true_arch='x86-64-avx512'
+  elif check_flags 'avxvnni' 'bmi2'; then
+    true_arch='x86-64-avxvnni'
   elif [ -z "${znver_1_2+1}" ] && check_flags 'bmi2'; then
     true_arch='x86-64-bmi2'
   elif check_flags 'avx2'; then
@@ -57,7 +64,8 @@ case $uname_s in
       'x86_64')
         flags=$(sysctl -n machdep.cpu.features machdep.cpu.leaf7_features | tr '\n' ' ' | tr '[:upper:]' '[:lower:]' | sed "s/[_.]//g")
         set_arch_x86_64
-        if [ "$true_arch" = 'x86-64-vnni256' ] || [ "$true_arch" = 'x86-64-avx512' ]; then
+        if [ "$true_arch" = 'x86-64-vnni512' ] || [ "$true_arch" = 'x86-64-vnni256' ] \
+           || [ "$true_arch" = 'x86-64-avx512' ] || [ "$true_arch" = 'x86-64-avxvnni' ]; then
            file_arch='x86-64-bmi2'
         fi
         ;;
@@ -17,6 +17,7 @@
 */
 
 #include <cassert>
+#include <mutex>
 #include <vector>
 #include <bitset>
 
@@ -32,6 +33,7 @@ namespace Stockfish {
         constexpr unsigned MAX_INDEX = 2 * 24 * 64 * 64; // stm * psq * wksq * bksq = 196608
 
         std::bitset<MAX_INDEX> KPKBitbase;
+        std::once_flag         KPKInitialized;
 
         // A KPK bitbase index is an integer in [0, IndexMax] range
         //
@@ -72,6 +74,10 @@ namespace Stockfish {
 
         assert(file_of(wpsq) <= FILE_D);
 
+        // Computed by the first probe, most processes never see a KPK ending and the
+        // computation is a large part of the startup time.
+        std::call_once(KPKInitialized, init);
+
         return KPKBitbase[index(stm, bksq, wksq, wpsq)];
     }
 
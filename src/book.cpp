@@ -1,12 +1,21 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
 #include <deque>
 #include <fstream>
 #include <iostream>
+#include <mutex>
+#include <queue>
 #include <random>
 #include <regex>
 #include <sstream>
-#include <unordered_set>
+#include <string_view>
+#include <vector>
 
 #include "book.h"
+#include "misc.h"
 #include "san.h"
 #include "thread.h"
 #include "uci.h"
@@ -15,42 +24,106 @@ namespace Stockfish::Book {
 
 	const char* StartFEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
 
-	static std::deque<Book> book;
+	const char* TextBookFile = "eco.txt";
+	const char* BinaryBookFile = "eco.bin";
 
-	void init()
-	{
-		if (!Options["Use Book"]) return;
-		if (!book.empty())
-		{
-			std::cout << "Book is already loaded!" << std::endl;
-			return;
-		}
+	// The binary book file is laid out exactly like the tables in memory, so it can
+	// be mapped and used without any parsing:
+	//
+	// Header
+	// Entry   entries[entryCount]   sorted by position key
+	// Opening openings[openingCount]
+	// char    strings[stringsSize]  zero terminated opening names
+	struct Header {
+		char     magic[8];
+		Key      startKey;   // Detects files written with different Zobrist keys
+		uint32_t entryCount;
+		uint32_t openingCount;
+		uint32_t stringsSize;
+		uint32_t padding;
+	};
+
+	// A move played from the position with the given key in an opening line.
+	// The last position of each line is stored with Move::none(). All entries
+	// of a position are adjacent and ordered by the length of their line.
+	// Books imported from PGN games have one entry per move of a position instead,
+	// ordered by the number of games, and no opening lines.
+	struct Entry {
+		Key      key;
+		uint16_t move;
+		uint16_t padding;
+		uint32_t opening;
+		uint32_t games;                // 1 for the lines of eco.txt
+		uint32_t wins, draws, losses; // Of the side playing the move, imported books only
+	};
+
+	// Opening line: offset of its name in the string table and number of positions
+	struct Opening {
+		uint32_t name;
+		uint32_t length;
+	};
+
+	static_assert(sizeof(Header) == 32 && sizeof(Entry) == 32 && sizeof(Opening) == 8);
+
+	constexpr char     Magic[8] = "FLBOOK3";
+	constexpr uint32_t NoOpening = UINT32_MAX; // Entries imported from PGN games
+
+	// Tables built from eco.txt when no binary book is available
+	struct BookData {
+		std::vector<Entry>   entries;
+		std::vector<Opening> openings;
+		std::string          strings;
+	};
+
+	static BookData     bookData;
+	static const Entry*   entries = nullptr;
+	static const Opening* openings = nullptr;
+	static const char*    strings = nullptr;
+	static size_t         entryCount = 0, openingCount = 0;
+	static Key            startKey = 0;
 
-		std::ifstream is("eco.txt");
+	static void*    mapAddress = nullptr;
+	static size_t   mapSize = 0;
+	static uint64_t mapping = 0;
+
+	// Helper: starts a new opening line in the book data.
+	static uint32_t add_opening(BookData& data, const std::string& name) {
+
+		data.openings.push_back({ uint32_t(data.strings.size()), 0 });
+		data.strings += name;
+		data.strings += '\0';
+		return uint32_t(data.openings.size() - 1);
+	}
+
+	// Helper: adds the position of the given key and the move played from there.
+	static void add_entry(BookData& data, uint32_t opening, Key key, Move m) {
+
+		data.entries.push_back({ key, m.raw(), 0, opening, 1, 0, 0, 0 });
+		data.openings[opening].length++;
+	}
+
+	// Parses the ECO lines of the text book into data. The entries are sorted by key
+	// and then by line length, so the shortest opening of a position comes first.
+	static bool parse(const char* fname, BookData& data) {
+
+		std::ifstream is(fname);
 		if (!is)
-		{
-			Options["Use Book"] = false;
-			return;
-		}
-		bool bLoopGame = false;
-		bool bHaveECO = false;
-		Book* pBook = 0;
+			return false;
 
 		std::cout << "Init book ...\n";
 
 		Position pos;
-		StateListPtr sp(new std::deque<StateInfo>(1));
+		StateListPtr sp(new StateList(1));
 		{
 			pos.set(StartFEN, false, &sp->back(), nullptr);
-			auto& b = book.emplace_back();
-			b.opening = "Initial position";
-			b.list.emplace_back(Move::none(), pos.key());
+			add_entry(data, add_opening(data, "Initial position"), pos.key(), Move::none());
 		}
 
 		while (true) {
 
 			std::string line;
 			if (!std::getline(is, line)) break;
+			if (!line.empty() && line.back() == '\r') line.pop_back();
 			if (line.empty()) continue;
 
 			try
@@ -60,19 +133,18 @@ namespace Stockfish::Book {
 				std::regex rx(R"(\{(\w*)\s*(.*)\}\s*(.*))");
 				if (std::regex_match(line, match, rx))
 				{
-					sp.reset(new std::deque<StateInfo>(1));
+					sp.reset(new StateList(1));
 					pos.set(StartFEN, false, &sp->back(), Threads.main());
-					Book& b = book.emplace_back();
-					b.opening = match[1].str() + " " + match[2].str();
+					uint32_t opening = add_opening(data, match[1].str() + " " + match[2].str());
 #if _DEBUG
-					std::cout << b.opening << " ->";
+					std::cout << match[1].str() + " " + match[2].str() << " ->";
 #endif
 
-					std::string line(match[3]);
+					std::string moves(match[3]);
 					std::smatch match2;
 					std::regex rx2(R"((\d*)\.\s*(\S*)\s*(\S*))");
 
-					while (std::regex_search(line, match2, rx2))
+					while (std::regex_search(moves, match2, rx2))
 					{
 						for (int i = 2; i <= 3; ++i)
 						{
@@ -80,8 +152,8 @@ namespace Stockfish::Book {
 							Move m = SAN::algebraic_to_move(pos, match2[i]);
 							if (m)
 							{
+								add_entry(data, opening, pos.key(), m);
 								pos.do_move(m, sp->emplace_back());
-								b.list.emplace_back(m, pos.key());
 #if _DEBUG
 								std::cout << " " << match2[i];
 #endif
@@ -92,8 +164,9 @@ namespace Stockfish::Book {
 								exit(0);
 							}
 						}
-						line = match2.suffix();
+						moves = match2.suffix();
 					}
+					add_entry(data, opening, pos.key(), Move::none());
 #if _DEBUG
 					std::cout << std::endl;
 #endif
@@ -104,65 +177,588 @@ namespace Stockfish::Book {
 				std::cout << "ERROR: " << e.what() << std::endl;
 			}
 		}
+
+		std::stable_sort(data.entries.begin(), data.entries.end(),
+			[&](const Entry& a, const Entry& b) {
+				return a.key != b.key ? a.key < b.key
+					: data.openings[a.opening].length < data.openings[b.opening].length;
+			});
+
 		std::cout << "finished" << std::endl;
+		return true;
 	}
 
-	Move find_move(const Position& pos)
+	// Maps the binary book and sets up the tables, if the file exists and is valid.
+	static bool map_book(const char* fname) {
+
+		mapAddress = map_file(fname, mapSize, mapping);
+		if (!mapAddress)
+			return false;
+
+		const Header* header = static_cast<const Header*>(mapAddress);
+
+		if (mapSize < sizeof(Header)
+			|| std::memcmp(header->magic, Magic, sizeof(Magic))
+			|| header->startKey != startKey
+			|| mapSize != sizeof(Header) + header->entryCount * sizeof(Entry)
+			+ header->openingCount * sizeof(Opening) + header->stringsSize)
+		{
+			std::cout << "info string " << fname << " is invalid or outdated, use 'book build'" << std::endl;
+			unmap_file(mapAddress, mapSize, mapping);
+			mapAddress = nullptr;
+			return false;
+		}
+
+		entryCount = header->entryCount;
+		openingCount = header->openingCount;
+		entries = reinterpret_cast<const Entry*>(header + 1);
+		openings = reinterpret_cast<const Opening*>(entries + entryCount);
+		strings = reinterpret_cast<const char*>(openings + openingCount);
+		return true;
+	}
+
+	// Releases the book, so that the binary book file can be written again
+	static void unload() {
+
+		if (mapAddress)
+			unmap_file(mapAddress, mapSize, mapping);
+
+		mapAddress = nullptr;
+		bookData = BookData();
+		entries = nullptr;
+		openings = nullptr;
+		strings = nullptr;
+		entryCount = openingCount = 0;
+	}
+
+	void init()
 	{
-		Move bookMove = Move::none();
-		std::random_device rnd;
+		if (!Options["Use Book"]) return;
+		if (entries)
+		{
+			std::cout << "Book is already loaded!" << std::endl;
+			return;
+		}
 
-		if (book.empty())
-			return Move::none();
+		Position pos;
+		StateInfo st;
+		startKey = pos.set(StartFEN, false, &st, nullptr).key();
+
+		// Prefer the precompiled binary book, parsing eco.txt is slow
+		if (map_book(BinaryBookFile))
+			return;
 
-		if (pos.key() == 0x8F8F01D4562F59FB) // position key of the initial position
+		if (!parse(TextBookFile, bookData))
 		{
-			std::uniform_int_distribution<int> dist(0, int(book.size()) - 1);
-			bookMove = book[dist(rnd)].list[0].move;
+			Options["Use Book"] = false;
+			return;
 		}
-		else
+
+		entries = bookData.entries.data();
+		openings = bookData.openings.data();
+		strings = bookData.strings.data();
+		entryCount = bookData.entries.size();
+		openingCount = bookData.openings.size();
+	}
+
+	// Parses eco.txt and writes the binary book that is mapped by init().
+	bool build(const std::string& fname)
+	{
+		Position pos;
+		StateInfo st;
+		BookData data;
+
+		if (!parse(TextBookFile, data))
 		{
-			std::unordered_set<Move, Move::MoveHash> list;
-			for (const auto& b : book)
+			std::cout << "Unable to open " << TextBookFile << std::endl;
+			return false;
+		}
+
+		Header header = {};
+		std::memcpy(header.magic, Magic, sizeof(Magic));
+		header.startKey = pos.set(StartFEN, false, &st, nullptr).key();
+		header.entryCount = uint32_t(data.entries.size());
+		header.openingCount = uint32_t(data.openings.size());
+		header.stringsSize = uint32_t(data.strings.size());
+
+		unload();
+		std::ofstream os(fname, std::ios::binary);
+		os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		os.write(reinterpret_cast<const char*>(data.entries.data()), data.entries.size() * sizeof(Entry));
+		os.write(reinterpret_cast<const char*>(data.openings.data()), data.openings.size() * sizeof(Opening));
+		os.write(data.strings.data(), data.strings.size());
+
+		if (!os)
+		{
+			std::cout << "Failed to write " << fname << std::endl;
+			return false;
+		}
+
+		std::cout << "Book with " << header.openingCount << " openings and " << header.entryCount
+			<< " positions written to " << fname << std::endl;
+		init();
+		return true;
+	}
+
+	// Aggregated statistics of a move played from a position, see import()
+	struct Record {
+		Key      key;
+		uint16_t move;
+		uint16_t padding;
+		uint32_t games, wins, draws, losses;
+	};
+
+	static bool operator<(const Record& a, const Record& b) {
+
+		return a.key != b.key ? a.key < b.key : a.move < b.move;
+	}
+
+	// The records of an import are split by the top bits of the key over shards, so that
+	// the search threads rarely wait for each other. A shard is an open addressing table of
+	// fixed size: when it is full, its records are sorted and spilled to a run file. The
+	// key ranges of the shards are disjoint, merging the runs shard by shard gives the
+	// sorted entries of the book.
+	class ImportShard {
+
+		static constexpr size_t Size = 1 << 16; // Records, 2 MB per shard
+
+	public:
+		static constexpr int Bits = 6;
+
+		ImportShard() : table(Size) {}
+
+		void add(const Record* first, const Record* last, const std::string& prefix) {
+
+			std::lock_guard<std::mutex> lock(mutex);
+			for (; first != last; ++first)
 			{
-				if (b.list.size() > pos.game_ply())
+				size_t i = size_t(first->key ^ (first->key >> 29) ^ first->move * 0x9E3779B97F4A7C15ULL) & (Size - 1);
+				while (table[i].games && (table[i].key != first->key || table[i].move != first->move))
+					i = (i + 1) & (Size - 1);
+
+				Record& r = table[i];
+				if (!r.games)
 				{
-					const BookMove* l = &b.list[pos.game_ply() - 1];
-					if (l->hashKey == pos.key())
-						list.insert((l + 1)->move);
+					r = *first;
+					if (++count >= Size * 3 / 4)
+						spill(prefix);
+					continue;
 				}
+
+				r.games += first->games;
+				r.wins += first->wins;
+				r.draws += first->draws;
+				r.losses += first->losses;
 			}
+		}
+
+		// Sorts the records of the table to the front and empties it, they are returned
+		// as the last run and the table is not used any more.
+		std::vector<Record>& sorted() {
+
+			std::erase_if(table, [](const Record& r) { return !r.games; });
+			std::sort(table.begin(), table.end());
+			count = 0;
+			return table;
+		}
+
+		std::vector<std::string> runs;
+		bool                     failed = false;
+
+	private:
+		void spill(const std::string& prefix) {
 
-			if (list.empty())
-				return Move::none();
+			std::string fname = prefix + "." + std::to_string(runs.size());
+			std::vector<Record>& records = sorted();
+			std::ofstream os(fname, std::ios::binary);
+			os.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(Record));
+			failed |= !os;
+			runs.push_back(fname);
 
-			auto m = list.begin();
-			std::uniform_int_distribution<int> dist(0, int(list.size()) - 1);
-			std::advance(m, dist(rnd));
-			bookMove = *m;
+			records.assign(Size, Record{});
 		}
-		return bookMove;
+
+		std::mutex          mutex;
+		std::vector<Record> table;
+		size_t              count = 0;
+	};
+
+	// Replays the first plies of a PGN game and appends a record for each of them. Games
+	// from a setup position start from their FEN tag, games of other variants are skipped.
+	// Returns false if the game has no moves or one of them is not legal.
+	static bool replay(std::string_view game, Position& pos, std::vector<StateInfo>& states,
+		Thread* th, int maxPly, std::vector<Record>& records) {
+
+		std::string fen = StartFEN, result, token;
+		size_t      i = 0;
+
+		// Tag pairs like [Result "1-0"]
+		while (true)
+		{
+			while (i < game.size() && std::isspace(static_cast<unsigned char>(game[i])))
+				++i;
+			if (i == game.size() || game[i] != '[')
+				break;
+
+			size_t end = game.find('\n', i);
+			std::string_view tag = game.substr(i + 1, end == std::string_view::npos ? end : end - i - 1);
+			i = end == std::string_view::npos ? game.size() : end;
+
+			size_t q1 = tag.find('"'), q2 = tag.rfind('"');
+			if (q1 == std::string_view::npos || q2 <= q1)
+				continue;
+
+			std::string_view name = tag.substr(0, tag.find(' '));
+			std::string_view value = tag.substr(q1 + 1, q2 - q1 - 1);
+			if (name == "Result")
+				result = value;
+			else if (name == "FEN")
+				fen = value;
+			else if (name == "Variant" && value != "Standard" && value != "standard")
+				return false;
+		}
+
+		const int score = result == "1-0" ? 1 : result == "0-1" ? -1 : result == "1/2-1/2" ? 0 : 2;
+
+		pos.set(fen, false, &states[0], th);
+		int ply = 0, depth = 0; // Nesting of variations
+
+		// Movetext: move numbers, SAN moves, comments, variations, NAGs and the result
+		while (i < game.size() && ply < maxPly)
+		{
+			char c = game[i];
+			if (std::isspace(static_cast<unsigned char>(c)))
+			{
+				++i;
+				continue;
+			}
+
+			if (c == '{' || c == ';')
+			{
+				size_t end = game.find(c == '{' ? '}' : '\n', i);
+				i = end == std::string_view::npos ? game.size() : end + 1;
+				continue;
+			}
+
+			size_t end = i;
+			while (end < game.size() && !std::isspace(static_cast<unsigned char>(game[end]))
+				&& game[end] != '{' && game[end] != '(' && game[end] != ')' && game[end] != ';')
+				++end;
+			if (end == i)
+				end = i + 1; // A parenthesis
+
+			std::string_view word = game.substr(i, end - i);
+			i = end;
+
+			if (word == "(" || word == ")")
+			{
+				depth += word == "(" ? 1 : -1;
+				continue;
+			}
+
+			if (depth > 0 || word[0] == '$')
+				continue;
+
+			if (word == "1-0" || word == "0-1" || word == "1/2-1/2" || word == "*")
+				break;
+
+			// Move numbers like "12." and "12...", also glued to the move as in "12.e4"
+			size_t digits = word.find_first_not_of("0123456789");
+			if (digits == std::string_view::npos)
+				continue;
+			if (digits > 0 && word[digits] == '.')
+			{
+				word.remove_prefix(std::min(word.find_first_not_of('.', digits), word.size()));
+				if (word.empty())
+					continue;
+			}
+
+			token = word;
+			Move m = SAN::algebraic_to_move(pos, token);
+			if (!m)
+				return ply > 0;
+
+			const int s = pos.side_to_move() == WHITE ? score : -score;
+			records.push_back({ pos.key(), m.raw(), 0, 1, s == 1, s == 0, s == -1 });
+			pos.do_move(m, states[++ply]);
+		}
+
+		return ply > 0;
 	}
 
-	const Book* find_opening(const Position& pos) {
+	// Merges the runs of a shard and hands each (key, move) with its statistics summed up to f
+	template<typename F>
+	static void merge_runs(ImportShard& shard, F&& f) {
+
+		struct Run {
+			std::ifstream is;
+			const Record* memory = nullptr, * end = nullptr;
+			Record        current;
+
+			bool next() {
+				if (memory)
+				{
+					if (memory == end)
+						return false;
+					current = *memory++;
+					return true;
+				}
+				return bool(is.read(reinterpret_cast<char*>(&current), sizeof(Record)));
+			}
+		};
 
-		const Book* pBook = nullptr;
-		size_t min = 100;
-		for (const auto& b : book)
+		std::vector<Record>& last = shard.sorted();
+		std::deque<Run>      runs(shard.runs.size() + 1);
+		for (size_t i = 0; i < shard.runs.size(); ++i)
+			runs[i].is.open(shard.runs[i], std::ios::binary);
+		runs.back().memory = last.data();
+		runs.back().end = last.data() + last.size();
+
+		auto greater = [&](size_t a, size_t b) { return runs[b].current < runs[a].current; };
+		std::priority_queue<size_t, std::vector<size_t>, decltype(greater)> queue(greater);
+		for (size_t i = 0; i < runs.size(); ++i)
+			if (runs[i].next())
+				queue.push(i);
+
+		bool   any = false;
+		Record sum{};
+		while (!queue.empty())
+		{
+			size_t i = queue.top();
+			queue.pop();
+			const Record& r = runs[i].current;
+
+			if (any && sum.key == r.key && sum.move == r.move)
+			{
+				sum.games += r.games;
+				sum.wins += r.wins;
+				sum.draws += r.draws;
+				sum.losses += r.losses;
+			}
+			else
+			{
+				if (any)
+					f(sum);
+				sum = r;
+				any = true;
+			}
+
+			if (runs[i].next())
+				queue.push(i);
+		}
+		if (any)
+			f(sum);
+
+		for (auto& run : runs)
+			run.is.close();
+		for (const auto& fname : shard.runs)
+			std::remove(fname.c_str());
+	}
+
+	// Builds a book from the PGN games of a file: reads them in blocks, which are replayed
+	// by the search threads while the next block is read, and writes every move played in
+	// at least minGames games within the first maxPly plies with its statistics to fname.
+	bool import(const std::string& pgn, int maxPly, int minGames, const std::string& fname)
+	{
+		constexpr size_t BlockSize = 4096; // Games
+
+		std::ifstream in(pgn);
+		if (!in)
 		{
-			if (b.list.size() >= pos.game_ply())
+			std::cout << "Unable to open " << pgn << std::endl;
+			return false;
+		}
+
+		maxPly = std::clamp(maxPly, 1, MAX_PLY);
+		minGames = std::max(minGames, 1);
+
+		Position  p;
+		StateInfo st;
+		Header    header = {};
+		std::memcpy(header.magic, Magic, sizeof(Magic));
+		header.startKey = p.set(StartFEN, false, &st, nullptr).key();
+
+		Tasks::start();
+		const size_t             chunks = 4 * Tasks::workers();
+		std::vector<ImportShard> shards(1 << ImportShard::Bits);
+		std::atomic<uint64_t>    games = 0, skipped = 0;
+		TimePoint                start = now();
+
+		// Each task replays a chunk of the block with the Position of the search thread of its worker
+		auto replay_block = [&](const std::vector<std::string>& block, size_t c) {
+			Thread*                th = *(Threads.begin() + Tasks::worker());
+			Position               pos;
+			std::vector<StateInfo> states(maxPly + 1);
+			std::vector<Record>    records;
+
+			for (size_t i = c * block.size() / chunks; i < (c + 1) * block.size() / chunks; ++i)
+				if (replay(block[i], pos, states, th, maxPly, records))
+					++games;
+				else
+					++skipped;
+
+			// Add the records shard by shard, so that every shard is locked only once
+			std::sort(records.begin(), records.end(),
+				[](const Record& a, const Record& b) { return (a.key >> (64 - ImportShard::Bits)) < (b.key >> (64 - ImportShard::Bits)); });
+			for (auto first = records.begin(); first != records.end();)
 			{
-				for (const auto& l : b.list)
+				size_t s = size_t(first->key >> (64 - ImportShard::Bits));
+				auto   last = std::find_if(first, records.end(),
+					[&](const Record& r) { return size_t(r.key >> (64 - ImportShard::Bits)) != s; });
+				shards[s].add(&*first, &*first + (last - first), fname + ".shard" + std::to_string(s));
+				first = last;
+			}
+		};
+
+		std::vector<std::string> block, next;
+		std::string              line, game;
+		bool                     movetext = false;
+
+		auto read_block = [&](std::vector<std::string>& b) {
+			b.clear();
+			while (b.size() < BlockSize && std::getline(in, line))
+			{
+				if (!line.empty() && line.back() == '\r')
+					line.pop_back();
+
+				// A tag after the movetext starts the next game
+				if (!line.empty() && line[0] == '[' && movetext)
 				{
-					if (l.hashKey == pos.key() && b.list.size() < min)
-					{
-						min = b.list.size();
-						pBook = &b;
-					}
+					b.push_back(std::move(game));
+					game.clear();
+					movetext = false;
 				}
+				else if (!line.empty() && line[0] != '[' && line.find_first_not_of(" \t") != std::string::npos)
+					movetext = true;
+
+				game += line;
+				game += '\n';
+			}
+			if (!in && !game.empty())
+			{
+				b.push_back(std::move(game));
+				game.clear();
+			}
+		};
+
+		uint64_t report = 100000;
+		read_block(block);
+		while (!block.empty())
+		{
+			for (size_t c = 0; c < chunks; ++c)
+				Tasks::submit([&, c] { replay_block(block, c); }, false);
+			read_block(next);
+			Tasks::wait();
+			std::swap(block, next);
+
+			if (games >= report)
+			{
+				sync_cout << "info string " << games << " games imported" << sync_endl;
+				report += 100000;
 			}
 		}
 
-		return pBook;
+		// Merge the runs of each shard and write the entries. The entries of a position are
+		// kept until the key changes, then they are written ordered by the number of games.
+		unload();
+		std::ofstream os(fname, std::ios::binary);
+		os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+		std::vector<Entry> position;
+		bool               failed = false;
+		auto flush = [&] {
+			std::stable_sort(position.begin(), position.end(),
+				[](const Entry& a, const Entry& b) { return a.games > b.games; });
+			os.write(reinterpret_cast<const char*>(position.data()), position.size() * sizeof(Entry));
+			header.entryCount += uint32_t(position.size());
+			position.clear();
+		};
+
+		for (auto& shard : shards)
+		{
+			failed |= shard.failed;
+			merge_runs(shard, [&](const Record& r) {
+				if (!position.empty() && position[0].key != r.key)
+					flush();
+				if (r.games >= uint32_t(minGames))
+					position.push_back({ r.key, r.move, 0, NoOpening, r.games, r.wins, r.draws, r.losses });
+				});
+		}
+		flush();
+
+		os.seekp(0);
+		os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		os.close();
+
+		if (failed || !os)
+		{
+			std::cout << "Failed to write " << fname << std::endl;
+			return false;
+		}
+
+		std::cout << "Book with " << header.entryCount << " moves of " << games << " games ("
+			<< skipped << " skipped) written to " << fname << " in " << now() - start << " ms" << std::endl;
+		init();
+		return true;
+	}
+
+	// Helper: returns all entries of the position with the given key.
+	static std::pair<const Entry*, const Entry*> probe(Key key) {
+
+		return std::equal_range(entries, entries + entryCount, Entry{ key, 0, 0, 0, 0, 0, 0, 0 },
+			[](const Entry& a, const Entry& b) { return a.key < b.key; });
+	}
+
+	Move find_move(const Position& pos)
+	{
+		Move bookMove = Move::none();
+		std::random_device rnd;
+
+		if (!entries)
+			return Move::none();
+
+		auto [first, last] = probe(pos.key());
+
+		// Every opening line continuing from this position has an entry, and an imported
+		// move counts its games, so each move is weighted by how often it is played.
+		uint64_t count = 0;
+		for (const Entry* e = first; e != last; ++e)
+			count += e->move ? e->games : 0;
+
+		if (!count)
+			return Move::none();
+
+		std::uniform_int_distribution<uint64_t> dist(0, count - 1);
+		for (uint64_t n = dist(rnd); !bookMove; ++first)
+			if (first->move && n < first->games)
+				bookMove = Move(first->move);
+			else if (first->move)
+				n -= first->games;
+
+		MoveList<LEGAL> legalMoves(pos);
+
+		// Guard against key collisions
+		return legalMoves.contains(bookMove) ? bookMove : Move::none();
+	}
+
+	std::string_view find_opening(const Position& pos) {
+
+		if (!entries)
+			return {};
+
+		// The entries of a position are ordered by line length, the first line
+		// long enough to contain the position is the shortest opening.
+		auto [first, last] = probe(pos.key());
+		for (const Entry* e = first; e != last; ++e)
+		{
+			if (e->opening == NoOpening)
+				continue;
+
+			const Opening& o = openings[e->opening];
+			if (o.length >= size_t(pos.game_ply()) && o.length < 100)
+				return std::string_view(strings + o.name);
+		}
+
+		return {};
 	}
 }
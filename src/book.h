@@ -2,30 +2,17 @@
 #define BOOK_H_INCLUDED
 
 #include <string>
-#include <vector>
+#include <string_view>
 
 #include "position.h"
 
 namespace Stockfish::Book {
 
-	struct BookMove {
-		Move move;
-		Key hashKey;
-
-		BookMove(Move m, Key key) {
-			move = m;
-			hashKey = key; // position key AFTER the move has been made
-		}
-	};
-
-	struct Book {
-		std::string opening;
-		std::vector<BookMove> list;
-	};
-
 	void init();
+	bool build(const std::string& fname);
+	bool import(const std::string& pgn, int maxPly, int minGames, const std::string& fname);
 	Move find_move(const Position& pos);
-	const Book* find_opening(const Position& pos);
+	std::string_view find_opening(const Position& pos);
 }
 
 #endif
\ No newline at end of file
@@ -39,6 +39,7 @@
 #include "syzygy/tbprobe.h"
 
 #include "san.h"
+#include "searchstats.h"
 
 namespace Stockfish {
 
@@ -195,7 +196,7 @@ namespace Stockfish {
                 if (!rootNode)
                 {
                     // Step 2. Check for aborted search and immediate draw
-                    if (Threads.stop.load(std::memory_order_relaxed) || pos.is_draw(ss->ply) || ss->ply >= MAX_PLY)
+                    if (thisThread->stop_requested() || pos.is_draw(ss->ply) || ss->ply >= MAX_PLY)
                         return (ss->ply >= MAX_PLY && !ss->inCheck) ? evaluate<SearchMate>(pos) : value_draw(pos.this_thread());
 
                     // Step 3. Mate distance pruning. Even if we mate at the next move our score
@@ -338,6 +339,7 @@ namespace Stockfish {
                     improving = false;
                     improvement = 0;
                     complexity = 0;
+                    SEARCH_TRY(ProbCutInCheck, depth);
                     goto moves_loop;
                 }
                 else if (ss->ttHit)
@@ -385,19 +387,27 @@ namespace Stockfish {
                 // return a fail low.
                 if (eval < alpha - 369 - 254 * depth * depth)
                 {
+                    SEARCH_TRY(Razoring, depth);
                     value = qsearch<NonPV, SearchMate>(pos, ss, alpha - 1, alpha);
                     if (value < alpha)
+                    {
+                        SEARCH_CUT(Razoring, depth);
                         return value;
+                    }
                 }
 
                 // Step 8. Futility pruning: child node (~25 Elo).
                 // The depth condition is important for mate finding.
+                SEARCH_TRY(Futility, depth);
                 if (!ss->ttPv
                     && depth < 8
                     && eval - futility_margin<SearchMate>(depth, improving) - (ss - 1)->statScore / 303 >= beta
                     && eval >= beta
                     && eval < 28031) // larger than VALUE_KNOWN_WIN, but smaller than TB wins
+                {
+                    SEARCH_CUT(Futility, depth);
                     return eval;
+                }
 
                 // Step 9. Null move search with verification search (~22 Elo)
                 if (!PvNode
@@ -411,6 +421,7 @@ namespace Stockfish {
                     && (ss->ply >= thisThread->nmpMinPly || us != thisThread->nmpColor))
                 {
                     assert(eval - beta >= 0);
+                    SEARCH_TRY(NullMove, depth);
 
                     // Null move dynamic reduction based on depth, eval and complexity of position
                     Depth R = std::min(int(eval - beta) / 168, 7) + depth / 3 + 4 - (complexity > 861);
@@ -431,7 +442,10 @@ namespace Stockfish {
                             nullValue = beta;
 
                         if (thisThread->nmpMinPly || (std::abs(beta) < VALUE_KNOWN_WIN && depth < 14))
+                        {
+                            SEARCH_CUT(NullMove, depth);
                             return nullValue;
+                        }
 
                         assert(!thisThread->nmpMinPly); // Recursive verification is not allowed
 
@@ -445,7 +459,10 @@ namespace Stockfish {
                         thisThread->nmpMinPly = 0;
 
                         if (v >= beta)
+                        {
+                            SEARCH_CUT(NullMove, depth);
                             return nullValue;
+                        }
                     }
                 }
 
@@ -467,6 +484,7 @@ namespace Stockfish {
                         && ttValue < probCutBeta))
                 {
                     assert(probCutBeta < VALUE_INFINITE);
+                    SEARCH_TRY(ProbCut, depth);
 
                     MovePicker mp(pos, ttMove, probCutBeta - ss->staticEval, &captureHistory);
 
@@ -494,6 +512,7 @@ namespace Stockfish {
                             {
                                 // Save ProbCut data into transposition table
                                 tte->save(posKey, value_to_tt(value, ss->ply), ss->ttPv, BOUND_LOWER, depth - 3, move, ss->staticEval);
+                                SEARCH_CUT(ProbCut, depth);
                                 return value;
                             }
                         }
@@ -523,7 +542,10 @@ namespace Stockfish {
                     && ttValue >= probCutBeta
                     && std::abs(ttValue) <= VALUE_KNOWN_WIN
                     && std::abs(beta) <= VALUE_KNOWN_WIN)
+                {
+                    SEARCH_CUT(ProbCutInCheck, depth);
                     return probCutBeta;
+                }
 
                 const PieceToHistory* contHist[] = { (ss - 1)->continuationHistory,
                                                      (ss - 2)->continuationHistory,
@@ -534,7 +556,7 @@ namespace Stockfish {
 
                 Move countermove = prevSq != SQ_NONE ? thisThread->counterMoves[pos.piece_on(prevSq)][prevSq] : Move::none();
 
-                MovePicker mp(pos, ttMove, depth, &thisThread->mainHistory, &captureHistory, contHist, countermove, ss->killers);
+                MovePicker mp(pos, ttMove, depth, &thisThread->mainHistory, &captureHistory, contHist, nullptr, countermove, ss->killers);
 
                 value = bestValue;
                 moveCountPruning = singularQuietLMR = false;
@@ -567,9 +589,9 @@ namespace Stockfish {
                     ss->moveCount = ++moveCount;
 
                     if (rootNode && bUCI && thisThread == Threads.main() && Time.elapsed() > 3000)
-                        sync_cout << "info depth " << depth
-                        << " currmove " << UCI::move(move, pos.is_chess960())
-                        << " currmovenumber " << moveCount + thisThread->pvIdx << sync_endl;
+                        AsyncOut::post([s = "info depth " + std::to_string(depth) + " currmove " + UCI::move(move, pos.is_chess960())
+                            + " currmovenumber " + std::to_string(moveCount + thisThread->pvIdx)]() { return s; },
+                            AsyncOut::CurrMove);
 
                     if (PvNode)
                         (ss + 1)->pv = nullptr;
@@ -590,9 +612,16 @@ namespace Stockfish {
                         // Skip quiet moves if movecount exceeds our FutilityMoveCount threshold (~7 Elo)
                         moveCountPruning = moveCount >= futility_move_count(improving, depth);
 
+                        SEARCH_TRY(MoveCount, depth);
+                        if (moveCountPruning)
+                            SEARCH_CUT(MoveCount, depth);
+
                         // Reduced depth of the next LMR search
                         int lmrDepth = std::max(newDepth - reduction<SearchMate>(improving, depth, moveCount, delta, thisThread->rootDelta), 0);
 
+                        SEARCH_TRY(MoveFutility, depth);
+                        SEARCH_TRY(SeePruning, depth);
+
                         if (capture || givesCheck)
                         {
                             // Futility pruning for captures (~0 Elo)
@@ -602,11 +631,17 @@ namespace Stockfish {
                                 && !ss->inCheck
                                 && ss->staticEval + 180 + 201 * lmrDepth + PieceValueME[EG][pos.piece_on(move.to_sq())]
                                 + captureHistory[movedPiece][move.to_sq()][type_of(pos.piece_on(move.to_sq()))] / 6 < alpha)
+                            {
+                                SEARCH_CUT(MoveFutility, depth);
                                 continue;
+                            }
 
                             // SEE based pruning (~9 Elo)
-                            if (!pos.see_ge<true>(move, -222 * depth))
+                            if (!mp.see_ge(move, -222 * depth))
+                            {
+                                SEARCH_CUT(SeePruning, depth);
                                 continue;
+                            }
                         }
                         else
                         {
@@ -616,7 +651,10 @@ namespace Stockfish {
 
                             // Continuation history based pruning (~2 Elo)
                             if (lmrDepth < 5 && history < -3875 * (depth - 1))
+                            {
+                                SEARCH_CUT(MoveFutility, depth);
                                 continue;
+                            }
 
                             history += 2 * thisThread->mainHistory[us][move.from_to()];
 
@@ -624,11 +662,17 @@ namespace Stockfish {
                             if (!ss->inCheck
                                 && lmrDepth < 13
                                 && ss->staticEval + 106 + 145 * lmrDepth + history / 52 <= alpha)
+                            {
+                                SEARCH_CUT(MoveFutility, depth);
                                 continue;
+                            }
 
                             // Prune moves with negative SEE (~3 Elo)
-                            if (!pos.see_ge<true>(move, (-24 * lmrDepth - 15) * lmrDepth))
+                            if (!mp.see_ge(move, (-24 * lmrDepth - 15) * lmrDepth))
+                            {
+                                SEARCH_CUT(SeePruning, depth);
                                 continue;
+                            }
                         }
                     }
 
@@ -656,8 +700,12 @@ namespace Stockfish {
                             value = search<NonPV, SearchMate>(pos, ss, singularBeta - 1, singularBeta, singularDepth, cutNode);
                             ss->excludedMove = Move::none();
 
+                            SEARCH_TRY(Singular, depth);
+                            SEARCH_TRY(MultiCut, depth);
+
                             if (value < singularBeta)
                             {
+                                SEARCH_CUT(Singular, depth);
                                 extension = 1;
                                 singularQuietLMR = !ttCapture;
 
@@ -672,7 +720,10 @@ namespace Stockfish {
                             // that multiple moves fail high, and we can prune the whole subtree by returning
                             // a soft bound.
                             else if (singularBeta >= beta)
+                            {
+                                SEARCH_CUT(MultiCut, depth);
                                 return singularBeta;
+                            }
 
                             // If the eval of ttMove is greater than beta, we reduce it (negative extension)
                             else if (ttValue >= beta)
@@ -702,7 +753,7 @@ namespace Stockfish {
                     ss->doubleExtensions = (ss - 1)->doubleExtensions + (extension == 2);
 
                     // Speculative prefetch as early as possible
-                    prefetch(TT.first_entry(pos.key_after(move)));
+                    thisThread->prefetch_after<true, SearchMate>(pos, move);
 
                     // Update the current move (this must be done after singular extension search)
                     ss->currentMove = move;
@@ -772,6 +823,13 @@ namespace Stockfish {
 
                         value = -search<NonPV, SearchMate>(pos, ss + 1, -(alpha + 1), -alpha, d, true);
 
+                        if (d < newDepth)
+                        {
+                            SEARCH_TRY(Lmr, depth);
+                            if (value <= alpha)
+                                SEARCH_CUT(Lmr, depth);
+                        }
+
                         // Do full depth search when reduced LMR search fails high
                         if (value > alpha && d < newDepth)
                         {
@@ -820,7 +878,7 @@ namespace Stockfish {
                     // Finished searching the move. If a stop occurred, the return value of
                     // the search cannot be trusted, and we return immediately without
                     // updating best move, PV and TT.
-                    if (Threads.stop.load(std::memory_order_relaxed))
+                    if (thisThread->stop_requested())
                         return VALUE_ZERO;
 
                     if (rootNode)
@@ -957,6 +1015,10 @@ namespace Stockfish {
             }
             else
             {
+                // The search of 'go mate', with the Huntsman evaluation and margins and depth
+                // conditions tuned for mates. It shares the TT with the normal search: a small
+                // table of its own solved no more mates, and no faster, in 'test mate'.
+
                 // Dive into quiescence search when the depth reaches zero
                 if (depth <= 0)
                     return qsearch<PvNode ? PV : NonPV, SearchMate>(pos, ss, alpha, beta);
@@ -1006,7 +1068,7 @@ namespace Stockfish {
                     if (pos.is_draw(ss->ply))
                         return value_draw(thisThread);
 
-                    if (Threads.stop.load(std::memory_order_relaxed) || ss->ply >= MAX_PLY)
+                    if (thisThread->stop_requested() || ss->ply >= MAX_PLY)
                         return (ss->ply >= MAX_PLY && !ss->inCheck) ? evaluate<SearchMate>(pos) : VALUE_ZERO;
 
                     // Step 3. Mate distance pruning. Even if we mate at the next move our score
@@ -1337,7 +1399,7 @@ namespace Stockfish {
 
                 Move countermove = prevSq != SQ_NONE ? thisThread->counterMoves[pos.piece_on(prevSq)][prevSq] : Move::none();
 
-                MovePicker mp(pos, ttMove, depth, &thisThread->mainHistory, &captureHistory, contHist, countermove, ss->killers);
+                MovePicker mp(pos, ttMove, depth, &thisThread->mainHistory, &captureHistory, contHist, nullptr, countermove, ss->killers);
 
                 value = bestValue;
                 moveCountPruning = singularQuietLMR = false;
@@ -1369,9 +1431,9 @@ namespace Stockfish {
                     ss->moveCount = ++moveCount;
 
                     if (rootNode && bUCI && thisThread == Threads.main() && Time.elapsed() > 3000)
-                        sync_cout << "info depth " << depth
-                        << " currmove " << UCI::move(move, pos.is_chess960())
-                        << " currmovenumber " << moveCount + thisThread->pvIdx << sync_endl;
+                        AsyncOut::post([s = "info depth " + std::to_string(depth) + " currmove " + UCI::move(move, pos.is_chess960())
+                            + " currmovenumber " + std::to_string(moveCount + thisThread->pvIdx)]() { return s; },
+                            AsyncOut::CurrMove);
 
                     if (PvNode)
                         (ss + 1)->pv = nullptr;
@@ -1414,7 +1476,7 @@ namespace Stockfish {
                                 continue;
 
                             // SEE based pruning (~11 Elo)
-                            if (!pos.see_ge<true>(move, -205 * depth))
+                            if (!mp.see_ge(move, -205 * depth))
                                 continue;
                         }
                         else
@@ -1439,7 +1501,7 @@ namespace Stockfish {
                             lmrDepth = std::max(lmrDepth, 0);
 
                             // Prune moves with negative SEE (~4 Elo)
-                            if (!pos.see_ge<true>(move, (-27 * lmrDepth - 16) * lmrDepth))
+                            if (!mp.see_ge(move, (-27 * lmrDepth - 16) * lmrDepth))
                                 continue;
                         }
                     }
@@ -1522,7 +1584,7 @@ namespace Stockfish {
                     ss->doubleExtensions = (ss - 1)->doubleExtensions + (extension == 2);
 
                     // Speculative prefetch as early as possible
-                    prefetch(TT.first_entry(pos.key_after(move)));
+                    thisThread->prefetch_after<true, SearchMate>(pos, move);
 
                     // Update the current move (this must be done after singular extension search)
                     ss->currentMove = move;
@@ -1649,7 +1711,7 @@ namespace Stockfish {
                     // Finished searching the move. If a stop occurred, the return value of
                     // the search cannot be trusted, and we return immediately without
                     // updating best move, PV and TT.
-                    if (Threads.stop.load(std::memory_order_relaxed))
+                    if (thisThread->stop_requested())
                         return VALUE_ZERO;
 
                     if constexpr (rootNode)
@@ -1813,7 +1875,7 @@ namespace Stockfish {
                 Move ttMove, move, bestMove;
                 Depth ttDepth;
                 Value bestValue, value, ttValue, futilityValue, futilityBase;
-                bool pvHit, givesCheck, capture;
+                bool pvHit, givesCheck, capture, windowExit = false;
                 int moveCount;
 
                 // Step 1. Initialize node
@@ -1870,7 +1932,7 @@ namespace Stockfish {
                     {
                         // Never assume anything about values stored in TT
                         if ((ss->staticEval = bestValue = tte->eval()) == VALUE_NONE)
-                            ss->staticEval = bestValue = evaluate<SearchMate>(pos);
+                            ss->staticEval = bestValue = evaluate<SearchMate>(pos, nullptr, alpha, beta, &windowExit);
 
                         // ttValue can be used as a better position evaluation (~7 Elo)
                         if (ttValue != VALUE_NONE
@@ -1880,15 +1942,16 @@ namespace Stockfish {
                     else
                         // In case of null move search use previous static eval with a different sign
                         ss->staticEval = bestValue =
-                        (ss - 1)->currentMove != Move::null() ? evaluate<SearchMate>(pos) : -(ss - 1)->staticEval;
+                        (ss - 1)->currentMove != Move::null() ? evaluate<SearchMate>(pos, nullptr, alpha, beta, &windowExit) : -(ss - 1)->staticEval;
 
                     // Stand pat. Return immediately if static value is at least beta
                     if (bestValue >= beta)
                     {
-                        // Save gathered info in transposition table
+                        // Save gathered info in transposition table, but not an evaluation
+                        // that stopped early on the window
                         if (!ss->ttHit)
                             tte->save(posKey, value_to_tt(bestValue, ss->ply), false, BOUND_LOWER,
-                                DEPTH_NONE, Move::none(), ss->staticEval);
+                                DEPTH_NONE, Move::none(), windowExit ? VALUE_NONE : ss->staticEval);
 
                         return bestValue;
                     }
@@ -1906,7 +1969,7 @@ namespace Stockfish {
                 // queen promotions, and other checks (only if depth >= DEPTH_QS_CHECKS)
                 // will be generated.
                 Square prevSq = (ss - 1)->currentMove.is_ok() ? (ss - 1)->currentMove.to_sq() : SQ_NONE;
-                MovePicker mp(pos, ttMove, depth, &thisThread->mainHistory, &thisThread->captureHistory, contHist, prevSq);
+                MovePicker mp(pos, ttMove, depth, &thisThread->mainHistory, &thisThread->captureHistory, contHist, nullptr, prevSq);
 
                 int quietCheckEvasions = 0;
 
@@ -1932,31 +1995,44 @@ namespace Stockfish {
                         && futilityBase > -VALUE_KNOWN_WIN
                         && move.type_of() != PROMOTION)
                     {
+                        SEARCH_TRY(QsFutility, depth);
 
                         if (moveCount > 2)
+                        {
+                            SEARCH_CUT(QsFutility, depth);
                             continue;
+                        }
 
                         futilityValue = futilityBase + PieceValueME[EG][pos.piece_on(move.to_sq())];
 
                         if (futilityValue <= alpha)
                         {
+                            SEARCH_CUT(QsFutility, depth);
                             bestValue = std::max(bestValue, futilityValue);
                             continue;
                         }
 
-                        if (futilityBase <= alpha && !pos.see_ge<true>(move, 1))
+                        if (futilityBase <= alpha && !mp.see_ge(move, 1))
                         {
+                            SEARCH_CUT(QsFutility, depth);
                             bestValue = std::max(bestValue, futilityBase);
                             continue;
                         }
                     }
 
                     // Do not search moves with negative SEE values (~5 Elo)
-                    if (bestValue > VALUE_TB_LOSS_IN_MAX_PLY && !pos.see_ge<true>(move))
-                        continue;
+                    if (bestValue > VALUE_TB_LOSS_IN_MAX_PLY)
+                    {
+                        SEARCH_TRY(QsSee, depth);
+                        if (!mp.see_ge(move, 0))
+                        {
+                            SEARCH_CUT(QsSee, depth);
+                            continue;
+                        }
+                    }
 
                     // Speculative prefetch as early as possible
-                    prefetch(TT.first_entry(pos.key_after(move)));
+                    thisThread->prefetch_after<true, SearchMate>(pos, move);
 
                     ss->currentMove = move;
                     ss->continuationHistory = &thisThread->
@@ -2016,7 +2092,7 @@ namespace Stockfish {
                 // Save gathered info in transposition table
                 tte->save(posKey, value_to_tt(bestValue, ss->ply), pvHit,
                     bestValue >= beta ? BOUND_LOWER : BOUND_UPPER,
-                    ttDepth, bestMove, ss->staticEval);
+                    ttDepth, bestMove, windowExit ? VALUE_NONE : ss->staticEval);
 
                 assert(bestValue > -VALUE_INFINITE && bestValue < VALUE_INFINITE);
 
@@ -2126,7 +2202,7 @@ namespace Stockfish {
                 // queen promotions, and other checks (only if depth >= DEPTH_QS_CHECKS)
                 // will be generated.
                 Square prevSq = (ss - 1)->currentMove.is_ok() ? (ss - 1)->currentMove.to_sq() : SQ_NONE;
-                MovePicker mp(pos, ttMove, depth, &thisThread->mainHistory, &thisThread->captureHistory, contHist, prevSq);
+                MovePicker mp(pos, ttMove, depth, &thisThread->mainHistory, &thisThread->captureHistory, contHist, nullptr, prevSq);
 
                 // Step 5. Loop through all pseudo-legal moves until no moves remain or a beta cutoff occurs.
                 while ((move = mp.next_move<SearchMate>()))
@@ -2162,7 +2238,7 @@ namespace Stockfish {
                                 continue;
                             }
 
-                            if (futilityBase <= alpha && !pos.see_ge<true>(move, 1))
+                            if (futilityBase <= alpha && !mp.see_ge(move, 1))
                             {
                                 bestValue = std::max(bestValue, futilityBase);
                                 continue;
@@ -2170,12 +2246,12 @@ namespace Stockfish {
                         }
 
                         // Do not search moves with bad enough SEE values (~5 Elo)
-                        if (!ss->inCheck && !pos.see_ge<true>(move, -95))
+                        if (!ss->inCheck && !mp.see_ge(move, -95))
                             continue;
                     }
 
                     // Speculative prefetch as early as possible
-                    prefetch(TT.first_entry(pos.key_after(move)));
+                    thisThread->prefetch_after<true, SearchMate>(pos, move);
 
                     // Update the current move
                     ss->currentMove = move;
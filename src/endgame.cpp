@@ -16,10 +16,13 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
 #include <cassert>
+#include <iterator>
 
 #include "bitboard.h"
 #include "endgame.h"
+#include "misc.h"
 #include "movegen.h"
 
 namespace Stockfish {
@@ -67,10 +70,44 @@ namespace Stockfish {
 
     namespace Endgames {
 
-        std::pair<Map<Value>, Map<ScaleFactor>> maps;
+        std::pair<Table<Value>, Table<ScaleFactor>> tables;
+
+        // Tries odd multipliers until every key has a slot of its own. In a table of 64
+        // slots for the 18 keys of the evaluation functions that takes about ten tries.
+        template<typename T>
+        bool Table<T>::build() {
+
+            PRNG rng(1070372);
+
+            for (int tries = 0; tries < 100000; ++tries)
+            {
+                multiplier = rng.rand<std::uint64_t>() | 1;
+                std::fill(std::begin(entries), std::end(entries), Entry{ 0, nullptr });
+
+                bool perfect = true;
+                for (const auto& [key, endgame] : endgames)
+                {
+                    Entry& e = entries[index(key)];
+                    if (e.endgame && e.key != key)
+                    {
+                        perfect = false;
+                        break;
+                    }
+                    e = { key, endgame.get() };
+                }
+
+                if (perfect)
+                    return true;
+            }
+
+            return false;
+        }
 
         void init() {
 
+            table<Value>() = Table<Value>();
+            table<ScaleFactor>() = Table<ScaleFactor>();
+
             add<KPK>("KPK");
             add<KNNK>("KNNK");
             add<KBNK>("KBNK");
@@ -87,6 +124,9 @@ namespace Stockfish {
             add<KBPKN>("KBPKN");
             add<KBPPKB>("KBPPKB");
             add<KRPPKRP>("KRPPKRP");
+
+            [[maybe_unused]] bool built = table<Value>().build() && table<ScaleFactor>().build();
+            assert(built);
         }
     }
 
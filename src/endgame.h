@@ -19,11 +19,12 @@
 #ifndef ENDGAME_H_INCLUDED
 #define ENDGAME_H_INCLUDED
 
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <type_traits>
-#include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include "position.h"
 #include "types.h"
@@ -88,35 +89,56 @@ namespace Stockfish {
 
 
     // The Endgames namespace handles the pointers to endgame evaluation and scaling
-    // base objects in two std::map. We use polymorphism to invoke the actual
+    // base objects in two flat tables. We use polymorphism to invoke the actual
     // endgame function by calling its virtual operator().
 
     namespace Endgames {
 
         template<typename T> using Ptr = std::unique_ptr<EndgameBase<T>>;
-        template<typename T> using Map = std::unordered_map<Key, Ptr<T>>;
 
-        extern std::pair<Map<Value>, Map<ScaleFactor>> maps;
+        // The endgames of one type, indexed by a perfect hash of their material keys. The
+        // keys come from the Zobrist numbers, so the multiplier of the hash is searched by
+        // init() such that no two of them share a slot. A probe then reads one entry, and
+        // the table is never written after init(), so all threads share it.
+        template<typename T>
+        struct Table {
+
+            static constexpr int Bits = 6;
+
+            struct Entry {
+                Key                   key;
+                const EndgameBase<T>* endgame;
+            };
+
+            size_t index(Key key) const { return size_t((key * multiplier) >> (64 - Bits)); }
+            bool   build();
+
+            std::vector<std::pair<Key, Ptr<T>>> endgames; // Owns the functions
+            std::uint64_t                       multiplier = 0;
+            Entry                               entries[1 << Bits] = {};
+        };
+
+        extern std::pair<Table<Value>, Table<ScaleFactor>> tables;
 
         void init();
 
         template<typename T>
-        Map<T>& map() {
-            return std::get<std::is_same<T, ScaleFactor>::value>(maps);
+        Table<T>& table() {
+            return std::get<std::is_same<T, ScaleFactor>::value>(tables);
         }
 
         template<EndgameCode E, typename T = eg_type<E>>
         void add(const std::string& code) {
 
             StateInfo st;
-            map<T>()[Position().set(code, WHITE, &st).material_key()] = Ptr<T>(new Endgame<E>(WHITE));
-            map<T>()[Position().set(code, BLACK, &st).material_key()] = Ptr<T>(new Endgame<E>(BLACK));
+            table<T>().endgames.emplace_back(Position().set(code, WHITE, &st).material_key(), Ptr<T>(new Endgame<E>(WHITE)));
+            table<T>().endgames.emplace_back(Position().set(code, BLACK, &st).material_key(), Ptr<T>(new Endgame<E>(BLACK)));
         }
 
         template<typename T>
         const EndgameBase<T>* probe(Key key) {
-            auto it = map<T>().find(key);
-            return it != map<T>().end() ? it->second.get() : nullptr;
+            const auto& e = table<T>().entries[table<T>().index(key)];
+            return e.key == key ? e.endgame : nullptr;
         }
     }
 
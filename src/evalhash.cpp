@@ -0,0 +1,51 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2024 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "evalhash.h"
+
+#include <ostream>
+
+#include "thread.h"
+
+namespace Stockfish::EvalHash {
+
+    std::uint32_t generation = 1;
+
+    // Prints the probes and hits of the eval hash tables of all threads
+    void print_stats(std::ostream& os) {
+
+        std::uint64_t probes = 0, hits = 0;
+        for (Thread* th : Threads)
+        {
+            probes += th->evalHash.probes;
+            hits += th->evalHash.hits;
+        }
+
+        os << "\nEval hash statistics"
+            << "\nProbes                : " << probes
+            << "\nHits                  : " << hits << " (" << (probes ? 100.0 * hits / probes : 0.0) << "%)"
+            << "\nEvaluations           : " << probes - hits << std::endl;
+    }
+
+    void clear_stats() {
+
+        for (Thread* th : Threads)
+            th->evalHash.probes = th->evalHash.hits = 0;
+    }
+
+} // namespace Stockfish::EvalHash
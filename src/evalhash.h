@@ -0,0 +1,113 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2024 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef EVALHASH_H_INCLUDED
+#define EVALHASH_H_INCLUDED
+
+#include <cstdint>
+#include <cstring>
+#include <iosfwd>
+
+#include "misc.h"
+#include "types.h"
+
+namespace Stockfish::EvalHash {
+
+    // EvalHash::Entry holds the part of an evaluation that only depends on the position,
+    // the network output with its complexity or the classic evaluation before the
+    // shuffling is applied. It sits under the TT: positions whose static eval has been
+    // replaced in the TT are often still found here.
+
+    struct Entry {
+        std::uint32_t key32;
+        std::int16_t  value;
+        std::int16_t  complexity;
+    };
+
+    // Keys of the classic evaluation, which shares the table with the NNUE one
+    constexpr Key ClassicSalt = 0x5D2C1E7A93B4F061ULL;
+    constexpr Key ClassicMateSalt = 0xA1F3960C27D84E5BULL;
+
+    // Incremented when another network is loaded, tables of an older generation are cleared
+    extern std::uint32_t generation;
+
+    // Every thread has a table of its own, so there is nothing to lock. A bucket fills one
+    // cache line, the most recently stored entry is kept first in its bucket.
+    class Table {
+
+        static constexpr int         EntriesPerBucket = 8;
+        static constexpr std::size_t Size = 16384; // Buckets, a MB per thread
+
+        struct alignas(64) Bucket {
+            Entry entry[EntriesPerBucket];
+        };
+
+        static_assert(sizeof(Bucket) == 64, "A bucket must fill one cache line");
+
+    public:
+        bool probe(Key key, Value& value, int& complexity) {
+
+            if (tableGeneration != generation)
+                clear();
+
+            ++probes;
+            const std::uint32_t key32 = std::uint32_t(key >> 32) | 1; // Zero marks an empty entry
+            for (const Entry& e : buckets[std::uint32_t(key) & (Size - 1)].entry)
+                if (e.key32 == key32)
+                {
+                    ++hits;
+                    value = Value(e.value);
+                    complexity = e.complexity;
+                    return true;
+                }
+
+            return false;
+        }
+
+        void prefetch(Key key) { Stockfish::prefetch(&buckets[std::uint32_t(key) & (Size - 1)]); }
+
+        void save(Key key, Value value, int complexity) {
+
+            if (value < INT16_MIN || value > INT16_MAX || complexity > INT16_MAX)
+                return;
+
+            Entry* e = buckets[std::uint32_t(key) & (Size - 1)].entry;
+            std::memmove(e + 1, e, (EntriesPerBucket - 1) * sizeof(Entry));
+            e->key32 = std::uint32_t(key >> 32) | 1;
+            e->value = std::int16_t(value);
+            e->complexity = std::int16_t(complexity);
+        }
+
+        void clear() {
+            std::memset(buckets, 0, sizeof(buckets));
+            tableGeneration = generation;
+        }
+
+        std::uint64_t probes = 0, hits = 0;
+
+    private:
+        Bucket        buckets[Size]; // Left to clear(), like the HashTable of misc.h
+        std::uint32_t tableGeneration = 0;
+    };
+
+    void print_stats(std::ostream& os);
+    void clear_stats();
+
+} // namespace Stockfish::EvalHash
+
+#endif // #ifndef EVALHASH_H_INCLUDED
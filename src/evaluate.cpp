@@ -28,6 +28,7 @@
 
 #include "incbin/incbin.h"
 #include "bitboard.h"
+#include "evalhash.h"
 #include "evaluate.h"
 #include "misc.h"
 #include "thread.h"
@@ -55,20 +56,30 @@ namespace Stockfish {
 
     namespace Eval {
 
-        std::string currentEvalFileName = "None";
+        std::string currentEvalFileName[2] = { "None", "None" };
 
-        // NNUE::init() tries to load a NNUE network at startup time, or when the engine
+        // Options naming the network files, indexed by NNUE::NetSize
+        constexpr const char* EvalFileOptions[2] = { "EvalFile", "EvalFileSmall" };
+
+        static std::string eval_file_name(NNUE::NetSize netSize) {
+
+            std::string eval_file = std::string(Options[EvalFileOptions[netSize]]);
+            if (eval_file.empty() && netSize == NNUE::Big)
+                eval_file = EvalFileDefaultName;
+            return eval_file;
+        }
+
+        // NNUE::init() tries to load the NNUE networks at startup time, or when the engine
         // receives a UCI command "setoption name EvalFile value nn-[a-z0-9]{12}.nnue"
-        // The name of the NNUE network is always retrieved from the EvalFile option.
-        // We search the given network in three locations: internally (the default
-        // network may be embedded in the binary), in the active working directory and
-        // in the engine directory. Distro packagers may define the DEFAULT_NNUE_DIRECTORY
+        // The names of the NNUE networks are always retrieved from the EvalFile and
+        // EvalFileSmall options. We search the given network in three locations: internally
+        // (the default network may be embedded in the binary), in the active working directory
+        // and in the engine directory. Distro packagers may define the DEFAULT_NNUE_DIRECTORY
         // variable to have the engine search in a special directory in their distro.
+        // The small network is optional, with EvalFileSmall set to <empty> only the big
+        // network is used.
 
         void NNUE::init() {
-            std::string eval_file = std::string(Options["EvalFile"]);
-            if (eval_file.empty())
-                eval_file = EvalFileDefaultName;
 
 #if defined(DEFAULT_NNUE_DIRECTORY)
             std::vector<std::string> dirs = { "<internal>", "", CommandLine::binaryDirectory,
@@ -77,46 +88,69 @@ namespace Stockfish {
             std::vector<std::string> dirs = { "<internal>", "", CommandLine::binaryDirectory };
 #endif
 
-            for (const std::string& directory : dirs)
-                if (currentEvalFileName != eval_file)
+            for (NetSize netSize : { Big, Small })
+            {
+                std::string eval_file = eval_file_name(netSize);
+
+                if (netSize == Small && (eval_file.empty() || eval_file == "<empty>"))
                 {
-                    if (directory != "<internal>")
-                    {
-                        std::ifstream stream(directory + eval_file, std::ios::binary);
-                        if (NNUE::load_eval(eval_file, stream))
-                            currentEvalFileName = eval_file;
-                    }
+                    NNUE::unload_eval(Small);
+                    currentEvalFileName[Small] = "None";
+                    continue;
+                }
 
-                    if (directory == "<internal>" && eval_file == EvalFileDefaultName)
+                for (const std::string& directory : dirs)
+                    if (currentEvalFileName[netSize] != eval_file)
                     {
-                        // C++ way to prepare a buffer for a memory stream
-                        class MemoryBuffer : public std::basic_streambuf<char> {
-                        public:
-                            MemoryBuffer(char* p, size_t n) {
-                                setg(p, p, p + n);
-                                setp(p, p + n);
+                        if (directory != "<internal>")
+                        {
+                            // A net exported with 'export_net <file> mapped' is used directly from the file
+                            if (NNUE::load_mapped_eval(eval_file, directory + eval_file, netSize))
+                                currentEvalFileName[netSize] = eval_file;
+                            else
+                            {
+                                std::ifstream stream(directory + eval_file, std::ios::binary);
+                                if (NNUE::load_eval(eval_file, stream, netSize))
+                                    currentEvalFileName[netSize] = eval_file;
                             }
-                        };
-
-                        MemoryBuffer buffer(const_cast<char*>
-                            (reinterpret_cast<const char*>(gEmbeddedNNUEData)), size_t(gEmbeddedNNUESize));
-                        (void)gEmbeddedNNUEEnd; // Silence warning on unused variable
+                        }
 
-                        std::istream stream(&buffer);
-                        if (NNUE::load_eval(eval_file, stream))
-                            currentEvalFileName = eval_file;
+                        if (directory == "<internal>" && netSize == Big && eval_file == EvalFileDefaultName)
+                        {
+                            // C++ way to prepare a buffer for a memory stream
+                            class MemoryBuffer : public std::basic_streambuf<char> {
+                            public:
+                                MemoryBuffer(char* p, size_t n) {
+                                    setg(p, p, p + n);
+                                    setp(p, p + n);
+                                }
+                            };
+
+                            MemoryBuffer buffer(const_cast<char*>
+                                (reinterpret_cast<const char*>(gEmbeddedNNUEData)), size_t(gEmbeddedNNUESize));
+                            (void)gEmbeddedNNUEEnd; // Silence warning on unused variable
+
+                            std::istream stream(&buffer);
+                            if (NNUE::load_eval(eval_file, stream, Big))
+                                currentEvalFileName[Big] = eval_file;
+                        }
                     }
-                }
+
+                // A small network that failed to load is not used
+                if (netSize == Small && currentEvalFileName[Small] != eval_file)
+                    currentEvalFileName[Small] = "None";
+            }
+
+            // The eval hash tables hold the outputs of the previous networks
+            ++EvalHash::generation;
         }
 
         // NNUE::verify() verifies that the last net used was loaded successfully
         void NNUE::verify() {
 
-            std::string eval_file = std::string(Options["EvalFile"]);
-            if (eval_file.empty())
-                eval_file = EvalFileDefaultName;
+            std::string eval_file = eval_file_name(Big);
 
-            if (currentEvalFileName != eval_file)
+            if (currentEvalFileName[Big] != eval_file)
             {
                 std::string msg1 = "Network evaluation parameters compatible with the engine must be available.";
                 std::string msg2 = "The network file " + eval_file + " was not loaded successfully.";
@@ -137,6 +171,18 @@ namespace Stockfish {
             }
 
             sync_cout << "info string NNUE evaluation using " << eval_file << " enabled" << sync_endl;
+
+            // Without the small network the big one evaluates all positions
+            std::string small_file = eval_file_name(Small);
+            if (small_file.empty() || small_file == "<empty>")
+                return;
+
+            if (currentEvalFileName[Small] != small_file)
+                sync_cout << "info string ERROR: The network file " << small_file
+                << " was not loaded successfully, the small net is disabled." << sync_endl;
+            else
+                sync_cout << "info string NNUE evaluation using " << small_file
+                << " enabled for large material imbalances" << sync_endl;
         }
     }
 
@@ -170,7 +216,22 @@ namespace Stockfish {
         else
         {
             int   nnueComplexity;
-            Value nnue = NNUE::evaluate(pos, true, &nnueComplexity);
+            Value nnue;
+
+            // The network output only depends on the position, look it up before running the network
+            EvalHash::Table& evalHash = pos.this_thread()->evalHash;
+            if (!evalHash.probe(pos.key(), nnue, nnueComplexity))
+            {
+                bool smallNet = NNUE::use_small_net(pos);
+                nnue = smallNet ? NNUE::evaluate<NNUE::Small>(pos, true, &nnueComplexity)
+                    : NNUE::evaluate<NNUE::Big>(pos, true, &nnueComplexity);
+
+                // Fall back to the big net if the small net does not confirm the material imbalance
+                if (smallNet && (nnue * simpleEval < 0 || std::abs(nnue) < 227))
+                    nnue = NNUE::evaluate<NNUE::Big>(pos, true, &nnueComplexity);
+
+                evalHash.save(pos.key(), nnue, nnueComplexity);
+            }
 
             Value optimism = pos.this_thread()->optimism[stm];
 
@@ -282,6 +343,11 @@ namespace Stockfish::Classic {
         // Threshold for lazy and space evaluation
         constexpr Value LazyThreshold1 = Value(3631);
         constexpr Value LazyThreshold2 = Value(2084);
+
+        // Margins of the early exits on the search window, after each stage of the evaluation
+        constexpr Value WindowMargin1 = Value(1100);
+        constexpr Value WindowMargin2 = Value(800);
+        constexpr Value WindowMargin3 = Value(500);
         constexpr Value SpaceThreshold = Value(11551);
 
         // KingAttackWeights[PieceType] contains king attack weights by piece type
@@ -377,10 +443,19 @@ namespace Stockfish::Classic {
 
         public:
             Evaluation() = delete;
-            explicit Evaluation(const Position& p) : pos(p) {}
+            explicit Evaluation(const Position& p, Value a = -VALUE_INFINITE, Value b = VALUE_INFINITE)
+                : pos(p), alpha(a), beta(b) {}
             Evaluation& operator=(const Evaluation&) = delete;
             template<bool SearchMate = false> Value value();
 
+            // Set when value() stopped early because of the search window, the value
+            // then depends on alpha and beta and must not be hashed.
+            bool windowExit = false;
+
+            // Set when value() took a lazy exit, whose threshold depends on the bestValue
+            // of the thread. Such a value is not hashed either.
+            bool lazyExit = false;
+
         private:
             template<Color Us> void initialize();
             template<Color Us, PieceType Pt> Score pieces();
@@ -391,8 +466,10 @@ namespace Stockfish::Classic {
             Value winnable(Score score) const;
 
             const Position& pos;
+            const Value alpha, beta;
             Material::Entry* me;
             Pawns::Entry* pe;
+            const Bitboard* pieceAttacks; // Kept across moves by the Position, see piece_attacks()
             Bitboard mobilityArea[COLOR_NB];
             Score mobility[COLOR_NB] = { SCORE_ZERO, SCORE_ZERO };
 
@@ -489,9 +566,7 @@ namespace Stockfish::Classic {
                 Square s = pop_lsb(b1);
 
                 // Find attacked squares, including x-ray attacks for bishops and rooks
-                b = Pt == BISHOP ? attacks_bb<BISHOP>(s, pos.pieces() ^ pos.pieces(QUEEN))
-                    : Pt == ROOK ? attacks_bb<  ROOK>(s, pos.pieces() ^ pos.pieces(QUEEN) ^ pos.pieces(Us, ROOK))
-                    : attacks_bb<Pt>(s, pos.pieces());
+                b = pieceAttacks[s];
 
                 if (pos.blockers_for_king(Us) & s)
                     b &= line_bb(pos.square<KING>(Us), s);
@@ -1083,15 +1158,26 @@ namespace Stockfish::Classic {
 
             // Early exit if score is high
             auto lazy_skip = [&](Value lazyThreshold) {
-                return std::abs(mg_value(score) + eg_value(score)) > lazyThreshold
+                return lazyExit = std::abs(mg_value(score) + eg_value(score)) > lazyThreshold
                     + std::abs(pos.this_thread()->bestValue) * 5 / 4
                     + pos.non_pawn_material() / 32;
                 };
 
-            if (!SearchMate && lazy_skip(LazyThreshold1))
+            // Early exit if the partial score, seen from the side to move, is so far outside
+            // the search window that the remaining terms are unlikely to bring it back.
+            auto outside_window = [&](Value margin) {
+                Value v = (mg_value(score) * int(me->game_phase())
+                    + eg_value(score) * int(PHASE_MIDGAME - me->game_phase())) / PHASE_MIDGAME;
+                v = (pos.side_to_move() == WHITE ? v : -v) * (195 - pos.rule50_count()) / 211;
+                return windowExit = (v >= beta + margin || v <= alpha - margin);
+                };
+
+            // Stage 1: material, piece square tables, imbalance and pawns
+            if (!SearchMate && (lazy_skip(LazyThreshold1) || outside_window(WindowMargin1)))
                 goto make_v;
 
-            // Main evaluation begins here
+            // Stage 2: pieces and mobility
+            pieceAttacks = pos.piece_attacks();
             initialize<WHITE>();
             initialize<BLACK>();
 
@@ -1106,13 +1192,16 @@ namespace Stockfish::Classic {
 
             if constexpr (SearchMate) score = score / 32;
 
-            // More complex interactions that require fully populated attack bitboards
+            // Stage 3: more complex interactions that require fully populated attack bitboards
             if constexpr (!SearchMate)
             {
+                if (outside_window(WindowMargin2))
+                    goto make_v;
+
                 score += king<WHITE, SearchMate>() - king<BLACK, SearchMate>()
                     + passed<WHITE>() - passed<BLACK>();
 
-                if (lazy_skip(LazyThreshold2))
+                if (lazy_skip(LazyThreshold2) || outside_window(WindowMargin3))
                     goto make_v;
 
                 score += threats<WHITE>() - threats<BLACK>()
@@ -1170,10 +1259,32 @@ namespace Stockfish::Classic {
     // evaluate() is the evaluator for the outer world. It returns a static
     // evaluation of the position from the point of view of the side to move.
 
+    // alpha and beta are the window of the caller. The evaluation stops early when its
+    // partial score is far outside of it, the default window gives the full evaluation.
+    // windowExit tells whether it did, the value then depends on the window.
     template<bool SearchMate>
-    Value Eval::evaluate(const Position& pos, int* complexity) {
+    Value Eval::evaluate(const Position& pos, int* complexity, Value alpha, Value beta, bool* windowExit) {
+
+        // Only full evaluations are hashed, a lazy or window exit depends on the thread
+        // and the caller. A hit gives the full value even where the evaluation would take
+        // a lazy exit now, so hashing still changes the search, if only to exact values.
+        EvalHash::Table& evalHash = pos.this_thread()->evalHash;
+        const Key        key = pos.key() ^ (SearchMate ? EvalHash::ClassicMateSalt : EvalHash::ClassicSalt);
+        Value            v;
+        int              unused;
+        bool             early = false;
+
+        if (!evalHash.probe(key, v, unused))
+        {
+            Evaluation<NO_TRACE> e(pos, alpha, beta);
+            v = e.value<SearchMate>();
+            early = e.windowExit;
+            if (!early && !e.lazyExit)
+                evalHash.save(key, v, 0);
+        }
 
-        Value v = Evaluation<NO_TRACE>(pos).value<SearchMate>();
+        if (windowExit)
+            *windowExit = early;
 
         // Damp down the evaluation linearly when shuffling
         v = v * (195 - pos.rule50_count()) / 211;
@@ -1187,8 +1298,8 @@ namespace Stockfish::Classic {
         return v;
     }
 
-    template Value Eval::evaluate<false>(const Position& pos, int* complexity);
-    template Value Eval::evaluate<true>(const Position& pos, int* complexity);
+    template Value Eval::evaluate<false>(const Position& pos, int* complexity, Value alpha, Value beta, bool* windowExit);
+    template Value Eval::evaluate<true>(const Position& pos, int* complexity, Value alpha, Value beta, bool* windowExit);
 
     // trace() is like evaluate(), but instead of returning a value, it returns
     // a string (suitable for outputting to stdout) that contains the detailed
@@ -34,7 +34,8 @@ namespace Stockfish {
         Value simple_eval(const Position& pos, Color c);
         Value evaluate(const Position& pos);
 
-        extern std::string currentEvalFileName;
+        // Names of the networks loaded, the big one first and then the small one
+        extern std::string currentEvalFileName[2];
 
         // The default net name MUST follow the format nn-[SHA256 first 12 digits].nnue
         // for the build process (profile-build and fishtest) to work. Do not change the
@@ -54,7 +55,9 @@ namespace Stockfish {
     namespace Classic::Eval {
 
         std::string trace(Position& pos);
-        template <bool SearchMate> Value evaluate(const Position& pos, int* complexity = nullptr);
+        template <bool SearchMate>
+        Value evaluate(const Position& pos, int* complexity = nullptr, Value alpha = -VALUE_INFINITE, Value beta = VALUE_INFINITE,
+                       bool* windowExit = nullptr);
 
     } // namespace Classic::Eval
 
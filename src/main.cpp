@@ -28,6 +28,7 @@
 #include "psqt.h"
 #include "search.h"
 #include "thread.h"
+#include "timeman.h"
 #include "tune.h"
 #include "types.h"
 #include "uci.h"
@@ -39,20 +40,23 @@ int main(int argc, char* argv[]) {
     std::cout << engine_info() << std::endl;
 
     CommandLine::init(argc, argv);
-    UCI::init(Options);
+    Startup::timed("options", [] { UCI::init(Options); });
+    AsyncOut::start();
     Tune::init();
-    PSQT::init();
-    Bitboards::init();
-    Position::init();
-    Bitbases::init();
-    Endgames::init();
-    Threads.set(size_t(Options["Threads"]));
-    Search::clear(); // After threads are up
-    Eval::NNUE::init();
-    Book::init();
+    Startup::timed("psqt", PSQT::init);
+    Startup::timed("bitboards", Bitboards::init);
+    Startup::timed("position", Position::init);
+    Startup::timed("endgames", Endgames::init);
+    Startup::timed("threads", [] { Threads.set(size_t(Options["Threads"])); });
+    Startup::timed("clear", Search::clear); // After threads are up
+    Startup::timed("nnue", Eval::NNUE::init);
+    Startup::timed("book", Book::init);
 
     UCI::loop(argc, argv);
 
     Threads.set(0);
+    Deadline::exit();
+    Tasks::exit();
+    AsyncOut::stop();
     return 0;
 }
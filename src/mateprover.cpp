@@ -0,0 +1,246 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2024 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "mateprover.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "misc.h"
+#include "movegen.h"
+#include "position.h"
+#include "search.h"
+#include "thread.h"
+#include "timeman.h"
+#include "types.h"
+#include "uci.h"
+
+namespace Stockfish::MateProver {
+
+    namespace {
+
+        // What is known about the side to move in a position: it mates within 'mate' moves
+        // with 'move', or it does not mate within 'noMate' moves. Zero for nothing known.
+        struct Entry {
+            uint32_t key32;
+            uint8_t  mate, noMate;
+            uint16_t move;
+        };
+
+        constexpr size_t TableSize = 1 << 18; // Entries, 2 MB per thread
+
+        // A depth-limited mate search, exact: every move of the attacker is tried, checks
+        // first, and every reply of the defender has to be refuted. Only checks can mate on
+        // the last move. The table of each prover is its own, so it needs no locking.
+        class Prover {
+
+        public:
+            explicit Prover(Thread& t) : th(t), table(TableSize) {}
+
+            bool              attack(Position& pos, int n);
+            bool              defend(Position& pos, int n);
+            std::vector<Move> pv(Position& pos, Move first);
+
+            bool stopped = false;
+
+        private:
+            Entry* probe(Key key, bool& found) {
+
+                Entry* e = &table[size_t(key) & (TableSize - 1)];
+                found = e->key32 == (uint32_t(key >> 32) | 1); // Zero marks an empty entry
+                return e;
+            }
+
+            bool check_stop() {
+
+                if (&th == Threads.main())
+                    Threads.main()->check_time();
+                return stopped = th.stop_requested();
+            }
+
+            Thread&            th;
+            std::vector<Entry> table;
+        };
+
+        // Can the side to move mate within n moves?
+        bool Prover::attack(Position& pos, int n) {
+
+            bool   found;
+            Entry* e = probe(pos.key(), found);
+            if (found && e->mate && e->mate <= n)
+                return true;
+            if ((found && e->noMate >= n) || check_stop())
+                return false;
+
+            StateInfo       st;
+            MoveList<LEGAL> moves(pos);
+            Move            mateMove = Move::none();
+
+            // The checks, then the captures and the quiet moves
+            for (int stage = 0; stage < (n > 1 ? 3 : 1) && !mateMove && !stopped; ++stage)
+                for (const auto& m : moves)
+                {
+                    const bool check = pos.gives_check(m);
+                    if (stage == 0 ? !check : check || (stage == 1) != pos.capture_stage(m))
+                        continue;
+
+                    pos.do_move(m, st, check);
+                    const bool mates = defend(pos, n);
+                    pos.undo_move(m);
+
+                    if (mates)
+                    {
+                        mateMove = m;
+                        break;
+                    }
+                    if (stopped)
+                        return false;
+                }
+
+            if (stopped)
+                return false;
+
+            e = probe(pos.key(), found);
+            if (!found)
+                *e = { uint32_t(pos.key() >> 32) | 1, 0, 0, 0 };
+            if (mateMove)
+                e->mate = uint8_t(n), e->move = mateMove.raw();
+            else
+                e->noMate = uint8_t(std::max(n, int(e->noMate)));
+
+            return bool(mateMove);
+        }
+
+        // The attacker has moved: is the defender mated, or mated within n - 1 moves after
+        // every one of its replies?
+        bool Prover::defend(Position& pos, int n) {
+
+            MoveList<LEGAL> moves(pos);
+            if (!moves.size())
+                return pos.checkers();
+
+            if (n == 1)
+                return false;
+
+            StateInfo st;
+            for (const auto& m : moves)
+            {
+                pos.do_move(m, st);
+                const bool mated = attack(pos, n - 1);
+                pos.undo_move(m);
+
+                if (!mated)
+                    return false;
+            }
+
+            return !stopped;
+        }
+
+        // Follows the table from a proven root move, the defender playing the reply after
+        // which the mate takes longest, until the mate or a missing entry
+        std::vector<Move> Prover::pv(Position& pos, Move first) {
+
+            std::vector<Move>      line{ first };
+            std::vector<StateInfo> states(2 * MAX_MOVES);
+            size_t                 ply = 0;
+            bool                   found;
+
+            pos.do_move(first, states[ply++]);
+            while (ply + 2 < states.size())
+            {
+                Move reply = Move::none();
+                int  longest = 0;
+                for (const auto& m : MoveList<LEGAL>(pos))
+                {
+                    pos.do_move(m, states[ply]);
+                    const Entry* e = probe(pos.key(), found);
+                    if (found && e->mate > longest && e->move)
+                        reply = m, longest = e->mate;
+                    pos.undo_move(m);
+                }
+
+                if (!reply)
+                    break;
+
+                line.push_back(reply);
+                pos.do_move(reply, states[ply++]);
+
+                // The entry may be of another position with the same index
+                const Entry* e = probe(pos.key(), found);
+                const Move   m = found ? Move(e->move) : Move::none();
+                if (!m || !pos.pseudo_legal(m) || !pos.legal(m))
+                    break;
+
+                line.push_back(m);
+                pos.do_move(m, states[ply++]);
+            }
+
+            for (auto it = line.rbegin(); it != line.rend(); ++it)
+                pos.undo_move(*it);
+
+            return line;
+        }
+
+    } // namespace
+
+    bool prove(Thread& th, int mate) {
+
+        Prover    prover(th);
+        Position& pos = th.rootPos;
+        StateInfo st;
+
+        // The shortest mate of the root moves of the thread, one more move per iteration
+        for (int n = 1; n <= mate && !prover.stopped; ++n)
+            for (size_t i = 0; i < th.rootMoves.size(); ++i)
+            {
+                const Move m = th.rootMoves[i].pv[0];
+                pos.do_move(m, st);
+                const bool mates = prover.defend(pos, n);
+                pos.undo_move(m);
+
+                if (prover.stopped)
+                    return false;
+                if (!mates)
+                    continue;
+
+                Search::RootMove& rm = th.rootMoves[i];
+                rm.pv = prover.pv(pos, m);
+                rm.score = rm.uciScore = rm.averageScore = rm.previousScore = mate_in(2 * n - 1);
+                rm.scoreLowerbound = rm.scoreUpperbound = false;
+                rm.selDepth = int(rm.pv.size());
+                std::rotate(th.rootMoves.begin(), th.rootMoves.begin() + i, th.rootMoves.begin() + i + 1);
+
+                th.rootDepth = th.completedDepth = 2 * n - 1;
+                th.bestValue = mate_in(2 * n - 1);
+
+                TimePoint none = -1;
+                Threads.main()->firstMateTime.compare_exchange_strong(none, Time.elapsed());
+                Threads.stop = true;
+
+                // The output ring has a single producer, the main thread reports the best
+                // thread at the end of the search
+                if (&th == Threads.main())
+                    AsyncOut::post(UCI::pv(pos, th.completedDepth), AsyncOut::Report);
+                return true;
+            }
+
+        return false;
+    }
+
+} // namespace Stockfish::MateProver
@@ -0,0 +1,38 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2024 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MATEPROVER_H_INCLUDED
+#define MATEPROVER_H_INCLUDED
+
+namespace Stockfish {
+
+    class Thread;
+
+    namespace MateProver {
+
+        // Tries to prove a mate in at most 'mate' moves with the root moves of the thread, before
+        // its search of 'go mate'. The threads prove distinct parts of the root moves, see
+        // ThreadPool::start_thinking(). True if the thread found a mate, with the move and its
+        // PV first in its root moves, after raising Threads.stop.
+        bool prove(Thread& th, int mate);
+
+    } // namespace MateProver
+
+} // namespace Stockfish
+
+#endif // #ifndef MATEPROVER_H_INCLUDED
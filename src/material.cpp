@@ -18,6 +18,7 @@
 
 #include <cassert>
 #include <cstring>   // For std::memset
+#include <ostream>
 
 #include "material.h"
 #include "thread.h"
@@ -222,6 +223,29 @@ namespace Stockfish {
             return e;
         }
 
+        // Prints the probes and hits of the material tables of all threads
+        void print_stats(std::ostream& os) {
+
+            uint64_t probes = 0, hits = 0;
+            for (Thread* th : Threads)
+            {
+                probes += th->materialTable.probes;
+                hits += th->materialTable.hits;
+            }
+
+            os << "\nMaterial table statistics"
+                << "\nEntries per thread    : " << Threads.main()->materialTable.size()
+                << "\nProbes                : " << probes
+                << "\nHits                  : " << hits << " (" << (probes ? 100.0 * hits / probes : 0.0) << "%)"
+                << "\nEvaluations           : " << probes - hits << std::endl;
+        }
+
+        void clear_stats() {
+
+            for (Thread* th : Threads)
+                th->materialTable.probes = th->materialTable.hits = 0;
+        }
+
     } // namespace Material
 
 } // namespace Stockfish
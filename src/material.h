@@ -19,6 +19,8 @@
 #ifndef MATERIAL_H_INCLUDED
 #define MATERIAL_H_INCLUDED
 
+#include <iosfwd>
+
 #include "endgame.h"
 #include "misc.h"
 #include "position.h"
@@ -62,9 +64,11 @@ namespace Stockfish::Material {
         uint8_t factor[COLOR_NB];
     };
 
-    using Table = HashTable<Entry, 8192>;
+    using Table = HashTable<Entry>;
 
     Entry* probe(const Position& pos);
+    void   print_stats(std::ostream& os);
+    void   clear_stats();
 
 } // namespace Stockfish::Material
 
@@ -47,20 +47,41 @@ using fun8_t = bool (*)(HANDLE, BOOL, PTOKEN_PRIVILEGES, DWORD, PTOKEN_PRIVILEGE
 }
 #endif
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <ctime>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <mutex>
 #include <sstream>
 #include <string_view>
+#include <thread>
+#include <tuple>
 
 #include "types.h"
 
-#if defined(__linux__) && !defined(__ANDROID__)
+#ifndef _WIN32
+    #include <fcntl.h>
     #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+#if defined(USE_NUMA) && defined(__linux__)
+    #include <numa.h>
+    #include <numaif.h>
+#endif
+
+#if defined(__linux__)
+    #include <sched.h>
 #endif
 
 #if defined(__APPLE__) || defined(__ANDROID__) || defined(__OpenBSD__) \
@@ -70,6 +91,11 @@ using fun8_t = bool (*)(HANDLE, BOOL, PTOKEN_PRIVILEGES, DWORD, PTOKEN_PRIVILEGE
     #include <stdlib.h>
 #endif
 
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#endif
+
 namespace Stockfish {
 
     namespace {
@@ -78,73 +104,324 @@ namespace Stockfish {
         constexpr std::string_view version = "1.0";
 
         // Our fancy logging facility. The trick here is to replace cin.rdbuf() and
-        // cout.rdbuf() with two Tie objects that tie cin and cout to a file stream. We
+        // cout.rdbuf() with two Tie objects that tie cin and cout to the log. We
         // can toggle the logging of std::cout and std:cin at runtime whilst preserving
         // usual I/O functionality, all without changing a single line of code!
         // Idea from http://groups.google.com/group/comp.lang.c++/msg/1d941c0f26ea0d81
+        //
+        // The Tie objects only cut the lines into LogPieces and put them into a LogRing,
+        // without a lock. A thread of the Logger writes them to the file with the time of
+        // day, so the output of the engine never waits for the file. Lines that still find
+        // the ring full after the writer had a chance to run are dropped and counted. A file
+        // name ending in ".gz" is written through gzip. The pieces carry the number of the
+        // log they were cut for, so that those a tie still pushes while its log is closed do
+        // not turn up in the next one.
+
+        // A line, or a piece of a longer one, on its way to the log file
+        struct LogPiece {
+            std::atomic<size_t> seq;
+            int64_t             time; // Milliseconds since the epoch, when the line began
+            uint32_t            line; // Counts the lines of a stream, so that a cut one is noticed
+            uint16_t            size;
+            bool                in;   // Read from cin, else written to cout
+            bool                last; // Ends the line
+            uint8_t             log;  // The number of the log, see Logger::openLog
+            char                text[231];
+        };
+
+        static_assert(sizeof(LogPiece) == 256);
+
+        // A bounded queue for any number of producers and one consumer, after the bounded
+        // MPMC queue of D. Vyukov. A cell is free for the producer at position pos when its
+        // seq is pos, and filled for the consumer when it is pos + 1.
+        class LogRing {
+
+        public:
+            static constexpr size_t Size = 4096; // A power of 2, 1 MB of pieces
+
+            LogRing() {
+                for (size_t i = 0; i < Size; ++i)
+                    cells[i].seq.store(i, std::memory_order_relaxed);
+            }
+
+            bool push(int64_t time, uint32_t line, bool in, bool last, uint8_t log, const char* text, size_t size) {
+
+                size_t pos = head.load(std::memory_order_relaxed);
+                for (;;)
+                {
+                    LogPiece&      c = cells[pos & (Size - 1)];
+                    const intptr_t diff = intptr_t(c.seq.load(std::memory_order_acquire)) - intptr_t(pos);
+
+                    if (diff < 0)
+                        return false; // Full
+
+                    if (diff > 0)
+                        pos = head.load(std::memory_order_relaxed);
+
+                    else if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        c.time = time;
+                        c.line = line;
+                        c.size = uint16_t(size);
+                        c.in = in;
+                        c.last = last;
+                        c.log = log;
+                        std::memcpy(c.text, text, size);
+                        c.seq.store(pos + 1, std::memory_order_release);
+
+                        // Wakes the writer early in a burst of lines, without taking the mutex:
+                        // a wakeup it misses only makes it wait for the end of its nap.
+                        if (!(pos & (Size / 4 - 1)))
+                            filling.notify_one();
+                        return true;
+                    }
+                }
+            }
+
+            // The oldest piece, nullptr if there is none. Only for the consumer.
+            LogPiece* front() {
+                LogPiece& c = cells[tail & (Size - 1)];
+                return c.seq.load(std::memory_order_acquire) == tail + 1 ? &c : nullptr;
+            }
+
+            void pop() {
+                cells[tail & (Size - 1)].seq.store(tail + Size, std::memory_order_release);
+                ++tail;
+            }
+
+            void nap() {
+                std::unique_lock<std::mutex> lock(mutex);
+                filling.wait_for(lock, std::chrono::milliseconds(5));
+            }
+
+            std::atomic<uint64_t> lost = 0; // Lines dropped because the ring was full
+
+        private:
+            LogPiece                        cells[Size];
+            alignas(64) std::atomic<size_t> head = 0;
+            alignas(64) size_t              tail = 0;
+            std::mutex                      mutex;
+            std::condition_variable         filling;
+        };
 
         struct Tie : public std::streambuf {  // MSVC requires split streambuf for cin and cout
 
-            Tie(std::streambuf* b, std::streambuf* l) :
+            Tie(std::streambuf* b, LogRing& r, bool i, const std::atomic<uint8_t>& o) :
                 buf(b),
-                logBuf(l) {}
+                ring(r),
+                in(i),
+                openLog(o) {}
 
-            int sync() override { return logBuf->pubsync(), buf->pubsync(); }
-            int overflow(int c) override { return log(buf->sputc(char(c)), "<< "); }
+            int sync() override { return buf->pubsync(); }
+            int overflow(int c) override { return log(buf->sputc(char(c))); }
             int underflow() override { return buf->sgetc(); }
-            int uflow() override { return log(buf->sbumpc(), ">> "); }
+            int uflow() override { return log(buf->sbumpc()); }
 
-            std::streambuf* buf, * logBuf;
+            std::streamsize xsputn(const char* s, std::streamsize n) override {
+                n = buf->sputn(s, n);
+                for (std::streamsize i = 0; i < n; ++i)
+                    log(s[i]);
+                return n;
+            }
 
-            int log(int c, const char* prefix) {
+            std::streambuf*             buf;
+            LogRing&                    ring;
+            const bool                  in;
+            const std::atomic<uint8_t>& openLog;
+            char                        piece[sizeof(LogPiece::text)];
+            size_t                      size = 0;
+            int64_t                     time = 0;
+            uint32_t                    line = 0;
+            bool                        dropping = false;
 
-                static int last = '\n'; // Single log file
+            int log(int c) {
+
+                if (c == EOF)
+                    return c;
+
+                // Not logged, a line begun before the log was closed is dropped
+                const uint8_t number = openLog;
+                if (!number)
+                {
+                    size = time = 0;
+                    return c;
+                }
 
-                if (last == '\n')
-                    logBuf->sputn(prefix, 3);
+                if (!size && !time)
+                    time = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::system_clock::now().time_since_epoch()).count();
 
-                return last = logBuf->sputc(char(c));
+                if (c != '\n')
+                    piece[size++] = char(c);
+
+                if (c == '\n' || size == sizeof(piece))
+                {
+                    // A full ring lets the writer run a few times before the line is dropped
+                    bool pushed = dropping;
+                    for (int i = 0; !pushed && i < 16; ++i)
+                        if (!(pushed = ring.push(time, line, in, c == '\n', number, piece, size)))
+                            std::this_thread::yield();
+
+                    if (!pushed)
+                    {
+                        dropping = true;
+                        ++ring.lost;
+                    }
+
+                    size = 0;
+                    if (c == '\n')
+                    {
+                        ++line;
+                        time = 0;
+                        dropping = false;
+                    }
+                }
+
+                return c;
             }
         };
 
+        // Quotes a file name for the shell that popen() runs. On Windows a file name cannot
+        // hold a '"', elsewhere it is put in single quotes, which a shell takes literally.
+        std::string shell_quoted(const std::string& fname) {
+#ifdef _WIN32
+            return "\"" + fname + "\"";
+#else
+            std::string quoted = "'";
+            for (char c : fname)
+                quoted += c == '\'' ? std::string("'\\''") : std::string(1, c);
+            return quoted + "'";
+#endif
+        }
+
+        // The streams go through the ties for the whole run, logged or not. Swapping their
+        // buffers when a log is opened would race with the input thread, which is always
+        // reading std::cin, and with the output thread.
         class Logger {
 
             Logger() :
-                in(std::cin.rdbuf(), file.rdbuf()),
-                out(std::cout.rdbuf(), file.rdbuf()) {}
-            ~Logger() { start(""); }
+                in(std::cin.rdbuf(), ring, true, openLog),
+                out(std::cout.rdbuf(), ring, false, openLog) {
+                std::cin.rdbuf(&in);
+                std::cout.rdbuf(&out);
+                std::atexit([] { start(""); });
+            }
+
+            // Created before main(), when no other thread runs, and never destroyed: the
+            // input thread may still be reading through its tie when the engine exits.
+            static Logger& l;
+
+            LogRing              ring;
+            std::atomic<uint8_t> openLog = 0; // The number of the open log, 0 if none
+            uint8_t              logs = 0;    // Opened so far, counting from 1 again after 255
+            Tie                  in, out;
+            FILE*                file = nullptr;
+            bool                 piped = false;
+            std::atomic_bool     quit = false;
+            std::thread          writer;
+
+            // Writes the lines of the ring for the log, until quit is set when the ring is empty
+            void write(uint8_t number) {
+
+                std::string text[2]; // The line so far of cout and of cin
+                uint32_t    line[2] = {};
+                std::string batch;
+                char        stamp[16] = {};
+                int64_t     stampTime = -1;
+
+                auto print = [&](int64_t time, bool fromCin, std::string_view rest, const char* end) {
+                    if (time != stampTime)
+                    {
+                        const int64_t ms = (stampTime = time) % 86400000;
+                        std::snprintf(stamp, sizeof(stamp), "%02d:%02d:%02d.%03d", int(ms / 3600000),
+                                      int(ms / 60000 % 60), int(ms / 1000 % 60), int(ms % 1000));
+                    }
+                    batch.append(stamp).append(fromCin ? " >> " : " << ").append(text[fromCin]).append(rest).append(end);
+                    batch += '\n';
+                    text[fromCin].clear();
+                };
+
+                for (;;)
+                {
+                    const bool last = quit;
+
+                    while (LogPiece* p = ring.front())
+                    {
+                        if (p->log != number)
+                        {
+                            ring.pop(); // Left over from the previous log
+                            continue;
+                        }
+
+                        if (!text[p->in].empty() && line[p->in] != p->line)
+                            print(p->time, p->in, "", " (cut)");
+
+                        line[p->in] = p->line;
+                        if (p->last)
+                            print(p->time, p->in, std::string_view(p->text, p->size), "");
+                        else
+                            text[p->in].append(p->text, p->size);
+
+                        ring.pop();
+                        if (batch.size() > 65536)
+                            break;
+                    }
 
-            std::ofstream file;
-            Tie           in, out;
+                    if (uint64_t n = ring.lost.exchange(0))
+                        batch += std::to_string(n) + " lines lost, the log could not keep up\n";
+
+                    if (!batch.empty())
+                    {
+                        std::fwrite(batch.data(), 1, batch.size(), file);
+                        std::fflush(file);
+                        batch.clear();
+                    }
+                    else if (last)
+                        break;
+                    else
+                        ring.nap();
+                }
+            }
 
         public:
             static void start(const std::string& fname) {
 
-                static Logger l;
-
-                if (l.file.is_open())
+                if (l.file)
                 {
-                    std::cout.rdbuf(l.out.buf);
-                    std::cin.rdbuf(l.in.buf);
-                    l.file.close();
+                    l.openLog = 0;
+                    l.quit = true;
+                    l.writer.join();
+                    l.piped ? pclose(l.file) : std::fclose(l.file);
+                    l.file = nullptr;
                 }
 
                 if (!fname.empty())
                 {
-                    l.file.open(fname, std::ifstream::out);
+                    l.piped = fname.size() > 3 && fname.compare(fname.size() - 3, 3, ".gz") == 0;
+                    l.file = l.piped ? popen(("gzip -c > " + shell_quoted(fname)).c_str(), "w") : std::fopen(fname.c_str(), "w");
 
-                    if (!l.file.is_open())
+                    if (!l.file)
                     {
                         std::cerr << "Unable to open debug log file " << fname << std::endl;
                         exit(EXIT_FAILURE);
                     }
 
-                    std::cin.rdbuf(&l.in);
-                    std::cout.rdbuf(&l.out);
+                    const std::time_t t = std::time(nullptr);
+                    char          date[32];
+                    std::strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", std::gmtime(&t));
+                    std::fprintf(l.file, "Debug log of %s, started %s, times are UTC\n", engine_info().c_str(), date);
+
+                    l.logs = uint8_t(l.logs % 255 + 1);
+                    l.ring.lost = 0;
+                    l.quit = false;
+                    l.writer = std::thread(&Logger::write, &l, l.logs);
+                    l.openLog = l.logs;
                 }
             }
         };
 
+        Logger& Logger::l = *new Logger;
+
     } // namespace
 
 
@@ -191,6 +468,22 @@ namespace Stockfish {
     }
 
 
+    namespace {
+
+        // The steps timed by Startup::timed(), in microseconds
+        std::vector<std::pair<const char*, int64_t>> startupSteps;
+
+    } // namespace
+
+    void Startup::timed(const char* step, const std::function<void()>& init) {
+
+        const auto start = std::chrono::steady_clock::now();
+        init();
+        startupSteps.emplace_back(step, std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count());
+    }
+
+
     // Returns a string trying to describe the compiler we use
     std::string compiler_info() {
 
@@ -302,6 +595,19 @@ namespace Stockfish {
         compiler += "(undefined macro)";
 #endif
 
+        std::ostringstream startup;
+        int64_t            total = 0;
+        startup << std::fixed << std::setprecision(2);
+        for (const auto& [step, us] : startupSteps)
+        {
+            startup << " " << step << " " << us / 1000.0;
+            total += us;
+        }
+        startup << ", total " << total / 1000.0;
+
+        compiler += "\nStartup time (ms)          :";
+        compiler += startup.str();
+
         compiler += "\n";
 
         return compiler;
@@ -394,20 +700,163 @@ namespace Stockfish {
 
     // Used to serialize access to std::cout to avoid multiple threads writing at
     // the same time.
-    std::ostream& operator<<(std::ostream& os, SyncCout sc) {
+    static std::mutex ioMutex;
 
-        static std::mutex m;
+    std::ostream& operator<<(std::ostream& os, SyncCout sc) {
 
         if (sc == IO_LOCK)
-            m.lock();
+        {
+            AsyncOut::drain(); // Keep the order of all output
+            ioMutex.lock();
+        }
 
         if (sc == IO_UNLOCK)
-            m.unlock();
+            ioMutex.unlock();
 
         return os;
     }
 
 
+    namespace AsyncOut {
+
+        namespace {
+
+            struct Item {
+                std::function<std::string()> format;
+                Kind                         kind;
+            };
+
+            constexpr uint64_t RingSize = 256;
+
+            Item                  ring[RingSize];
+            std::atomic<uint64_t> head, tail; // Items written or dropped, items posted
+            std::mutex            postMutex;  // Producers take turns, the writer never waits for it
+            std::atomic<bool>     running;
+            std::atomic<int>      interval;
+            std::thread::id       writerId;
+
+            void write_loop() {
+
+                TimePoint lastReport = 0;
+
+                while (true)
+                {
+                    const uint64_t h = head.load(std::memory_order_relaxed);
+                    const uint64_t t = tail.load(std::memory_order_acquire);
+
+                    if (h == t)
+                    {
+                        tail.wait(t, std::memory_order_acquire);
+                        continue;
+                    }
+
+                    Item&      item = ring[h % RingSize];
+                    const bool more = h + 1 < t;
+
+                    if (item.kind == Stop)
+                    {
+                        head.store(h + 1, std::memory_order_release);
+                        head.notify_all();
+                        return;
+                    }
+
+                    // Superseded by a newer item of the same kind
+                    if (item.kind != Plain && more && ring[(h + 1) % RingSize].kind == item.kind)
+                    {
+                        item.format = nullptr;
+                        head.store(h + 1, std::memory_order_release);
+                        head.notify_all();
+                        continue;
+                    }
+
+                    // Rate limit, unless something else is waiting behind the report
+                    if (item.kind == Report && !more && now() - lastReport < interval)
+                    {
+                        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                        continue;
+                    }
+
+                    const std::string s = item.format();
+                    item.format = nullptr;
+
+                    ioMutex.lock();
+                    std::cout << s << std::endl;
+                    ioMutex.unlock();
+
+                    if (item.kind == Report)
+                        lastReport = now();
+
+                    head.store(h + 1, std::memory_order_release);
+                    head.notify_all();
+                }
+            }
+
+        } // namespace
+
+        void start() {
+
+            std::thread writer(write_loop);
+            writerId = writer.get_id();
+            writer.detach(); // May still run when exit() is called
+            running = true;
+        }
+
+        // Writes everything posted so far, then ends the writer
+        void stop() {
+
+            if (!running)
+                return;
+
+            post(nullptr, Stop);
+            drain();
+            running = false;
+        }
+
+        void post(std::function<std::string()> format, Kind kind) {
+
+            if (!running)
+            {
+                if (format)
+                {
+                    const std::string s = format();
+                    sync_cout << s << sync_endl;
+                }
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(postMutex);
+
+            const uint64_t t = tail.load(std::memory_order_relaxed);
+
+            // When the ring is full a report is dropped, anything else waits
+            while (t - head.load(std::memory_order_acquire) >= RingSize)
+            {
+                if (kind == Report || kind == CurrMove)
+                    return;
+                std::this_thread::yield();
+            }
+
+            ring[t % RingSize] = { std::move(format), kind };
+            tail.store(t + 1, std::memory_order_release);
+            tail.notify_one();
+        }
+
+        // Waits until all posted items are written, the writer itself never waits
+        void drain() {
+
+            if (!running || std::this_thread::get_id() == writerId)
+                return;
+
+            const uint64_t t = tail.load(std::memory_order_acquire);
+            for (uint64_t h; (h = head.load(std::memory_order_acquire)) < t;)
+                head.wait(h, std::memory_order_acquire);
+        }
+
+        void set_interval(int ms) { interval = ms; }
+
+    } // namespace AsyncOut
+
+
     // Trampoline helper to avoid moving Logger to misc.h
     void start_logger(const std::string& fname) { Logger::start(fname); }
 
@@ -591,10 +1040,184 @@ namespace Stockfish {
 #endif
 
 
-    namespace WinProcGroup {
+    // map_file() maps a file read-only and shared, so that several engine
+    // processes using the same file share the physical pages.
 
 #ifndef _WIN32
 
+    void* map_file(const std::string& fname, size_t& size, uint64_t& mapping) {
+
+        struct stat statbuf;
+        int         fd = ::open(fname.c_str(), O_RDONLY);
+
+        if (fd == -1)
+            return nullptr;
+
+        if (fstat(fd, &statbuf) || !statbuf.st_size)
+        {
+            ::close(fd);
+            return nullptr;
+        }
+
+        size = size_t(statbuf.st_size);
+        mapping = size;
+        void* baseAddress = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+
+        return baseAddress == MAP_FAILED ? nullptr : baseAddress;
+    }
+
+    void unmap_file(void* baseAddress, size_t size, uint64_t) {
+
+        if (baseAddress)
+            munmap(baseAddress, size);
+    }
+
+#else
+
+    void* map_file(const std::string& fname, size_t& size, uint64_t& mapping) {
+
+        HANDLE fd = CreateFileA(fname.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+        if (fd == INVALID_HANDLE_VALUE)
+            return nullptr;
+
+        DWORD size_high;
+        DWORD size_low = GetFileSize(fd, &size_high);
+        size = (size_t(size_high) << 32) | size_low;
+
+        HANDLE mmap = size ? CreateFileMapping(fd, nullptr, PAGE_READONLY, size_high, size_low, nullptr) : nullptr;
+        CloseHandle(fd);
+
+        if (!mmap)
+            return nullptr;
+
+        void* baseAddress = MapViewOfFile(mmap, FILE_MAP_READ, 0, 0, 0);
+        if (!baseAddress)
+        {
+            CloseHandle(mmap);
+            return nullptr;
+        }
+
+        mapping = uint64_t(mmap);
+        return baseAddress;
+    }
+
+    void unmap_file(void* baseAddress, size_t, uint64_t mapping) {
+
+        if (baseAddress)
+        {
+            UnmapViewOfFile(baseAddress);
+            CloseHandle((HANDLE)mapping);
+        }
+    }
+
+#endif
+
+
+    // large_pages_info() reports how much of the memory is backed by transparent huge
+    // pages, as found in /proc/self/smaps. Other systems give no such information.
+
+#if defined(__linux__) && !defined(__ANDROID__)
+
+    std::string large_pages_info(void* mem, size_t size) {
+
+        std::ifstream smaps("/proc/self/smaps");
+        std::string   line;
+        bool          inRange = false;
+        size_t        hugeKB = 0;
+
+        while (std::getline(smaps, line))
+        {
+            unsigned long long start, end;
+            char dash;
+            std::istringstream ss(line);
+
+            // Mapping headers look like "7f12a0000000-7f12e0000000 rw-p ..."
+            if (line.find('-') < line.find(' ') && (ss >> std::hex >> start >> dash >> end))
+                inRange = uintptr_t(mem) < end && uintptr_t(mem) + size > start;
+
+            else if (inRange && line.rfind("AnonHugePages:", 0) == 0)
+            {
+                size_t kb;
+                std::istringstream(line.substr(14)) >> kb;
+                hugeKB += kb;
+            }
+        }
+
+        return std::to_string(hugeKB / 1024) + " of " + std::to_string(size / (1024 * 1024))
+            + " MB in 2 MB pages";
+    }
+
+#else
+
+    std::string large_pages_info(void*, size_t) { return ""; }
+
+#endif
+
+
+    namespace Numa {
+
+#if defined(USE_NUMA) && defined(__linux__)
+
+        int nodes() { return numa_available() < 0 ? 1 : numa_num_configured_nodes(); }
+
+        void interleave(void* mem, size_t size) {
+
+            if (nodes() > 1)
+                numa_interleave_memory(mem, size, numa_all_nodes_ptr);
+        }
+
+        void move_to_this_node(void* mem, size_t size) {
+
+            int node = nodes() > 1 ? numa_node_of_cpu(sched_getcpu()) : -1;
+            if (node < 0)
+                return;
+
+            // mbind() works on whole pages, neighbouring data on the same pages moves as well
+            const uintptr_t pageSize = uintptr_t(sysconf(_SC_PAGESIZE));
+            const uintptr_t start = uintptr_t(mem) & ~(pageSize - 1);
+
+            struct bitmask* mask = numa_allocate_nodemask();
+            numa_bitmask_setbit(mask, unsigned(node));
+            mbind((void*)start, uintptr_t(mem) + size - start, MPOL_PREFERRED, mask->maskp, mask->size + 1,
+                MPOL_MF_MOVE);
+            numa_free_nodemask(mask);
+        }
+
+#else
+
+        int  nodes() { return 1; }
+        void interleave(void*, size_t) {}
+        void move_to_this_node(void*, size_t) {}
+
+#endif
+
+    } // namespace Numa
+
+
+    namespace WinProcGroup {
+
+#if defined(USE_NUMA) && defined(__linux__)
+
+        // Binds the thread to a NUMA node. Like on Windows, the nodes are filled up one
+        // after another with one thread per logical processor.
+        void bindThisThread(size_t idx) {
+
+            const int nodes = Numa::nodes();
+            if (nodes < 2)
+                return;
+
+            const size_t cpusPerNode = std::max(1, numa_num_configured_cpus() / nodes);
+            const int    node = int(idx / cpusPerNode % nodes);
+
+            numa_run_on_node(node);
+            numa_set_preferred(node);
+        }
+
+#elif !defined(_WIN32)
+
         void bindThisThread(size_t) {}
 
 #else
@@ -713,6 +1336,91 @@ namespace Stockfish {
 
     } // namespace WinProcGroup
 
+
+    namespace Affinity {
+
+#if defined(__linux__)
+
+        // Returns the logical processors the process may run on, ordered for the mode:
+        // 'compact' fills a core with all its SMT siblings before the next one, 'scatter'
+        // puts consecutive threads on different packages and cores, 'physical-cores-first'
+        // takes one logical processor of every core before any SMT sibling. More threads
+        // than processors start again with the first one.
+        std::vector<int> mapping(const std::string& mode, size_t threads) {
+
+            if (mode != "compact" && mode != "scatter" && mode != "physical-cores-first")
+                return {};
+
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            if (sched_getaffinity(0, sizeof(set), &set))
+                return {};
+
+            struct Cpu {
+                int cpu, package, core, smt, coreIdx;
+            };
+            std::vector<Cpu> cpus;
+
+            auto read_id = [](int cpu, const char* name) {
+                std::ifstream f("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/" + name);
+                int id = 0;
+                f >> id;
+                return id;
+                };
+
+            for (int c = 0; c < CPU_SETSIZE; ++c)
+                if (CPU_ISSET(c, &set))
+                    cpus.push_back({ c, read_id(c, "physical_package_id"), read_id(c, "core_id"), 0, 0 });
+
+            if (cpus.empty())
+                return {};
+
+            // Number the SMT siblings of each core, and the cores of each package
+            for (Cpu& c : cpus)
+            {
+                std::vector<int> cores;
+                for (const Cpu& o : cpus)
+                {
+                    if (o.package == c.package && o.core == c.core && o.cpu < c.cpu)
+                        c.smt++;
+                    if (o.package == c.package && o.core < c.core
+                        && std::find(cores.begin(), cores.end(), o.core) == cores.end())
+                        cores.push_back(o.core);
+                }
+                c.coreIdx = int(cores.size());
+            }
+
+            auto key = [&](const Cpu& c) {
+                return mode == "compact" ? std::make_tuple(c.package, c.core, c.smt)
+                    : mode == "scatter" ? std::make_tuple(c.smt, c.coreIdx, c.package)
+                    : std::make_tuple(c.smt, c.package, c.core);
+                };
+            std::sort(cpus.begin(), cpus.end(), [&](const Cpu& a, const Cpu& b) { return key(a) < key(b); });
+
+            std::vector<int> result;
+            for (size_t i = 0; i < threads; ++i)
+                result.push_back(cpus[i % cpus.size()].cpu);
+
+            return result;
+        }
+
+        void bind_this_thread(int cpu) {
+
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            sched_setaffinity(0, sizeof(set), &set);
+        }
+
+#else
+
+        std::vector<int> mapping(const std::string&, size_t) { return {}; }
+        void             bind_this_thread(int) {}
+
+#endif
+
+    } // namespace Affinity
+
 #ifdef _WIN32
 #include <direct.h>
 #define GETCWD _getcwd
@@ -23,8 +23,12 @@
 #include <chrono>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <functional>
 #include <iosfwd>
+#include <new>
 #include <string>
+#include <vector>
 
 #include "types.h"
 
@@ -48,6 +52,26 @@ namespace Stockfish {
     void* aligned_large_pages_alloc(size_t size);
     // nop if mem == nullptr
     void aligned_large_pages_free(void* mem);
+    // Maps a whole file read-only into memory. Returns nullptr if that fails,
+    // otherwise size and mapping are set and needed later by unmap_file().
+    void* map_file(const std::string& fname, size_t& size, uint64_t& mapping);
+    void  unmap_file(void* baseAddress, size_t size, uint64_t mapping);
+    // Describes the pages actually obtained for memory from aligned_large_pages_alloc()
+    std::string large_pages_info(void* mem, size_t size);
+
+    // NUMA memory placement on Linux, needs a build with libnuma (make numa=yes).
+    // Otherwise there is a single node and the functions are nops.
+    namespace Numa {
+        int  nodes();
+        void interleave(void* mem, size_t size);
+        // Migrates the pages of mem to the node the calling thread runs on
+        void move_to_this_node(void* mem, size_t size);
+    }
+
+    // Runs and times the initialization steps of main(), compiler_info() lists the times
+    namespace Startup {
+        void timed(const char* step, const std::function<void()>& init);
+    }
 
     void dbg_hit_on(bool cond, int slot = 0);
     void dbg_mean_of(int64_t value, int slot = 0);
@@ -63,12 +87,70 @@ namespace Stockfish {
             .count();
     }
 
-    template<class Entry, int Size>
-    struct HashTable {
-        Entry* operator[](Key key) { return &table[(uint32_t)key & (Size - 1)]; }
+    // The pawn and material tables of a thread, 2-way set associative: a key maps to a
+    // bucket of two entries, operator[] returns the entry holding the key or else the less
+    // recently used one of the bucket, which the caller overwrites. resize() only sets the
+    // number of entries, the memory is allocated and cleared by clear(), which runs on the
+    // thread owning the table, so that it is the first to touch its memory.
+    template<class Entry>
+    class HashTable {
+
+    public:
+        HashTable() = default;
+        HashTable(const HashTable&) = delete;
+        HashTable& operator=(const HashTable&) = delete;
+        ~HashTable() { std_aligned_free(table); }
+
+        void prefetch(Key key) { Stockfish::prefetch(table + 2 * (size_t(uint32_t(key)) & (buckets - 1))); }
+
+        Entry* operator[](Key key) {
+
+            const size_t bucket = size_t(uint32_t(key)) & (buckets - 1);
+            Entry*       e = table + 2 * bucket;
+            int          way;
+
+            ++probes;
+            if (e[0].key == key)
+                way = 0, ++hits;
+            else if (e[1].key == key)
+                way = 1, ++hits;
+            else
+                way = !recent[bucket];
+
+            recent[bucket] = uint8_t(way);
+            return e + way;
+        }
+
+        // Rounded down to a power of two, at least one bucket
+        void resize(size_t entries) {
+            wanted = 2;
+            while (wanted * 2 <= entries)
+                wanted *= 2;
+        }
+
+        void clear() {
+
+            if (2 * buckets != wanted)
+            {
+                std_aligned_free(table);
+                table = static_cast<Entry*>(std_aligned_alloc(64, wanted * sizeof(Entry) + wanted / 2));
+                if (!table)
+                    throw std::bad_alloc();
+
+                buckets = wanted / 2;
+                recent = reinterpret_cast<uint8_t*>(table + wanted);
+            }
+
+            std::memset(static_cast<void*>(table), 0, 2 * buckets * sizeof(Entry) + buckets);
+        }
+
+        size_t   size() const { return 2 * buckets; }
+        uint64_t probes = 0, hits = 0, sharedHits = 0;
 
     private:
-        std::vector<Entry> table = std::vector<Entry>(Size); // Allocate on the heap
+        Entry*   table = nullptr;
+        uint8_t* recent = nullptr; // The way of the bucket used last
+        size_t   buckets = 0, wanted = 2;
     };
 
 
@@ -81,6 +163,26 @@ namespace Stockfish {
 #define sync_cout std::cout << IO_LOCK
 #define sync_endl std::endl << IO_UNLOCK
 
+    // Output of the search, formatted and written by a thread of its own so that the search
+    // never waits for stdout. Any thread may post, the writer takes the items from a ring
+    // without locking.
+    // A report still waiting to be written is dropped when a newer one of the same kind
+    // follows it. sync_cout first waits until everything posted has been written.
+    namespace AsyncOut {
+        enum Kind {
+            Plain,    // Always written, e.g. bestmove
+            Report,   // A PV report of UCI::pv()
+            CurrMove, // Progress within an iteration
+            Stop      // Internal, ends the writer
+        };
+
+        void start();
+        void stop();
+        void post(std::function<std::string()> format, Kind kind = Plain);
+        void drain();
+        void set_interval(int ms); // Minimum time between two written reports
+    }
+
 
     // Get the first aligned element of an array.
     // ptr must point to an array of size at least `sizeof(T) * N + alignment` bytes,
@@ -131,6 +233,7 @@ namespace Stockfish {
     public:
         std::size_t size() const { return size_; }
         void        push_back(const T& value) { values_[size_++] = value; }
+        void        remove(int index) { values_[index] = values_[--size_]; } // Doesn't keep the order
         const T*    begin() const { return values_; }
         const T*    end() const { return values_ + size_; }
         const T&    operator[](int index) const { return values_[index]; }
@@ -208,9 +311,19 @@ namespace Stockfish {
         void bindThisThread(size_t idx);
     }
 
+    // Binding of the search threads to logical processors by the 'Thread Binding' option,
+    // Linux only. The topology is read from /sys/devices/system/cpu.
+    namespace Affinity {
+        // Logical processor of each of the threads for a mode of the option (compact,
+        // scatter or physical-cores-first), empty if the threads are not to be bound.
+        std::vector<int> mapping(const std::string& mode, size_t threads);
+        void             bind_this_thread(int cpu);
+    }
+
     namespace CommandLine {
         void init(int argc, char* argv[]);
 
+        extern std::string argv0;           // path+name of the executable binary
         extern std::string binaryDirectory; // path of the executable directory
         extern std::string workingDirectory; // path of the working directory
     }
@@ -28,8 +28,10 @@ namespace Stockfish {
 
     namespace {
 
-        template<GenType Type, Direction D, bool Enemy>
-        ExtMove* make_promotions(ExtMove* moveList, [[maybe_unused]] Square to) {
+        // The generators write either ExtMove, for the move picker, or plain Move, the
+        // compact list of generate_legal().
+        template<GenType Type, Direction D, bool Enemy, typename T>
+        T* make_promotions(T* moveList, [[maybe_unused]] Square to) {
 
             constexpr bool all = Type == EVASIONS || Type == NON_EVASIONS;
 
@@ -46,8 +48,11 @@ namespace Stockfish {
             return moveList;
         }
 
-        template<Color Us, GenType Type>
-        ExtMove* generate_pawn_moves(const Position& pos, ExtMove* moveList, Bitboard target) {
+        // With Legal set, the pawn, piece and king move generators below skip the moves
+        // that leave the king in check, using the pins and checkers of the StateInfo. Only
+        // en passant captures, at most two per position, go through Position::legal().
+        template<Color Us, GenType Type, bool Legal = false, typename T = ExtMove>
+        T* generate_pawn_moves(const Position& pos, T* moveList, Bitboard target) {
 
             constexpr Color     Them = ~Us;
             constexpr Bitboard  TRank7BB = (Us == WHITE ? Rank7BB : Rank2BB);
@@ -62,10 +67,20 @@ namespace Stockfish {
             Bitboard pawnsOn7 = pos.pieces(Us, PAWN) & TRank7BB;
             Bitboard pawnsNotOn7 = pos.pieces(Us, PAWN) & ~TRank7BB;
 
+            // A pinned pawn can only push along the file of its king and capture along
+            // the diagonal of its pin.
+            [[maybe_unused]] const Square   ourKsq = pos.square<KING>(Us);
+            [[maybe_unused]] const Bitboard pinned = Legal ? pos.blockers_for_king(Us) & pos.pieces(Us) : 0;
+            [[maybe_unused]] const Bitboard unpushable = pinned & ~file_bb(ourKsq);
+
+            auto legal = [&](Square from, Square to) {
+                return !Legal || !(pinned & from) || aligned(from, to, ourKsq);
+            };
+
             // Single and double pawn pushes, no promotions
             if constexpr (Type != CAPTURES)
             {
-                Bitboard b1 = shift<Up>(pawnsNotOn7) & emptySquares;
+                Bitboard b1 = shift<Up>(pawnsNotOn7 & ~unpushable) & emptySquares;
                 Bitboard b2 = shift<Up>(b1 & TRank3BB) & emptySquares;
 
                 if constexpr (Type == EVASIONS) // Consider only blocking squares
@@ -103,13 +118,21 @@ namespace Stockfish {
             {
                 Bitboard b = shift<UpRight>(pawnsOn7) & enemies;
                 while (b)
-                    moveList = make_promotions<Type, UpRight, true>(moveList, pop_lsb(b));
+                {
+                    Square to = pop_lsb(b);
+                    if (legal(to - UpRight, to))
+                        moveList = make_promotions<Type, UpRight, true>(moveList, to);
+                }
 
                 b = shift<UpLeft>(pawnsOn7) & enemies;
                 while (b)
-                    moveList = make_promotions<Type, UpLeft, true>(moveList, pop_lsb(b));
+                {
+                    Square to = pop_lsb(b);
+                    if (legal(to - UpLeft, to))
+                        moveList = make_promotions<Type, UpLeft, true>(moveList, to);
+                }
 
-                b = shift<Up>(pawnsOn7) & emptySquares;
+                b = shift<Up>(pawnsOn7 & ~unpushable) & emptySquares;
                 if constexpr (Type == EVASIONS)
                     b &= target;
                 while (b)
@@ -123,14 +146,16 @@ namespace Stockfish {
                 while (b)
                 {
                     Square to = pop_lsb(b);
-                    *moveList++ = Move(to - UpRight, to);
+                    if (legal(to - UpRight, to))
+                        *moveList++ = Move(to - UpRight, to);
                 }
 
                 b = shift<UpLeft>(pawnsNotOn7) & enemies;
                 while (b)
                 {
                     Square to = pop_lsb(b);
-                    *moveList++ = Move(to - UpLeft, to);
+                    if (legal(to - UpLeft, to))
+                        *moveList++ = Move(to - UpLeft, to);
                 }
 
                 if (pos.ep_square() != SQ_NONE)
@@ -146,7 +171,11 @@ namespace Stockfish {
                     assert(b);
 
                     while (b)
-                        *moveList++ = Move::make<EN_PASSANT>(pop_lsb(b), pos.ep_square());
+                    {
+                        Move m = Move::make<EN_PASSANT>(pop_lsb(b), pos.ep_square());
+                        if (!Legal || pos.legal(m))
+                            *moveList++ = m;
+                    }
                 }
             }
 
@@ -154,8 +183,8 @@ namespace Stockfish {
         }
 
 
-        template<Color Us, PieceType Pt, bool Checks>
-        ExtMove* generate_moves(const Position& pos, ExtMove* moveList, Bitboard target) {
+        template<Color Us, PieceType Pt, bool Checks, bool Legal = false, typename T = ExtMove>
+        T* generate_moves(const Position& pos, T* moveList, Bitboard target) {
 
             static_assert(Pt != KING && Pt != PAWN, "Unsupported piece type in generate_moves()");
 
@@ -170,6 +199,10 @@ namespace Stockfish {
                 if (Checks && (Pt == QUEEN || !(pos.blockers_for_king(~Us) & from)))
                     b &= pos.check_squares(Pt);
 
+                // A pinned piece stays on the line of its pin, a pinned knight cannot move
+                if (Legal && (pos.blockers_for_king(Us) & from))
+                    b &= line_bb(pos.square<KING>(Us), from);
+
                 while (b)
                     *moveList++ = Move(from, pop_lsb(b));
             }
@@ -178,10 +211,28 @@ namespace Stockfish {
         }
 
 
-        template<Color Us, GenType Type>
-        ExtMove* generate_all(const Position& pos, ExtMove* moveList) {
+        // The squares the king passes over, its destination included, are not attacked, as in
+        // Position::legal(). In Chess960 the castling rook must not be pinned either.
+        template<Color Us>
+        bool castling_is_safe(const Position& pos, CastlingRights cr) {
+
+            const Square ksq = pos.square<KING>(Us);
+            const Square to = relative_square(Us, cr & KING_SIDE ? SQ_G1 : SQ_C1);
+            const Direction step = to > ksq ? WEST : EAST;
+
+            for (Square s = to; s != ksq; s += step)
+                if (pos.attackers_to(s) & pos.pieces(~Us))
+                    return false;
+
+            return !pos.is_chess960() || !(pos.blockers_for_king(Us) & pos.castling_rook_square(cr));
+        }
+
+
+        template<Color Us, GenType Type, bool Legal = false, typename T = ExtMove>
+        T* generate_all(const Position& pos, T* moveList) {
 
             static_assert(Type != LEGAL, "Unsupported type in generate_all()");
+            static_assert(!Legal || Type == EVASIONS || Type == NON_EVASIONS, "Legal needs all the moves");
 
             constexpr bool Checks = Type == QUIET_CHECKS; // Reduce template instantiations
             const Square   ksq = pos.square<KING>(Us);
@@ -195,11 +246,11 @@ namespace Stockfish {
                        : Type == CAPTURES     ? pos.pieces(~Us)
                        : ~pos.pieces(); // QUIETS || QUIET_CHECKS
 
-                moveList = generate_pawn_moves<Us, Type>(pos, moveList, target);
-                moveList = generate_moves<Us, KNIGHT, Checks>(pos, moveList, target);
-                moveList = generate_moves<Us, BISHOP, Checks>(pos, moveList, target);
-                moveList = generate_moves<Us, ROOK, Checks>(pos, moveList, target);
-                moveList = generate_moves<Us, QUEEN, Checks>(pos, moveList, target);
+                moveList = generate_pawn_moves<Us, Type, Legal>(pos, moveList, target);
+                moveList = generate_moves<Us, KNIGHT, Checks, Legal>(pos, moveList, target);
+                moveList = generate_moves<Us, BISHOP, Checks, Legal>(pos, moveList, target);
+                moveList = generate_moves<Us, ROOK, Checks, Legal>(pos, moveList, target);
+                moveList = generate_moves<Us, QUEEN, Checks, Legal>(pos, moveList, target);
             }
 
             if (!Checks || pos.blockers_for_king(~Us) & ksq)
@@ -209,11 +260,16 @@ namespace Stockfish {
                     b &= ~attacks_bb<QUEEN>(pos.square<KING>(~Us));
 
                 while (b)
-                    *moveList++ = Move(ksq, pop_lsb(b));
+                {
+                    Square to = pop_lsb(b);
+                    if (!Legal || !(pos.attackers_to(to, pos.pieces() ^ ksq) & pos.pieces(~Us)))
+                        *moveList++ = Move(ksq, to);
+                }
 
                 if ((Type == QUIETS || Type == NON_EVASIONS) && pos.can_castle(Us & ANY_CASTLING))
                     for (CastlingRights cr : {Us & KING_SIDE, Us & QUEEN_SIDE})
-                        if (!pos.castling_impeded(cr) && pos.can_castle(cr))
+                        if (!pos.castling_impeded(cr) && pos.can_castle(cr)
+                            && (!Legal || castling_is_safe<Us>(pos, cr)))
                             *moveList++ = Move::make<CASTLING>(ksq, pos.castling_rook_square(cr));
             }
 
@@ -250,24 +306,133 @@ namespace Stockfish {
     template ExtMove* generate<NON_EVASIONS>(const Position&, ExtMove*);
 
 
-    // generate<LEGAL> generates all the legal moves in the given position
+    // generate<LEGAL> generates all the legal moves in the given position, in the order
+    // of generate<EVASIONS> or generate<NON_EVASIONS> without the illegal ones. The pins,
+    // checkers and the attacks on the king squares decide, so no move is tried.
 
     template<>
     ExtMove* generate<LEGAL>(const Position& pos, ExtMove* moveList) {
 
-        Color    us = pos.side_to_move();
-        Bitboard pinned = pos.blockers_for_king(us) & pos.pieces(us);
-        Square   ksq = pos.square<KING>(us);
-        ExtMove* cur = moveList;
+        Color us = pos.side_to_move();
+
+        if (pos.checkers())
+            return us == WHITE ? generate_all<WHITE, EVASIONS, true>(pos, moveList)
+                               : generate_all<BLACK, EVASIONS, true>(pos, moveList);
+
+        return us == WHITE ? generate_all<WHITE, NON_EVASIONS, true>(pos, moveList)
+                           : generate_all<BLACK, NON_EVASIONS, true>(pos, moveList);
+    }
+
+
+    // generate_legal<Us> is generate<LEGAL> into a compact list of Move, for a side to
+    // move known at compile time
+
+    template<Color Us>
+    Move* generate_legal(const Position& pos, Move* moveList) {
+
+        assert(pos.side_to_move() == Us);
 
-        moveList = pos.checkers() ? generate<EVASIONS>(pos, moveList) : generate<NON_EVASIONS>(pos, moveList);
-        while (cur != moveList)
-            if (((pinned & cur->from_sq()) || cur->from_sq() == ksq || cur->type_of() == EN_PASSANT) && !pos.legal(*cur))
-                *cur = *(--moveList);
-            else
-                ++cur;
+        return pos.checkers() ? generate_all<Us, EVASIONS, true>(pos, moveList)
+                              : generate_all<Us, NON_EVASIONS, true>(pos, moveList);
+    }
+
+
+    // count_legal<Us> returns the number of legal moves, the size of generate<LEGAL>,
+    // without generating them: the targets of the pieces and of the pawns that are not
+    // pinned are counted with popcount. Only the king moves, the pinned pawns and en
+    // passant captures are looked at one by one. Used at the leaves of perft.
+
+    template<Color Us>
+    size_t count_legal(const Position& pos) {
+
+        assert(pos.side_to_move() == Us);
+
+        constexpr Color     Them = ~Us;
+        constexpr Bitboard  TRank7BB = (Us == WHITE ? Rank7BB : Rank2BB);
+        constexpr Bitboard  TRank3BB = (Us == WHITE ? Rank3BB : Rank6BB);
+        constexpr Direction Up = pawn_push(Us);
+        constexpr Direction UpRight = (Us == WHITE ? NORTH_EAST : SOUTH_WEST);
+        constexpr Direction UpLeft  = (Us == WHITE ? NORTH_WEST : SOUTH_EAST);
+
+        const Square   ksq = pos.square<KING>(Us);
+        const Bitboard checkers = pos.checkers();
+        size_t         count = 0;
+
+        Bitboard b = attacks_bb<KING>(ksq) & ~pos.pieces(Us);
+        while (b)
+            if (!(pos.attackers_to(pop_lsb(b), pos.pieces() ^ ksq) & pos.pieces(Them)))
+                ++count;
+
+        if (more_than_one(checkers))
+            return count;
+
+        if (!checkers && pos.can_castle(Us & ANY_CASTLING))
+            for (CastlingRights cr : {Us & KING_SIDE, Us & QUEEN_SIDE})
+                if (!pos.castling_impeded(cr) && pos.can_castle(cr) && castling_is_safe<Us>(pos, cr))
+                    ++count;
+
+        const Bitboard target = checkers ? between_bb(ksq, lsb(checkers)) : ~pos.pieces(Us);
+        const Bitboard pinned = pos.blockers_for_king(Us) & pos.pieces(Us);
+        const Bitboard emptySquares = ~pos.pieces();
+        const Bitboard enemies = checkers ? checkers : pos.pieces(Them);
+        const Bitboard pushTarget = checkers ? target : ~Bitboard(0);
+
+        for (PieceType pt : {KNIGHT, BISHOP, ROOK, QUEEN})
+        {
+            Bitboard bb = pos.pieces(Us, pt);
+            while (bb)
+            {
+                Square   from = pop_lsb(bb);
+                Bitboard t = attacks_bb(pt, from, pos.pieces()) & target;
+                count += popcount(pinned & from ? t & line_bb(ksq, from) : t);
+            }
+        }
+
+        // Pawns that are not pinned, a promotion counts for its four pieces
+        const Bitboard pawns = pos.pieces(Us, PAWN) & ~pinned;
+        const Bitboard pawnsOn7 = pawns & TRank7BB;
+        const Bitboard pawnsNotOn7 = pawns & ~TRank7BB;
+
+        Bitboard b1 = shift<Up>(pawnsNotOn7) & emptySquares;
+        Bitboard b2 = shift<Up>(b1 & TRank3BB) & emptySquares;
+
+        count += popcount(b1 & pushTarget) + popcount(b2 & pushTarget)
+               + popcount(shift<UpRight>(pawnsNotOn7) & enemies) + popcount(shift<UpLeft>(pawnsNotOn7) & enemies)
+               + 4 * (popcount(shift<UpRight>(pawnsOn7) & enemies) + popcount(shift<UpLeft>(pawnsOn7) & enemies)
+                    + popcount(shift<Up>(pawnsOn7) & emptySquares & pushTarget));
+
+        // Pinned pawns, which stay on the line of their pin
+        Bitboard pinnedPawns = pos.pieces(Us, PAWN) & pinned;
+        while (pinnedPawns)
+        {
+            Square   from = pop_lsb(pinnedPawns);
+            Bitboard push = shift<Up>(square_bb(from)) & emptySquares;
+            Bitboard t = (push | (shift<Up>(push & TRank3BB) & emptySquares)) & pushTarget;
+
+            t = (t | (pawn_attacks_bb(Us, from) & enemies)) & line_bb(ksq, from);
+            count += popcount(t) * (TRank7BB & from ? 4 : 1);
+        }
+
+        // En passant captures, as in generate_pawn_moves()
+        if (pos.ep_square() != SQ_NONE && !(checkers && (target & (pos.ep_square() + Up))))
+        {
+            Bitboard ep = pos.pieces(Us, PAWN) & ~TRank7BB & pawn_attacks_bb(Them, pos.ep_square());
+            while (ep)
+                if (pos.legal(Move::make<EN_PASSANT>(pop_lsb(ep), pos.ep_square())))
+                    ++count;
+        }
+
+        return count;
+    }
+
+    // Explicit template instantiations
+    template Move* generate_legal<WHITE>(const Position&, Move*);
+    template Move* generate_legal<BLACK>(const Position&, Move*);
+    template size_t count_legal<WHITE>(const Position&);
+    template size_t count_legal<BLACK>(const Position&);
 
-        return moveList;
+    size_t count_legal(const Position& pos) {
+        return pos.side_to_move() == WHITE ? count_legal<WHITE>(pos) : count_legal<BLACK>(pos);
     }
 
 } // namespace Stockfish
@@ -38,7 +38,8 @@ namespace Stockfish {
     };
 
     struct ExtMove : public Move {
-        int value;
+        int16_t see; // Of the captures the MovePicker tried in its good capture stage, first
+        int     value; // so that an ExtMove keeps its 8 bytes
 
         void operator=(Move m) { data = m.raw(); }
 
@@ -52,6 +53,13 @@ namespace Stockfish {
     template<GenType>
     ExtMove* generate(const Position& pos, ExtMove* moveList);
 
+    template<Color Us>
+    Move* generate_legal(const Position& pos, Move* moveList);
+
+    template<Color Us>
+    size_t count_legal(const Position& pos);
+    size_t count_legal(const Position& pos);
+
     // The MoveList struct wraps the generate() function and returns a convenient list of moves.
     // Using MoveList is sometimes preferable to directly calling the lower level generate() function.
     template<GenType T>
@@ -83,7 +83,8 @@ namespace Stockfish {
     // move ordering is at the current node.
 
     // MovePicker constructor for the main search
-    MovePicker::MovePicker(const Position& p,
+    template<typename Policy>
+    BasicMovePicker<Policy>::BasicMovePicker(const Position& p,
         Move                         ttm,
         Depth                        d,
         const ButterflyHistory* mh,
@@ -98,27 +99,31 @@ namespace Stockfish {
         continuationHistory(ch),
         pawnHistory(ph),
         ttMove(ttm),
-        refutations{ {killers[0], 0}, {killers[1], 0}, {cm, 0} },
+        refutations{ {killers[0], 0, 0}, {killers[1], 0, 0}, {cm, 0, 0} },
         depth(d) {
         assert(d > 0);
 
         stage = (pos.checkers() ? EVASION_TT : MAIN_TT) + !(ttm && pos.pseudo_legal(ttm));
     }
 
-    // Constructor for quiescence search
-    MovePicker::MovePicker(const Position& p,
+    // Constructor for quiescence search, the classic search only tries recaptures on
+    // the recapture square below DEPTH_QS_RECAPTURES
+    template<typename Policy>
+    BasicMovePicker<Policy>::BasicMovePicker(const Position& p,
         Move                         ttm,
         Depth                        d,
         const ButterflyHistory* mh,
         const CapturePieceToHistory* cph,
         const PieceToHistory** ch,
-        const PawnHistory* ph) :
+        const PawnHistory* ph,
+        Square                       rs) :
         pos(p),
         mainHistory(mh),
         captureHistory(cph),
         continuationHistory(ch),
         pawnHistory(ph),
         ttMove(ttm),
+        recaptureSquare(rs),
         depth(d) {
         assert(d <= 0);
 
@@ -126,7 +131,8 @@ namespace Stockfish {
     }
 
     // Constructor for ProbCut: we generate captures with SEE greater than or equal to the given threshold.
-    MovePicker::MovePicker(
+    template<typename Policy>
+    BasicMovePicker<Policy>::BasicMovePicker(
         const Position& p, Move ttm, int th, const CapturePieceToHistory* cph) :
         pos(p),
         captureHistory(cph),
@@ -134,22 +140,24 @@ namespace Stockfish {
         threshold(th) {
         assert(!pos.checkers());
 
-        stage = PROBCUT_TT + !(ttm && pos.capture_stage(ttm) && pos.pseudo_legal(ttm) && pos.see_ge(ttm, threshold));
+        stage = PROBCUT_TT
+            + !(ttm && pos.capture_stage(ttm) && pos.pseudo_legal(ttm) && pos.see_ge<Policy::Classic>(ttm, threshold));
     }
 
     // Assigns a numerical value to each move in a list, used for sorting.
     // Captures are ordered by Most Valuable Victim (MVV), preferring captures with a good history.
     // Quiets moves are ordered using the history tables.
-    template<GenType Type>
-    void MovePicker::score() {
+    template<typename Policy>
+    template<GenType Type, bool SearchMate>
+    void BasicMovePicker<Policy>::score() {
 
         static_assert(Type == CAPTURES || Type == QUIETS || Type == EVASIONS, "Wrong type");
 
+        const Color us = pos.side_to_move();
+
         [[maybe_unused]] Bitboard threatenedByPawn, threatenedByMinor, threatenedByRook, threatenedPieces;
         if constexpr (Type == QUIETS)
         {
-            Color us = pos.side_to_move();
-
             threatenedByPawn = pos.attacks_by<PAWN>(~us);
             threatenedByMinor = pos.attacks_by<KNIGHT>(~us) | pos.attacks_by<BISHOP>(~us) | threatenedByPawn;
             threatenedByRook = pos.attacks_by<ROOK>(~us) | threatenedByMinor;
@@ -160,6 +168,11 @@ namespace Stockfish {
                 | (pos.pieces(us, KNIGHT, BISHOP) & threatenedByPawn);
         }
 
+        // The pawn structure is the same for all moves, index its history once
+        [[maybe_unused]] int pawnIndex = 0;
+        if constexpr (Type != CAPTURES && Policy::UsePawnHistory)
+            pawnIndex = pawn_structure_index(pos);
+
         for (auto& m : *this)
         {
             Piece movedPiece = pos.moved_piece(m);
@@ -168,7 +181,7 @@ namespace Stockfish {
             if constexpr (Type == CAPTURES)
             {
                 Piece pto = pos.piece_on(to);
-                m.value = (7 * int(PieceValue[pto]) + (*captureHistory)[movedPiece][to][type_of(pto)]) / 16;
+                m.value = (7 * Policy::capture_value(pto) + (*captureHistory)[movedPiece][to][type_of(pto)]) / 16;
             }
 
             else if constexpr (Type == QUIETS)
@@ -177,14 +190,15 @@ namespace Stockfish {
                 Square    from = m.from_sq();
 
                 // histories
-                m.value = (*mainHistory)[pos.side_to_move()][m.from_to()] * 2;
-                m.value += (*pawnHistory)[pawn_structure_index(pos)][movedPiece][to] * 2;
+                m.value = (*mainHistory)[us][m.from_to()] * 2;
                 m.value += (*continuationHistory[0])[movedPiece][to] * 2;
                 m.value += (*continuationHistory[1])[movedPiece][to];
-                m.value += (*continuationHistory[2])[movedPiece][to] / 4;
                 m.value += (*continuationHistory[3])[movedPiece][to];
                 m.value += (*continuationHistory[5])[movedPiece][to];
 
+                if constexpr (Policy::UsePawnHistory)
+                    m.value += (*pawnHistory)[pawnIndex][movedPiece][to] * 2;
+
                 // bonus for escaping from capture
                 m.value += threatenedPieces & from
                     ? (   pt == QUEEN && !(to & threatenedByRook ) ? 50000
@@ -193,37 +207,109 @@ namespace Stockfish {
                         : 0)
                         : 0;
 
-                // bonus for checks
-                m.value += bool(pos.check_squares(pt) & to) * 16384;
-
-                // malus for putting piece en prise
-                m.value -= !(threatenedPieces & from)
-                    ? (pt == QUEEN ? bool(to & threatenedByRook) * 50000
-                        + bool(to & threatenedByMinor) * 10000
-                        + bool(to & threatenedByPawn) * 20000
-                        : pt == ROOK ? bool(to & threatenedByMinor) * 25000
-                        + bool(to & threatenedByPawn) * 10000
-                        : pt != PAWN ? bool(to & threatenedByPawn) * 15000
-                        : 0)
-                    : 0;
+                if constexpr (!SearchMate)
+                {
+                    m.value += (*continuationHistory[2])[movedPiece][to] / 4;
+
+                    // bonus for checks
+                    m.value += bool(pos.check_squares(pt) & to) * 16384;
+
+                    // malus for putting piece en prise
+                    m.value -= !(threatenedPieces & from)
+                        ? (pt == QUEEN ? bool(to & threatenedByRook) * 50000
+                            + bool(to & threatenedByMinor) * 10000
+                            + bool(to & threatenedByPawn) * 20000
+                            : pt == ROOK ? bool(to & threatenedByMinor) * 25000
+                            + bool(to & threatenedByPawn) * 10000
+                            : pt != PAWN ? bool(to & threatenedByPawn) * 15000
+                            : 0)
+                        : 0;
+                }
             }
 
             else // Type == EVASIONS
             {
                 if (pos.capture_stage(m))
-                    m.value = PieceValue[pos.piece_on(to)] - Value(type_of(movedPiece)) + (1 << 28);
+                    m.value = Policy::capture_value(pos.piece_on(to)) - Value(type_of(movedPiece)) + (1 << 28);
                 else
-                    m.value = (*mainHistory)[pos.side_to_move()][m.from_to()]
-                    + (*continuationHistory[0])[movedPiece][to]
-                    + (*pawnHistory)[pawn_structure_index(pos)][movedPiece][to];
+                {
+                    m.value = (*mainHistory)[us][m.from_to()] + (*continuationHistory[0])[movedPiece][to];
+                    if constexpr (Policy::UsePawnHistory)
+                        m.value += (*pawnHistory)[pawnIndex][movedPiece][to];
+                }
+            }
+
+            if constexpr (SearchMate && (Type == CAPTURES || Type == QUIETS))
+            {
+                Square theirKing = pos.square<KING>(~us);
+                Bitboard kingRing = pos.attacks_from<KING>(theirKing);
+
+                if (pos.gives_check(m))
+                {
+                    m.value += 20000 - 400 * distance(theirKing, to);
+
+                    // Bonus for a knight check
+                    if (type_of(movedPiece) == KNIGHT)
+                        m.value += 3000;
+
+                    // Bonus for queen/rook contact checks
+                    else if ((type_of(movedPiece) == QUEEN || type_of(movedPiece) == ROOK) && distance(theirKing, to) == 1)
+                        m.value += 4000;
+                }
+
+                // Bonus for pawns
+                if (type_of(movedPiece) == PAWN)
+                {
+                    m.value += 640 * edge_distance(file_of(to)) + 1280 * relative_rank(us, to);
+
+                    // Extra bonus for double push
+                    m.value += 4000 * (distance<Rank>(to, m.from_sq()) == 2);
+                }
+
+                // Bonus for a knight eventually able to give check on the next move
+                if (type_of(movedPiece) == KNIGHT)
+                {
+                    if (pos.attacks_from<KNIGHT>(to) & pos.check_squares(KNIGHT))
+                        m.value += 6000;
+
+                    m.value += 2560 * popcount(PseudoAttacks[KNIGHT][to] & kingRing);
+                }
+
+                // Bonus for a queen eventually able to give check on the next move
+                else if (type_of(movedPiece) == QUEEN)
+                {
+                    if (pos.attacks_from<QUEEN>(to) & pos.check_squares(QUEEN))
+                        m.value += 5000;
+
+                    m.value += 1280 * popcount(PseudoAttacks[QUEEN][to] & kingRing);
+                }
+
+                // Bonus for a rook eventually able to give check on the next move
+                else if (type_of(movedPiece) == ROOK)
+                {
+                    if (pos.attacks_from<ROOK>(to) & pos.check_squares(ROOK))
+                        m.value += 4000;
+
+                    m.value += 960 * popcount(PseudoAttacks[ROOK][to] & kingRing);
+                }
+
+                // Bonus for a bishop eventually able to give check on the next move
+                else if (type_of(movedPiece) == BISHOP)
+                {
+                    if (pos.attacks_from<BISHOP>(to) & pos.check_squares(BISHOP))
+                        m.value += 3000;
+
+                    m.value += 640 * popcount(PseudoAttacks[BISHOP][to] & kingRing);
+                }
             }
         }
     }
 
     // Returns the next move satisfying a predicate function.
     // It never returns the TT move.
-    template<MovePicker::PickType T, typename Pred>
-    Move MovePicker::select(Pred filter) {
+    template<typename Policy>
+    template<typename BasicMovePicker<Policy>::PickType T, typename Pred>
+    Move BasicMovePicker<Policy>::select(Pred filter) {
 
         while (cur < endMoves)
         {
@@ -241,7 +327,9 @@ namespace Stockfish {
     // Most important method of the MovePicker class.
     // It returns a new pseudo-legal move every time it is called until there are no more moves left,
     // picking the move with the highest score from a list of generated moves.
-    Move MovePicker::next_move(bool skipQuiets) {
+    template<typename Policy>
+    template<bool SearchMate>
+    Move BasicMovePicker<Policy>::next_move(bool skipQuiets) {
 
     top:
         switch (stage)
@@ -260,17 +348,20 @@ namespace Stockfish {
             cur = endBadCaptures = moves;
             endMoves = generate<CAPTURES>(pos, cur);
 
-            score<CAPTURES>();
+            score<CAPTURES, SearchMate>();
             partial_insertion_sort(cur, endMoves, std::numeric_limits<int>::min());
             ++stage;
             goto top;
 
         case GOOD_CAPTURE:
             if (select<Next>([&]() {
+                cur->see = int16_t(pos.see<Policy::Classic>(*cur));
+
                 // Move losing capture to endBadCaptures to be tried later
-                return pos.see_ge(*cur, Value(-cur->value)) ? true : (*endBadCaptures++ = *cur, false);
+                return cur->see >= Policy::see_threshold(cur->value) ? true
+                    : (*endBadCaptures++ = *cur, false);
                 }))
-                return *(cur - 1);
+                return with_see(*(cur - 1));
 
                 // Prepare the pointers to loop over the refutations array
                 cur = std::begin(refutations);
@@ -285,7 +376,7 @@ namespace Stockfish {
 
         case REFUTATION:
             if (select<Next>([&]() {
-                return *cur && !pos.capture_stage(*cur) && pos.pseudo_legal(*cur);
+                return *cur && !Policy::is_capture(pos, *cur) && pos.pseudo_legal(*cur);
                 }))
                 return *(cur - 1);
                 ++stage;
@@ -297,8 +388,8 @@ namespace Stockfish {
                 cur = endBadCaptures;
                 endMoves = generate<QUIETS>(pos, cur);
 
-                score<QUIETS>();
-                partial_insertion_sort(cur, endMoves, -3330 * depth);
+                score<QUIETS, SearchMate>();
+                partial_insertion_sort(cur, endMoves, -Policy::QuietSortScale * depth);
             }
 
             ++stage;
@@ -318,13 +409,16 @@ namespace Stockfish {
                 [[fallthrough]];
 
         case BAD_CAPTURE:
-            return select<Next>([]() { return true; });
+            if (select<Next>([]() { return true; }))
+                return with_see(*(cur - 1));
+
+            return Move::none();
 
         case EVASION_INIT:
             cur = moves;
             endMoves = generate<EVASIONS>(pos, cur);
 
-            score<EVASIONS>();
+            score<EVASIONS, SearchMate>();
             ++stage;
             [[fallthrough]];
 
@@ -332,10 +426,12 @@ namespace Stockfish {
             return select<Best>([]() { return true; });
 
         case PROBCUT:
-            return select<Next>([&]() { return pos.see_ge(*cur, threshold); });
+            return select<Next>([&]() { return pos.see_ge<Policy::Classic>(*cur, threshold); });
 
         case QCAPTURE:
-            if (select<Next>([&]() { return true; }))
+            if (select<Next>([&]() {
+                return !Policy::Recaptures || depth > DEPTH_QS_RECAPTURES || cur->to_sq() == recaptureSquare;
+                }))
                 return *(cur - 1);
 
             // If we did not find any move and we do not try checks, we have finished
@@ -360,4 +456,11 @@ namespace Stockfish {
         return Move::none(); // Silence warning
     }
 
-}
+    template class BasicMovePicker<MainPickPolicy>;
+    template Move BasicMovePicker<MainPickPolicy>::next_move<false>(bool skipQuiets);
+
+    template class BasicMovePicker<Search::Classic::PickPolicy>;
+    template Move BasicMovePicker<Search::Classic::PickPolicy>::next_move<false>(bool skipQuiets);
+    template Move BasicMovePicker<Search::Classic::PickPolicy>::next_move<true>(bool skipQuiets);
+
+} // namespace Stockfish
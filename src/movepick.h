@@ -78,13 +78,40 @@ namespace Stockfish {
         }
     };
 
+    // The piece dimension of the stats tables leaves out the unused values of Piece
+    // between the white and the black pieces: the black pieces follow the white king,
+    // so that a table addressed by [piece][to] has 13 rows instead of 16. The
+    // continuation history, by far the largest table, shrinks by a third.
+    constexpr int PIECE_SLOT_NB = 13;
+
+    constexpr int piece_slot(Piece pc) { return pc - 2 * (pc >> 3); }
+
+    static_assert(piece_slot(B_PAWN) == piece_slot(W_KING) + 1 && piece_slot(B_KING) == PIECE_SLOT_NB - 1);
+
+    // PieceArray is a dimension of size PIECE_NB, indexed by a Piece only
+    template<typename T>
+    struct PieceArray : public std::array<T, PIECE_SLOT_NB> {
+
+        T& operator[](Piece pc) {
+            assert(pc == NO_PIECE || (type_of(pc) >= PAWN && type_of(pc) <= KING));
+            return std::array<T, PIECE_SLOT_NB>::operator[](piece_slot(pc));
+        }
+        const T& operator[](Piece pc) const {
+            assert(pc == NO_PIECE || (type_of(pc) >= PAWN && type_of(pc) <= KING));
+            return std::array<T, PIECE_SLOT_NB>::operator[](piece_slot(pc));
+        }
+    };
+
+    template<typename T, int Size>
+    using StatsArray = std::conditional_t<Size == PIECE_NB, PieceArray<T>, std::array<T, Size>>;
+
     // Stats is a generic N-dimensional array used to store various statistics.
     // The first template parameter T is the base type of the array, and the second
     // template parameter D limits the range of updates in [-D, D] when we update
     // values with the << operator, while the last parameters (Size and Sizes)
-    // encode the dimensions of the array.
+    // encode the dimensions of the array, PIECE_NB one of PieceArray.
     template<typename T, int D, int Size, int... Sizes>
-    struct Stats : public std::array<Stats<T, D, Sizes...>, Size> {
+    struct Stats : public StatsArray<Stats<T, D, Sizes...>, Size> {
         using stats = Stats<T, D, Size, Sizes...>;
 
         void fill(const T& v) {
@@ -99,7 +126,7 @@ namespace Stockfish {
     };
 
     template<typename T, int D, int Size>
-    struct Stats<T, D, Size> : public std::array<StatsEntry<T, D>, Size> {};
+    struct Stats<T, D, Size> : public StatsArray<StatsEntry<T, D>, Size> {};
 
     // In stats table, D=0 means that the template parameter is not used
     enum StatsParams {
@@ -138,13 +165,42 @@ namespace Stockfish {
     // CorrectionHistory is addressed by color and pawn structure
     using CorrectionHistory = Stats<int16_t, CORRECTION_HISTORY_LIMIT, COLOR_NB, CORRECTION_HISTORY_SIZE>;
 
+    // The move ordering of the main and the classic search differs in a few values and
+    // rules, a policy of the MovePicker gives those of one search.
+    struct MainPickPolicy {
+        static constexpr bool Classic = false;        // SEE with the piece values of the classic eval
+        static constexpr bool UsePawnHistory = true;  // Quiets and evasions are scored with the pawn history
+        static constexpr bool Recaptures = false;     // Deep in qsearch only recaptures are tried
+        static constexpr int  QuietSortScale = 3330;  // Quiets above -scale * depth are sorted
+
+        static int capture_value(Piece pc) { return PieceValue[pc]; }
+        static int see_threshold(int value) { return -value; }
+        static bool is_capture(const Position& pos, Move m) { return pos.capture_stage(m); }
+    };
+
+    namespace Search::Classic {
+
+        struct PickPolicy {
+            static constexpr bool Classic = true;
+            static constexpr bool UsePawnHistory = false;
+            static constexpr bool Recaptures = true;
+            static constexpr int  QuietSortScale = 3000;
+
+            static int capture_value(Piece pc) { return PieceValueME[MG][pc]; }
+            static int see_threshold(int value) { return -69 * value / 1024; }
+            static bool is_capture(const Position& pos, Move m) { return pos.capture(m); }
+        };
+
+    }
+
     // MovePicker class is used to pick one pseudo-legal move at a time from the
     // current position. The most important method is next_move(), which returns a
     // new pseudo-legal move each time it is called, until there are no moves left,
     // when Move::none() is returned. In order to improve the efficiency of the
     // alpha-beta algorithm, MovePicker attempts to return the moves which are most
     // likely to get a cut-off first.
-    class MovePicker {
+    template<typename Policy>
+    class BasicMovePicker {
 
         enum PickType {
             Next,
@@ -152,9 +208,9 @@ namespace Stockfish {
         };
 
     public:
-        MovePicker(const MovePicker&) = delete;
-        MovePicker& operator=(const MovePicker&) = delete;
-        MovePicker(const Position&,
+        BasicMovePicker(const BasicMovePicker&) = delete;
+        BasicMovePicker& operator=(const BasicMovePicker&) = delete;
+        BasicMovePicker(const Position&,
             Move,
             Depth,
             const ButterflyHistory*,
@@ -163,23 +219,42 @@ namespace Stockfish {
             const PawnHistory*,
             Move,
             const Move*);
-        MovePicker(const Position&,
+        BasicMovePicker(const Position&,
             Move,
             Depth,
             const ButterflyHistory*,
             const CapturePieceToHistory*,
             const PieceToHistory**,
-            const PawnHistory*);
-        MovePicker(const Position&, Move, int, const CapturePieceToHistory*);
+            const PawnHistory*,
+            Square = SQ_NONE);
+        BasicMovePicker(const Position&, Move, int, const CapturePieceToHistory*);
+
+        // SearchMate orders the quiets and the captures of the mate search of the classic
+        // search towards the enemy king.
+        template<bool SearchMate = false>
         Move next_move(bool skipQuiets = false);
 
+        Bitboard threatenedPieces = 0; // Read by the classic search, not computed by now
+
+        // Tests the SEE of the move returned last like Position::see_ge(). The exchange of
+        // the captures the picker sorted into good and bad ones is not played out again.
+        bool see_ge(Move m, int th) const {
+
+            if (m != seeMove)
+                return pos.see_ge<Policy::Classic>(m, th);
+
+            assert((seeValue >= th) == pos.see_ge<Policy::Classic>(m, th));
+            return seeValue >= th;
+        }
+
     private:
         template<PickType T, typename Pred>
         Move select(Pred);
-        template<GenType>
+        template<GenType Type, bool SearchMate>
         void     score();
         ExtMove* begin() { return cur; }
         ExtMove* end() { return endMoves; }
+        Move     with_see(const ExtMove& m) { seeMove = m, seeValue = m.see; return m; }
 
         const Position& pos;
         const ButterflyHistory* mainHistory;
@@ -189,52 +264,19 @@ namespace Stockfish {
         Move                         ttMove;
         ExtMove                      refutations[3], * cur, * endMoves, * endBadCaptures;
         int                          stage;
+        Square                       recaptureSquare;
         int                          threshold;
         Depth                        depth;
+        Move                         seeMove = Move::none();
+        int                          seeValue = 0;
         ExtMove                      moves[MAX_MOVES];
     };
 
+    using MovePicker = BasicMovePicker<MainPickPolicy>;
+
     namespace Search::Classic {
 
-        class MovePicker {
-
-            enum PickType { Next, Best };
-
-        public:
-            MovePicker(const MovePicker&) = delete;
-            MovePicker& operator=(const MovePicker&) = delete;
-            MovePicker(const Position&, Move, Depth, const ButterflyHistory*,
-                const CapturePieceToHistory*,
-                const PieceToHistory**,
-                Move,
-                const Move*);
-            MovePicker(const Position&, Move, Depth, const ButterflyHistory*,
-                const CapturePieceToHistory*,
-                const PieceToHistory**,
-                Square);
-            MovePicker(const Position&, Move, int, const CapturePieceToHistory*);
-            template<bool SearchMate> Move next_move(bool skipQuiets = false);
-
-            Bitboard threatenedPieces;
-
-        private:
-            template<PickType T, typename Pred> Move select(Pred);
-            template<GenType Type, bool SearchMate> void score();
-            ExtMove* begin() { return cur; }
-            ExtMove* end() { return endMoves; }
-
-            const Position& pos;
-            const ButterflyHistory* mainHistory;
-            const CapturePieceToHistory* captureHistory;
-            const PieceToHistory** continuationHistory;
-            Move ttMove;
-            ExtMove refutations[3], * cur, * endMoves, * endBadCaptures;
-            int stage;
-            Square recaptureSquare;
-            int threshold;
-            Depth depth;
-            ExtMove moves[MAX_MOVES];
-        };
+        using MovePicker = BasicMovePicker<PickPolicy>;
 
     }
 
@@ -20,18 +20,24 @@
 
 #include "evaluate_nnue.h"
 
+#include <chrono>
 #include <cmath>
 #include <cstdlib>
 #include <cstring>
+#include <deque>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <string_view>
+#include <type_traits>
+#include <vector>
 
 #include "../evaluate.h"
 #include "../misc.h"
+#include "../movegen.h"
 #include "../position.h"
+#include "../thread.h"
 #include "../types.h"
 #include "../uci.h"
 #include "nnue_accumulator.h"
@@ -39,15 +45,113 @@
 
 namespace Stockfish::Eval::NNUE {
 
-    // Input feature converter
-    LargePagePtr<FeatureTransformer> featureTransformer;
+    // The network file currently mapped, if any
+    struct MappedNet {
+        void*         base = nullptr;
+        std::size_t   size = 0;
+        std::uint64_t mapping = 0;
 
-    // Evaluation function
-    AlignedPtr<Network> network[LayerStacks];
+        ~MappedNet() { unmap(); }
 
-    // Evaluation function file name
-    std::string fileName;
-    std::string netDescription;
+        void unmap() {
+            unmap_file(base, size, mapping);
+            base = nullptr;
+        }
+    };
+
+    // Header of a network file in the mapped layout, see save_mapped_eval(). The
+    // parameters follow in the in-memory layout of this build, each block aligned to
+    // MappedAlignment, so that the file can be mapped read-only and shared by processes.
+    struct MappedHeader {
+        char          magic[8];
+        std::uint32_t hashValue;
+        std::uint32_t layout;
+        std::uint64_t transformerSize;
+        std::uint64_t networkSize;
+        std::uint64_t descriptionSize;
+    };
+
+    constexpr char        MappedMagic[8] = "FLNNUEM";
+    constexpr std::size_t MappedAlignment = 4096;
+
+    static_assert(std::is_trivially_copyable_v<FeatureTransformerBig>
+        && std::is_trivially_copyable_v<NetworkBig>
+        && std::is_trivially_copyable_v<FeatureTransformerSmall>
+        && std::is_trivially_copyable_v<NetworkSmall>,
+        "The mapped network layout needs parameters that can be copied as raw bytes");
+    static_assert(alignof(FeatureTransformerBig) <= MappedAlignment && alignof(NetworkBig) <= MappedAlignment);
+    static_assert(alignof(FeatureTransformerSmall) <= MappedAlignment && alignof(NetworkSmall) <= MappedAlignment);
+
+    // The order of the weights depends on the SIMD code they are permuted for
+    static constexpr std::uint32_t layout_id() {
+        return 0
+#if defined(USE_SSE2)
+            | 1
+#endif
+#if defined(USE_SSSE3)
+            | 2
+#endif
+#if defined(USE_AVX2)
+            | 4
+#endif
+#if defined(USE_AVX512)
+            | 8
+#endif
+#if defined(USE_VNNI)
+            | 16
+#endif
+#if defined(USE_NEON)
+            | 32
+#endif
+#if defined(USE_NEON_DOTPROD)
+            | 64
+#endif
+            ;
+    }
+
+    static std::size_t mapped_offset(std::size_t offset) {
+        return (offset + MappedAlignment - 1) / MappedAlignment * MappedAlignment;
+    }
+
+    // Parameters of one network. The input feature converter and the evaluation function
+    // in use point either to the storage or into a network file mapped with load_mapped_eval().
+    template<typename Transformer, typename Arch>
+    struct Net {
+        using FeatureTransformerType = Transformer;
+        using NetworkType = Arch;
+
+        Transformer* featureTransformer = nullptr;
+        Arch*        network[LayerStacks];
+
+        // Storage for the parameters read from a stream
+        LargePagePtr<Transformer> featureTransformerStorage;
+        AlignedPtr<Arch>          networkStorage[LayerStacks];
+
+        // The network file currently mapped, if any
+        MappedNet mappedNet;
+
+        // Evaluation function file name
+        std::string fileName;
+        std::string netDescription;
+
+        // Incremented for every network loaded, to notice stale accumulator caches
+        std::uint32_t netVersion = 0;
+    };
+
+    Net<FeatureTransformerBig, NetworkBig>     netBig;
+    Net<FeatureTransformerSmall, NetworkSmall> netSmall;
+
+#ifdef NNUE_STATS
+    std::atomic<std::uint64_t> accumulatorStats[2][ACC_EVENT_NB];
+#endif
+
+    template<NetSize Net_Size>
+    static auto& net() {
+        if constexpr (Net_Size == Big)
+            return netBig;
+        else
+            return netSmall;
+    }
 
     namespace Detail {
 
@@ -91,11 +195,21 @@ namespace Stockfish::Eval::NNUE {
 
 
     // Initialize the evaluation function parameters
+    template<NetSize Net_Size>
     static void initialize() {
 
-        Detail::initialize(featureTransformer);
+        auto& n = net<Net_Size>();
+
+        n.mappedNet.unmap();
+        ++n.netVersion;
+
+        Detail::initialize(n.featureTransformerStorage);
+        n.featureTransformer = n.featureTransformerStorage.get();
         for (std::size_t i = 0; i < LayerStacks; ++i)
-            Detail::initialize(network[i]);
+        {
+            Detail::initialize(n.networkStorage[i]);
+            n.network[i] = n.networkStorage[i].get();
+        }
     }
 
     // Read network header
@@ -122,62 +236,99 @@ namespace Stockfish::Eval::NNUE {
     }
 
     // Read network parameters
+    template<NetSize Net_Size>
     static bool read_parameters(std::istream& stream) {
 
+        auto&         n = net<Net_Size>();
         std::uint32_t hashValue;
-        if (!read_header(stream, &hashValue, &netDescription))
+        if (!read_header(stream, &hashValue, &n.netDescription))
             return false;
-        if (hashValue != HashValue)
+        if (hashValue != HashValue[Net_Size])
             return false;
-        if (!Detail::read_parameters(stream, *featureTransformer))
+        if (!Detail::read_parameters(stream, *n.featureTransformer))
             return false;
         for (std::size_t i = 0; i < LayerStacks; ++i)
-            if (!Detail::read_parameters(stream, *(network[i])))
+            if (!Detail::read_parameters(stream, *(n.network[i])))
                 return false;
         return stream && stream.peek() == std::ios::traits_type::eof();
     }
 
     // Write network parameters
+    template<NetSize Net_Size>
     static bool write_parameters(std::ostream& stream) {
 
-        if (!write_header(stream, HashValue, netDescription))
+        auto& n = net<Net_Size>();
+        if (!write_header(stream, HashValue[Net_Size], n.netDescription))
             return false;
-        if (!Detail::write_parameters(stream, *featureTransformer))
+        if (!Detail::write_parameters(stream, *n.featureTransformer))
             return false;
         for (std::size_t i = 0; i < LayerStacks; ++i)
-            if (!Detail::write_parameters(stream, *(network[i])))
+            if (!Detail::write_parameters(stream, *(n.network[i])))
                 return false;
         return bool(stream);
     }
 
+    // Returns the accumulator cache of the thread of the position, the entries are
+    // reset the first time the cache is used with a new network.
+    template<NetSize Net_Size>
+    static auto* accumulator_cache(const Position& pos) {
+
+        auto&   n = net<Net_Size>();
+        Thread* th = pos.this_thread();
+        auto*   cache = th ? &th->accumulatorCaches.get<Net_Size>() : nullptr;
+
+        if (cache && cache->netVersion != n.netVersion)
+        {
+            n.featureTransformer->clear_cache(*cache);
+            cache->netVersion = n.netVersion;
+        }
+
+        return cache;
+    }
+
+    // Returns true if the position is evaluated by the small network. The small network
+    // is used for a large material imbalance, where the big one is not needed to see
+    // which side is better, and only if it has been loaded with the EvalFileSmall option.
+    bool use_small_net(const Position& pos) {
+        return netSmall.featureTransformer
+            && std::abs(simple_eval(pos, pos.side_to_move())) > SmallNetThreshold;
+    }
+
     void hint_common_parent_position(const Position& pos) {
-        featureTransformer->hint_common_access(pos);
+        if (use_small_net(pos))
+            netSmall.featureTransformer->hint_common_access(pos, accumulator_cache<Small>(pos));
+        else
+            netBig.featureTransformer->hint_common_access(pos, accumulator_cache<Big>(pos));
     }
 
     // Evaluation function. Perform differential calculation.
+    template<NetSize Net_Size>
     Value evaluate(const Position& pos, bool adjusted, int* complexity) {
 
         // We manually align the arrays on the stack because with gcc < 9.3
         // overaligning stack variables with alignas() doesn't work correctly.
 
+        using Transformer = typename std::remove_reference_t<decltype(net<Net_Size>())>::FeatureTransformerType;
+
         constexpr uint64_t alignment = CacheLineSize;
         constexpr int      delta = 24;
 
 #if defined(ALIGNAS_ON_STACK_VARIABLES_BROKEN)
         TransformedFeatureType
-            transformedFeaturesUnaligned[FeatureTransformer::BufferSize
+            transformedFeaturesUnaligned[Transformer::BufferSize
             + alignment / sizeof(TransformedFeatureType)];
 
         auto* transformedFeatures = align_ptr_up<alignment>(&transformedFeaturesUnaligned[0]);
 #else
-        alignas(alignment) TransformedFeatureType transformedFeatures[FeatureTransformer::BufferSize];
+        alignas(alignment) TransformedFeatureType transformedFeatures[Transformer::BufferSize];
 #endif
 
         ASSERT_ALIGNED(transformedFeatures, alignment);
 
+        auto&      n = net<Net_Size>();
         const int  bucket = (pos.count<ALL_PIECES>() - 1) / 4;
-        const auto psqt = featureTransformer->transform(pos, transformedFeatures, bucket);
-        const auto positional = network[bucket]->propagate(transformedFeatures);
+        const auto psqt = n.featureTransformer->transform(pos, accumulator_cache<Net_Size>(pos), transformedFeatures, bucket);
+        const auto positional = n.network[bucket]->propagate(transformedFeatures);
 
         if (complexity)
             *complexity = std::abs(psqt - positional) / OutputScale;
@@ -190,6 +341,15 @@ namespace Stockfish::Eval::NNUE {
             return static_cast<Value>((psqt + positional) / OutputScale);
     }
 
+    template Value evaluate<Big>(const Position& pos, bool adjusted, int* complexity);
+    template Value evaluate<Small>(const Position& pos, bool adjusted, int* complexity);
+
+    // Evaluates the position with the network chosen by use_small_net()
+    Value evaluate(const Position& pos, bool adjusted, int* complexity) {
+        return use_small_net(pos) ? evaluate<Small>(pos, adjusted, complexity)
+            : evaluate<Big>(pos, adjusted, complexity);
+    }
+
     struct NnueEvalTrace {
         static_assert(LayerStacks == PSQTBuckets);
 
@@ -198,30 +358,35 @@ namespace Stockfish::Eval::NNUE {
         std::size_t correctBucket;
     };
 
+    template<NetSize Net_Size>
     static NnueEvalTrace trace_evaluate(const Position& pos) {
 
         // We manually align the arrays on the stack because with gcc < 9.3
         // overaligning stack variables with alignas() doesn't work correctly.
+
+        using Transformer = typename std::remove_reference_t<decltype(net<Net_Size>())>::FeatureTransformerType;
+
         constexpr uint64_t alignment = CacheLineSize;
 
 #if defined(ALIGNAS_ON_STACK_VARIABLES_BROKEN)
         TransformedFeatureType
-            transformedFeaturesUnaligned[FeatureTransformer::BufferSize
+            transformedFeaturesUnaligned[Transformer::BufferSize
             + alignment / sizeof(TransformedFeatureType)];
 
         auto* transformedFeatures = align_ptr_up<alignment>(&transformedFeaturesUnaligned[0]);
 #else
-        alignas(alignment) TransformedFeatureType transformedFeatures[FeatureTransformer::BufferSize];
+        alignas(alignment) TransformedFeatureType transformedFeatures[Transformer::BufferSize];
 #endif
 
         ASSERT_ALIGNED(transformedFeatures, alignment);
 
+        auto&         n = net<Net_Size>();
         NnueEvalTrace t{};
         t.correctBucket = (pos.count<ALL_PIECES>() - 1) / 4;
         for (IndexType bucket = 0; bucket < LayerStacks; ++bucket)
         {
-            const auto materialist = featureTransformer->transform(pos, transformedFeatures, bucket);
-            const auto positional = network[bucket]->propagate(transformedFeatures);
+            const auto materialist = n.featureTransformer->transform(pos, accumulator_cache<Net_Size>(pos), transformedFeatures, bucket);
+            const auto positional = n.network[bucket]->propagate(transformedFeatures);
 
             t.psqt[bucket] = static_cast<Value>(materialist / OutputScale);
             t.positional[bucket] = static_cast<Value>(positional / OutputScale);
@@ -230,6 +395,275 @@ namespace Stockfish::Eval::NNUE {
         return t;
     }
 
+    // Inputs and outputs of all layers for one position, to time the layers one by one
+    template<typename Transformer, typename Arch>
+    struct alignas(CacheLineSize) LayerBuffers {
+        alignas(CacheLineSize) TransformedFeatureType transformed[Transformer::BufferSize];
+        alignas(CacheLineSize) typename decltype(Arch::fc_0)::OutputBuffer fc_0_out;
+        alignas(CacheLineSize) typename decltype(Arch::ac_sqr_0)::OutputType
+            ac_sqr_0_out[ceil_to_multiple<IndexType>(Arch::FC_0_OUTPUTS * 2, 32)];
+        alignas(CacheLineSize) typename decltype(Arch::ac_0)::OutputBuffer ac_0_out;
+        alignas(CacheLineSize) typename decltype(Arch::fc_1)::OutputBuffer fc_1_out;
+        alignas(CacheLineSize) typename decltype(Arch::ac_1)::OutputBuffer ac_1_out;
+        alignas(CacheLineSize) typename decltype(Arch::fc_2)::OutputBuffer fc_2_out;
+        int bucket;
+    };
+
+    // Times the feature transformer and each layer of one network on the given positions.
+    // The bandwidth is estimated from the weights, accumulators and activations a call reads
+    // and writes, for the sparse layer only the weights of the nonzero inputs are counted.
+    template<NetSize Net_Size>
+    static void benchmark(const std::vector<std::string>& fens, std::size_t iterations) {
+
+        using NetType = std::remove_reference_t<decltype(net<Net_Size>())>;
+        using Network = typename NetType::NetworkType;
+        using Transformer = typename NetType::FeatureTransformerType;
+        using Buffers = LayerBuffers<Transformer, Network>;
+
+        auto&             nt = net<Net_Size>();
+        const std::size_t n = fens.size();
+
+        std::deque<StateInfo> states(n), childStates(2 * n);
+        std::vector<StateData> data(n), childData(2 * n); // Every position keeps its accumulators
+        std::vector<Position> positions(n), children(n);
+        std::vector<Buffers>  buffers(n), out(1);
+        volatile std::int32_t sink = 0;
+
+        // Bytes of one accumulator and of one feature of it, for one perspective
+        constexpr double AccBytes = Transformer::OutputDimensions * sizeof(BiasType) + PSQTBuckets * sizeof(PSQTWeightType);
+        constexpr double FeatureBytes = Transformer::OutputDimensions * sizeof(WeightType) + PSQTBuckets * sizeof(PSQTWeightType);
+        constexpr double OutputBytes = 2 * AccBytes + Transformer::BufferSize;
+
+        double refreshBytes = 0, updateBytes = 0, fc0Bytes = 0;
+
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            Position& pos = positions[i];
+            Buffers&  b = buffers[i];
+
+            pos.set(fens[i], false, &states[i], Threads.main());
+            states[i].data = &data[i];
+            b.bucket = (pos.count<ALL_PIECES>() - 1) / 4;
+
+            Network& net = *nt.network[b.bucket];
+            nt.featureTransformer->transform(pos, accumulator_cache<Net_Size>(pos), b.transformed, b.bucket);
+
+            net.fc_0.propagate(b.transformed, b.fc_0_out);
+            net.ac_sqr_0.propagate(b.fc_0_out, b.ac_sqr_0_out);
+            net.ac_0.propagate(b.fc_0_out, b.ac_0_out);
+            std::memcpy(b.ac_sqr_0_out + Network::FC_0_OUTPUTS, b.ac_0_out,
+                Network::FC_0_OUTPUTS * sizeof(typename decltype(Network::ac_0)::OutputType));
+            net.fc_1.propagate(b.ac_sqr_0_out, b.fc_1_out);
+            net.ac_1.propagate(b.fc_1_out, b.ac_1_out);
+            net.fc_2.propagate(b.ac_1_out, b.fc_2_out);
+
+            // Every active feature of both perspectives is added to the biases
+            refreshBytes += 2 * (pos.count<ALL_PIECES>() * FeatureBytes + 2 * AccBytes) + Transformer::BufferSize;
+
+            // 4 inputs of the sparse layer share a column of weights
+            const auto* in = reinterpret_cast<const std::uint32_t*>(b.transformed);
+            std::size_t nnz = 0;
+            for (std::size_t j = 0; j < Transformer::BufferSize / 4; ++j)
+                nnz += in[j] != 0;
+            fc0Bytes += nnz * 4 * Network::FC_0_OUTPUTS * sizeof(std::int8_t) + Transformer::BufferSize
+                + sizeof(b.fc_0_out);
+
+            // The child is the position after the first legal move of a piece other than the
+            // king, its accumulators are updated from those of the parent.
+            Position& child = children[i];
+            child.set(fens[i], false, &childStates[2 * i], Threads.main());
+            childStates[2 * i].data = &childData[2 * i];
+            nt.featureTransformer->transform(child, accumulator_cache<Net_Size>(child), out[0].transformed, b.bucket);
+
+            for (const auto& m : MoveList<LEGAL>(child))
+                if (type_of(child.moved_piece(m)) != KING)
+                {
+                    child.do_move(m, childStates[2 * i + 1]);
+                    childStates[2 * i + 1].data = &childData[2 * i + 1];
+                    break;
+                }
+
+            for (Color c : { WHITE, BLACK })
+            {
+                FeatureSet::IndexList removed, added;
+                if (c == WHITE)
+                    FeatureSet::append_changed_indices<WHITE>(child.square<KING>(WHITE), child.state()->dirtyPiece, removed, added);
+                else
+                    FeatureSet::append_changed_indices<BLACK>(child.square<KING>(BLACK), child.state()->dirtyPiece, removed, added);
+                updateBytes += (removed.size() + added.size()) * FeatureBytes + 2 * AccBytes;
+            }
+            updateBytes += Transformer::BufferSize;
+        }
+
+        // The cache entry of a king square holds the last position that used it, so replay
+        // a pass over the positions to count the features a refresh from the cache changes.
+        struct CachedBoard {
+            Bitboard byColorBB[COLOR_NB];
+            Bitboard byTypeBB[PIECE_TYPE_NB];
+        };
+        std::vector<CachedBoard> cached(int(SQUARE_NB) * COLOR_NB, CachedBoard{});
+        double                   cacheBytes = 0;
+
+        for (int pass = 0; pass < 2; ++pass)
+            for (const Position& pos : positions)
+                for (Color c : { WHITE, BLACK })
+                {
+                    CachedBoard&          e = cached[int(pos.square<KING>(c)) * COLOR_NB + c];
+                    FeatureSet::IndexList removed, added;
+                    if (c == WHITE)
+                        FeatureSet::append_changed_indices<WHITE>(pos, e.byColorBB, e.byTypeBB, removed, added);
+                    else
+                        FeatureSet::append_changed_indices<BLACK>(pos, e.byColorBB, e.byTypeBB, removed, added);
+
+                    if (pass)
+                        cacheBytes += (removed.size() + added.size()) * FeatureBytes + 3 * AccBytes;
+
+                    for (Color cc : { WHITE, BLACK })
+                        e.byColorBB[cc] = pos.pieces(cc);
+                    for (PieceType pt = PAWN; pt <= KING; ++pt)
+                        e.byTypeBB[pt] = pos.pieces(pt);
+                }
+        cacheBytes = cacheBytes / n + Transformer::BufferSize;
+
+        // Bytes of the dense layers, their weights and biases with the activations
+        const Network& net0 = *nt.network[0];
+        const Buffers& b0 = buffers[0];
+        const double   sqrBytes = sizeof(b0.fc_0_out) + sizeof(b0.ac_sqr_0_out) / 2;
+        const double   ac0Bytes = sizeof(b0.fc_0_out) + sizeof(b0.ac_0_out);
+        const double   fc1Bytes = sizeof(net0.fc_1) + sizeof(b0.ac_sqr_0_out) + sizeof(b0.fc_1_out);
+        const double   ac1Bytes = sizeof(b0.fc_1_out) + sizeof(b0.ac_1_out);
+        const double   fc2Bytes = sizeof(net0.fc_2) + sizeof(b0.ac_1_out) + sizeof(b0.fc_2_out);
+        const double   netBytes = fc0Bytes / n + sqrBytes + ac0Bytes + fc1Bytes + ac1Bytes + fc2Bytes;
+
+        // Runs f for every position 'iterations' times and prints the ns per call and the
+        // bandwidth given the bytes per call. The accumulator counters are per call as well.
+        auto run = [&](const char* name, double bytes, auto&& f) {
+#ifdef NNUE_STATS
+            clear_stats();
+#endif
+            auto start = std::chrono::steady_clock::now();
+            for (std::size_t it = 0; it < iterations; ++it)
+                for (std::size_t i = 0; i < n; ++i)
+                    f(i, positions[i], buffers[i], *nt.network[buffers[i].bucket]);
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+            const double perCall = double(ns.count()) / double(n * iterations);
+
+            sync_cout << std::left << std::setw(34) << name << std::right << std::fixed << std::setprecision(1)
+                << std::setw(10) << perCall << " ns" << std::setw(10) << bytes / perCall << " GB/s"
+#ifdef NNUE_STATS
+                << std::setprecision(2)
+                << std::setw(8) << double(accumulatorStats[Net_Size][AccUpdate]) / double(n * iterations)
+                << std::setw(8) << double(accumulatorStats[Net_Size][AccCacheRefresh]) / double(n * iterations)
+                << std::setw(8) << double(accumulatorStats[Net_Size][AccRefresh]) / double(n * iterations)
+#endif
+                << sync_endl;
+            };
+
+        // Marks the accumulators of the position as not computed, to time a refresh
+        auto reset = [](Position& pos) {
+            std::memset(pos.state()->nnueComputed, 0, sizeof(StateInfo::nnueComputed));
+            };
+
+        Buffers& o = out[0];
+        sync_cout << "NNUE benchmark, " << (Net_Size == Big ? "big" : "small") << " network " << nt.fileName
+            << ", " << n << " positions, " << iterations << " iterations" << sync_endl;
+#ifdef NNUE_STATS
+        sync_cout << std::setw(66) << "update" << std::setw(8) << "cache" << std::setw(8) << "full" << sync_endl;
+#endif
+
+        run("Feature transformer with refresh", cacheBytes, [&](std::size_t, Position& pos, Buffers& b, Network&) {
+            reset(pos);
+            sink = nt.featureTransformer->transform(pos, accumulator_cache<Net_Size>(pos), o.transformed, b.bucket);
+            });
+        run("Feature transformer full refresh", refreshBytes / n, [&](std::size_t, Position& pos, Buffers& b, Network&) {
+            reset(pos);
+            sink = nt.featureTransformer->transform(pos, nullptr, o.transformed, b.bucket);
+            });
+        run("Feature transformer with update", updateBytes / n, [&](std::size_t i, Position&, Buffers& b, Network&) {
+            reset(children[i]);
+            sink = nt.featureTransformer->transform(children[i], nullptr, o.transformed, b.bucket);
+            });
+        run("Feature transformer output only", OutputBytes, [&](std::size_t, Position& pos, Buffers& b, Network&) {
+            sink = nt.featureTransformer->transform(pos, accumulator_cache<Net_Size>(pos), o.transformed, b.bucket);
+            });
+        run("AffineTransformSparseInput fc_0", fc0Bytes / n, [&](std::size_t, Position&, Buffers& b, Network& net) {
+            net.fc_0.propagate(b.transformed, o.fc_0_out);
+            sink = o.fc_0_out[0];
+            });
+        run("SqrClippedReLU ac_sqr_0", sqrBytes, [&](std::size_t, Position&, Buffers& b, Network& net) {
+            net.ac_sqr_0.propagate(b.fc_0_out, o.ac_sqr_0_out);
+            sink = o.ac_sqr_0_out[0];
+            });
+        run("ClippedReLU ac_0", ac0Bytes, [&](std::size_t, Position&, Buffers& b, Network& net) {
+            net.ac_0.propagate(b.fc_0_out, o.ac_0_out);
+            sink = o.ac_0_out[0];
+            });
+        run("AffineTransform fc_1", fc1Bytes, [&](std::size_t, Position&, Buffers& b, Network& net) {
+            net.fc_1.propagate(b.ac_sqr_0_out, o.fc_1_out);
+            sink = o.fc_1_out[0];
+            });
+        run("ClippedReLU ac_1", ac1Bytes, [&](std::size_t, Position&, Buffers& b, Network& net) {
+            net.ac_1.propagate(b.fc_1_out, o.ac_1_out);
+            sink = o.ac_1_out[0];
+            });
+        run("AffineTransform fc_2", fc2Bytes, [&](std::size_t, Position&, Buffers& b, Network& net) {
+            net.fc_2.propagate(b.ac_1_out, o.fc_2_out);
+            sink = o.fc_2_out[0];
+            });
+        run("Network propagate", netBytes, [&](std::size_t, Position&, Buffers& b, Network& net) {
+            sink = net.propagate(b.transformed);
+            });
+        run("Evaluation with refresh", cacheBytes + netBytes, [&](std::size_t, Position& pos, Buffers&, Network&) {
+            reset(pos);
+            sink = evaluate<Net_Size>(pos);
+            });
+    }
+
+    // Prints the accumulator updates and refreshes of both networks, see 'make nnuestats=yes'
+    void print_stats(std::ostream& os) {
+#ifdef NNUE_STATS
+        os << "\nNNUE accumulator statistics";
+        for (int net : { Big, Small })
+        {
+            const std::uint64_t updates = accumulatorStats[net][AccUpdate];
+            const std::uint64_t cached = accumulatorStats[net][AccCacheRefresh];
+            const std::uint64_t full = accumulatorStats[net][AccRefresh];
+            const std::uint64_t total = updates + cached + full;
+            if (!total)
+                continue;
+
+            os << "\n" << (net == Big ? "Big network" : "Small network")
+                << "\nUpdates               : " << updates << " (" << 100.0 * updates / total << "%)"
+                << "\nCache refreshes       : " << cached << " (" << 100.0 * cached / total << "%)"
+                << "\nFull refreshes        : " << full << " (" << 100.0 * full / total << "%)";
+        }
+        os << std::endl;
+#else
+        (void) os;
+#endif
+    }
+
+    void clear_stats() {
+#ifdef NNUE_STATS
+        for (auto& net : accumulatorStats)
+            for (auto& c : net)
+                c = 0;
+#endif
+    }
+
+    // Times the feature transformer and each layer of the networks on the given positions
+    // and prints the average time per evaluation, see 'bench nnue'.
+    void benchmark(const std::vector<std::string>& fens, std::size_t iterations) {
+
+        if (fens.empty() || !iterations)
+            return;
+
+        benchmark<Big>(fens, iterations);
+
+        if (netSmall.featureTransformer)
+            benchmark<Small>(fens, iterations);
+    }
+
     constexpr std::string_view PieceToChar(" PNBRQK  pnbrqk");
 
 
@@ -284,7 +718,8 @@ namespace Stockfish::Eval::NNUE {
 
     // Returns a string with the value of each piece on a board,
     // and a table for (PSQT, Layers) values bucket by bucket.
-    std::string trace(Position& pos) {
+    template<NetSize Net_Size>
+    static std::string trace(Position& pos) {
 
         std::stringstream ss;
 
@@ -310,7 +745,7 @@ namespace Stockfish::Eval::NNUE {
 
         // We estimate the value of each piece by doing a differential evaluation from
         // the current base eval, simulating the removal of the piece from its square.
-        Value base = evaluate(pos);
+        Value base = evaluate<Net_Size>(pos);
         base = pos.side_to_move() == WHITE ? base : -base;
 
         for (File f = FILE_A; f <= FILE_H; ++f)
@@ -325,16 +760,14 @@ namespace Stockfish::Eval::NNUE {
                     auto st = pos.state();
 
                     pos.remove_piece(sq);
-                    st->accumulator.computed[WHITE] = false;
-                    st->accumulator.computed[BLACK] = false;
+                    std::memset(st->nnueComputed, 0, sizeof(st->nnueComputed));
 
-                    Value eval = evaluate(pos);
+                    Value eval = evaluate<Net_Size>(pos);
                     eval = pos.side_to_move() == WHITE ? eval : -eval;
                     v = base - eval;
 
                     pos.put_piece(pc, sq);
-                    st->accumulator.computed[WHITE] = false;
-                    st->accumulator.computed[BLACK] = false;
+                    std::memset(st->nnueComputed, 0, sizeof(st->nnueComputed));
                 }
 
                 writeSquare(f, r, pc, v);
@@ -345,10 +778,11 @@ namespace Stockfish::Eval::NNUE {
             ss << board[row] << '\n';
         ss << '\n';
 
-        auto t = trace_evaluate(pos);
+        auto t = trace_evaluate<Net_Size>(pos);
 
         ss << " NNUE network contributions "
-            << (pos.side_to_move() == WHITE ? "(White to move)" : "(Black to move)") << std::endl
+            << (pos.side_to_move() == WHITE ? "(White to move" : "(Black to move")
+            << (Net_Size == Big ? ", big net)" : ", small net)") << std::endl
             << "+------------+------------+------------+------------+\n"
             << "|   Bucket   |  Material  | Positional |   Total    |\n"
             << "|            |   (PSQT)   |  (Layers)  |            |\n"
@@ -377,26 +811,163 @@ namespace Stockfish::Eval::NNUE {
         return ss.str();
     }
 
+    std::string trace(Position& pos) { return use_small_net(pos) ? trace<Small>(pos) : trace<Big>(pos); }
+
 
     // Load eval, from a file stream or a memory stream
-    bool load_eval(std::string name, std::istream& stream) {
+    template<NetSize Net_Size>
+    static bool load_eval(std::string name, std::istream& stream) {
+
+        auto& n = net<Net_Size>();
+
+        initialize<Net_Size>();
+        n.fileName = name;
+        if (read_parameters<Net_Size>(stream))
+            return true;
+
+        // Only a network read completely is used, see use_small_net()
+        n.featureTransformer = nullptr;
+        return false;
+    }
+
+    bool load_eval(std::string name, std::istream& stream, NetSize netSize) {
+        return netSize == Big ? load_eval<Big>(name, stream) : load_eval<Small>(name, stream);
+    }
+
+    // Load eval by mapping a file in the mapped layout. Returns false if the file is
+    // missing or has been written for another architecture or build.
+    template<NetSize Net_Size>
+    static bool load_mapped_eval(std::string name, const std::string& path) {
+
+        using NetType = std::remove_reference_t<decltype(net<Net_Size>())>;
+        using Transformer = typename NetType::FeatureTransformerType;
+        using Network = typename NetType::NetworkType;
+
+        std::size_t   size;
+        std::uint64_t mapping;
+        void*         base = map_file(path, size, mapping);
+        if (!base)
+            return false;
+
+        const MappedHeader* header = static_cast<const MappedHeader*>(base);
+        std::size_t         offset = 0;
+
+        if (size >= sizeof(MappedHeader) && !std::memcmp(header->magic, MappedMagic, sizeof(MappedMagic))
+            && header->hashValue == HashValue[Net_Size] && header->layout == layout_id()
+            && header->transformerSize == sizeof(Transformer) && header->networkSize == sizeof(Network))
+        {
+            // Offset of the last network, the file must reach to its end
+            offset = mapped_offset(sizeof(MappedHeader) + header->descriptionSize);
+            for (std::size_t i = 0; i < LayerStacks; ++i)
+                offset = mapped_offset(offset + (i ? sizeof(Network) : sizeof(Transformer)));
+        }
+
+        if (!offset || offset + sizeof(Network) > size)
+        {
+            unmap_file(base, size, mapping);
+            return false;
+        }
+
+        auto& n = net<Net_Size>();
+
+        // Release the previous parameters, they are in the file now
+        n.mappedNet.unmap();
+        n.featureTransformerStorage.reset();
+        for (std::size_t i = 0; i < LayerStacks; ++i)
+            n.networkStorage[i].reset();
 
-        initialize();
-        fileName = name;
-        return read_parameters(stream);
+        ++n.netVersion;
+        n.mappedNet.base = base;
+        n.mappedNet.size = size;
+        n.mappedNet.mapping = mapping;
+
+        char* data = static_cast<char*>(base);
+        n.netDescription.assign(data + sizeof(MappedHeader), header->descriptionSize);
+
+        offset = mapped_offset(sizeof(MappedHeader) + header->descriptionSize);
+        n.featureTransformer = reinterpret_cast<Transformer*>(data + offset);
+        offset = mapped_offset(offset + sizeof(Transformer));
+        for (std::size_t i = 0; i < LayerStacks; ++i)
+        {
+            n.network[i] = reinterpret_cast<Network*>(data + offset);
+            offset = mapped_offset(offset + sizeof(Network));
+        }
+
+        n.fileName = name;
+        return true;
+    }
+
+    bool load_mapped_eval(std::string name, const std::string& path, NetSize netSize) {
+        return netSize == Big ? load_mapped_eval<Big>(name, path) : load_mapped_eval<Small>(name, path);
+    }
+
+    // Releases the parameters of a network, only the small one can be switched off
+    template<NetSize Net_Size>
+    static void unload_eval() {
+
+        auto& n = net<Net_Size>();
+
+        n.mappedNet.unmap();
+        ++n.netVersion;
+
+        n.featureTransformer = nullptr;
+        n.featureTransformerStorage.reset();
+        for (std::size_t i = 0; i < LayerStacks; ++i)
+            n.networkStorage[i].reset();
+        n.fileName.clear();
+    }
+
+    void unload_eval(NetSize netSize) {
+        netSize == Big ? unload_eval<Big>() : unload_eval<Small>();
     }
 
     // Save eval, to a file stream or a memory stream
-    bool save_eval(std::ostream& stream) {
+    bool save_eval(std::ostream& stream, NetSize netSize) {
 
-        if (fileName.empty())
+        if (netSize == Big)
+            return !netBig.fileName.empty() && netBig.featureTransformer && write_parameters<Big>(stream);
+        else
+            return !netSmall.fileName.empty() && netSmall.featureTransformer && write_parameters<Small>(stream);
+    }
+
+    // Save eval in the mapped layout, it can only be loaded by builds for the same architecture
+    template<NetSize Net_Size>
+    static bool save_mapped_eval(std::ostream& stream) {
+
+        using NetType = std::remove_reference_t<decltype(net<Net_Size>())>;
+        using Transformer = typename NetType::FeatureTransformerType;
+        using Network = typename NetType::NetworkType;
+
+        auto& n = net<Net_Size>();
+        if (n.fileName.empty() || !n.featureTransformer)
             return false;
 
-        return write_parameters(stream);
+        MappedHeader header{};
+        std::memcpy(header.magic, MappedMagic, sizeof(MappedMagic));
+        header.hashValue = HashValue[Net_Size];
+        header.layout = layout_id();
+        header.transformerSize = sizeof(Transformer);
+        header.networkSize = sizeof(Network);
+        header.descriptionSize = n.netDescription.size();
+
+        std::size_t offset = sizeof(MappedHeader) + n.netDescription.size();
+        auto        write_block = [&](const void* data, std::size_t size) {
+            stream.write(std::string(mapped_offset(offset) - offset, '\0').data(), mapped_offset(offset) - offset);
+            stream.write(static_cast<const char*>(data), size);
+            offset = mapped_offset(offset) + size;
+            };
+
+        stream.write(reinterpret_cast<const char*>(&header), sizeof(MappedHeader));
+        stream.write(n.netDescription.data(), n.netDescription.size());
+        write_block(n.featureTransformer, sizeof(Transformer));
+        for (std::size_t i = 0; i < LayerStacks; ++i)
+            write_block(n.network[i], sizeof(Network));
+
+        return bool(stream);
     }
 
     // Save eval, to a file given by its name
-    bool save_eval(const std::optional<std::string>& filename) {
+    bool save_eval(const std::optional<std::string>& filename, NetSize netSize, bool mapped) {
 
         std::string actualFilename;
         std::string msg;
@@ -405,7 +976,7 @@ namespace Stockfish::Eval::NNUE {
             actualFilename = filename.value();
         else
         {
-            if (currentEvalFileName != EvalFileDefaultName)
+            if (netSize != Big || currentEvalFileName[Big] != EvalFileDefaultName)
             {
                 msg = "Failed to export a net. "
                     "A non-embedded net can only be saved if the filename is specified";
@@ -417,7 +988,8 @@ namespace Stockfish::Eval::NNUE {
         }
 
         std::ofstream stream(actualFilename, std::ios_base::binary);
-        bool          saved = save_eval(stream);
+        bool          saved = !mapped ? save_eval(stream, netSize)
+            : netSize == Big ? save_mapped_eval<Big>(stream) : save_mapped_eval<Small>(stream);
 
         msg = saved ? "Network saved successfully to " + actualFilename : "Failed to export a net";
 
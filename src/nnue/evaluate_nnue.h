@@ -26,6 +26,7 @@
 #include <memory>
 #include <optional>
 #include <string>
+#include <vector>
 
 #include "../misc.h"
 #include "nnue_architecture.h"
@@ -38,9 +39,19 @@ namespace Stockfish {
 
 namespace Stockfish::Eval::NNUE {
 
-    // Hash value of evaluation function structure
-    constexpr std::uint32_t HashValue =
-        FeatureTransformer::get_hash_value() ^ Network::get_hash_value();
+    using FeatureTransformerBig = FeatureTransformer<TransformedFeatureDimensionsBig, &StateData::accumulatorBig>;
+    using FeatureTransformerSmall = FeatureTransformer<TransformedFeatureDimensionsSmall, &StateData::accumulatorSmall>;
+
+    using NetworkBig = NetworkArchitecture<TransformedFeatureDimensionsBig, L2Big, L3Big>;
+    using NetworkSmall = NetworkArchitecture<TransformedFeatureDimensionsSmall, L2Small, L3Small>;
+
+    // Hash value of evaluation function structure, indexed by NetSize
+    constexpr std::uint32_t HashValue[2] = {
+        FeatureTransformerBig::get_hash_value() ^ NetworkBig::get_hash_value(),
+        FeatureTransformerSmall::get_hash_value() ^ NetworkSmall::get_hash_value() };
+
+    // Positions with a larger material imbalance are evaluated by the small network
+    constexpr int SmallNetThreshold = 1050;
 
 
     // Deleter for automating release of memory area
@@ -68,11 +79,21 @@ namespace Stockfish::Eval::NNUE {
 
     std::string trace(Position& pos);
     Value       evaluate(const Position& pos, bool adjusted = false, int* complexity = nullptr);
+    bool        use_small_net(const Position& pos);
     void        hint_common_parent_position(const Position& pos);
 
-    bool load_eval(std::string name, std::istream& stream);
-    bool save_eval(std::ostream& stream);
-    bool save_eval(const std::optional<std::string>& filename);
+    template<NetSize Net_Size>
+    Value evaluate(const Position& pos, bool adjusted = false, int* complexity = nullptr);
+
+    void benchmark(const std::vector<std::string>& fens, std::size_t iterations);
+    void print_stats(std::ostream& os);
+    void clear_stats();
+
+    bool load_eval(std::string name, std::istream& stream, NetSize netSize);
+    bool load_mapped_eval(std::string name, const std::string& path, NetSize netSize);
+    void unload_eval(NetSize netSize);
+    bool save_eval(std::ostream& stream, NetSize netSize);
+    bool save_eval(const std::optional<std::string>& filename, NetSize netSize, bool mapped = false);
 
 } // namespace Stockfish::Eval::NNUE
 
@@ -75,6 +75,41 @@ namespace Stockfish::Eval::NNUE::Features {
         IndexList& removed,
         IndexList& added);
 
+    // Get a list of indices for the features that differ between the pieces given
+    // by the bitboards and the position, if both have the same king square
+    template<Color Perspective>
+    void HalfKAv2_hm::append_changed_indices(const Position& pos,
+        const Bitboard byColorBB[COLOR_NB],
+        const Bitboard byTypeBB[PIECE_TYPE_NB],
+        IndexList& removed,
+        IndexList& added) {
+        Square ksq = pos.square<KING>(Perspective);
+        for (Color c : { WHITE, BLACK })
+            for (PieceType pt = PAWN; pt <= KING; ++pt)
+            {
+                Piece    pc = make_piece(c, pt);
+                Bitboard before = byColorBB[c] & byTypeBB[pt];
+                Bitboard now = pos.pieces(c, pt);
+
+                for (Bitboard b = before & ~now; b;)
+                    removed.push_back(make_index<Perspective>(pop_lsb(b), pc, ksq));
+                for (Bitboard b = now & ~before; b;)
+                    added.push_back(make_index<Perspective>(pop_lsb(b), pc, ksq));
+            }
+    }
+
+    // Explicit template instantiations
+    template void HalfKAv2_hm::append_changed_indices<WHITE>(const Position& pos,
+        const Bitboard byColorBB[COLOR_NB],
+        const Bitboard byTypeBB[PIECE_TYPE_NB],
+        IndexList& removed,
+        IndexList& added);
+    template void HalfKAv2_hm::append_changed_indices<BLACK>(const Position& pos,
+        const Bitboard byColorBB[COLOR_NB],
+        const Bitboard byTypeBB[PIECE_TYPE_NB],
+        IndexList& removed,
+        IndexList& added);
+
     int HalfKAv2_hm::update_cost(const StateInfo* st) { return st->dirtyPiece.dirty_num; }
 
     int HalfKAv2_hm::refresh_cost(const Position& pos) { return pos.count<ALL_PIECES>(); }
@@ -137,6 +137,15 @@ namespace Stockfish::Eval::NNUE::Features {
         static void
             append_changed_indices(Square ksq, const DirtyPiece& dp, IndexList& removed, IndexList& added);
 
+        // Get a list of indices for the features that differ between the pieces given
+        // by the bitboards and the position, if both have the same king square
+        template<Color Perspective>
+        static void append_changed_indices(const Position& pos,
+            const Bitboard byColorBB[COLOR_NB],
+            const Bitboard byTypeBB[PIECE_TYPE_NB],
+            IndexList& removed,
+            IndexList& added);
+
         // Returns the cost of updating one perspective, the most costly one.
         // Assumes no refresh needed.
         static int update_cost(const StateInfo* st);
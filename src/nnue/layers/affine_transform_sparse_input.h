@@ -79,8 +79,12 @@ namespace Stockfish::Eval::NNUE::Layers {
 #define vec128_add(a, b) _mm_add_epi16(a, b)
 #elif defined(USE_NEON)
             using vec_t = uint32x4_t;
-            static const std::uint32_t Mask[4] = { 1, 2, 4, 8 };
-#define vec_nnz(a) vaddvq_u32(vandq_u32(vtstq_u32(a, a), vld1q_u32(Mask)))
+            static const std::uint8_t Mask[8] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+            // The compare results of two vectors are narrowed to bytes, so that a single
+            // horizontal add gives the bitmask of 8 inputs.
+#define vec_nnz_x2(a, b) \
+                vaddv_u8(vand_u8(vmovn_u16(vcombine_u16(vmovn_u32(vtstq_u32(a, a)), \
+                                                        vmovn_u32(vtstq_u32(b, b)))), vld1_u8(Mask)))
             using vec128_t = uint16x8_t;
 #define vec128_zero vdupq_n_u16(0)
 #define vec128_set_16(a) vdupq_n_u16(a)
@@ -90,7 +94,15 @@ namespace Stockfish::Eval::NNUE::Layers {
 #endif
             constexpr IndexType InputSimdWidth = sizeof(vec_t) / sizeof(std::int32_t);
             // Inputs are processed InputSimdWidth at a time and outputs are processed 8 at a time so we process in chunks of max(InputSimdWidth, 8)
+            // unless a bigger chunk is chosen at build time with 'make nnzchunk=16' or 32.
+#if defined(NNZ_CHUNK_SIZE)
+            constexpr IndexType ChunkSize = NNZ_CHUNK_SIZE;
+            static_assert(ChunkSize % InputSimdWidth == 0 && ChunkSize % 8 == 0 && ChunkSize <= 32,
+                "The chunk size must be a multiple of the SIMD width and 8, and at most 32");
+#else
             constexpr IndexType ChunkSize = std::max<IndexType>(InputSimdWidth, 8);
+#endif
+            static_assert(InputDimensions % ChunkSize == 0);
             constexpr IndexType NumChunks = InputDimensions / ChunkSize;
             constexpr IndexType InputsPerChunk = ChunkSize / InputSimdWidth;
             constexpr IndexType OutputsPerChunk = ChunkSize / 8;
@@ -103,11 +115,17 @@ namespace Stockfish::Eval::NNUE::Layers {
             {
                 // bitmask of nonzero values in this chunk
                 unsigned nnz = 0;
+#if defined(USE_SSSE3)
                 for (IndexType j = 0; j < InputsPerChunk; ++j)
                 {
                     const vec_t inputChunk = inputVector[i * InputsPerChunk + j];
                     nnz |= unsigned(vec_nnz(inputChunk)) << (j * InputSimdWidth);
                 }
+#else
+                for (IndexType j = 0; j < InputsPerChunk; j += 2)
+                    nnz |= unsigned(vec_nnz_x2(inputVector[i * InputsPerChunk + j],
+                        inputVector[i * InputsPerChunk + j + 1])) << (j * InputSimdWidth);
+#endif
                 for (IndexType j = 0; j < OutputsPerChunk; ++j)
                 {
                     const auto lookup = (nnz >> (j * 8)) & 0xFF;
@@ -120,6 +138,7 @@ namespace Stockfish::Eval::NNUE::Layers {
             count_out = count;
         }
 #undef vec_nnz
+#undef vec_nnz_x2
 #undef vec128_zero
 #undef vec128_set_16
 #undef vec128_load
@@ -23,16 +23,55 @@
 
 #include <cstdint>
 
+#include "../types.h"
 #include "nnue_architecture.h"
 #include "nnue_common.h"
 
+namespace Stockfish {
+    struct StateInfo;
+}
+
 namespace Stockfish::Eval::NNUE {
 
-    // Class that holds the result of affine transformation of input features
+    // Class that holds the result of affine transformation of input features. It lives on the
+    // state stack of a thread (see StateData), owner is the state each perspective belongs to.
+    template<IndexType Size>
     struct alignas(CacheLineSize) Accumulator {
-        std::int16_t accumulation[2][TransformedFeatureDimensions];
-        std::int32_t psqtAccumulation[2][PSQTBuckets];
-        bool         computed[2];
+        std::int16_t     accumulation[2][Size];
+        std::int32_t     psqtAccumulation[2][PSQTBuckets];
+        const StateInfo* owner[2] = {};
+    };
+
+    // Accumulators of the last refreshed position for each king square and perspective,
+    // also known as "Finny tables". A refresh then only needs the pieces that differ from
+    // the cached position instead of all pieces. Every thread has a cache of its own.
+    template<IndexType Size>
+    struct AccumulatorCache {
+
+        struct alignas(CacheLineSize) Entry {
+            std::int16_t accumulation[Size];
+            std::int32_t psqtAccumulation[PSQTBuckets];
+            Bitboard     byColorBB[COLOR_NB];
+            Bitboard     byTypeBB[PIECE_TYPE_NB];
+        };
+
+        Entry         entries[SQUARE_NB][COLOR_NB];
+        std::uint32_t netVersion = 0; // Network the entries are valid for, 0 if none
+    };
+
+    // The caches of a thread, one for each network
+    struct AccumulatorCaches {
+
+        template<NetSize Net_Size>
+        auto& get() {
+            if constexpr (Net_Size == Big)
+                return big;
+            else
+                return small;
+        }
+
+        AccumulatorCache<TransformedFeatureDimensionsBig>   big;
+        AccumulatorCache<TransformedFeatureDimensionsSmall> small;
     };
 
 } // namespace Stockfish::Eval::NNUE
@@ -22,6 +22,7 @@
 #define NNUE_FEATURE_TRANSFORMER_H_INCLUDED
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cstdint>
 #include <cstring>
@@ -40,6 +41,22 @@ namespace Stockfish::Eval::NNUE {
     using WeightType = std::int16_t;
     using PSQTWeightType = std::int32_t;
 
+    // Accumulators updated incrementally, refreshed from the cache and refreshed from scratch,
+    // per network and summed over all threads. Compiled in with 'make nnuestats=yes'.
+    enum AccumulatorEvent : int {
+        AccUpdate,
+        AccCacheRefresh,
+        AccRefresh,
+        ACC_EVENT_NB
+    };
+
+#ifdef NNUE_STATS
+    extern std::atomic<std::uint64_t> accumulatorStats[2][ACC_EVENT_NB];
+#define NNUE_COUNT(net, event) accumulatorStats[net][event].fetch_add(1, std::memory_order_relaxed)
+#else
+#define NNUE_COUNT(net, event) ((void) 0)
+#endif
+
     // If vector instructions are enabled, we update and refresh the accumulator tile by tile
     // such that each tile fits in the CPU's vector registers.
 #define VECTOR
@@ -185,25 +202,44 @@ namespace Stockfish::Eval::NNUE {
 
         return 1;
     }
-
-    static constexpr int NumRegs =
-        BestRegisterCount<vec_t, WeightType, TransformedFeatureDimensions, NumRegistersSIMD>();
-    static constexpr int NumPsqtRegs =
-        BestRegisterCount<psqt_vec_t, PSQTWeightType, PSQTBuckets, NumRegistersSIMD>();
 #if defined(__GNUC__)
 #pragma GCC diagnostic pop
 #endif
 #endif
 
 
-    // Input feature converter
+    // Input feature converter, accPtr is the accumulator of StateData it works on
+    template<IndexType TransformedFeatureDimensions,
+        Accumulator<TransformedFeatureDimensions> StateData::* accPtr>
     class FeatureTransformer {
 
     private:
         // Number of output dimensions for one side
         static constexpr IndexType HalfDimensions = TransformedFeatureDimensions;
 
+        static constexpr NetSize Net = TransformedFeatureDimensions == TransformedFeatureDimensionsBig ? Big : Small;
+
+        // The accumulator holds the accumulation of a state if the state marked it computed
+        // and no other state has taken over its entry of the state stack since.
+        template<Color Perspective>
+        static bool computed(const StateInfo* st) {
+            return st->nnueComputed[Net][Perspective] && (st->data->*accPtr).owner[Perspective] == st;
+        }
+
+        template<Color Perspective>
+        static void set_computed(StateInfo* st) {
+            st->nnueComputed[Net][Perspective] = true;
+            (st->data->*accPtr).owner[Perspective] = st;
+        }
+
+        using Cache = AccumulatorCache<TransformedFeatureDimensions>;
+
 #ifdef VECTOR
+        static constexpr int NumRegs =
+            BestRegisterCount<vec_t, WeightType, TransformedFeatureDimensions, NumRegistersSIMD>();
+        static constexpr int NumPsqtRegs =
+            BestRegisterCount<psqt_vec_t, PSQTWeightType, PSQTBuckets, NumRegistersSIMD>();
+
         static constexpr IndexType TileHeight = NumRegs * sizeof(vec_t) / 2;
         static constexpr IndexType PsqtTileHeight = NumPsqtRegs * sizeof(psqt_vec_t) / 4;
         static_assert(HalfDimensions% TileHeight == 0, "TileHeight must divide HalfDimensions");
@@ -247,13 +283,13 @@ namespace Stockfish::Eval::NNUE {
         }
 
         // Convert input features
-        std::int32_t transform(const Position& pos, OutputType* output, int bucket) const {
-            update_accumulator<WHITE>(pos);
-            update_accumulator<BLACK>(pos);
+        std::int32_t transform(const Position& pos, Cache* cache, OutputType* output, int bucket) const {
+            update_accumulator<WHITE>(pos, cache);
+            update_accumulator<BLACK>(pos, cache);
 
             const Color perspectives[2] = { pos.side_to_move(), ~pos.side_to_move() };
-            const auto& accumulation = pos.state()->accumulator.accumulation;
-            const auto& psqtAccumulation = pos.state()->accumulator.psqtAccumulation;
+            const auto& accumulation = (pos.state()->data->*accPtr).accumulation;
+            const auto& psqtAccumulation = (pos.state()->data->*accPtr).psqtAccumulation;
 
             const auto psqt =
                 (psqtAccumulation[perspectives[0]][bucket] - psqtAccumulation[perspectives[1]][bucket])
@@ -309,9 +345,19 @@ namespace Stockfish::Eval::NNUE {
             return psqt;
         } // end of function transform()
 
-        void hint_common_access(const Position& pos) const {
-            hint_common_access_for_perspective<WHITE>(pos);
-            hint_common_access_for_perspective<BLACK>(pos);
+        void hint_common_access(const Position& pos, Cache* cache) const {
+            hint_common_access_for_perspective<WHITE>(pos, cache);
+            hint_common_access_for_perspective<BLACK>(pos, cache);
+        }
+
+        // Resets the entries of a cache to the empty board, whose accumulator holds the biases only
+        void clear_cache(Cache& cache) const {
+            for (auto& entries : cache.entries)
+                for (auto& entry : entries)
+                {
+                    std::memset(&entry, 0, sizeof(entry));
+                    std::memcpy(entry.accumulation, biases, sizeof(biases));
+                }
         }
 
     private:
@@ -322,19 +368,39 @@ namespace Stockfish::Eval::NNUE {
             // of the estimated gain in terms of features to be added/subtracted.
             StateInfo* st = pos.state(), * next = nullptr;
             int        gain = FeatureSet::refresh_cost(pos);
-            while (st->previous && !st->accumulator.computed[Perspective])
+            while (st->previous && !computed<Perspective>(st))
             {
                 // This governs when a full feature refresh is needed and how many
                 // updates are better than just one full refresh.
                 if (FeatureSet::requires_refresh(st, Perspective)
                     || (gain -= FeatureSet::update_cost(st) + 1) < 0)
                     break;
+
+                // The states before the root of a search are on the stack of another thread
+                if (st->previous->data + 1 != st->data)
+                    break;
                 next = st;
                 st = st->previous;
             }
             return { st, next };
         }
 
+        // Drops the features that are both removed and added over a chain of states, e.g. by a
+        // piece that moves away and back, so that their weight rows aren't read at all.
+        static void cancel_common_indices(FeatureSet::IndexList& removed, FeatureSet::IndexList& added) {
+            for (int r = 0; r < int(removed.size());)
+            {
+                auto it = std::find(added.begin(), added.end(), removed[r]);
+                if (it != added.end())
+                {
+                    added.remove(int(it - added.begin()));
+                    removed.remove(r);
+                }
+                else
+                    ++r;
+            }
+        }
+
         // NOTE: The parameter states_to_update is an array of position states, ending with nullptr.
         //       All states must be sequential, that is states_to_update[i] must either be reachable
         //       by repeatedly applying ->previous from states_to_update[i+1] or
@@ -380,13 +446,16 @@ namespace Stockfish::Eval::NNUE {
 
                 for (; i >= 0; --i)
                 {
-                    states_to_update[i]->accumulator.computed[Perspective] = true;
+                    set_computed<Perspective>(states_to_update[i]);
+                    NNUE_COUNT(Net, AccUpdate);
 
                     const StateInfo* end_state = i == 0 ? computed_st : states_to_update[i - 1];
 
                     for (; st2 != end_state; st2 = st2->previous)
                         FeatureSet::append_changed_indices<Perspective>(ksq, st2->dirtyPiece,
                             removed[i], added[i]);
+
+                    cancel_common_indices(removed[i], added[i]);
                 }
             }
 
@@ -401,9 +470,9 @@ namespace Stockfish::Eval::NNUE {
                 assert(states_to_update[0]);
 
                 auto accIn =
-                    reinterpret_cast<const vec_t*>(&st->accumulator.accumulation[Perspective][0]);
+                    reinterpret_cast<const vec_t*>(&(st->data->*accPtr).accumulation[Perspective][0]);
                 auto accOut = reinterpret_cast<vec_t*>(
-                    &states_to_update[0]->accumulator.accumulation[Perspective][0]);
+                    &(states_to_update[0]->data->*accPtr).accumulation[Perspective][0]);
 
                 const IndexType offsetR0 = HalfDimensions * removed[0][0];
                 auto            columnR0 = reinterpret_cast<const vec_t*>(&weights[offsetR0]);
@@ -428,9 +497,9 @@ namespace Stockfish::Eval::NNUE {
                 }
 
                 auto accPsqtIn = reinterpret_cast<const psqt_vec_t*>(
-                    &st->accumulator.psqtAccumulation[Perspective][0]);
+                    &(st->data->*accPtr).psqtAccumulation[Perspective][0]);
                 auto accPsqtOut = reinterpret_cast<psqt_vec_t*>(
-                    &states_to_update[0]->accumulator.psqtAccumulation[Perspective][0]);
+                    &(states_to_update[0]->data->*accPtr).psqtAccumulation[Perspective][0]);
 
                 const IndexType offsetPsqtR0 = PSQTBuckets * removed[0][0];
                 auto columnPsqtR0 = reinterpret_cast<const psqt_vec_t*>(&psqtWeights[offsetPsqtR0]);
@@ -462,7 +531,7 @@ namespace Stockfish::Eval::NNUE {
                 {
                     // Load accumulator
                     auto accTileIn = reinterpret_cast<const vec_t*>(
-                        &st->accumulator.accumulation[Perspective][j * TileHeight]);
+                        &(st->data->*accPtr).accumulation[Perspective][j * TileHeight]);
                     for (IndexType k = 0; k < NumRegs; ++k)
                         acc[k] = vec_load(&accTileIn[k]);
 
@@ -488,7 +557,7 @@ namespace Stockfish::Eval::NNUE {
 
                         // Store accumulator
                         auto accTileOut = reinterpret_cast<vec_t*>(
-                            &states_to_update[i]->accumulator.accumulation[Perspective][j * TileHeight]);
+                            &(states_to_update[i]->data->*accPtr).accumulation[Perspective][j * TileHeight]);
                         for (IndexType k = 0; k < NumRegs; ++k)
                             vec_store(&accTileOut[k], acc[k]);
                     }
@@ -498,7 +567,7 @@ namespace Stockfish::Eval::NNUE {
                 {
                     // Load accumulator
                     auto accTilePsqtIn = reinterpret_cast<const psqt_vec_t*>(
-                        &st->accumulator.psqtAccumulation[Perspective][j * PsqtTileHeight]);
+                        &(st->data->*accPtr).psqtAccumulation[Perspective][j * PsqtTileHeight]);
                     for (std::size_t k = 0; k < NumPsqtRegs; ++k)
                         psqt[k] = vec_load_psqt(&accTilePsqtIn[k]);
 
@@ -524,8 +593,7 @@ namespace Stockfish::Eval::NNUE {
 
                         // Store accumulator
                         auto accTilePsqtOut = reinterpret_cast<psqt_vec_t*>(
-                            &states_to_update[i]
-                            ->accumulator.psqtAccumulation[Perspective][j * PsqtTileHeight]);
+                            &(states_to_update[i]->data->*accPtr).psqtAccumulation[Perspective][j * PsqtTileHeight]);
                         for (std::size_t k = 0; k < NumPsqtRegs; ++k)
                             vec_store_psqt(&accTilePsqtOut[k], psqt[k]);
                     }
@@ -534,13 +602,13 @@ namespace Stockfish::Eval::NNUE {
 #else
             for (IndexType i = 0; states_to_update[i]; ++i)
             {
-                std::memcpy(states_to_update[i]->accumulator.accumulation[Perspective],
-                    st->accumulator.accumulation[Perspective],
+                std::memcpy((states_to_update[i]->data->*accPtr).accumulation[Perspective],
+                    (st->data->*accPtr).accumulation[Perspective],
                     HalfDimensions * sizeof(BiasType));
 
                 for (std::size_t k = 0; k < PSQTBuckets; ++k)
-                    states_to_update[i]->accumulator.psqtAccumulation[Perspective][k] =
-                    st->accumulator.psqtAccumulation[Perspective][k];
+                    (states_to_update[i]->data->*accPtr).psqtAccumulation[Perspective][k] =
+                    (st->data->*accPtr).psqtAccumulation[Perspective][k];
 
                 st = states_to_update[i];
 
@@ -550,10 +618,10 @@ namespace Stockfish::Eval::NNUE {
                     const IndexType offset = HalfDimensions * index;
 
                     for (IndexType j = 0; j < HalfDimensions; ++j)
-                        st->accumulator.accumulation[Perspective][j] -= weights[offset + j];
+                        (st->data->*accPtr).accumulation[Perspective][j] -= weights[offset + j];
 
                     for (std::size_t k = 0; k < PSQTBuckets; ++k)
-                        st->accumulator.psqtAccumulation[Perspective][k] -=
+                        (st->data->*accPtr).psqtAccumulation[Perspective][k] -=
                         psqtWeights[index * PSQTBuckets + k];
                 }
 
@@ -563,10 +631,10 @@ namespace Stockfish::Eval::NNUE {
                     const IndexType offset = HalfDimensions * index;
 
                     for (IndexType j = 0; j < HalfDimensions; ++j)
-                        st->accumulator.accumulation[Perspective][j] += weights[offset + j];
+                        (st->data->*accPtr).accumulation[Perspective][j] += weights[offset + j];
 
                     for (std::size_t k = 0; k < PSQTBuckets; ++k)
-                        st->accumulator.psqtAccumulation[Perspective][k] +=
+                        (st->data->*accPtr).psqtAccumulation[Perspective][k] +=
                         psqtWeights[index * PSQTBuckets + k];
                 }
             }
@@ -574,7 +642,11 @@ namespace Stockfish::Eval::NNUE {
         }
 
         template<Color Perspective>
-        void update_accumulator_refresh(const Position& pos) const {
+        void update_accumulator_refresh(const Position& pos, Cache* cache) const {
+
+            if (cache)
+                return update_accumulator_refresh_cache<Perspective>(pos, *cache);
+
 #ifdef VECTOR
             // Gcc-10.2 unnecessarily spills AVX2 registers if this array
             // is defined in the VECTOR code below, once in each branch
@@ -585,8 +657,9 @@ namespace Stockfish::Eval::NNUE {
             // Refresh the accumulator
             // Could be extracted to a separate function because it's done in 2 places,
             // but it's unclear if compilers would correctly handle register allocation.
-            auto& accumulator = pos.state()->accumulator;
-            accumulator.computed[Perspective] = true;
+            auto& accumulator = pos.state()->data->*accPtr;
+            set_computed<Perspective>(pos.state());
+            NNUE_COUNT(Net, AccRefresh);
             FeatureSet::IndexList active;
             FeatureSet::append_active_indices<Perspective>(pos, active);
 
@@ -653,8 +726,128 @@ namespace Stockfish::Eval::NNUE {
 #endif
         }
 
+        // Refreshes the accumulator starting from the cache entry of the king square, only
+        // the pieces that differ from the position the entry was last used for are updated.
+        template<Color Perspective>
+        void update_accumulator_refresh_cache(const Position& pos, Cache& cache) const {
+#ifdef VECTOR
+            vec_t      acc[NumRegs];
+            psqt_vec_t psqt[NumPsqtRegs];
+#endif
+
+            auto& entry = cache.entries[pos.square<KING>(Perspective)][Perspective];
+            auto& accumulator = pos.state()->data->*accPtr;
+            set_computed<Perspective>(pos.state());
+            NNUE_COUNT(Net, AccCacheRefresh);
+            FeatureSet::IndexList removed, added;
+            FeatureSet::append_changed_indices<Perspective>(pos, entry.byColorBB, entry.byTypeBB,
+                removed, added);
+
+#ifdef VECTOR
+            for (IndexType j = 0; j < HalfDimensions / TileHeight; ++j)
+            {
+                auto entryTile = reinterpret_cast<vec_t*>(&entry.accumulation[j * TileHeight]);
+                for (IndexType k = 0; k < NumRegs; ++k)
+                    acc[k] = vec_load(&entryTile[k]);
+
+                for (const auto index : removed)
+                {
+                    const IndexType offset = HalfDimensions * index + j * TileHeight;
+                    auto            column = reinterpret_cast<const vec_t*>(&weights[offset]);
+
+                    for (IndexType k = 0; k < NumRegs; ++k)
+                        acc[k] = vec_sub_16(acc[k], column[k]);
+                }
+
+                for (const auto index : added)
+                {
+                    const IndexType offset = HalfDimensions * index + j * TileHeight;
+                    auto            column = reinterpret_cast<const vec_t*>(&weights[offset]);
+
+                    for (IndexType k = 0; k < NumRegs; ++k)
+                        acc[k] = vec_add_16(acc[k], column[k]);
+                }
+
+                auto accTile =
+                    reinterpret_cast<vec_t*>(&accumulator.accumulation[Perspective][j * TileHeight]);
+                for (IndexType k = 0; k < NumRegs; ++k)
+                {
+                    vec_store(&entryTile[k], acc[k]);
+                    vec_store(&accTile[k], acc[k]);
+                }
+            }
+
+            for (IndexType j = 0; j < PSQTBuckets / PsqtTileHeight; ++j)
+            {
+                auto entryTilePsqt =
+                    reinterpret_cast<psqt_vec_t*>(&entry.psqtAccumulation[j * PsqtTileHeight]);
+                for (std::size_t k = 0; k < NumPsqtRegs; ++k)
+                    psqt[k] = vec_load_psqt(&entryTilePsqt[k]);
+
+                for (const auto index : removed)
+                {
+                    const IndexType offset = PSQTBuckets * index + j * PsqtTileHeight;
+                    auto columnPsqt = reinterpret_cast<const psqt_vec_t*>(&psqtWeights[offset]);
+
+                    for (std::size_t k = 0; k < NumPsqtRegs; ++k)
+                        psqt[k] = vec_sub_psqt_32(psqt[k], columnPsqt[k]);
+                }
+
+                for (const auto index : added)
+                {
+                    const IndexType offset = PSQTBuckets * index + j * PsqtTileHeight;
+                    auto columnPsqt = reinterpret_cast<const psqt_vec_t*>(&psqtWeights[offset]);
+
+                    for (std::size_t k = 0; k < NumPsqtRegs; ++k)
+                        psqt[k] = vec_add_psqt_32(psqt[k], columnPsqt[k]);
+                }
+
+                auto accTilePsqt = reinterpret_cast<psqt_vec_t*>(
+                    &accumulator.psqtAccumulation[Perspective][j * PsqtTileHeight]);
+                for (std::size_t k = 0; k < NumPsqtRegs; ++k)
+                {
+                    vec_store_psqt(&entryTilePsqt[k], psqt[k]);
+                    vec_store_psqt(&accTilePsqt[k], psqt[k]);
+                }
+            }
+
+#else
+            for (const auto index : removed)
+            {
+                const IndexType offset = HalfDimensions * index;
+
+                for (IndexType j = 0; j < HalfDimensions; ++j)
+                    entry.accumulation[j] -= weights[offset + j];
+
+                for (std::size_t k = 0; k < PSQTBuckets; ++k)
+                    entry.psqtAccumulation[k] -= psqtWeights[index * PSQTBuckets + k];
+            }
+
+            for (const auto index : added)
+            {
+                const IndexType offset = HalfDimensions * index;
+
+                for (IndexType j = 0; j < HalfDimensions; ++j)
+                    entry.accumulation[j] += weights[offset + j];
+
+                for (std::size_t k = 0; k < PSQTBuckets; ++k)
+                    entry.psqtAccumulation[k] += psqtWeights[index * PSQTBuckets + k];
+            }
+
+            std::memcpy(accumulator.accumulation[Perspective], entry.accumulation,
+                HalfDimensions * sizeof(BiasType));
+            std::memcpy(accumulator.psqtAccumulation[Perspective], entry.psqtAccumulation,
+                PSQTBuckets * sizeof(PSQTWeightType));
+#endif
+
+            for (Color c : { WHITE, BLACK })
+                entry.byColorBB[c] = pos.pieces(c);
+            for (PieceType pt = PAWN; pt <= KING; ++pt)
+                entry.byTypeBB[pt] = pos.pieces(pt);
+        }
+
         template<Color Perspective>
-        void hint_common_access_for_perspective(const Position& pos) const {
+        void hint_common_access_for_perspective(const Position& pos, Cache* cache) const {
 
             // Works like update_accumulator, but performs less work.
             // Updates ONLY the accumulator for pos.
@@ -662,12 +855,12 @@ namespace Stockfish::Eval::NNUE {
             // Look for a usable accumulator of an earlier position. We keep track
             // of the estimated gain in terms of features to be added/subtracted.
             // Fast early exit.
-            if (pos.state()->accumulator.computed[Perspective])
+            if (computed<Perspective>(pos.state()))
                 return;
 
             auto [oldest_st, _] = try_find_computed_accumulator<Perspective>(pos);
 
-            if (oldest_st->accumulator.computed[Perspective])
+            if (computed<Perspective>(oldest_st))
             {
                 // Only update current position accumulator to minimize work.
                 StateInfo* states_to_update[2] = { pos.state(), nullptr };
@@ -675,16 +868,16 @@ namespace Stockfish::Eval::NNUE {
             }
             else
             {
-                update_accumulator_refresh<Perspective>(pos);
+                update_accumulator_refresh<Perspective>(pos, cache);
             }
         }
 
         template<Color Perspective>
-        void update_accumulator(const Position& pos) const {
+        void update_accumulator(const Position& pos, Cache* cache) const {
 
             auto [oldest_st, next] = try_find_computed_accumulator<Perspective>(pos);
 
-            if (oldest_st->accumulator.computed[Perspective])
+            if (computed<Perspective>(oldest_st))
             {
                 if (next == nullptr)
                     return;
@@ -701,7 +894,7 @@ namespace Stockfish::Eval::NNUE {
             }
             else
             {
-                update_accumulator_refresh<Perspective>(pos);
+                update_accumulator_refresh<Perspective>(pos, cache);
             }
         }
 
@@ -17,7 +17,10 @@
 */
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cstring>
+#include <ostream>
 
 #include "bitboard.h"
 #include "pawns.h"
@@ -201,6 +204,99 @@ namespace Stockfish {
 
     namespace Pawns {
 
+        namespace {
+
+            // The optional table shared by all threads behind their own tables. It is direct
+            // mapped and read mostly: a thread that misses its own table copies the entry from
+            // here, and stores there an entry it had to compute. The sequence number of a slot
+            // is odd while a thread writes it, a reader checks that it is even and unchanged
+            // over the copy, so that a torn entry is never used.
+            struct SharedSlot {
+                std::atomic<uint32_t> sequence;
+                Entry                 entry;
+            };
+
+            SharedSlot* shared = nullptr;
+            size_t      sharedSize = 0;
+
+            bool load_shared(Key key, Entry* e) {
+
+                SharedSlot&    s = shared[uint32_t(key) & (sharedSize - 1)];
+                const uint32_t seq = s.sequence.load(std::memory_order_acquire);
+
+                if ((seq & 1) || s.entry.key != key)
+                    return false;
+
+                std::memcpy(static_cast<void*>(e), &s.entry, sizeof(Entry));
+                std::atomic_thread_fence(std::memory_order_acquire);
+                return s.sequence.load(std::memory_order_relaxed) == seq && e->key == key;
+            }
+
+            void store_shared(const Entry* e) {
+
+                SharedSlot& s = shared[uint32_t(e->key) & (sharedSize - 1)];
+                uint32_t    seq = s.sequence.load(std::memory_order_relaxed);
+
+                // Skip the slot while another thread writes it
+                if ((seq & 1) || !s.sequence.compare_exchange_strong(seq, seq + 1, std::memory_order_acquire))
+                    return;
+
+                std::memcpy(static_cast<void*>(&s.entry), e, sizeof(Entry));
+                s.sequence.store(seq + 2, std::memory_order_release);
+            }
+
+        } // namespace
+
+        // Sets the number of entries of the shared table, rounded down to a power of two,
+        // 0 disables it. Must not be called during a search.
+        void set_shared(size_t entries) {
+
+            std_aligned_free(shared);
+            shared = nullptr;
+            sharedSize = 0;
+
+            if (!entries)
+                return;
+
+            sharedSize = 1;
+            while (sharedSize * 2 <= entries)
+                sharedSize *= 2;
+
+            shared = static_cast<SharedSlot*>(std_aligned_alloc(64, sharedSize * sizeof(SharedSlot)));
+            if (!shared)
+                throw std::bad_alloc();
+
+            std::memset(static_cast<void*>(shared), 0, sharedSize * sizeof(SharedSlot));
+        }
+
+        // Prints the probes and hits of the pawn tables of all threads, and of the shared one
+        void print_stats(std::ostream& os) {
+
+            uint64_t probes = 0, hits = 0, sharedHits = 0;
+            for (Thread* th : Threads)
+            {
+                probes += th->pawnsTable.probes;
+                hits += th->pawnsTable.hits;
+                sharedHits += th->pawnsTable.sharedHits;
+            }
+
+            auto percent = [&](uint64_t n) { return probes ? 100.0 * n / probes : 0.0; };
+
+            os << "\nPawn table statistics"
+                << "\nEntries per thread    : " << Threads.main()->pawnsTable.size()
+                << "\nShared entries        : " << sharedSize
+                << "\nProbes                : " << probes
+                << "\nHits                  : " << hits << " (" << percent(hits) << "%)"
+                << "\nShared hits           : " << sharedHits << " (" << percent(sharedHits) << "%)"
+                << "\nEvaluations           : " << probes - hits - sharedHits << std::endl;
+        }
+
+        void clear_stats() {
+
+            for (Thread* th : Threads)
+                th->pawnsTable.probes = th->pawnsTable.hits = th->pawnsTable.sharedHits = 0;
+        }
+
         // Pawns::probe() looks up the current position's pawns configuration in
         // the pawns hash table. It returns a pointer to the Entry if the position
         // is found. Otherwise a new Entry is computed and stored there, so we don't
@@ -208,17 +304,27 @@ namespace Stockfish {
 
         Entry* probe(const Position& pos) {
 
-            Key key = pos.pawn_key();
-            Entry* e = pos.this_thread()->pawnsTable[key];
+            Key    key = pos.pawn_key();
+            Table& table = pos.this_thread()->pawnsTable;
+            Entry* e = table[key];
 
             if (e->key == key)
                 return e;
 
+            if (shared && load_shared(key, e))
+            {
+                ++table.sharedHits;
+                return e;
+            }
+
             e->key = key;
             e->blockedCount = 0;
             e->scores[WHITE] = evaluate<WHITE>(pos, e);
             e->scores[BLACK] = evaluate<BLACK>(pos, e);
 
+            if (shared)
+                store_shared(e);
+
             return e;
         }
 
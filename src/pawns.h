@@ -19,6 +19,9 @@
 #ifndef PAWNS_H_INCLUDED
 #define PAWNS_H_INCLUDED
 
+#include <cstddef>
+#include <iosfwd>
+
 #include "misc.h"
 #include "position.h"
 #include "types.h"
@@ -61,9 +64,12 @@ namespace Stockfish::Pawns {
         int blockedCount;
     };
 
-    using Table = HashTable<Entry, 131072>;
+    using Table = HashTable<Entry>;
 
     Entry* probe(const Position& pos);
+    void   set_shared(size_t entries);
+    void   print_stats(std::ostream& os);
+    void   clear_stats();
 
 } // namespace Stockfish::Pawns
 
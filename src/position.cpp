@@ -22,15 +22,17 @@
 #include <atomic>
 #include <cassert>
 #include <cctype>
+#include <charconv>
 #include <cstddef>
 #include <cstring>
 #include <initializer_list>
 #include <iomanip>
 #include <iostream>
-#include <regex>
+#include <mutex>
 #include <sstream>
 #include <string_view>
 #include <utility>
+#include <vector>
 
 #include "bitboard.h"
 #include "book.h"
@@ -58,9 +60,170 @@ namespace Stockfish {
 
         constexpr Piece Pieces[] = { W_PAWN, W_KNIGHT, W_BISHOP, W_ROOK, W_QUEEN, W_KING,
                                      B_PAWN, B_KNIGHT, B_BISHOP, B_ROOK, B_QUEEN, B_KING };
+
+        // Splits a FEN string into its fields and checks the characters of each of them,
+        // in place of the former regex that cost more than setting up the position.
+        // Returns the number of fields found, 0 if the string is not a valid FEN.
+        int split_fen(std::string_view fen, std::string_view(&fields)[6]) {
+
+            int n = 0;
+            for (size_t i = 0; i < fen.size();)
+            {
+                if (std::isspace(static_cast<unsigned char>(fen[i])))
+                {
+                    ++i;
+                    continue;
+                }
+
+                if (n == 6)
+                    return 0;
+
+                size_t end = i;
+                while (end < fen.size() && !std::isspace(static_cast<unsigned char>(fen[end])))
+                    ++end;
+
+                fields[n++] = fen.substr(i, end - i);
+                i = end;
+            }
+
+            auto only = [](std::string_view field, std::string_view chars) {
+                return field.find_first_not_of(chars) == std::string_view::npos;
+            };
+
+            if (n < 2
+                || !only(fields[0], "pnbrqkPNBRQK12345678/")
+                || (fields[1] != "w" && fields[1] != "b")
+                || (n > 2 && fields[2] != "-" && !only(fields[2], "KQkqABCDEFGHabcdefgh"))
+                || (n > 3 && fields[3] != "-" && (fields[3].size() != 2
+                    || fields[3][0] < 'a' || fields[3][0] > 'h' || fields[3][1] < '1' || fields[3][1] > '8'))
+                || (n > 4 && fields[4] != "-" && !only(fields[4], "0123456789"))
+                || (n > 5 && !only(fields[5], "0123456789")))
+                return 0;
+
+            return n;
+        }
+
+        template<typename T>
+        void parse_number(std::string_view field, T& value) {
+            std::from_chars(field.data(), field.data() + field.size(), value);
+        }
+
+        // Returns the first n in [0, count) with keys[-n] == key, or -1. The keys of the key
+        // ring lie in a row before keys, four of them are compared at once with AVX2.
+        int find_key(const Key* keys, int count, Key key) {
+
+            int n = 0;
+
+#if defined(USE_AVX2)
+            const __m256i k = _mm256_set1_epi64x(std::int64_t(key));
+            for (; n + 4 <= count; n += 4)
+            {
+                const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys - n - 3));
+                if (const int mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(v, k))))
+                    return n + 3 - int(msb(Bitboard(mask))); // The highest lane is keys[-n]
+            }
+#endif
+
+            for (; n < count; ++n)
+                if (keys[-n] == key)
+                    return n;
+
+            return -1;
+        }
+
+        // The free lists of the StatePool, a handful is enough for every batch loop
+        constexpr size_t            MaxPooledLists = 16;
+        std::vector<StateListPtr>   pooledLists;
+        std::mutex                  poolMutex;
+
+        // The free blocks of states of the lists, carved out of larger chunks that are kept
+        // until the program ends. A std::deque always asks for blocks of one size, the size
+        // of the first block asked for is the one kept.
+        constexpr size_t BlocksPerChunk = 64;
+        size_t           blockBytes = 0;
+        void*            freeBlocks = nullptr;
+        std::mutex       blockMutex;
     } // namespace
 
 
+    // Returns a block of states of a list, from the free blocks if it has the usual size
+    void* StatePool::allocate(size_t bytes) {
+
+        {
+            std::lock_guard<std::mutex> lock(blockMutex);
+            if (!blockBytes)
+                blockBytes = bytes;
+
+            if (bytes == blockBytes)
+            {
+                if (!freeBlocks)
+                {
+                    char* chunk = static_cast<char*>(::operator new(BlocksPerChunk * bytes));
+                    for (size_t i = 0; i < BlocksPerChunk; ++i)
+                    {
+                        *reinterpret_cast<void**>(chunk + i * bytes) = freeBlocks;
+                        freeBlocks = chunk + i * bytes;
+                    }
+                }
+
+                void* p = freeBlocks;
+                freeBlocks = *static_cast<void**>(p);
+                return p;
+            }
+        }
+
+        return ::operator new(bytes);
+    }
+
+    void StatePool::deallocate(void* p, size_t bytes) {
+
+        {
+            std::lock_guard<std::mutex> lock(blockMutex);
+            if (bytes == blockBytes)
+            {
+                *static_cast<void**>(p) = freeBlocks;
+                freeBlocks = p;
+                return;
+            }
+        }
+
+        ::operator delete(p);
+    }
+
+
+    // Hands out a list holding one state, the first state of a released list if there
+    // is any. Unlike a new list its state is not zeroed, Position::set() does what is needed.
+    StateListPtr StatePool::acquire() {
+
+        {
+            std::lock_guard<std::mutex> lock(poolMutex);
+            if (!pooledLists.empty())
+            {
+                StateListPtr states = std::move(pooledLists.back());
+                pooledLists.pop_back();
+                return states;
+            }
+        }
+
+        return StateListPtr(new StateList(1));
+    }
+
+    // Takes back a list that is no longer needed. It is cut back to its first state,
+    // whose storage the deque keeps, so that acquire() does not allocate again.
+    void StatePool::release(StateListPtr&& states) {
+
+        if (!states || states->empty())
+            return;
+
+        states->erase(states->begin() + 1, states->end());
+
+        std::lock_guard<std::mutex> lock(poolMutex);
+        if (pooledLists.size() < MaxPooledLists)
+            pooledLists.push_back(std::move(states));
+        states.reset();
+    }
+
+
     // Returns an ASCII representation of the position
     std::ostream& operator<<(std::ostream& os, const Position& pos) {
 
@@ -86,14 +249,13 @@ namespace Stockfish {
                 os << UCI::square(pop_lsb(b)) << " ";
         }
 
-        const auto* book_entry = Book::find_opening(pos);
-        if (book_entry)
-            os << "\nPosition: " << book_entry->opening;
+        const auto opening = Book::find_opening(pos);
+        if (!opening.empty())
+            os << "\nPosition: " << opening;
 
         if (int(Tablebases::MaxCardinality) >= popcount(pos.pieces()) && !pos.can_castle(ANY_CASTLING))
         {
             StateInfo st;
-            ASSERT_ALIGNED(&st, Eval::NNUE::CacheLineSize);
 
             Position p;
             p.set(pos.fen(), pos.is_chess960(), &st, pos.this_thread());
@@ -191,7 +353,7 @@ namespace Stockfish {
     // Initializes the position object with the given FEN string.
     // This function is not very robust - make sure that input FENs are correct,
     // this is assumed to be the responsibility of the GUI.
-    Position& Position::set(const std::string& fenStr, bool isChess960, StateInfo* si, Thread* th) {
+    Position& Position::set(std::string_view fenStr, bool isChess960, StateInfo* si, Thread* th) {
     /*
        A FEN string defines a particular position using only the ASCII character set.
 
@@ -228,30 +390,28 @@ namespace Stockfish {
 
         assert(si);
 
-        // Validate FEN string with RegEx.
+        // Validate the FEN string and split it into its fields, without copying it. Batch
+        // loops set up millions of positions, Endgames::init() 30 of them at startup.
+        std::string_view fields[6];
+        const int        fieldCount = split_fen(fenStr, fields);
+        if (!fieldCount)
         {
-            std::smatch match;
-            std::regex rx(R"(([pnbrqkPNBRQK1-8\/]*)[\s]*([wb])[\s]*(-|K?Q?k?q?|[A-H]?[A-H]?[a-h]?[a-h]?)[\s]*(-|[a-h][1-8])?[\s]*?(-|[\d]*)?[\s]*?([\d]*)?[\s]*)");
-            if (!std::regex_match(fenStr, match, rx))
-            {
-                std::cerr << "ERROR: Not a valid FEN string!" << std::endl;
-                return *this;
-            }
+            std::cerr << "ERROR: Not a valid FEN string!" << std::endl;
+            return *this;
         }
 
-        unsigned char      col, row, token;
-        size_t             idx;
-        Square             sq = SQ_A8;
-        std::istringstream ss(fenStr);
+        size_t idx;
+        Square sq = SQ_A8;
 
+        // The accumulators and the piece attacks of the position go to the first entry of the
+        // state stack of the thread. Positions without a thread are never evaluated.
         std::memset(this, 0, sizeof(Position));
         std::memset(si, 0, sizeof(StateInfo));
+        si->data = th ? th->stateStack : nullptr;
         st = si;
 
-        ss >> std::noskipws;
-
         // 1. Piece placement
-        while ((ss >> token) && !isspace(token))
+        for (char token : fields[0])
         {
             if (isdigit(token))
                 sq += (token - '0') * EAST; // Advance the given number of files
@@ -267,16 +427,14 @@ namespace Stockfish {
         }
 
         // 2. Active color
-        ss >> token;
-        sideToMove = (token == 'w' ? WHITE : BLACK);
-        ss >> token;
+        sideToMove = (fields[1] == "w" ? WHITE : BLACK);
 
         // 3. Castling availability. Compatible with 3 standards: Normal FEN standard,
         // Shredder-FEN that uses the letters of the columns on which the rooks began
         // the game instead of KQkq and also X-FEN standard that, in case of Chess960,
         // if an inner rook is associated with the castling right, the castling tag is
         // replaced by the file letter of the involved rook, as for the Shredder-FEN.
-        while ((ss >> token) && !isspace(token))
+        for (char token : fieldCount > 2 ? fields[2] : std::string_view())
         {
             Square rsq;
             Color  c = islower(token) ? BLACK : WHITE;
@@ -307,9 +465,9 @@ namespace Stockfish {
         // Ignore if square is invalid or not on side to move relative rank 6.
         bool enpassant = false;
 
-        if (((ss >> col) && (col >= 'a' && col <= 'h')) && ((ss >> row) && (row == (sideToMove == WHITE ? '6' : '3'))))
+        if (fieldCount > 3 && fields[3].size() == 2 && fields[3][1] == (sideToMove == WHITE ? '6' : '3'))
         {
-            st->epSquare = make_square(File(col - 'a'), Rank(row - '1'));
+            st->epSquare = make_square(File(fields[3][0] - 'a'), Rank(fields[3][1] - '1'));
 
             // En passant square will be considered only if
             // a) side to move has a pawn threatening epSquare
@@ -324,7 +482,10 @@ namespace Stockfish {
             st->epSquare = SQ_NONE;
 
         // 5-6. Halfmove clock and fullmove number
-        ss >> std::skipws >> st->rule50 >> gamePly;
+        if (fieldCount > 4)
+            parse_number(fields[4], st->rule50);
+        if (fieldCount > 5)
+            parse_number(fields[5], gamePly);
 
         // Convert from fullmove starting from 1 to gamePly starting from 0,
         // handle also common incorrect FEN with fullmove = 0.
@@ -334,6 +495,9 @@ namespace Stockfish {
         thisThread = th;
         set_state();
 
+        keyPly = 0;
+        push_key(st->key);
+
         assert(pos_is_ok());
 
         return *this;
@@ -558,6 +722,56 @@ namespace Stockfish {
     }
 
 
+    // Returns the attacks of the knights, bishops, rooks and queens by square as the classic
+    // evaluation sees them: bishops x-ray through queens, rooks through queens and rooks of
+    // their color. When the attacks of the previous position are known only the pieces touched
+    // by the last move, and the pieces whose attacks reach one of its squares, are computed again.
+    const Bitboard* Position::piece_attacks() const {
+
+        Bitboard* attacks = st->data->pieceAttacks;
+
+        if (st->attacksComputed && st->data->attacksOwner == st)
+            return attacks;
+
+        // The previous state must be on the same stack, the states before the root of a
+        // search are on the stack of the thread that set up the position.
+        const StateInfo* prev = st->previous;
+        const bool incremental = prev && prev->data + 1 == st->data && prev->attacksComputed
+            && prev->data->attacksOwner == prev && st->dirtyPiece.dirty_num >= 0;
+        Bitboard changed = 0;
+
+        if (incremental)
+            for (int i = 0; i < st->dirtyPiece.dirty_num; ++i)
+            {
+                if (is_ok(st->dirtyPiece.from[i]))
+                    changed |= st->dirtyPiece.from[i];
+                if (is_ok(st->dirtyPiece.to[i]))
+                    changed |= st->dirtyPiece.to[i];
+            }
+
+        Bitboard b = pieces(KNIGHT, BISHOP) | pieces(ROOK, QUEEN);
+        while (b)
+        {
+            Square s = pop_lsb(b);
+
+            if (incremental && !((prev->data->pieceAttacks[s] | s) & changed))
+            {
+                attacks[s] = prev->data->pieceAttacks[s];
+                continue;
+            }
+
+            Piece pc = piece_on(s);
+            attacks[s] = type_of(pc) == BISHOP ? attacks_bb<BISHOP>(s, pieces() ^ pieces(QUEEN))
+                : type_of(pc) == ROOK ? attacks_bb<ROOK>(s, pieces() ^ pieces(QUEEN) ^ pieces(color_of(pc), ROOK))
+                : attacks_bb(type_of(pc), s, pieces());
+        }
+
+        st->attacksComputed = true;
+        st->data->attacksOwner = st;
+        return attacks;
+    }
+
+
     // Tests whether a pseudo-legal move is legal
     bool Position::legal(Move m) const {
 
@@ -766,11 +980,18 @@ namespace Stockfish {
             ++st->pliesFromNull;
 
             // Used by NNUE
-            st->accumulator.computed[WHITE] = false;
-            st->accumulator.computed[BLACK] = false;
+            st->data = thisThread->next_state_data(st->previous->data);
+            st->nnueComputed[Eval::NNUE::Big][WHITE] = false;
+            st->nnueComputed[Eval::NNUE::Big][BLACK] = false;
+            st->nnueComputed[Eval::NNUE::Small][WHITE] = false;
+            st->nnueComputed[Eval::NNUE::Small][BLACK] = false;
             dp = &st->dirtyPiece;
             dp->dirty_num = 1;
         }
+        else
+            st->dirtyPiece.dirty_num = -1; // Not recorded, piece_attacks() starts from scratch
+
+        st->attacksComputed = false;
 
         Color  us = sideToMove;
         Color  them = ~us;
@@ -947,19 +1168,22 @@ namespace Stockfish {
         // negative in the 3-fold case, or zero if the position was not repeated.
         if constexpr (Update)
         {
+            ++keyPly;
+            push_key(st->key);
+
             st->repetition = 0;
-            int end = std::min(st->rule50, st->pliesFromNull);
+            int end = ring_window();
             if (end >= 4)
             {
-                StateInfo* stp = st->previous->previous;
-                for (int i = 4; i <= end; i += 2)
+                const int n = find_key(ring_keys(4), (end - 4) / 2 + 1, st->key);
+                if (n >= 0)
                 {
-                    stp = stp->previous->previous;
-                    if (stp->key == st->key)
-                    {
-                        st->repetition = stp->repetition ? -i : i;
-                        break;
-                    }
+                    const int  i = 4 + 2 * n;
+                    StateInfo* stp = st;
+                    for (int j = 0; j < i; ++j)
+                        stp = stp->previous;
+
+                    st->repetition = stp->repetition ? -i : i;
                 }
             }
         }
@@ -1030,7 +1254,10 @@ namespace Stockfish {
         // Finally point our state pointer back to the previous state
         st = st->previous;
         if constexpr (Update)
+        {
             --gamePly;
+            --keyPly;
+        }
 
         assert(pos_is_ok());
     }
@@ -1076,15 +1303,19 @@ namespace Stockfish {
         assert(!checkers());
         assert(&newSt != st);
 
-        std::memcpy(&newSt, st, offsetof(StateInfo, accumulator));
+        std::memcpy(&newSt, st, offsetof(StateInfo, data));
 
         newSt.previous = st;
         st = &newSt;
 
+        st->data = thisThread->next_state_data(st->previous->data);
         st->dirtyPiece.dirty_num = 0;
         st->dirtyPiece.piece[0] = NO_PIECE; // Avoid checks in UpdateAccumulator()
-        st->accumulator.computed[WHITE] = false;
-        st->accumulator.computed[BLACK] = false;
+        st->nnueComputed[Eval::NNUE::Big][WHITE] = false;
+        st->nnueComputed[Eval::NNUE::Big][BLACK] = false;
+        st->nnueComputed[Eval::NNUE::Small][WHITE] = false;
+        st->nnueComputed[Eval::NNUE::Small][BLACK] = false;
+        st->attacksComputed = false;
 
         if (st->epSquare != SQ_NONE)
         {
@@ -1104,6 +1335,9 @@ namespace Stockfish {
 
         st->repetition = 0;
 
+        ++keyPly;
+        push_key(st->key);
+
         assert(pos_is_ok());
     }
 
@@ -1115,6 +1349,7 @@ namespace Stockfish {
 
         st = st->previous;
         sideToMove = ~sideToMove;
+        --keyPly;
     }
 
 
@@ -1137,6 +1372,31 @@ namespace Stockfish {
         return (captured || type_of(pc) == PAWN) ? k : adjust_key50<true>(k);
     }
 
+    // Like key_after(), the material and the pawn key after the given move, for the
+    // speculative prefetch of the material and the pawn hash tables
+    Key Position::material_key_after(Move m) const {
+
+        Piece captured = piece_on(m.to_sq());
+        return captured ? st->materialKey ^ Zobrist::psq[captured][pieceCount[captured] - 1] : st->materialKey;
+    }
+
+    Key Position::pawn_key_after(Move m) const {
+
+        Square from = m.from_sq();
+        Square to = m.to_sq();
+        Piece  pc = piece_on(from);
+        Piece  captured = piece_on(to);
+        Key    k = st->pawnKey;
+
+        if (type_of(captured) == PAWN)
+            k ^= Zobrist::psq[captured][to];
+
+        if (type_of(pc) == PAWN)
+            k ^= Zobrist::psq[pc][from] ^ Zobrist::psq[pc][to];
+
+        return k;
+    }
+
 
     // Tests if the SEE (Static Exchange Evaluation) value of move is greater or equal to the given threshold.
     // We'll use an algorithm similar to alpha-beta pruning with a null window.
@@ -1247,6 +1507,110 @@ namespace Stockfish {
     template bool Position::see_ge<true>(Move m, Value threshold) const;
 
 
+    // Returns the SEE value of the move, see_ge(m, threshold) is see(m) >= threshold. The
+    // captures are those of see_ge() but all of them are made, without its early exits, and
+    // the gains are then negamaxed back, so it costs more than a single see_ge() but gives
+    // the answer for every threshold. The MovePicker keeps it for the search.
+    template <bool Classic>
+    int Position::see(Move m) const {
+
+        assert(m.is_ok());
+
+        if (m.type_of() != NORMAL)
+            return 0;
+
+        Square from = m.from_sq(), to = m.to_sq();
+
+        // gain[d] is what the side making the d-th capture wins if the exchange stops there
+        int gain[32], d = 0;
+        gain[0] = Classic ? PieceValueME[MG][piece_on(to)] : PieceValue[piece_on(to)];
+        int onTo = Classic ? PieceValueME[MG][piece_on(from)] : PieceValue[piece_on(from)];
+
+        Bitboard occupied = pieces() ^ from ^ to;
+        Color    stm = sideToMove;
+        Bitboard attackers = attackers_to(to, occupied);
+        Bitboard stmAttackers, bb;
+
+        while (true)
+        {
+            stm = ~stm;
+            attackers &= occupied;
+
+            if (!(stmAttackers = attackers & pieces(stm)))
+                break;
+
+            if (pinners(~stm) & occupied)
+            {
+                stmAttackers &= ~blockers_for_king(stm);
+
+                if (!stmAttackers)
+                    break;
+            }
+
+            // The king only captures when the opponent has no more attackers
+            if (!(stmAttackers & ~pieces(KING)) && (attackers & ~pieces(stm)))
+                break;
+
+            ++d;
+            gain[d] = onTo - gain[d - 1];
+
+            if ((bb = stmAttackers & pieces(PAWN)))
+            {
+                onTo = Classic ? PawnValueMg : PawnValue;
+                occupied ^= least_significant_square_bb(bb);
+
+                attackers |= attacks_bb<BISHOP>(to, occupied) & pieces(BISHOP, QUEEN);
+            }
+
+            else if ((bb = stmAttackers & pieces(KNIGHT)))
+            {
+                onTo = KnightValue;
+                occupied ^= least_significant_square_bb(bb);
+            }
+
+            else if ((bb = stmAttackers & pieces(BISHOP)))
+            {
+                onTo = BishopValue;
+                occupied ^= least_significant_square_bb(bb);
+
+                attackers |= attacks_bb<BISHOP>(to, occupied) & pieces(BISHOP, QUEEN);
+            }
+
+            else if ((bb = stmAttackers & pieces(ROOK)))
+            {
+                onTo = RookValue;
+                occupied ^= least_significant_square_bb(bb);
+
+                attackers |= attacks_bb<ROOK>(to, occupied) & pieces(ROOK, QUEEN);
+            }
+
+            else if ((bb = stmAttackers & pieces(QUEEN)))
+            {
+                onTo = QueenValue;
+                occupied ^= least_significant_square_bb(bb);
+
+                attackers |= (attacks_bb<BISHOP>(to, occupied) & pieces(BISHOP, QUEEN))
+                           | (attacks_bb<ROOK>  (to, occupied) & pieces(ROOK,   QUEEN));
+            }
+
+            else // KING, nothing can recapture
+                break;
+        }
+
+        // Each side may as well not capture, the first capture is the move itself
+        while (d)
+        {
+            gain[d - 1] = -std::max(-gain[d - 1], gain[d]);
+            --d;
+        }
+
+        return gain[0];
+    }
+
+    template int Position::see<false>(Move m) const;
+    template int Position::see<true>(Move m) const;
+
+
     // Tests whether the position is drawn by 50-move rule or by repetition.
     // It does not detect stalemates.
     bool Position::is_draw(int ply) const {
@@ -1260,6 +1624,20 @@ namespace Stockfish {
     }
 
 
+    // Loads the keys of the positions the new state follows into the key ring, as far as
+    // they can repeat. Needed when the state was replaced after set(), like the root state
+    // of the threads that carries the game history.
+    void Position::sync_keys() {
+
+        const int        n = ring_window();
+        const StateInfo* s = st;
+        for (keyPly = n; keyPly >= 0; --keyPly, s = s->previous)
+            push_key(s->key);
+
+        keyPly = n;
+    }
+
+
     // Tests whether there has been at least one repetition of positions since the last capture or pawn move.
     bool Position::has_repeated() const {
 
@@ -1281,19 +1659,17 @@ namespace Stockfish {
     bool Position::has_game_cycle(int ply) const {
 
         int j;
-        int end = std::min(st->rule50, st->pliesFromNull);
+        int end = ring_window();
 
         if (end < 3)
             return false;
 
         Key        originalKey = st->key;
-        StateInfo* stp = st->previous;
+        const Key* keys = ring_keys(3);
 
-        for (int i = 3; i <= end; i += 2)
+        for (int i = 3; i <= end; i += 2, --keys)
         {
-            stp = stp->previous->previous;
-
-            Key moveKey = originalKey ^ stp->key;
+            Key moveKey = originalKey ^ *keys;
             if ((j = H1(moveKey), cuckoo[j] == moveKey) || (j = H2(moveKey), cuckoo[j] == moveKey))
             {
                 Move   move = cuckooMove[j];
@@ -1313,6 +1689,10 @@ namespace Stockfish {
                         continue;
 
                     // For repetitions before or at the root, require one more
+                    const StateInfo* stp = st;
+                    for (int k = 0; k < i; ++k)
+                        stp = stp->previous;
+
                     if (stp->repetition)
                         return true;
                 }
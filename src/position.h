@@ -19,11 +19,14 @@
 #ifndef POSITION_H_INCLUDED
 #define POSITION_H_INCLUDED
 
+#include <algorithm>
 #include <cassert>
 #include <deque>
 #include <iosfwd>
 #include <memory>
 #include <string>
+#include <string_view>
+#include <type_traits>
 
 #include "bitboard.h"
 #include "nnue/nnue_accumulator.h"
@@ -35,6 +38,8 @@ namespace Stockfish {
     // StateInfo struct stores information needed to restore a Position object to its previous state when we retract a move.
     // Whenever a move is made on the board (by calling Position::do_move), a StateInfo object must be passed.
 
+    struct StateData;
+
     struct StateInfo {
 
         // Copied when making a move
@@ -56,17 +61,82 @@ namespace Stockfish {
         Piece      capturedPiece;
         int        repetition;
 
-        // Used by NNUE
-        Eval::NNUE::Accumulator accumulator;
-        DirtyPiece              dirtyPiece;
+        // The NNUE accumulators and the piece attacks of the classic evaluation are kept on the
+        // state stack of the thread, see StateData. The flags tell what has been computed.
+        StateData* data;
+        bool       nnueComputed[2][COLOR_NB]; // Indexed by NetSize and perspective
+        bool       attacksComputed;
+        DirtyPiece dirtyPiece;
+    };
+
+    // The bulky part of a state, several KB. Every thread has a stack of them indexed by the
+    // ply since the last Position::set(), so that the states of the search stack and of the
+    // game history fit in a few cache lines. An entry is reused whenever its ply comes again,
+    // the owners tell whether it still holds the data of a state.
+    struct StateData {
+        Eval::NNUE::Accumulator<Eval::NNUE::TransformedFeatureDimensionsBig>   accumulatorBig;
+        Eval::NNUE::Accumulator<Eval::NNUE::TransformedFeatureDimensionsSmall> accumulatorSmall;
+
+        // Used by the classic evaluation, see Position::piece_attacks()
+        Bitboard         pieceAttacks[SQUARE_NB];
+        const StateInfo* attacksOwner = nullptr;
     };
 
 
+    // Keeps the state lists of the batch loops (bench, test mate, the position command)
+    // for reuse, a released list is handed out again instead of allocating a new one.
+    // The blocks of states of the lists come from free lists as well, see StateAllocator.
+    namespace StatePool {
+
+        void* allocate(std::size_t bytes);
+        void  deallocate(void* p, std::size_t bytes);
+
+    } // namespace StatePool
+
+    // Allocator of the state lists. The blocks of states a std::deque asks for are taken from
+    // and given back to the free lists of the StatePool, so that the states of a long game are
+    // not allocated one by one again for every position command. Anything else is allocated
+    // as usual.
+    template<typename T>
+    struct StateAllocator {
+
+        using value_type = T;
+
+        StateAllocator() = default;
+        template<typename U>
+        StateAllocator(const StateAllocator<U>&) noexcept {}
+
+        T* allocate(std::size_t n) {
+            if constexpr (std::is_same_v<T, StateInfo>)
+                return static_cast<T*>(StatePool::allocate(n * sizeof(T)));
+            else
+                return std::allocator<T>().allocate(n);
+        }
+
+        void deallocate(T* p, std::size_t n) noexcept {
+            if constexpr (std::is_same_v<T, StateInfo>)
+                StatePool::deallocate(p, n * sizeof(T));
+            else
+                std::allocator<T>().deallocate(p, n);
+        }
+
+        template<typename U>
+        bool operator==(const StateAllocator<U>&) const noexcept { return true; }
+    };
+
     // A list to keep track of the position states along the setup moves
     // (from the start position to the position just before the search starts).
     // Needed by 'draw by repetition' detection.
     // Use a std::deque because pointers to elements are not invalidated upon list resizing.
-    using StateListPtr = std::unique_ptr<std::deque<StateInfo>>;
+    using StateList = std::deque<StateInfo, StateAllocator<StateInfo>>;
+    using StateListPtr = std::unique_ptr<StateList>;
+
+    namespace StatePool {
+
+        StateListPtr acquire();
+        void         release(StateListPtr&& states);
+
+    } // namespace StatePool
 
 
     // Position class stores information regarding the board representation as pieces, side to move,
@@ -83,7 +153,7 @@ namespace Stockfish {
         Position& operator=(const Position&) = delete;
 
         // FEN string input/output
-        Position& set(const std::string& fenStr, bool isChess960, StateInfo* si, Thread* th);
+        Position& set(std::string_view fenStr, bool isChess960, StateInfo* si, Thread* th);
         Position& set(const std::string& code, Color c, StateInfo* si);
         std::string fen() const;
 
@@ -121,6 +191,7 @@ namespace Stockfish {
         Bitboard attacks_from(PieceType pt, Square s) const;
         template<PieceType> Bitboard attacks_from(Square s) const;
         template<PieceType> Bitboard attacks_from(Square s, Color c) const;
+        const Bitboard* piece_attacks() const;
         template<PieceType Pt>
         Bitboard attacks_by(Color c) const;
 
@@ -148,12 +219,16 @@ namespace Stockfish {
         // Static Exchange Evaluation
         template<bool Classic = false>
         bool see_ge(Move m, int threshold = 0) const;
+        template<bool Classic = false>
+        int  see(Move m) const;
 
         // Accessing hash keys
         Key key() const;
         Key key_after(Move m) const;
         Key material_key() const;
+        Key material_key_after(Move m) const;
         Key pawn_key() const;
+        Key pawn_key_after(Move m) const;
 
         // Other properties of the position
         Color   side_to_move() const;
@@ -176,6 +251,9 @@ namespace Stockfish {
         // Used by NNUE
         StateInfo* state() const;
 
+        // Loads the key ring from the StateInfo chain, after the state was replaced
+        void sync_keys();
+
         void put_piece(Piece pc, Square s);
         void remove_piece(Square s);
         void move_piece(Square from, Square to);
@@ -193,8 +271,17 @@ namespace Stockfish {
         // Other helpers
         template<bool Do> void do_castling(Color us, Square from, Square& to, Square& rfrom, Square& rto);
         template<bool AfterMove> Key adjust_key50(Key k) const;
+        void       push_key(Key k);
+        const Key* ring_keys(int distance) const;
+        int        ring_window() const;
+
+        // The keys of the last positions, by side to move and stored twice, so that the keys of
+        // the last KeyRingSize positions of a side lie in a row. The repetition and cycle checks
+        // scan them instead of following StateInfo::previous, a state per cache line.
+        static constexpr int KeyRingSize = 128;
 
         // Data members
+        Key        keyRing[COLOR_NB][2 * KeyRingSize];
         Piece      board[SQUARE_NB];
         Bitboard   byTypeBB[PIECE_TYPE_NB];
         Bitboard   byColorBB[COLOR_NB];
@@ -205,6 +292,7 @@ namespace Stockfish {
         Thread*    thisThread;
         StateInfo* st;
         int        gamePly;
+        int        keyPly; // Positions since set(), indexes the key ring
         Color      sideToMove;
         Score      psq;
         bool       chess960;
@@ -355,6 +443,26 @@ namespace Stockfish {
 
     inline int Position::game_ply() const { return gamePly; }
 
+    inline void Position::push_key(Key k) {
+        Key* ring = keyRing[keyPly & 1];
+        const int slot = (keyPly >> 1) & (KeyRingSize - 1);
+        ring[slot] = ring[slot + KeyRingSize] = k;
+    }
+
+    // The key of the position distance plies ago, p[-n] is the one 2 * n plies before that
+    inline const Key* Position::ring_keys(int distance) const {
+        assert(keyPly >= distance);
+        const int ply = keyPly - distance;
+        return &keyRing[ply & 1][((ply >> 1) & (KeyRingSize - 1)) + KeyRingSize];
+    }
+
+    // How many plies back a position can repeat: since the last capture, pawn move or null move.
+    // Any position more than 100 plies back is already a draw by the 50-move rule, so the ring
+    // may cut off what it does not keep.
+    inline int Position::ring_window() const {
+        return std::min({ st->rule50, st->pliesFromNull, 2 * KeyRingSize - 2 });
+    }
+
     inline int Position::rule50_count() const { return st->rule50; }
 
     inline bool Position::opposite_bishops() const {
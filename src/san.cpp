@@ -1,7 +1,6 @@
 #include <cassert>
 #include <algorithm>
-#include <regex>
-#include <sstream>
+#include <string_view>
 #include <vector>
 #include "san.h"
 #include "movegen.h"
@@ -15,24 +14,25 @@
 namespace Stockfish::SAN
 {
 
-	bool is_ok(const std::string& s)
-	{
-		std::smatch match;
-		std::regex rx("([a-h][1-8])([a-h][1-8])([qrbn]?)");
-		if (std::regex_match(s, match, rx))
-			return true;
-
-		rx = R"(([NBRQK])?([a-h1-8])?([1-8])?([x])?([a-h][1-8])(\=[NBRQ])?.*)";
-		if (std::regex_match(s, match, rx))
-			return true;
-
-		std::string castle(s);
-		std::for_each(castle.begin(), castle.end(), [](char& c) { c = tolower(c); });
-		return castle == "o-o" || s == "o-o-o";
-	}
+	// A move in LAN or SAN, split into its parts by parse(). PGN files and book lines are
+	// replayed move by move, so this is done in one pass without any regex.
+	struct Token {
+
+		enum Kind { NONE, LAN, SAN, CASTLE_KING, CASTLE_QUEEN };
+
+		Kind      kind = NONE;
+		PieceType pt = PAWN;
+		PieceType promotion = NO_PIECE_TYPE; // As given, LAN and SAN default to a queen
+		Square    from = SQ_NONE, to = SQ_NONE;
+		File      file = File(-1);           // Disambiguation of SAN, if any
+		Rank      rank = Rank(-1);
+	};
+
+	static bool is_file(char c) { return c >= 'a' && c <= 'h'; }
+	static bool is_rank(char c) { return c >= '1' && c <= '8'; }
 
 	// Helper: returns square from an AN string.
-	static Square get_square_from(const std::string& s) {
+	static Square get_square_from(std::string_view s) {
 
 		return make_square(File(s[0] - 'a'), Rank(s[1] - '1'));
 	}
@@ -41,296 +41,306 @@ namespace Stockfish::SAN
 	static PieceType get_pt_from_prom(char c) {
 
 		static std::string_view PieceToChar("  nbrq");
-		size_t idx = PieceToChar.find(tolower(c));
-		return idx != std::string::npos ? PieceType(idx) : QUEEN;
+		size_t idx = PieceToChar.find(char(tolower(c)));
+		return idx != std::string::npos && c ? PieceType(idx) : QUEEN;
 	}
 
 	// Helper: returns the piece type from a character.
 	static PieceType get_pt(char c) {
 
 		static std::string_view PieceToChar(" pnbrqk");
-		size_t idx = PieceToChar.find(tolower(c));
+		size_t idx = PieceToChar.find(char(tolower(c)));
 		return idx != std::string::npos ? PieceType(idx) : PAWN;
 	}
 
-	// Helper: returns a Move from the given parameters.
-	using ret = std::pair<std::string, Move>;
+	// Splits a move into its parts. Accepted are LAN like "e2e4" and "e7e8q", SAN like "Nf3",
+	// "Nbd7", "R1a3", "exd5" and "e8=Q", followed by anything such as "+", "#" or "!?", and
+	// castling as "O-O", "o-o" or "0-0", followed by check marks and annotations only.
+	static Token parse(std::string_view s) {
 
-	static ret get_move_from(const Position& pos, PieceType pt, Square to, PieceType promotion, File file, Rank rank) {
+		Token t;
+		const size_t n = s.size();
 
-		MoveList<LEGAL> ml(pos);
-		std::vector<ExtMove> list(ml.begin(), ml.end());
-			
-		std::erase_if(list, [&](const auto& m) {
+		// LAN
+		if ((n == 4 || n == 5) && is_file(s[0]) && is_rank(s[1]) && is_file(s[2]) && is_rank(s[3])
+			&& (n == 4 || std::string_view("qrbn").find(s[4]) != std::string_view::npos))
+		{
+			t.kind = Token::LAN;
+			t.from = get_square_from(s);
+			t.to = get_square_from(s.substr(2));
+			t.promotion = n == 5 ? get_pt_from_prom(s[4]) : NO_PIECE_TYPE;
+			return t;
+		}
 
-			return (m.to_sq() != to
-				|| type_of(pos.piece_on(m.from_sq())) != pt
-				|| (m.type_of() == PROMOTION && (!promotion || m.promotion_type() != promotion)));
-			});
+		// Castling, nothing else begins with one of these
+		if (n && (s[0] == 'O' || s[0] == 'o' || s[0] == '0'))
+		{
+			size_t i = 1;
+			int    sides = 1;
+			while (i + 1 < n && s[i] == '-' && s[i + 1] == s[0])
+				i += 2, ++sides;
+
+			if ((sides == 2 || sides == 3) && s.find_first_not_of("+#!?", i) == std::string_view::npos)
+				t.kind = sides == 2 ? Token::CASTLE_KING : Token::CASTLE_QUEEN;
+			return t;
+		}
 
-		if (list.size() == 0)
-			return { "", Move::none() };
+		// SAN: [NBRQK]? [a-h1-8]? [1-8]? x? [a-h][1-8] (=[NBRQ])? and anything after that.
+		// Of the possible target squares the last one is taken, e.g. "Ng1f3" moves to f3.
+		size_t i = 0;
+		if (n && std::string_view("NBRQK").find(s[0]) != std::string_view::npos)
+			t.pt = get_pt(s[i++]);
 
-		// Disambiguating
-		if (list.size() > 1)
+		for (size_t j = n >= i + 2 ? std::min(i + 3, n - 2) + 1 : 0; j-- > i;)
 		{
-			if (file >= FILE_A && file <= FILE_H)
-				std::erase_if(list, [&](const auto& m) { return file_of(m.from_sq()) != file; });
-			if (rank >= RANK_1 && rank <= RANK_8)
-				std::erase_if(list, [&](const auto& m) { return rank_of(m.from_sq()) != rank; });
-		}
+			if (!is_file(s[j]) || !is_rank(s[j + 1]))
+				continue;
+
+			// The part between the piece and the target square
+			std::string_view amb = s.substr(i, j - i);
+			if (!amb.empty() && amb.back() == 'x')
+				amb.remove_suffix(1);
 
-		if (list.size() == 1)
-			return { UCI::move(list[0],pos.is_chess960()), list[0] };
+			File file = File(-1);
+			Rank rank = Rank(-1);
+			if (!amb.empty() && (is_file(amb[0]) || is_rank(amb[0])))
+			{
+				if (is_file(amb[0]))
+					file = File(amb[0] - 'a');
+				else
+					rank = Rank(amb[0] - '1');
+				amb.remove_prefix(1);
+			}
+			if (!amb.empty() && is_rank(amb[0]))
+			{
+				rank = Rank(amb[0] - '1');
+				amb.remove_prefix(1);
+			}
+			if (!amb.empty())
+				continue;
+
+			t.kind = Token::SAN;
+			t.to = get_square_from(s.substr(j));
+			t.file = file;
+			t.rank = rank;
+			if (j + 3 < n && s[j + 2] == '=' && std::string_view("NBRQ").find(s[j + 3]) != std::string_view::npos)
+				t.promotion = get_pt_from_prom(s[j + 3]);
+			return t;
+		}
 
-		return { "", Move::none() };
+		return t;
 	}
 
-	// Returns the Move from a string in LAN or SAN.
-	Move algebraic_to_move(const Position& pos, const std::string& str) {
+	// Looks up the move of a token in the legal moves of the position, Move::none() if it
+	// is not legal or is ambiguous.
+	static Move find_move(const Position& pos, const Token& t, const MoveList<LEGAL>& legal) {
 
-		Color us = pos.side_to_move();
-		Square sq_from, sq_to;
-		PieceType p = NO_PIECE_TYPE;
-		Move move = Move::none();
-		std::smatch match;
+		const Color us = pos.side_to_move();
 
-		// Test for LAN
-		std::regex rx("([a-h][1-8])([a-h][1-8])([qrbn]?)");
-		if (std::regex_match(str, match, rx))
+		switch (t.kind)
 		{
-			sq_from = get_square_from(match[1]);
-			sq_to = get_square_from(match[2]);
-
-			if (type_of(pos.piece_on(sq_from)) == PAWN)
+		case Token::LAN:
+			for (const auto& m : legal)
 			{
-				// Promotion
-				if (relative_rank(us, sq_to) == RANK_8)
-				{
-					PieceType p = match[3].length() ? get_pt_from_prom(match[3].str()[0]) : QUEEN;
-					move = Move::make<PROMOTION>(sq_from, sq_to, p);
-				}
-				else if (pos.state()->epSquare != SQ_NONE && sq_to == pos.state()->epSquare)
-				{
-					move = Move::make<EN_PASSANT>(sq_from, sq_to);
-				}
-			}
+				if (m.from_sq() != t.from)
+					continue;
 
-			// Castling
-			else if (type_of(pos.piece_on(sq_from)) == KING)
-			{
-				if (pos.is_chess960())
-				{
-					if (pos.piece_on(sq_to) == make_piece(us, ROOK))
-						move = Move::make<CASTLING>(sq_from, sq_to);
-				}
-				else
-				{
-					if (str == "e1g1" || str == "e8g8")
-						move = Move::make<CASTLING>(relative_square(us, SQ_E1), pos.castling_rook_square(us & KING_SIDE));
-					if (str == "e1c1" || str == "e8c8")
-						move = Move::make<CASTLING>(relative_square(us, SQ_E1), pos.castling_rook_square(us & QUEEN_SIDE));
-				}
-			}
+				// Castling is written as king to rook in Chess960, else as the king's step
+				Square to = m.to_sq();
+				if (m.type_of() == CASTLING && !pos.is_chess960())
+					to = make_square(to > m.from_sq() ? FILE_G : FILE_C, rank_of(m.from_sq()));
 
-			// Other moves
-			if (!move)
-				move = Move(sq_from, sq_to);
+				if (to == t.to
+					&& (m.type_of() != PROMOTION || m.promotion_type() == (t.promotion ? t.promotion : QUEEN)))
+					return m;
+			}
+			return Move::none();
 
-			return MoveList<LEGAL>(pos).contains(move) ? move : Move::none();
-		}
+		case Token::CASTLE_KING:
+		case Token::CASTLE_QUEEN:
+			for (const auto& m : legal)
+				if (m.type_of() == CASTLING && (m.to_sq() > m.from_sq()) == (t.kind == Token::CASTLE_KING))
+					return m;
+			return Move::none();
 
-		// Test for SAN.
-		rx = R"(([NBRQK])?([a-h1-8])?([1-8])?([x])?([a-h][1-8])(\=[NBRQ])?.*)";
-		if (std::regex_match(str, match, rx))
+		case Token::SAN:
 		{
-			PieceType p = match[1].length() ? get_pt(match[1].str()[0]) : PAWN;
-			File amb_file = File(-1);
-			Rank amb_rank = Rank(-1);
-			if (match[2].length())
+			// A pawn reaching the last rank becomes a queen unless told otherwise
+			PieceType promotion = t.pt == PAWN && relative_rank(us, t.to) == RANK_8
+				? (t.promotion ? t.promotion : QUEEN) : NO_PIECE_TYPE;
+
+			Move found = Move::none();
+			int  count = 0, matching = 0;
+			for (const auto& m : legal)
 			{
-				char c = match[2].str()[0];
-				if (isdigit(c)) amb_rank = Rank(c - '1');
-				else amb_file = File(c - 'a');
+				if (m.to_sq() != t.to
+					|| m.type_of() == CASTLING
+					|| type_of(pos.piece_on(m.from_sq())) != t.pt
+					|| (m.type_of() == PROMOTION && m.promotion_type() != promotion))
+					continue;
+
+				++count;
+				if ((t.file < FILE_A || file_of(m.from_sq()) == t.file)
+					&& (t.rank < RANK_1 || rank_of(m.from_sq()) == t.rank))
+					++matching, found = m;
+				else if (!found)
+					found = m; // Taken when it is the only candidate, whatever the hints say
 			}
-			if (match[3].length())
-				amb_rank = Rank(match[3].str()[0] - '1');
 
-			sq_to = get_square_from(match[5]);
+			// Disambiguating
+			if (count == 1)
+				return found;
+			return matching == 1 ? found : Move::none();
+		}
 
-			// Handle promotion.
-			PieceType promotion = NO_PIECE_TYPE;
+		default:
+			return Move::none();
+		}
+	}
 
-			if (p == PAWN && relative_rank(us, sq_to) == RANK_8)
-				promotion = match[6].length() ? get_pt_from_prom(match[6].str()[1]) : QUEEN;
+	bool is_ok(const std::string& s)
+	{
+		return parse(s).kind != Token::NONE;
+	}
 
-			return get_move_from(pos, p, sq_to, promotion, amb_file, amb_rank).second;
-		}
+	// Returns the Move from a string in LAN or SAN.
+	Move algebraic_to_move(const Position& pos, const std::string& str) {
 
-		// Handle castling.
-		if (str == "O-O" || str == "o-o" || str == "0-0")
-			return Move::make<CASTLING>(relative_square(us, SQ_E1), pos.castling_rook_square(us & KING_SIDE));
-		if (str == "O-O-O" || str == "o-o-o" || str == "0-0-0")
-			return Move::make<CASTLING>(relative_square(us, SQ_E1), pos.castling_rook_square(us & QUEEN_SIDE));
-		return move;
+		Token t = parse(str);
+		return t.kind != Token::NONE ? find_move(pos, t, MoveList<LEGAL>(pos)) : Move::none();
 	}
 
 	// Returns string in LAN from LAN or SAN.
 	std::string algebraic_to_string(const Position& pos, const std::string& str)
 	{
-		std::string smove;
-		std::smatch match;
+		Token t = parse(str);
+
+		if (t.kind == Token::NONE)
+			return "";
 
 		// Test for LAN.
-		std::regex rx("([a-h][1-8])([a-h][1-8])([qrbn]?)");
-		if (std::regex_match(str, match, rx))
+		if (t.kind == Token::LAN)
 			return str;
 
-		// Test for SAN.
-		Color us = pos.side_to_move();
-		Move move = Move::none();
-		rx = R"(([NBRQK])?([a-h1-8])?([1-8])?([x])?([a-h][1-8])(\=[NBRQ])?.*)";
-		if (std::regex_match(str, match, rx))
-		{
-			PieceType p = match[1].length() ? get_pt((match[1].str()[0])) : PAWN;
-			File amb_file = File(-1);
-			Rank amb_rank = Rank(-1);
-
-			if (match[2].length())
-			{
-				char c = match[2].str()[0];
-				if (isdigit(c)) amb_rank = Rank(c - '1');
-				else amb_file = File(c - 'a');
-			}
-			if (match[3].length())
-				amb_rank = Rank(match[3].str()[0] - '1');
-
-			Square sq_to = get_square_from(match[5]);
-
-			// Handle promotion.
-			PieceType promotion = NO_PIECE_TYPE;
-			if (p == PAWN && relative_rank(pos.side_to_move(), sq_to) == RANK_8)
-				promotion = get_pt_from_prom(match[6].str()[1]);
-			return get_move_from(pos, p, sq_to, promotion, amb_file, amb_rank).first;
-		}
-
 		// Handle castling.
-		if (str == "O-O" || str == "o-o" || str == "0-0")
-		{
-			if (pos.is_chess960())
-			{
-				Move m = Move::make<CASTLING>(pos.square<KING>(us), pos.castling_rook_square(us & KING_SIDE));
-				return UCI::move(m, true);
-			}
-			else
-				return pos.side_to_move() == WHITE ? "e1g1" : "e8g8";
-		}
-		if (str == "O-O-O" || str == "o-o-o" || str == "0-0-0")
-		{
-			if (pos.is_chess960())
-			{
-				Move m = Move::make<CASTLING>(pos.square<KING>(us), pos.castling_rook_square(us & QUEEN_SIDE));
-				return UCI::move(m, true);
-			}
-			else
-				return pos.side_to_move() == WHITE ? "e1c1" : "e8c8";
-		}
-		return "";
+		if (t.kind != Token::SAN && !pos.is_chess960())
+			return t.kind == Token::CASTLE_KING ? (pos.side_to_move() == WHITE ? "e1g1" : "e8g8")
+			                                    : (pos.side_to_move() == WHITE ? "e1c1" : "e8c8");
+
+		Move m = find_move(pos, t, MoveList<LEGAL>(pos));
+		return m ? UCI::move(m, pos.is_chess960()) : "";
 	}
 
-	// Converts a move to a SAN string.
-	std::string to_san(const Position& pos, Move move)
+	// Appends the SAN of a move without its check suffix. Only the legal moves of the
+	// position are needed to disambiguate it.
+	static void append_san(std::string& san, const Position& pos, Move move, const MoveList<LEGAL>& legal)
 	{
 		static const char* piece = "  NBRQK";
 
-		if (!move)
-			return "(none)";
-
-		if (move == Move::null())
-			return "0000";
-
-		std::ostringstream SAN;
+		auto append_square = [&](Square s) {
+			san += char(file_of(s) + 'a');
+			san += char(rank_of(s) + '1');
+		};
 
 		if (move.type_of() == CASTLING)
-			SAN << (move.from_sq() > move.to_sq() ? "O-O-O" : "O-O");
-		else
 		{
-			PieceType pt = type_of(pos.moved_piece(move));
-
-			if (pt != PAWN)
-			{
-				SAN << piece[pt];
+			san += move.from_sq() > move.to_sq() ? "O-O-O" : "O-O";
+			return;
+		}
 
-				// Check for ambiguate from-squares
-				if (popcount(pos.pieces(pos.side_to_move(), pt) > 1))
-				{
-					MoveList<LEGAL> ml(pos);
-					std::vector<ExtMove> list(ml.begin(), ml.end());
-					std::erase_if(list, [&](const auto& m) {
+		PieceType pt = type_of(pos.moved_piece(move));
 
-						return m.to_sq() != move.to_sq() || type_of(pos.moved_piece(m)) != pt;
-						});
+		if (pt != PAWN)
+		{
+			san += piece[pt];
 
-					if (list.size() > 1)
+			// Check for ambiguate from-squares
+			if (popcount(pos.pieces(pos.side_to_move(), pt)) > 1)
+			{
+				int candidates = 0, sameFile = 0, sameRank = 0;
+				for (const auto& m : legal)
+					if (m.to_sq() == move.to_sq() && m.type_of() != CASTLING && type_of(pos.moved_piece(m)) == pt)
 					{
-						if (std::ranges::count_if(list, [&](const auto& m) {
-							return file_of(move.from_sq()) == file_of(m.from_sq());
-							}) == 1)
-							SAN << char(file_of(move.from_sq()) + 'a');
-						else if (std::ranges::count_if(list, [&](const auto& m) {
-							return rank_of(move.from_sq()) == rank_of(m.from_sq());
-							}) == 1)
-							SAN << char(rank_of(move.from_sq()) + '1');
-						else
-							SAN << move.from_sq();
+						++candidates;
+						sameFile += file_of(m.from_sq()) == file_of(move.from_sq());
+						sameRank += rank_of(m.from_sq()) == rank_of(move.from_sq());
 					}
+
+				if (candidates > 1)
+				{
+					if (sameFile == 1)
+						san += char(file_of(move.from_sq()) + 'a');
+					else if (sameRank == 1)
+						san += char(rank_of(move.from_sq()) + '1');
+					else
+						append_square(move.from_sq());
 				}
 			}
+		}
 
-			if (pos.capture(move))
-			{
-				if (pt == PAWN)
-					SAN << char(file_of(move.from_sq()) + 'a');
-
-				SAN << 'x';
-			}
+		if (pos.capture(move))
+		{
+			if (pt == PAWN)
+				san += char(file_of(move.from_sq()) + 'a');
 
-			SAN << move.to_sq();
+			san += 'x';
+		}
 
-			if (move.type_of() == EN_PASSANT)
-				SAN << "/e.p.";
+		append_square(move.to_sq());
 
-			else if (move.type_of() == PROMOTION)
-				SAN << '=' << piece[move.promotion_type()];
-		}
+		if (move.type_of() == EN_PASSANT)
+			san += "/e.p.";
 
-		if (pos.gives_check(move))
+		else if (move.type_of() == PROMOTION)
 		{
-			StateListPtr sp(new std::deque<StateInfo>(1));
-			Position copy;
-			copy.set(pos.fen(), pos.side_to_move(), &sp->back(), nullptr);
-			copy.do_move<false>(move, sp->emplace_back());
-			SAN << (MoveList<LEGAL>(copy).size() ? '+' : '#');
+			san += '=';
+			san += piece[move.promotion_type()];
 		}
+	}
 
-		return SAN.str();
+	// Converts a move to a SAN string.
+	std::string to_san(const Position& pos, Move move)
+	{
+		if (!move)
+			return "(none)";
+
+		if (move == Move::null())
+			return "0000";
+
+		std::string SAN = to_san(pos.fen(), pos.is_chess960(), { move });
+		return SAN.substr(1);
 	}
 
 	std::string to_san(const Position& pos, const Search::RootMove& rm)
 	{
-		std::ostringstream SAN;
-		StateListPtr sp(new std::deque<StateInfo>(1));
-		Position copy;
-		copy.set(pos.fen(), pos.is_chess960(), &sp->back(), nullptr);
-		for (const auto& move : rm.pv)
+		return to_san(pos.fen(), pos.is_chess960(), rm.pv);
+	}
+
+	// Also called by the output thread, which only has the FEN of the root position. The
+	// line is walked once: the legal moves of each position disambiguate its move, and
+	// the position after a checking move tells whether it is mate.
+	std::string to_san(const std::string& fen, bool chess960, const std::vector<Move>& pv)
+	{
+		std::string SAN;
+		StateListPtr sp(new StateList(1));
+		Position pos;
+		pos.set(fen, chess960, &sp->back(), nullptr);
+		for (const auto& move : pv)
 		{
 			if (!move) break;
-			assert(MoveList<LEGAL>(copy).contains(move));
 
-			SAN << " " << to_san(copy, move);
-			copy.do_move<false>(move, sp->emplace_back());
+			MoveList<LEGAL> legal(pos);
+			assert(legal.contains(move));
+
+			SAN += ' ';
+			append_san(SAN, pos, move, legal);
+
+			const bool check = pos.gives_check(move);
+			pos.do_move<false>(move, sp->emplace_back());
+			if (check)
+				SAN += count_legal(pos) ? '+' : '#';
 		}
-		return SAN.str();
+		return SAN;
 	}
 
 }
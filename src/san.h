@@ -10,6 +10,7 @@ namespace Stockfish::SAN {
 	std::string algebraic_to_string(const Position& pos, const std::string& str);
 	std::string to_san(const Position& pos, Move move);
 	std::string to_san(const Position& pos, const Search::RootMove& rm);
+	std::string to_san(const std::string& fen, bool chess960, const std::vector<Move>& pv);
 	bool is_ok(const std::string& str);
 
 }
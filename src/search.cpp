@@ -25,16 +25,18 @@
 #include <cmath>
 #include <cstdlib>
 #include <cstring>
+#include <fstream>
 #include <initializer_list>
 #include <iostream>
 #include <sstream>
 #include <string>
 #include <utility>
-#include <BS_thread_pool.hpp>
+#include <vector>
 
 #include "bitboard.h"
 #include "book.h"
 #include "evaluate.h"
+#include "mateprover.h"
 #include "misc.h"
 #include "movegen.h"
 #include "movepick.h"
@@ -42,6 +44,7 @@
 #include "nnue/nnue_common.h"
 #include "position.h"
 #include "san.h"
+#include "searchstats.h"
 #include "syzygy/tbprobe.h"
 #include "thread.h"
 #include "timeman.h"
@@ -72,6 +75,12 @@ namespace Stockfish {
 
     namespace {
 
+        // Iteration trace of the 'Search Trace File' option, one JSON object per line.
+        // Only the main thread writes it, at the end of each iteration.
+        std::ofstream traceFile;
+        bool          tracing = false;
+        uint64_t      traceSearches = 0;
+
         // Futility margin
         Value futility_margin(Depth d, bool noTtCutNode, bool improving) {
             return (116 - 44 * noTtCutNode) * (d - improving);
@@ -157,6 +166,46 @@ namespace Stockfish {
     } // namespace
 
 
+    namespace {
+
+        // Optional cache of perft subtree counts, separate from the TT. The entries are
+        // shared by all perft threads without locks: the key is stored xor'ed with the
+        // data, so that an entry torn by concurrent writes never matches a probe.
+        struct PerftEntry {
+            Key      key;
+            uint64_t data; // nodes << 8 | depth
+        };
+
+        std::vector<PerftEntry> perftTable;
+
+        PerftEntry* perft_entry(Key key) { return &perftTable[mul_hi64(key, perftTable.size())]; }
+
+        // The cache needs the position keys, which are only updated by the full do_move()
+        void perft_do_move(Position& pos, Move m, StateInfo& st) {
+            if (perftTable.empty())
+                pos.do_move<false>(m, st);
+            else
+                pos.do_move<true>(m, st);
+        }
+
+        void perft_undo_move(Position& pos, Move m) {
+            if (perftTable.empty())
+                pos.undo_move<false>(m);
+            else
+                pos.undo_move<true>(m);
+        }
+
+    } // namespace
+
+    // Resizes the perft cache to the given size in MB, 0 disables it. While the cache
+    // is enabled, the positions passed to perft() need a thread for the full do_move().
+    void perft_hash(size_t mbSize) {
+
+        perftTable.clear();
+        perftTable.shrink_to_fit();
+        perftTable.resize(mbSize * 1024 * 1024 / sizeof(PerftEntry));
+    }
+
     // Utility to verify move generation.
     // All the leaf nodes up to the given depth are generated and counted, and the sum is returned.
 
@@ -171,39 +220,126 @@ namespace Stockfish {
 
         if constexpr (Root)
         {
-            std::atomic_uint64_t nodes = 0;
-            BS::thread_pool pool(BS::concurrency_t(list.size()));
-            pool.push_loop(list.size(), [&](size_t from, size_t to)
+            // Small trees are counted faster than the threads are started
+            if (depth < 5)
+            {
+                uint64_t nodes = 0;
+                StateInfo st;
+                for (const auto& m : list) {
+                    perft_do_move(pos, m, st);
+                    uint64_t cnt = leaf ? count_legal(pos) : perft<false, false>(pos, depth - 1);
+                    nodes += cnt;
+                    perft_undo_move(pos, m);
+                    if constexpr (Verbose)
+                        sync_cout << UCI::move(m, pos.is_chess960()) << ": " << cnt << sync_endl;
+                }
+                return nodes;
+            }
+
+            // Split the tree two plies below the root, so that there are enough tasks
+            // to keep all threads busy even if the root position has only a few moves.
+            std::vector<std::pair<size_t, Move>> split;
+            StateInfo st;
+            for (size_t i = 0; i < list.size(); ++i) {
+                pos.do_move<false>(list[i], st);
+                for (const auto& m : MoveList<LEGAL>(pos))
+                    split.emplace_back(i, m);
+                pos.undo_move<false>(list[i]);
+            }
+
+            // Use more blocks than workers, so that workers that finish early can help out
+            const size_t blocks = std::min(split.size(), 16 * Tasks::workers());
+            std::vector<std::atomic_uint64_t> counts(list.size());
+            for (size_t b = 0; b < blocks; ++b)
+                Tasks::submit([&, from = b * split.size() / blocks, to = (b + 1) * split.size() / blocks]
                 {
-                    StateListPtr sp(new std::deque<StateInfo>(1));
+                    StateInfo st0, st1, st2;
                     Position copy;
-                    copy.set(pos.fen(), pos.is_chess960(), &sp->back(), nullptr);
+                    copy.set(pos.fen(), pos.is_chess960(), &st0, *(Threads.begin() + Tasks::worker()));
                     for (size_t i = from; i < to; ++i) {
-                        Move m = list[i];
-                        copy.do_move<false>(m, sp->emplace_back());
-                        uint64_t cnt = leaf ? MoveList<LEGAL>(copy).size() : perft<false, Verbose>(copy, depth - 1);
-                        nodes += cnt;
-                        copy.undo_move<false>(m);
-                        if constexpr (Verbose)
-                            sync_cout << UCI::move(m, copy.is_chess960()) << ": " << cnt << sync_endl;
+                        Move m1 = list[split[i].first], m2 = split[i].second;
+                        perft_do_move(copy, m1, st1);
+                        perft_do_move(copy, m2, st2);
+                        counts[split[i].first] += perft<false, false>(copy, depth - 2);
+                        perft_undo_move(copy, m2);
+                        perft_undo_move(copy, m1);
                     }
-                });
-            pool.wait_for_tasks();
+                }, false); // Like the perft of UCI, which is not stopped
+            Tasks::wait();
+
+            uint64_t nodes = 0;
+            for (size_t i = 0; i < list.size(); ++i) {
+                nodes += counts[i];
+                if constexpr (Verbose)
+                    sync_cout << UCI::move(list[i], pos.is_chess960()) << ": " << counts[i] << sync_endl;
+            }
             return nodes;
         }
         else
         {
+            PerftEntry* tte = depth > 2 && !perftTable.empty() ? perft_entry(pos.key()) : nullptr;
+            if (tte)
+            {
+                PerftEntry e = *tte;
+                if ((e.key ^ e.data) == pos.key() && (e.data & 0xFF) == uint64_t(depth))
+                    return e.data >> 8;
+            }
+
             uint64_t nodes = 0;
             StateInfo st;
             for (const auto& m : list) {
-                pos.do_move<false>(m, st);
-                nodes += leaf ? MoveList<LEGAL>(pos).size() : perft<false, Verbose>(pos, depth - 1);
-                pos.undo_move<false>(m);
+                perft_do_move(pos, m, st);
+                nodes += leaf ? count_legal(pos) : perft<false, Verbose>(pos, depth - 1);
+                perft_undo_move(pos, m);
+            }
+
+            if (tte)
+            {
+                uint64_t data = nodes << 8 | uint64_t(depth);
+                tte->key = pos.key() ^ data;
+                tte->data = data;
             }
             return nodes;
         }
     }
     template uint64_t perft<true, false>(Position& pos, Depth depth);
+    template uint64_t perft<false, false>(Position& pos, Depth depth);
+
+    namespace {
+
+        // The side to move is known at compile time, the inner nodes keep their moves in
+        // a compact list of Move and the leaves are counted without generating them.
+        template<Color Us>
+        uint64_t fast_perft(Position& pos, Depth depth) {
+
+            if (depth == 1)
+                return count_legal<Us>(pos);
+
+            Move      moves[MAX_MOVES];
+            Move*     last = generate_legal<Us>(pos, moves);
+            uint64_t  nodes = 0;
+            StateInfo st;
+
+            for (Move* m = moves; m != last; ++m)
+            {
+                pos.do_move<false>(*m, st);
+                nodes += fast_perft<~Us>(pos, depth - 1);
+                pos.undo_move<false>(*m);
+            }
+
+            return nodes;
+        }
+
+    } // namespace
+
+    // Perft on one thread without the cache, meant for timing the move generator
+    uint64_t fast_perft(Position& pos, Depth depth) {
+
+        if (depth <= 0)
+            return 1;
+
+        return pos.side_to_move() == WHITE ? fast_perft<WHITE>(pos, depth) : fast_perft<BLACK>(pos, depth);
+    }
 
 
     // Called at startup to initialize various lookup tables
@@ -221,6 +357,24 @@ namespace Stockfish {
                 WinProbability[value + 4000][depth] = UCI::getWinProbability(Value(value), depth);
     }
 
+    void Search::set_trace_file(const std::string& fname) {
+
+        Threads.main()->wait_for_search_finished();
+
+        if (traceFile.is_open())
+            traceFile.close();
+
+        tracing = fname != "<empty>" && !fname.empty();
+        if (tracing)
+        {
+            traceFile.open(fname, std::ios::app);
+            tracing = traceFile.is_open();
+            if (!tracing)
+                sync_cout << "info string Unable to open search trace file " << fname << sync_endl;
+        }
+    }
+
+
     // Resets search state to its initial value
     void Search::clear() {
 
@@ -229,7 +383,7 @@ namespace Stockfish {
         Time.availableNodes = 0;
         TT.clear();
         Threads.clear();
-        Tablebases::init(Options["SyzygyPath"]); // Free mapped files
+        Tablebases::init(Options["SyzygyPath"], Options["SyzygyPreload"]); // Free mapped files
         if (useShashin)
             initWinProbability();
     }
@@ -291,65 +445,67 @@ namespace Stockfish {
         return SHASHIN_POSITION_TAL_CAPABLANCA_PETROSIAN;
     }
 
-    inline bool isShashinHigh(const Position& pos) {
-
-        return (pos.this_thread()->shashinWinProbabilityRange != SHASHIN_POSITION_HIGH_PETROSIAN)
-            && (pos.this_thread()->shashinWinProbabilityRange != SHASHIN_POSITION_HIGH_TAL);
+    // The conditions on the Shashin range tested by the pruning in search() and qsearch().
+    // They are computed by setShashinRange() whenever the range changes, and every node
+    // copies them into Stack::shashin.
+    enum ShashinStyle : uint8_t {
+        ShashinHighTal             = 1 << 0,
+        ShashinMiddleHighTal       = 1 << 1,
+        ShashinCapablanca          = 1 << 2,
+        ShashinCapablancaPetrosian = 1 << 3,
+        ShashinCapablancaTal       = 1 << 4,
+        ShashinHighMiddle          = 1 << 5, // Neither high nor middle-high
+        ShashinTal                 = 1 << 6  // One of the Tal ranges
+    };
+
+    constexpr bool isShashinHigh(int8_t range) {
+
+        return (range != SHASHIN_POSITION_HIGH_PETROSIAN)
+            && (range != SHASHIN_POSITION_HIGH_TAL);
     }
 
-    inline bool isShashinHighMiddle(const Position& pos) {
+    constexpr bool isShashinHighMiddle(int8_t range) {
 
-        return isShashinHigh(pos)
-            && (pos.this_thread()->shashinWinProbabilityRange != SHASHIN_POSITION_MIDDLE_HIGH_PETROSIAN)
-            && (pos.this_thread()->shashinWinProbabilityRange != SHASHIN_POSITION_MIDDLE_HIGH_TAL);
+        return isShashinHigh(range)
+            && (range != SHASHIN_POSITION_MIDDLE_HIGH_PETROSIAN)
+            && (range != SHASHIN_POSITION_MIDDLE_HIGH_TAL);
     }
 
-    inline bool isShashinMiddle(const Position& pos) {
+    constexpr bool isShashinPositionTal(int8_t range) {
 
-        return isShashinHighMiddle(pos)
-            && (pos.this_thread()->shashinWinProbabilityRange != SHASHIN_POSITION_MIDDLE_PETROSIAN)
-            && (pos.this_thread()->shashinWinProbabilityRange != SHASHIN_POSITION_MIDDLE_TAL);
+        return range >= SHASHIN_POSITION_LOW_TAL && range <= SHASHIN_POSITION_HIGH_TAL;
     }
 
-    inline bool isShashinMiddleLow(const Position& pos) {
+    constexpr uint8_t shashinStyle(int8_t range) {
 
-        return isShashinMiddle(pos)
-            && (pos.this_thread()->shashinWinProbabilityRange != SHASHIN_POSITION_MIDDLE_LOW_PETROSIAN)
-            && (pos.this_thread()->shashinWinProbabilityRange != SHASHIN_POSITION_MIDDLE_LOW_TAL);
+        return (range == SHASHIN_POSITION_HIGH_TAL ? ShashinHighTal : 0)
+            | (range == SHASHIN_POSITION_MIDDLE_HIGH_TAL ? ShashinMiddleHighTal : 0)
+            | (range == SHASHIN_POSITION_CAPABLANCA ? ShashinCapablanca : 0)
+            | (range == SHASHIN_POSITION_CAPABLANCA_PETROSIAN ? ShashinCapablancaPetrosian : 0)
+            | (range == SHASHIN_POSITION_CAPABLANCA_TAL ? ShashinCapablancaTal : 0)
+            | (isShashinHighMiddle(range) ? ShashinHighMiddle : 0)
+            | (isShashinPositionTal(range) ? ShashinTal : 0);
     }
 
-    inline bool isShashinLow(const Position& pos) {
+    inline void setShashinRange(Thread* th, int8_t range) {
 
-        return isShashinMiddleLow(pos)
-            && (pos.this_thread()->shashinWinProbabilityRange != SHASHIN_POSITION_LOW_PETROSIAN)
-            && (pos.this_thread()->shashinWinProbabilityRange != SHASHIN_POSITION_LOW_TAL);
+        th->shashinWinProbabilityRange = range;
+        th->shashinStyle = shashinStyle(range);
     }
 
     inline void updateShashinValues(const Position& pos, Value score, int ply) {
 
         if ((ply > pos.this_thread()->shashinPly) || (ply == 0))
         {
-            pos.this_thread()->shashinWinProbabilityRange = getShashinRange(score, ply);
-            pos.this_thread()->shashinPly = ply;
-        }
-    }
-
-    inline bool isShashinPositionPetrosian(const Position& pos) {
+            const int8_t range = getShashinRange(score, ply);
 
-        return ((pos.this_thread()->shashinWinProbabilityRange == SHASHIN_POSITION_HIGH_PETROSIAN)
-            || (pos.this_thread()->shashinWinProbabilityRange == SHASHIN_POSITION_MIDDLE_HIGH_PETROSIAN)
-            || (pos.this_thread()->shashinWinProbabilityRange == SHASHIN_POSITION_MIDDLE_PETROSIAN)
-            || (pos.this_thread()->shashinWinProbabilityRange == SHASHIN_POSITION_MIDDLE_LOW_PETROSIAN)
-            || (pos.this_thread()->shashinWinProbabilityRange == SHASHIN_POSITION_LOW_PETROSIAN));
-    }
-
-    inline bool isShashinPositionTal(const Position& pos) {
+            SEARCH_TRY(ShashinRange, ply);
+            if (range != pos.this_thread()->shashinWinProbabilityRange)
+                SEARCH_CUT(ShashinRange, ply);
 
-        return ((pos.this_thread()->shashinWinProbabilityRange == SHASHIN_POSITION_HIGH_TAL)
-            || (pos.this_thread()->shashinWinProbabilityRange == SHASHIN_POSITION_MIDDLE_HIGH_TAL)
-            || (pos.this_thread()->shashinWinProbabilityRange == SHASHIN_POSITION_MIDDLE_TAL)
-            || (pos.this_thread()->shashinWinProbabilityRange == SHASHIN_POSITION_MIDDLE_LOW_TAL)
-            || (pos.this_thread()->shashinWinProbabilityRange == SHASHIN_POSITION_LOW_TAL));
+            setShashinRange(pos.this_thread(), range);
+            pos.this_thread()->shashinPly = ply;
+        }
     }
 
     inline int8_t getInitialShashinWinProbabilityRange(const Position& pos, const Stack* ss) {
@@ -388,7 +544,7 @@ namespace Stockfish {
     inline void initShashinValues(Position& pos, const Stack* ss) {
 
         pos.this_thread()->shashinPly = std::max(pos.game_ply(), ss->ply);
-        pos.this_thread()->shashinWinProbabilityRange = getInitialShashinWinProbabilityRange(pos, ss);
+        setShashinRange(pos.this_thread(), getInitialShashinWinProbabilityRange(pos, ss));
     }
 
     // Called when the program receives the UCI 'go' command.
@@ -411,6 +567,15 @@ namespace Stockfish {
         Time.init(Limits, us, rootPos.game_ply());
         TT.new_search();
 
+        // While pondering the GUI decides when the search ends, so the deadline is only
+        // armed by check_time() after a 'ponderhit'. It still counts from the 'go' command.
+        const TimePoint deadline = Limits.deadline ? Limits.startTime + Limits.deadline : 0;
+        ponderStopTime = 0;
+        if (deadline && ponder)
+            ponderStopTime = deadline - TimePoint(Options["Move Overhead"]);
+        else if (deadline)
+            Deadline::arm(deadline - TimePoint(Options["Move Overhead"]));
+
         Eval::NNUE::verify();
 
         if (useShashin)
@@ -428,10 +593,10 @@ namespace Stockfish {
         if (Options["Use Book"])
         {
             // Check for book moves
-            const Book::Book* book = Book::find_opening(rootPos);
+            const auto opening = Book::find_opening(rootPos);
 
-            if (book)
-                sync_cout << "info string position " << book->opening << sync_endl;
+            if (!opening.empty())
+                sync_cout << "info string position " << opening << sync_endl;
 
             if (Limits.mate == 0 && Limits.searchmoves.empty() && Options["Use Book"])
             {
@@ -473,6 +638,10 @@ namespace Stockfish {
         // Wait until all threads have finished
         Threads.wait_for_search_finished();
 
+        // A deadline still pending was never armed, the search ended while pondering
+        const bool      timed = deadline && !ponderStopTime;
+        const TimePoint stopped = timed ? Deadline::disarm() : 0;
+
         // When playing in 'nodes as time' mode, subtract the searched nodes from the available ones before exiting.
         if (Limits.npmsec)
             Time.availableNodes += Limits.inc[us] - Threads.nodes_searched();
@@ -483,30 +652,59 @@ namespace Stockfish {
         if (int(Options["MultiPV"]) == 1 && !Limits.depth && !skill.enabled() && rootMoves[0].pv[0] != Move::none())
             bestThread = Threads.get_best_thread();
 
+        Tablebases::search_finished();
+
         bestPreviousScore = bestThread->rootMoves[0].score;
         bestPreviousAverageScore = bestThread->rootMoves[0].averageScore;
 
+        TT.publish(rootPos.key(), bestThread->rootMoves[0].pv[0], bestThread->rootMoves[0].score,
+            bestThread->completedDepth, bestThread->rootMoves[0].pv.size(), Threads.nodes_searched());
+
         // Classic
         for (Thread* th : Threads)
             th->previousDepth = bestThread->completedDepth;
 
+        // Keep the PV for the next search, used if the game continues with its first two moves
+        const std::vector<Move>& bestPv = bestThread->rootMoves[0].pv;
+        if (Limits.use_time_management() && !bookMove && bestPv.size() > 2)
+        {
+            StateInfo st[2];
+            rootPos.do_move(bestPv[0], st[0]);
+            rootPos.do_move(bestPv[1], st[1]);
+            reuse.key = rootPos.key();
+            rootPos.undo_move(bestPv[1]);
+            rootPos.undo_move(bestPv[0]);
+
+            reuse.depth = bestThread->completedDepth - 2;
+            reuse.score = bestThread->rootMoves[0].score;
+            reuse.pv.assign(bestPv.begin() + 2, bestPv.end());
+        }
+
         // Send again PV info if we have a new best thread
         if (Threads.size() != 1 || bestThread != this)
-            sync_cout << UCI::pv(bestThread->rootPos, bestThread->completedDepth) << sync_endl;
+            AsyncOut::post(UCI::pv(bestThread->rootPos, bestThread->completedDepth), AsyncOut::Report);
 
-        sync_cout << "bestmove " << UCI::move(bestThread->rootMoves[0].pv[0], rootPos.is_chess960());
+        std::string bestmove = "bestmove " + UCI::move(bestThread->rootMoves[0].pv[0], rootPos.is_chess960());
 
         if (bestThread->rootMoves[0].pv.size() > 1 || bestThread->rootMoves[0].extract_ponder_from_tt(rootPos))
-            std::cout << " ponder " << UCI::move(bestThread->rootMoves[0].pv[1], rootPos.is_chess960());
+            bestmove += " ponder " + UCI::move(bestThread->rootMoves[0].pv[1], rootPos.is_chess960());
 
-        std::cout << sync_endl;
+        AsyncOut::post([bestmove, deadline, timed, stopped]() {
+            if (timed)
+                Deadline::record(deadline, stopped, now());
+            return bestmove;
+            });
     }
 
 
     // Main iterative deepening loop.
     // It calls search() repeatedly with increasing depth until the allocated thinking time has been consumed,
     // the user stops the search, or the maximum search depth is reached.
-    void Thread::search() {
+    template<SearchStyle Style>
+    void Thread::iterative_deepening() {
+
+        constexpr bool Classic = Style == SearchStyle::Classic || Style == SearchStyle::ClassicMate;
+        constexpr bool Shashin = Style == SearchStyle::Shashin;
 
         // Allocate stack with extra size to allow access from (ss - 7) to (ss + 2):
         // (ss - 7) is needed for update_continuation_histories(ss - 1) which accesses (ss - 6),
@@ -535,13 +733,14 @@ namespace Stockfish {
 
         bestValue = -VALUE_INFINITE;
 
-        if (useClassic)
+        if constexpr (Classic)
         {
             delta = alpha = -VALUE_INFINITE;
             beta = VALUE_INFINITE;
         }
 
-        if (mainThread)
+        // A search resuming the PV of the last one, see start_thinking(), keeps its iteration scores
+        if (mainThread && !rootDepth)
         {
             if (mainThread->bestPreviousScore == VALUE_INFINITE)
                 for (int i = 0; i < 4; ++i)
@@ -560,22 +759,26 @@ namespace Stockfish {
             multiPV = std::max(multiPV, size_t(4));
 
         multiPV = std::min(multiPV, rootMoves.size());
+        const bool fastMultiPV = multiPV > 1 && Options["MultiPV Fast"];
 
-        if (useClassic)
+        if constexpr (Classic)
         {
             complexityAverage.set(155, 1);
             optimism[us] = optimism[~us] = VALUE_ZERO;
         }
 
-        if (useShashin)
+        if constexpr (Shashin)
             initShashinValues(rootPos, ss);
 
-        int searchAgainCounter = 0;
+        int      searchAgainCounter = 0;
+        int      researches = 0;
+        uint64_t traceSearch = mainThread && tracing ? ++traceSearches : 0;
 
         // Iterative deepening loop until requested to stop or the target depth is reached
         while (++rootDepth < MAX_PLY
-            && !Threads.stop
-            && !(Limits.depth && mainThread && rootDepth > Limits.depth))
+            && !stop_requested()
+            && !(Limits.depth && mainThread && rootDepth > Limits.depth)
+            && !(ownDepth && rootDepth > ownDepth))
         {
             // Age out PV variability metric
             if (mainThread)
@@ -588,12 +791,13 @@ namespace Stockfish {
 
             size_t pvFirst = 0;
             pvLast = 0;
+            researches = 0;
 
             if (!Threads.increaseDepth)
                 searchAgainCounter++;
 
             // MultiPV loop. We perform a full root search for each PV line
-            for (pvIdx = 0; pvIdx < multiPV && !Threads.stop; ++pvIdx)
+            for (pvIdx = 0; pvIdx < multiPV && !stop_requested(); ++pvIdx)
             {
                 if (pvIdx == pvLast)
                 {
@@ -607,7 +811,7 @@ namespace Stockfish {
                 selDepth = 0;
 
                 // Reset aspiration window starting size
-                if (!useClassic)
+                if constexpr (!Classic)
                 {
                     Value avg = rootMoves[pvIdx].averageScore;
                     delta = 9 + avg * avg / 14847;
@@ -630,6 +834,16 @@ namespace Stockfish {
                     optimism[~us] = -optimism[us];
                 }
 
+                // With 'MultiPV Fast' the lines after the first are searched a ply less deep,
+                // their window ends above the score of the line before. A line failing low keeps
+                // its bound and is not searched again, only a move that would rank higher is.
+                bool boundOnly = fastMultiPV && pvIdx > 0;
+                if (boundOnly && (!Classic || rootDepth >= 4))
+                {
+                    beta = std::min(rootMoves[pvIdx - 1].score + 1, VALUE_INFINITE);
+                    alpha = std::max(std::min(rootMoves[pvIdx].averageScore, beta - 1) - delta, -VALUE_INFINITE);
+                }
+
                 // Start with a small aspiration window and, in the case of a fail high/low,
                 // re-search with a bigger window until we don't fail high/low anymore.
                 int failedHighCnt = 0;
@@ -639,24 +853,15 @@ namespace Stockfish {
                     // for every four searchAgain steps (see issue #2717).
 
                     Depth adjustedDepth =
-                        (useClassic
-                            || !useShashin
-                            || rootPos.this_thread()->shashinWinProbabilityRange != SHASHIN_POSITION_HIGH_TAL)
-                        ? std::max(1, rootDepth - failedHighCnt - 3 * (searchAgainCounter + 1) / 4)
+                        (!Shashin || shashinWinProbabilityRange != SHASHIN_POSITION_HIGH_TAL)
+                        ? std::max(1, rootDepth - failedHighCnt - 3 * (searchAgainCounter + 1) / 4 - boundOnly)
                         : rootDepth;
 
-                    if (useClassic)
-                    {
-                        bestValue = Limits.mate
-                            ? Search::Classic::search<Root, true>(rootPos, ss, alpha, beta, adjustedDepth, false)
-                            : Search::Classic::search<Root, false>(rootPos, ss, alpha, beta, adjustedDepth, false);
-                    }
+                    if constexpr (Classic)
+                        bestValue = Search::Classic::search<Root, Style == SearchStyle::ClassicMate>(
+                            rootPos, ss, alpha, beta, adjustedDepth, false);
                     else
-                    {
-                        bestValue = useShashin
-                            ? Stockfish::search<Root, true>(rootPos, ss, alpha, beta, adjustedDepth, false)
-                            : Stockfish::search<Root, false>(rootPos, ss, alpha, beta, adjustedDepth, false);
-                    }
+                        bestValue = Stockfish::search<Root, Shashin>(rootPos, ss, alpha, beta, adjustedDepth, false);
 
                     // Bring the best move to the front.
                     // It is critical that sorting is done with a stable algorithm
@@ -668,18 +873,24 @@ namespace Stockfish {
 
                     // If search has been stopped, we break immediately.
                     // Sorting is safe because RootMoves is still valid, although it refers to the previous iteration.
-                    if (Threads.stop)
+                    if (stop_requested())
                         break;
 
                     // When failing high/low give some update (without cluttering the UI) before a re-search.
                     if (bUCI && mainThread && multiPV == 1
                         && (bestValue <= alpha || bestValue >= beta)
                         && Time.elapsed() > 3000)
-                        sync_cout << UCI::pv(rootPos, rootDepth) << sync_endl;
+                        AsyncOut::post(UCI::pv(rootPos, rootDepth), AsyncOut::Report);
+
+                    if (boundOnly && bestValue < beta)
+                        break;
+
+                    boundOnly = false;
 
                     // In case of failing low/high increase aspiration window and re-search, otherwise exit the loop.
                     if (bestValue <= alpha)
                     {
+                        ++researches;
                         beta = (alpha + beta) / 2;
                         alpha = std::max(bestValue - delta, -VALUE_INFINITE);
 
@@ -689,13 +900,14 @@ namespace Stockfish {
                     }
                     else if (bestValue >= beta)
                     {
+                        ++researches;
                         beta = std::min(bestValue + delta, VALUE_INFINITE);
                         ++failedHighCnt;
                     }
                     else
                         break;
 
-                    delta += useClassic ? delta / 4 + 2 : delta / 3;
+                    delta += Classic ? delta / 4 + 2 : delta / 3;
 
                     assert(alpha >= -VALUE_INFINITE && beta <= VALUE_INFINITE);
                 }
@@ -705,18 +917,34 @@ namespace Stockfish {
 
                 if (bUCI)
                 {
-                    if (mainThread && (Threads.stop || pvIdx + 1 == multiPV || Time.elapsed() > 3000))
-                        sync_cout << UCI::pv(rootPos, rootDepth) << sync_endl;
+                    if (mainThread && (stop_requested() || pvIdx + 1 == multiPV || Time.elapsed() > 3000))
+                        AsyncOut::post(UCI::pv(rootPos, rootDepth), AsyncOut::Report);
                 }
-                else
+                else if (!ownSearch)
                 {
-                    if (Threads.stop || pvIdx + 1 == multiPV)
-                        sync_cout << UCI::pv(rootPos, rootDepth) << sync_endl;
+                    if (stop_requested() || pvIdx + 1 == multiPV)
+                        AsyncOut::post(UCI::pv(rootPos, rootDepth), AsyncOut::Report);
                 }
             }
 
-            if (!Threads.stop)
+            if (!stop_requested())
+            {
                 completedDepth = rootDepth;
+                if (ownReport)
+                    ownReport();
+            }
+
+            // Let the processes sharing the hash follow the search, see 'tt shared'
+            if (mainThread && !stop_requested())
+                TT.publish(rootPos.key(), rootMoves[0].pv[0], rootMoves[0].score, completedDepth,
+                    rootMoves[0].pv.size(), Threads.nodes_searched());
+
+            // Remember when the first mate score was found, test mate logs it
+            if (!stop_requested() && std::abs(bestValue) >= VALUE_MATE_IN_MAX_PLY)
+            {
+                TimePoint none = -1;
+                Threads.main()->firstMateTime.compare_exchange_strong(none, Time.elapsed());
+            }
 
             if (rootMoves[0].pv[0] != lastBestMove)
             {
@@ -732,6 +960,9 @@ namespace Stockfish {
             if (Limits.mate < 0 && bestValue <= VALUE_MATED_IN_MAX_PLY && VALUE_MATE + bestValue <= -2 * Limits.mate)
                 Threads.stop = true;
 
+            if ((ownNodes && nodes >= ownNodes) || (ownMovetime && now() - ownStart >= ownMovetime))
+                break;
+
             if (!mainThread)
                 continue;
 
@@ -747,7 +978,7 @@ namespace Stockfish {
             }
 
             // Do we have time for the next iteration? Can we stop searching now?
-            if (Limits.use_time_management() && !Threads.stop && !mainThread->stopOnPonderhit)
+            if (Limits.use_time_management() && !stop_requested() && !mainThread->stopOnPonderhit)
             {
                 double fallingEval = (66 + 14 * (mainThread->bestPreviousAverageScore - bestValue)
                     + 6 * (mainThread->iterValue[iterIdx] - bestValue)) / 616.6;
@@ -782,6 +1013,21 @@ namespace Stockfish {
 
             mainThread->iterValue[iterIdx] = bestValue;
             iterIdx = (iterIdx + 1) & 3;
+
+            if (traceSearch)
+            {
+                const TimePoint elapsed = Time.elapsed();
+                const uint64_t  searched = Threads.nodes_searched();
+
+                traceFile << "{\"search\":" << traceSearch << ",\"depth\":" << rootDepth
+                    << ",\"seldepth\":" << selDepth << ",\"completed\":" << (completedDepth == rootDepth ? "true" : "false")
+                    << ",\"researches\":" << researches << ",\"nodes\":" << searched
+                    << ",\"nps\":" << searched * 1000 / (elapsed + 1) << ",\"time\":" << elapsed
+                    << ",\"bestMoveChanges\":" << totBestMoveChanges << ",\"optimum\":" << Time.optimum()
+                    << ",\"maximum\":" << Time.maximum() << ",\"threads\":" << Threads.size()
+                    << ",\"score\":" << UCI::to_cp(rootMoves[0].score) << ",\"bestmove\":\""
+                    << UCI::move(rootMoves[0].pv[0], rootPos.is_chess960()) << "\"}" << std::endl;
+            }
         }
 
         if (!mainThread)
@@ -795,6 +1041,24 @@ namespace Stockfish {
                 skill.best ? skill.best : skill.pick_best(multiPV)));
     }
 
+    // Selects the configuration once, so that each one runs its own iterative deepening
+    // loop and the root searches, with no test of the options inside.
+    void Thread::search() {
+
+        // A short mate is tried first with the mate prover, see 'Mate Prover'
+        if (Limits.mate > 0 && Limits.mate <= int(Options["Mate Prover"]) && !ownSearch
+            && MateProver::prove(*this, Limits.mate))
+            return;
+
+        if (useClassic)
+            Limits.mate ? iterative_deepening<SearchStyle::ClassicMate>()
+                        : iterative_deepening<SearchStyle::Classic>();
+        else if (useShashin)
+            iterative_deepening<SearchStyle::Shashin>();
+        else
+            iterative_deepening<SearchStyle::Normal>();
+    }
+
 
     namespace {
 
@@ -846,7 +1110,6 @@ namespace Stockfish {
 
             Move      pv[MAX_PLY + 1], capturesSearched[32], quietsSearched[32];
             StateInfo st;
-            ASSERT_ALIGNED(&st, Eval::NNUE::CacheLineSize);
 
             TTEntry* tte;
             Key      posKey;
@@ -882,6 +1145,7 @@ namespace Stockfish {
                 nullParity = (ourMove == thisThread->nmpSide);
                 rootDepth = thisThread->rootDepth;
                 ss->secondaryLine = false;
+                ss->shashin = thisThread->shashinStyle;
             }
 
             // Check for the available remaining time
@@ -895,7 +1159,7 @@ namespace Stockfish {
             if (!rootNode)
             {
                 // Step 2. Check for aborted search and immediate draw
-                if (Threads.stop.load(std::memory_order_relaxed) || pos.is_draw(ss->ply) || ss->ply >= MAX_PLY)
+                if (thisThread->stop_requested() || pos.is_draw(ss->ply) || ss->ply >= MAX_PLY)
                     return (ss->ply >= MAX_PLY && !ss->inCheck) ? evaluate(pos) : value_draw(pos.this_thread());
 
                 // Step 3. Mate distance pruning. Even if we mate at the next move our score
@@ -940,8 +1204,8 @@ namespace Stockfish {
                 && (!Shashin
                     || (((!gameCycle) && (!ourMove || beta < VALUE_MATE_IN_MAX_PLY)
                         && (ttValue != VALUE_DRAW || VALUE_DRAW >= beta))
-                        || ((pos.this_thread()->shashinWinProbabilityRange != SHASHIN_POSITION_HIGH_TAL)
-                            && (pos.this_thread()->shashinWinProbabilityRange != SHASHIN_POSITION_CAPABLANCA))))
+                        || ((!(ss->shashin & ShashinHighTal))
+                            && (!(ss->shashin & ShashinCapablanca)))))
                 && tte->depth() > depth
                 && ttValue != VALUE_NONE  // Possible in case of TT access race or if !ttHit
                 && (tte->bound() & (ttValue >= beta ? BOUND_LOWER : BOUND_UPPER)))
@@ -1041,6 +1305,7 @@ namespace Stockfish {
                 // Skip early pruning when in check
                 ss->staticEval = eval = VALUE_NONE;
                 improving = false;
+                SEARCH_TRY(ProbCutInCheck, depth);
                 goto moves_loop;
             }
             else if (excludedMove)
@@ -1106,7 +1371,7 @@ namespace Stockfish {
                     && (ourMove || !excludedMove)
                     && !thisThread->nmpGuardV
                     && std::abs(eval) < 2 * VALUE_KNOWN_WIN)
-                    || (pos.this_thread()->shashinWinProbabilityRange != SHASHIN_POSITION_HIGH_TAL)))
+                    || (!(ss->shashin & ShashinHighTal))))
             {
                 // Step 7. Razoring (~1 Elo)
                 // If eval is really low check with qsearch if it can exceed alpha, if it can't,
@@ -1114,19 +1379,24 @@ namespace Stockfish {
                 // Adjust razor margin according to cutoffCnt. (~1 Elo)
                 if (!Shashin
                     || (!ourMove
-                        || ((pos.this_thread()->shashinWinProbabilityRange != SHASHIN_POSITION_HIGH_TAL)
-                            && (pos.this_thread()->shashinWinProbabilityRange != SHASHIN_POSITION_CAPABLANCA))))
+                        || ((!(ss->shashin & ShashinHighTal))
+                            && (!(ss->shashin & ShashinCapablanca)))))
                 {
                     if (eval < alpha - 472 - (284 - 165 * ((ss + 1)->cutoffCnt > 3)) * depth * depth)
                     {
+                        SEARCH_TRY(Razoring, depth);
                         value = qsearch<NonPV, Shashin>(pos, ss, alpha - 1, alpha);
                         if (value < alpha)
+                        {
+                            SEARCH_CUT(Razoring, depth);
                             return value;
+                        }
                     }
                 }
 
                 // Step 8. Futility pruning: child node (~40 Elo)
                 // The depth condition is important for mate finding.
+                SEARCH_TRY(Futility, depth);
                 if ((!Shashin
                     && (!ss->ttPv
                         && depth < 9
@@ -1140,9 +1410,12 @@ namespace Stockfish {
                             && eval >= beta
                             && (((!kingDanger && !gameCycle && !(thisThread->nmpGuard && nullParity)
                                 && std::abs(alpha) < VALUE_KNOWN_WIN)
-                                && ((!(isShashinHighMiddle(pos))) && isShashinPositionTal(pos)))
-                                || (eval < 29008 && (((isShashinHighMiddle(pos))) || !isShashinPositionTal(pos)))))))
+                                && ((!((ss->shashin & ShashinHighMiddle))) && (ss->shashin & ShashinTal)))
+                                || (eval < 29008 && ((((ss->shashin & ShashinHighMiddle))) || !(ss->shashin & ShashinTal)))))))
+                {
+                    SEARCH_CUT(Futility, depth);
                     return beta > VALUE_TB_LOSS_IN_MAX_PLY ? (eval + beta) / 2 : eval;
+                }
 
                 // Step 9. Null move search with verification search (~35 Elo)
                 if ((!Shashin
@@ -1162,12 +1435,12 @@ namespace Stockfish {
                             && eval >= ss->staticEval
                             && ss->staticEval >= beta - 23 * depth + 304
                             && pos.non_pawn_material(us)
-                            && (((isShashinHighMiddle(pos) || (!isShashinPositionTal(pos)))
+                            && ((((ss->shashin & ShashinHighMiddle) || (!(ss->shashin & ShashinTal)))
                                 && !PvNode
                                 && (ss - 1)->currentMove != Move::null()
                                 && !excludedMove
                                 && (ss->ply >= thisThread->nmpMinPly))
-                                || (((!(isShashinHighMiddle(pos))) && isShashinPositionTal(pos))
+                                || (((!((ss->shashin & ShashinHighMiddle))) && (ss->shashin & ShashinTal))
                                     && !thisThread->nmpGuard
                                     && !gameCycle
                                     && beta < VALUE_MATE_IN_MAX_PLY
@@ -1175,6 +1448,7 @@ namespace Stockfish {
                                     && (rootDepth < 11 || ourMove || MoveList<LEGAL>(pos).size() > 5))))))
                 {
                     assert(eval - beta >= 0);
+                    SEARCH_TRY(NullMove, depth);
 
                     if constexpr (Shashin)
                         thisThread->nmpSide = ourMove;
@@ -1197,14 +1471,17 @@ namespace Stockfish {
                     if (nullValue >= beta && nullValue < VALUE_TB_WIN_IN_MAX_PLY)
                     {
                         if (thisThread->nmpMinPly || depth < 15)
+                        {
+                            SEARCH_CUT(NullMove, depth);
                             return nullValue;
+                        }
 
                         assert(!thisThread->nmpMinPly); // Recursive verification is not allowed
 
                         // Do verification search at high depths, with null move pruning disabled
                         // until ply exceeds nmpMinPly.
                         if (!Shashin
-                            || pos.this_thread()->shashinWinProbabilityRange != SHASHIN_POSITION_CAPABLANCA)
+                            || !(ss->shashin & ShashinCapablanca))
                             thisThread->nmpMinPly = ss->ply + 3 * (depth - R) / 4;
 
                         if constexpr (Shashin)
@@ -1214,11 +1491,14 @@ namespace Stockfish {
                             thisThread->nmpGuardV = false;
 
                         if (!Shashin
-                            || pos.this_thread()->shashinWinProbabilityRange != SHASHIN_POSITION_HIGH_TAL)
+                            || !(ss->shashin & ShashinHighTal))
                             thisThread->nmpMinPly = 0;
 
                         if (v >= beta)
+                        {
+                            SEARCH_CUT(NullMove, depth);
                             return nullValue;
+                        }
                     }
                 }
 
@@ -1236,10 +1516,10 @@ namespace Stockfish {
                 {
                     if (PvNode && !ttMove
                         && ((!gameCycle && depth >= 3 && (ss - 1)->moveCount > 1)
-                            || ((pos.this_thread()->shashinWinProbabilityRange != SHASHIN_POSITION_HIGH_TAL))))
+                            || ((!(ss->shashin & ShashinHighTal)))))
                     {
                         depth -= 2 +
-                            (pos.this_thread()->shashinWinProbabilityRange != SHASHIN_POSITION_HIGH_TAL)
+                            (!(ss->shashin & ShashinHighTal))
                             ? 2 * (ss->ttHit && tte->depth() >= depth)
                             : 0;
                     }
@@ -1268,16 +1548,17 @@ namespace Stockfish {
                         && !(tte->depth() >= depth - 3 && ttValue != VALUE_NONE && ttValue < probCutBeta)))
                     || (Shashin
                         && (depth > 3
-                            && (((pos.this_thread()->shashinWinProbabilityRange == SHASHIN_POSITION_HIGH_TAL)
+                            && ((((ss->shashin & ShashinHighTal))
                                 && std::abs(beta) < VALUE_MATE_IN_MAX_PLY
                                 && (ttCapture || !ttMove)
                                 && (!ss->ttHit || (tte->depth()) < depth - 3))
-                                || ((pos.this_thread()->shashinWinProbabilityRange != SHASHIN_POSITION_HIGH_TAL)
+                                || ((!(ss->shashin & ShashinHighTal))
                                     && !PvNode
                                     && std::abs(beta) < VALUE_TB_WIN_IN_MAX_PLY
                                     && !(tte->depth() >= depth - 3 && ttValue != VALUE_NONE && ttValue < probCutBeta))))))
                 {
                     assert(probCutBeta < VALUE_INFINITE && probCutBeta > beta);
+                    SEARCH_TRY(ProbCut, depth);
 
                     MovePicker mp(pos, ttMove, probCutBeta - ss->staticEval, &captureHistory);
 
@@ -1286,8 +1567,8 @@ namespace Stockfish {
                         {
                             assert(pos.capture_stage(move));
 
-                            // Prefetch the TT entry for the resulting position
-                            prefetch(TT.first_entry(pos.key_after(move)));
+                            // Prefetch the entries of the resulting position
+                            thisThread->prefetch_after<false>(pos, move);
 
                             ss->currentMove = move;
                             ss->continuationHistory = &thisThread->
@@ -1310,6 +1591,7 @@ namespace Stockfish {
                                 // Save ProbCut data into transposition table
                                 tte->save(posKey, value_to_tt(value, ss->ply), ss->ttPv, BOUND_LOWER, depth - 3,
                                     move, unadjustedStaticEval);
+                                SEARCH_CUT(ProbCut, depth);
                                 return std::abs(value) < VALUE_TB_WIN_IN_MAX_PLY ? value - (probCutBeta - beta) : value;
                             }
                         }
@@ -1334,8 +1616,8 @@ namespace Stockfish {
                     && (!PvNode
                         && ss->inCheck
                         && ttCapture
-                        && ((((pos.this_thread()->shashinWinProbabilityRange != SHASHIN_POSITION_HIGH_TAL)
-                            && (pos.this_thread()->shashinWinProbabilityRange != SHASHIN_POSITION_CAPABLANCA)))
+                        && ((((!(ss->shashin & ShashinHighTal))
+                            && (!(ss->shashin & ShashinCapablanca))))
                             || (!gameCycle
                                 && !kingDanger
                                 && !(ss - 1)->secondaryLine
@@ -1346,7 +1628,10 @@ namespace Stockfish {
                         && ttValue >= probCutBeta
                         && std::abs(ttValue) < VALUE_TB_WIN_IN_MAX_PLY
                         && std::abs(beta) < VALUE_TB_WIN_IN_MAX_PLY)))
+            {
+                SEARCH_CUT(ProbCutInCheck, depth);
                 return probCutBeta;
+            }
 
             const PieceToHistory* contHist[] = { (ss - 1)->continuationHistory,
                                                  (ss - 2)->continuationHistory,
@@ -1402,9 +1687,9 @@ namespace Stockfish {
                 ss->moveCount = ++moveCount;
 
                 if (rootNode && bUCI && thisThread == Threads.main() && Time.elapsed() > 3000)
-                    sync_cout << "info depth " << depth << " currmove "
-                    << UCI::move(move, pos.is_chess960()) << " currmovenumber "
-                    << moveCount + thisThread->pvIdx << sync_endl;
+                    AsyncOut::post([s = "info depth " + std::to_string(depth) + " currmove " + UCI::move(move, pos.is_chess960())
+                        + " currmovenumber " + std::to_string(moveCount + thisThread->pvIdx)]() { return s; },
+                        AsyncOut::CurrMove);
                 if constexpr (PvNode)
                     (ss + 1)->pv = nullptr;
 
@@ -1427,7 +1712,7 @@ namespace Stockfish {
                     ss->secondaryLine = ((rootNode && moveCount > 1)
                         || (!ourMove && (ss - 1)->secondaryLine && !excludedMove && moveCount == 1)
                         || (ourMove && (ss - 1)->secondaryLine));
-                    if (pos.this_thread()->shashinWinProbabilityRange == SHASHIN_POSITION_MIDDLE_HIGH_TAL)
+                    if ((ss->shashin & ShashinMiddleHighTal))
                     {
                         if (givesCheck)
                         {
@@ -1468,25 +1753,33 @@ namespace Stockfish {
                 if ((!Shashin
                     && (!rootNode && pos.non_pawn_material(us) && bestValue > VALUE_TB_LOSS_IN_MAX_PLY))
                     || (Shashin
-                        && ((((pos.this_thread()->shashinWinProbabilityRange != SHASHIN_POSITION_HIGH_TAL)
+                        && ((((!(ss->shashin & ShashinHighTal))
                             && !rootNode
                             && pos.non_pawn_material(us)
                             && bestValue > VALUE_TB_LOSS_IN_MAX_PLY)
-                            || ((pos.this_thread()->shashinWinProbabilityRange == SHASHIN_POSITION_HIGH_TAL)
+                            || (((ss->shashin & ShashinHighTal))
                                 && doLMP
                                 && (bestValue < VALUE_MATE_IN_MAX_PLY || !ourMove)
                                 && bestValue > VALUE_MATED_IN_MAX_PLY)))))
                 {
                     // Skip quiet moves if movecount exceeds our FutilityMoveCount threshold (~8 Elo)
                     if (!moveCountPruning)
+                    {
+                        SEARCH_TRY(MoveCount, depth);
                         moveCountPruning = moveCount >= futility_move_count(improving, depth);
+                        if (moveCountPruning)
+                            SEARCH_CUT(MoveCount, depth);
+                    }
 
                     if (!Shashin
-                        || (lmPrunable || (pos.this_thread()->shashinWinProbabilityRange != SHASHIN_POSITION_HIGH_TAL)))
+                        || (lmPrunable || (!(ss->shashin & ShashinHighTal))))
                     {
                         // Reduced depth of the next LMR search
                         int lmrDepth = newDepth - r;
 
+                        SEARCH_TRY(MoveFutility, depth);
+                        SEARCH_TRY(SeePruning, depth);
+
                         if (capture || givesCheck)
                         {
                             // Futility pruning for captures (~2 Elo)
@@ -1498,12 +1791,18 @@ namespace Stockfish {
                                     + PieceValue[capturedPiece]
                                     + captureHistory[movedPiece][move.to_sq()][type_of(capturedPiece)] / 7;
                                 if (futilityEval < alpha)
+                                {
+                                    SEARCH_CUT(MoveFutility, depth);
                                     continue;
+                                }
                             }
 
                             // SEE based pruning for captures and checks (~11 Elo)
-                            if (!pos.see_ge(move, -187 * depth))
+                            if (!mp.see_ge(move, -187 * depth))
+                            {
+                                SEARCH_CUT(SeePruning, depth);
                                 continue;
+                            }
                         }
                         else
                         {
@@ -1514,7 +1813,10 @@ namespace Stockfish {
 
                             // Continuation history based pruning (~2 Elo)
                             if (lmrDepth < 6 && history < -3752 * depth)
+                            {
+                                SEARCH_CUT(MoveFutility, depth);
                                 continue;
+                            }
 
                             history += 2 * thisThread->mainHistory[us][move.from_to()];
 
@@ -1530,16 +1832,22 @@ namespace Stockfish {
                                     && (!ss->inCheck
                                         && lmrDepth < 14
                                         && ((history < 20500 - 3875 * (depth - 1))
-                                            || ((pos.this_thread()->shashinWinProbabilityRange != SHASHIN_POSITION_HIGH_TAL)
-                                                && (pos.this_thread()->shashinWinProbabilityRange != SHASHIN_POSITION_CAPABLANCA_PETROSIAN)))
+                                            || ((!(ss->shashin & ShashinHighTal))
+                                                && (!(ss->shashin & ShashinCapablancaPetrosian))))
                                         && ss->staticEval + (bestValue < ss->staticEval - 57 ? 124 : 71) + 118 * lmrDepth <= alpha)))
+                            {
+                                SEARCH_CUT(MoveFutility, depth);
                                 continue;
+                            }
 
                             lmrDepth = std::max(lmrDepth, 0);
 
                             // Prune moves with negative SEE (~4 Elo)
-                            if (!pos.see_ge(move, -26 * lmrDepth * lmrDepth))
+                            if (!mp.see_ge(move, -26 * lmrDepth * lmrDepth))
+                            {
+                                SEARCH_CUT(SeePruning, depth);
                                 continue;
+                            }
                         }
                     }
                 }
@@ -1573,8 +1881,12 @@ namespace Stockfish {
                         value = search<NonPV, Shashin>(pos, ss, singularBeta - 1, singularBeta, singularDepth, cutNode);
                         ss->excludedMove = Move::none();
 
+                        SEARCH_TRY(Singular, depth);
+                        SEARCH_TRY(MultiCut, depth);
+
                         if (value < singularBeta)
                         {
+                            SEARCH_CUT(Singular, depth);
                             extension = 1;
                             singularQuietLMR = !ttCapture;
 
@@ -1592,7 +1904,10 @@ namespace Stockfish {
                         // we assume this expected cut-node is not singular (multiple moves fail high),
                         // and we can prune the whole subtree by returning a softbound.
                         else if (singularBeta >= beta)
+                        {
+                            SEARCH_CUT(MultiCut, depth);
                             return singularBeta;
+                        }
 
                         // Negative extensions
                         // If other moves failed high over (ttValue - margin) without the ttMove on a reduced search,
@@ -1637,7 +1952,7 @@ namespace Stockfish {
                 ss->doubleExtensions = (ss - 1)->doubleExtensions + (extension == 2);
 
                 // Speculative prefetch as early as possible
-                prefetch(TT.first_entry(pos.key_after(move)));
+                thisThread->prefetch_after<false>(pos, move);
 
                 // Update the current move (this must be done after singular extension search)
                 ss->currentMove = move;
@@ -1672,9 +1987,9 @@ namespace Stockfish {
                         r--;
                     else
                         r -= 1
-                        + (((pos.this_thread()->shashinWinProbabilityRange != SHASHIN_POSITION_CAPABLANCA_TAL)
-                            && (pos.this_thread()->shashinWinProbabilityRange != SHASHIN_POSITION_CAPABLANCA_PETROSIAN)
-                            && (pos.this_thread()->shashinWinProbabilityRange != SHASHIN_POSITION_HIGH_TAL))
+                        + (((!(ss->shashin & ShashinCapablancaTal))
+                            && (!(ss->shashin & ShashinCapablancaPetrosian))
+                            && (!(ss->shashin & ShashinHighTal)))
                             ? (12 / (3 + depth))
                             : 1);
                 }
@@ -1715,11 +2030,11 @@ namespace Stockfish {
                     || (Shashin
                         && (depth >= 2
                             && moveCount > 1
-                            + ((pos.this_thread()->shashinWinProbabilityRange != SHASHIN_POSITION_CAPABLANCA_TAL)
+                            + ((!(ss->shashin & ShashinCapablancaTal))
                                 ? rootNode : 0)
                             && (!ss->ttPv || !capture || (cutNode && (ss - 1)->moveCount > 1))
                             && ((allowLMR && !lateKingDanger)
-                                || ((pos.this_thread()->shashinWinProbabilityRange != SHASHIN_POSITION_CAPABLANCA_TAL))))))
+                                || ((!(ss->shashin & ShashinCapablancaTal)))))))
                     {
                     // In general we want to cap the LMR depth search at newDepth, but when
                     // reduction is negative, we allow this move a limited search extension
@@ -1730,6 +2045,13 @@ namespace Stockfish {
 
                     value = -search<NonPV, Shashin>(pos, ss + 1, -(alpha + 1), -alpha, d, true);
 
+                    if (d < newDepth)
+                    {
+                        SEARCH_TRY(Lmr, depth);
+                        if (value <= alpha)
+                            SEARCH_CUT(Lmr, depth);
+                    }
+
                     // Do a full-depth search when reduced LMR search fails high
                     if (value > alpha && d < newDepth)
                     {
@@ -1780,7 +2102,7 @@ namespace Stockfish {
                 // Finished searching the move. If a stop occurred, the return value of
                 // the search cannot be trusted, and we return immediately without
                 // updating best move, PV and TT.
-                if (Threads.stop.load(std::memory_order_relaxed))
+                if (thisThread->stop_requested())
                     return VALUE_ZERO;
 
                 if (rootNode)
@@ -1854,7 +2176,7 @@ namespace Stockfish {
                                 && depth < 12
                                 && (!Shashin
                                     || (!gameCycle
-                                        || (pos.this_thread()->shashinWinProbabilityRange != SHASHIN_POSITION_CAPABLANCA)))
+                                        || (!(ss->shashin & ShashinCapablanca))))
                                 && beta < 13782
                                 && value > -11541)
                                 depth -= 2;
@@ -1902,7 +2224,7 @@ namespace Stockfish {
 
             if (PvNode
                 && (!Shashin
-                    || pos.this_thread()->shashinWinProbabilityRange != SHASHIN_POSITION_CAPABLANCA))
+                    || !(ss->shashin & ShashinCapablanca)))
                 bestValue = std::min(bestValue, maxValue);
 
             // If no good move is found and the previous position was ttPv, then the previous
@@ -1976,7 +2298,6 @@ namespace Stockfish {
 
             Move      pv[MAX_PLY + 1];
             StateInfo st;
-            ASSERT_ALIGNED(&st, Eval::NNUE::CacheLineSize);
 
             TTEntry* tte;
             Key      posKey;
@@ -1999,6 +2320,9 @@ namespace Stockfish {
             ss->inCheck = pos.checkers();
             moveCount = 0;
 
+            if constexpr (Shashin)
+                ss->shashin = thisThread->shashinStyle;
+
             // Used to send selDepth info to GUI (selDepth counts from 1, ply from 0)
             if (PvNode && thisThread->selDepth < ss->ply + 1)
                 thisThread->selDepth = ss->ply + 1;
@@ -2022,7 +2346,7 @@ namespace Stockfish {
             // At non-PV nodes we check for an early TT cutoff
             if (!PvNode
                 && (!Shashin ||
-                    ((pos.this_thread()->shashinWinProbabilityRange != SHASHIN_POSITION_HIGH_TAL)
+                    ((!(ss->shashin & ShashinHighTal))
                         || ((!gameCycle) && ((ss->ply & 1) || beta < VALUE_MATE_IN_MAX_PLY)
                             && (ttValue != VALUE_DRAW || VALUE_DRAW >= beta))))
                 && tte->depth() >= ttDepth
@@ -2116,11 +2440,16 @@ namespace Stockfish {
                         && futilityBase > VALUE_TB_LOSS_IN_MAX_PLY
                         && move.type_of() != PROMOTION)
                     {
+                        SEARCH_TRY(QsFutility, depth);
+
                         if ((!Shashin && moveCount > 2)
                             || (Shashin && moveCount > 2
-                                + ((pos.this_thread()->shashinWinProbabilityRange != SHASHIN_POSITION_HIGH_TAL)
+                                + ((!(ss->shashin & ShashinHighTal))
                                     ? 0 : PvNode)))
+                        {
+                            SEARCH_CUT(QsFutility, depth);
                             continue;
+                        }
 
                         futilityValue = futilityBase + PieceValue[pos.piece_on(move.to_sq())];
 
@@ -2128,22 +2457,25 @@ namespace Stockfish {
                         // than alpha we can prune this move.
                         if (futilityValue <= alpha)
                         {
+                            SEARCH_CUT(QsFutility, depth);
                             bestValue = std::max(bestValue, futilityValue);
                             continue;
                         }
 
                         // If static eval is much lower than alpha and move is not winning material
                         // we can prune this move.
-                        if (futilityBase <= alpha && !pos.see_ge(move, 1))
+                        if (futilityBase <= alpha && !mp.see_ge(move, 1))
                         {
+                            SEARCH_CUT(QsFutility, depth);
                             bestValue = std::max(bestValue, futilityBase);
                             continue;
                         }
 
                         // If static exchange evaluation is much worse than what is needed to not
                         // fall below alpha we can prune this move.
-                        if (futilityBase > alpha && !pos.see_ge(move, (alpha - futilityBase) * 4))
+                        if (futilityBase > alpha && !mp.see_ge(move, (alpha - futilityBase) * 4))
                         {
+                            SEARCH_CUT(QsFutility, depth);
                             bestValue = alpha;
                             continue;
                         }
@@ -2162,12 +2494,16 @@ namespace Stockfish {
                         continue;
 
                     // Do not search moves with bad enough SEE values (~5 Elo)
-                    if (!pos.see_ge(move, -77))
+                    SEARCH_TRY(QsSee, depth);
+                    if (!mp.see_ge(move, -77))
+                    {
+                        SEARCH_CUT(QsSee, depth);
                         continue;
+                    }
                 }
 
                 // Speculative prefetch as early as possible
-                prefetch(TT.first_entry(pos.key_after(move)));
+                thisThread->prefetch_after<false>(pos, move);
 
                 // Update the current move
                 ss->currentMove = move;
@@ -2450,6 +2786,12 @@ namespace Stockfish {
         if (ponder)
             return;
 
+        if (ponderStopTime)
+        {
+            Deadline::arm(ponderStopTime);
+            ponderStopTime = 0;
+        }
+
         if ((Limits.use_time_management() && (elapsed > Time.maximum() || stopOnPonderhit))
             || (Limits.movetime && elapsed >= Limits.movetime)
             || (Limits.nodes && Threads.nodes_searched() >= uint64_t(Limits.nodes)))
@@ -2459,9 +2801,11 @@ namespace Stockfish {
 
     // Formats PV information according to the UCI protocol.
     // UCI requires that all (if any) unsearched PV lines are sent using a previous search score.
-    std::string UCI::pv(const Position& pos, Depth depth) {
+    // All that is taken from the search is gathered here. The returned function formats the
+    // moves, for the non-UCI mode in SAN, and can run on the output thread.
+    std::function<std::string()> UCI::pv(const Position& pos, Depth depth) {
 
-        std::stringstream ss;
+        std::vector<std::pair<std::string, std::vector<Move>>> lines;
         TimePoint         elapsed = Time.elapsed() + 1;
         const RootMoves& rootMoves = pos.this_thread()->rootMoves;
         size_t            pvIdx = pos.this_thread()->pvIdx;
@@ -2485,9 +2829,7 @@ namespace Stockfish {
             bool tb = TB::RootInTB && std::abs(v) <= VALUE_TB;
             v = tb ? rootMoves[i].tbScore : v;
 
-            if (ss.rdbuf()->in_avail()) // Not at first line
-                ss << "\n";
-
+            std::stringstream ss;
             ss << "info";
 
             if (!bUCI && Threads.size() > 1)
@@ -2502,24 +2844,35 @@ namespace Stockfish {
             if (Options["UCI_ShowWDL"])
                 ss << UCI::wdl(v, pos.game_ply());
 
-            if (i == pvIdx && !tb && updated) // tablebase- and previous-scores are exact
+            if (i <= pvIdx && !tb && updated) // tablebase- and previous-scores are exact, see 'MultiPV Fast'
                 ss << (rootMoves[i].scoreLowerbound ? " lowerbound"
                     : (rootMoves[i].scoreUpperbound ? " upperbound" : ""));
 
             ss << " nodes " << nodesSearched << " nps " << nodesSearched * 1000 / elapsed << " hashfull " << TT.hashfull();
             if (tbHits) ss << " tbhits " << tbHits;
+            if (tbHits && !bUCI) ss << " tbcachehits " << TB::cache_hits();
             ss << " time " << elapsed << " pv";
 
-            if (bUCI)
-            {
-                for (Move m : rootMoves[i].pv)
-                    ss << " " << UCI::move(m, pos.is_chess960());
-            }
-            else
-                ss << SAN::to_san(pos, rootMoves[i]);
+            lines.emplace_back(ss.str(), rootMoves[i].pv);
         }
 
-        return ss.str();
+        return [lines = std::move(lines), isUCI = bUCI, fen = bUCI ? std::string() : pos.fen(),
+            chess960 = pos.is_chess960()]() {
+            std::string s;
+            for (const auto& [info, pv] : lines)
+            {
+                if (!s.empty()) // Not at first line
+                    s += "\n";
+
+                s += info;
+                if (isUCI)
+                    for (Move m : pv)
+                        s += " " + UCI::move(m, chess960);
+                else
+                    s += SAN::to_san(fen, chess960, pv);
+            }
+            return s;
+            };
     }
 
 
@@ -2530,7 +2883,6 @@ namespace Stockfish {
     bool RootMove::extract_ponder_from_tt(Position& pos) {
 
         StateInfo st;
-        ASSERT_ALIGNED(&st, Eval::NNUE::CacheLineSize);
 
         bool ttHit;
 
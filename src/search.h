@@ -50,6 +50,7 @@ namespace Stockfish {
             bool            ttPv;
             bool            ttHit;
             bool            secondaryLine; //from Crystal
+            uint8_t         shashin;       // ShashinStyle bits of the thread's range, see search.cpp
             int             doubleExtensions;
             int             cutoffCnt;
         };
@@ -91,7 +92,7 @@ namespace Stockfish {
 
             // Init explicitly due to broken value-initialization of non POD in MSVC
             LimitsType() {
-                time[WHITE] = time[BLACK] = inc[WHITE] = inc[BLACK] = npmsec = movetime = TimePoint(0);
+                time[WHITE] = time[BLACK] = inc[WHITE] = inc[BLACK] = npmsec = movetime = deadline = TimePoint(0);
                 movestogo = depth = mate = perft = infinite = 0;
                 nodes = 0;
             }
@@ -99,7 +100,7 @@ namespace Stockfish {
             bool use_time_management() const { return time[WHITE] || time[BLACK]; }
 
             std::vector<Move> searchmoves;
-            TimePoint         time[COLOR_NB], inc[COLOR_NB], npmsec, movetime, startTime;
+            TimePoint         time[COLOR_NB], inc[COLOR_NB], npmsec, movetime, deadline, startTime;
             int               movestogo, depth, mate, perft, infinite;
             int64_t           nodes;
         };
@@ -109,6 +110,9 @@ namespace Stockfish {
         void init();
         void clear();
 
+        // Opens the file of the 'Search Trace File' option, '<empty>' closes it
+        void set_trace_file(const std::string& fname);
+
     } // namespace Search
 
     // Different node types, used as a template parameter
@@ -118,7 +122,18 @@ namespace Stockfish {
         Root
     };
 
+    // The configurations of 'Use Classic', 'Use Shashin' and 'go mate', selected once per
+    // search as the template parameter of Thread::iterative_deepening()
+    enum class SearchStyle {
+        Normal,
+        Shashin,
+        Classic,
+        ClassicMate
+    };
+
     template<bool Root, bool Verbose> uint64_t perft(Position& pos, Depth depth);
+    void perft_hash(size_t mbSize);
+    uint64_t fast_perft(Position& pos, Depth depth);
 
     namespace Search::Classic {
 
@@ -0,0 +1,89 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2024 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "searchstats.h"
+
+#include <iomanip>
+#include <ostream>
+
+namespace Stockfish::SearchStats {
+
+#ifdef SEARCH_STATS
+
+    std::atomic<std::uint64_t> counts[STEP_NB][DepthBuckets][2];
+
+    namespace {
+
+        constexpr const char* StepNames[STEP_NB] = {
+            "Razoring", "Futility", "Null move", "ProbCut", "ProbCut in check", "Move count",
+            "Move futility", "SEE pruning", "Singular", "Multi-cut", "LMR", "QS futility",
+            "QS SEE", "Shashin range"
+        };
+
+    } // namespace
+
+    // Prints, for each step that has been tried, the total and the counts per depth
+    // with the rate of cuts in percent
+    void print(std::ostream& os) {
+
+        auto percent = [](std::uint64_t a, std::uint64_t b) { return b ? 100.0 * a / b : 0.0; };
+
+        os << "\nSearch statistics" << std::fixed << std::setprecision(1);
+
+        for (int s = 0; s < STEP_NB; ++s)
+        {
+            std::uint64_t tried = 0, cut = 0;
+            for (int d = 0; d < DepthBuckets; ++d)
+                tried += counts[s][d][0], cut += counts[s][d][1];
+
+            if (!tried)
+                continue;
+
+            os << "\n" << std::left << std::setw(22) << StepNames[s] << std::right
+                << " tried " << std::setw(12) << tried << " cut " << std::setw(12) << cut
+                << " (" << percent(cut, tried) << "%)";
+
+            for (int d = 0; d < DepthBuckets; ++d)
+                if (counts[s][d][0])
+                    os << "\n  depth " << std::setw(2) << d << (d == DepthBuckets - 1 ? "+" : " ")
+                    << "           tried " << std::setw(12) << counts[s][d][0]
+                    << " cut " << std::setw(12) << counts[s][d][1]
+                    << " (" << percent(counts[s][d][1], counts[s][d][0]) << "%)";
+        }
+
+        os << std::defaultfloat << std::setprecision(6) << std::endl;
+    }
+
+    void clear() {
+
+        for (auto& step : counts)
+            for (auto& depth : step)
+                depth[0] = depth[1] = 0;
+    }
+
+#else
+
+    void print(std::ostream& os) {
+        os << "Search statistics are not compiled in, build with 'make searchstats=yes'" << std::endl;
+    }
+
+    void clear() {}
+
+#endif
+
+} // namespace Stockfish::SearchStats
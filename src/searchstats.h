@@ -0,0 +1,74 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2024 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SEARCHSTATS_H_INCLUDED
+#define SEARCHSTATS_H_INCLUDED
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iosfwd>
+
+namespace Stockfish::SearchStats {
+
+    // The pruning steps of search() and qsearch(), in the NNUE and the classic search.
+    // A step is 'tried' when its condition is checked or its verification search is
+    // done and 'cut' when it prunes, reduces without a re-search or extends.
+    enum Step : int {
+        Razoring,
+        Futility,
+        NullMove,
+        ProbCut,
+        ProbCutInCheck,
+        MoveCount,
+        MoveFutility,
+        SeePruning,
+        Singular,
+        MultiCut,
+        Lmr,
+        QsFutility,
+        QsSee,
+        ShashinRange,
+        STEP_NB
+    };
+
+    constexpr int DepthBuckets = 32; // The last one collects all higher depths
+
+#ifdef SEARCH_STATS
+    // Counters of all threads, compiled in with 'make searchstats=yes'
+    extern std::atomic<std::uint64_t> counts[STEP_NB][DepthBuckets][2];
+
+    inline void record(Step s, int depth, bool cut) {
+        counts[s][std::clamp(depth, 0, DepthBuckets - 1)][cut].fetch_add(1, std::memory_order_relaxed);
+    }
+#endif
+
+    void print(std::ostream& os);
+    void clear();
+
+} // namespace Stockfish::SearchStats
+
+#ifdef SEARCH_STATS
+#define SEARCH_TRY(step, depth) Stockfish::SearchStats::record(Stockfish::SearchStats::step, depth, false)
+#define SEARCH_CUT(step, depth) Stockfish::SearchStats::record(Stockfish::SearchStats::step, depth, true)
+#else
+#define SEARCH_TRY(step, depth) ((void) 0)
+#define SEARCH_CUT(step, depth) ((void) 0)
+#endif
+
+#endif // #ifndef SEARCHSTATS_H_INCLUDED
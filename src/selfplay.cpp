@@ -0,0 +1,760 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2024 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "selfplay.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <BS_thread_pool.hpp>
+
+#include "book.h"
+#include "evaluate.h"
+#include "misc.h"
+#include "movegen.h"
+#include "position.h"
+#include "san.h"
+#include "search.h"
+#include "thread.h"
+#include "types.h"
+#include "uci.h"
+
+namespace Stockfish::SelfPlay {
+
+    namespace {
+
+        const char* StartFEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+
+        // The position a game starts from and the book moves played from it
+        struct Opening {
+            std::string       fen;
+            std::vector<Move> moves;
+        };
+
+        // Limits of every move, checked between the iterations, and the length of a game
+        struct Limits {
+            Depth     depth = 0;
+            uint64_t  nodes = 0;
+            TimePoint movetime = 0;
+            int       maxPly = 400;
+        };
+
+        struct Game {
+            size_t            round = 0;
+            const Opening*    opening = nullptr;
+            std::vector<Move> moves; // Played after those of the opening
+            std::string       result, reason;
+            bool              adjudicated = false;
+        };
+
+        // Searches the position with the thread alone and returns the best root move
+        const Search::RootMove& search(Thread* th, const Position& pos, const Limits& limits) {
+            return th->search_alone(pos, limits.depth, limits.nodes, limits.movetime);
+        }
+
+        // Returns true and sets the result of the game if it is over
+        bool game_over(const Position& pos, int ply, int maxPly, Game& game) {
+
+            if (!MoveList<LEGAL>(pos).size())
+            {
+                game.result = !pos.checkers() ? "1/2-1/2" : pos.side_to_move() == WHITE ? "0-1" : "1-0";
+                game.reason = !pos.checkers() ? "Stalemate" : pos.side_to_move() == WHITE ? "Black mates" : "White mates";
+                return true;
+            }
+
+            game.result = "1/2-1/2";
+            game.reason = pos.rule50_count() >= 100 ? "Fifty moves rule"
+                        : pos.state()->repetition < 0 ? "Threefold repetition"
+                        : !pos.pieces(PAWN) && pos.non_pawn_material() <= BishopValue ? "Insufficient material"
+                        : "";
+            game.adjudicated = game.reason.empty() && ply >= maxPly;
+
+            if (game.adjudicated)
+                game.reason = "Maximum game length";
+
+            return !game.reason.empty();
+        }
+
+        void play_game(Thread* th, Game& game, const Limits& limits, bool chess960) {
+
+            std::deque<StateInfo> states(1);
+            Position              pos;
+
+            pos.set(game.opening->fen, chess960, &states.back(), th);
+            for (Move m : game.opening->moves)
+                pos.do_move(m, states.emplace_back());
+
+            int ply = int(game.opening->moves.size());
+            while (!game_over(pos, ply++, limits.maxPly, game))
+            {
+                Move m = search(th, pos, limits).pv[0];
+                game.moves.push_back(m);
+                pos.do_move(m, states.emplace_back());
+            }
+        }
+
+        void write_pgn(std::ostream& os, const Game& game, bool chess960, const std::string& date) {
+
+            const Opening& o = *game.opening;
+            std::vector<Move> line = o.moves;
+            line.insert(line.end(), game.moves.begin(), game.moves.end());
+
+            os << "[Event \"Fluorine selfplay\"]\n[Site \"?\"]\n[Date \"" << date << "\"]\n[Round \""
+                << game.round << "\"]\n[White \"Fluorine\"]\n[Black \"Fluorine\"]\n[Result \"" << game.result
+                << "\"]\n";
+            if (chess960)
+                os << "[Variant \"Chess960\"]\n";
+            if (chess960 || o.fen != StartFEN)
+                os << "[FEN \"" << o.fen << "\"]\n[SetUp \"1\"]\n";
+            os << "[PlyCount \"" << line.size() << "\"]\n[Termination \""
+                << (game.adjudicated ? "adjudication" : "normal") << "\"]\n\n";
+
+            StateInfo st;
+            Position  pos;
+            pos.set(o.fen, chess960, &st, nullptr);
+            int  ply = pos.game_ply();
+            bool first = true;
+
+            std::istringstream san(SAN::to_san(o.fen, chess960, line));
+            std::string        text, token;
+            auto               append = [&](const std::string& s) {
+                if (text.size() + s.size() + 1 > 80)
+                    os << text << '\n', text.clear();
+                text += (text.empty() ? "" : " ") + s;
+                };
+
+            while (san >> token)
+            {
+                if (ply % 2 == 0 || first)
+                    append(std::to_string(1 + ply / 2) + (ply % 2 ? "..." : "."));
+                append(token);
+                first = false;
+                ++ply;
+            }
+            append("{" + game.reason + "}");
+            append(game.result);
+            os << text << "\n\n";
+        }
+
+        // Reads the positions of an EPD or FEN file, one per line, what follows a ';' is ignored
+        std::vector<Opening> read_openings(const std::string& fname, bool chess960) {
+
+            std::vector<Opening> openings;
+            std::ifstream        in(fname);
+            std::string          line;
+
+            while (std::getline(in, line))
+            {
+                std::string fen = line.substr(0, line.find(';'));
+                fen.erase(fen.find_last_not_of(" \t\r") + 1);
+                if (fen.empty())
+                    continue;
+
+                // An invalid FEN leaves the position as it was, so its board will not match
+                StateInfo st;
+                Position  pos;
+                pos.set(StartFEN, chess960, &st, nullptr);
+                pos.set(fen, chess960, &st, nullptr);
+                if (pos.fen().compare(0, fen.find(' '), fen, 0, fen.find(' ')) == 0 && MoveList<LEGAL>(pos).size())
+                    openings.push_back({ pos.fen(), {} });
+            }
+            return openings;
+        }
+
+        // Plays random moves of the opening book, weighted by their games, from the start position
+        Opening book_opening(int plies, bool chess960, Thread* th) {
+
+            Opening               o{ StartFEN, {} };
+            std::deque<StateInfo> states(1);
+            Position              pos;
+
+            pos.set(o.fen, chess960, &states.back(), th);
+            for (Move m; int(o.moves.size()) < plies && (m = Book::find_move(pos));)
+            {
+                o.moves.push_back(m);
+                pos.do_move(m, states.emplace_back());
+            }
+            return o;
+        }
+
+        std::string pgn_date() {
+
+            char        buf[16];
+            std::time_t t = std::time(nullptr);
+            return std::strftime(buf, sizeof(buf), "%Y.%m.%d", std::localtime(&t)) ? buf : "????.??.??";
+        }
+
+        // Returns the number of helper threads, those the games are played on
+        size_t helper_threads(const char* command) {
+
+            Threads.main()->wait_for_search_finished();
+
+            const size_t workers = Threads.size() - 1;
+            if (!workers)
+                sync_cout << "info string " << command
+                    << " plays its games on the threads but the main one, set Threads to 2 or more" << sync_endl;
+            else if (!useClassic)
+                Eval::NNUE::verify();
+
+            return workers;
+        }
+
+        // Clears the tables and sets the global state of the search, which all games share
+        void new_game() {
+
+            Search::clear();
+            Search::LimitsType searchLimits;
+            searchLimits.startTime = now();
+            Search::Limits = searchLimits;
+            Threads.stop = false;
+            Threads.increaseDepth = true;
+        }
+
+        // Training data of 'gensfen' starts with the 8 bytes of the magic, followed by one
+        // chain per game:
+        //  - the position after the opening: its occupancy and a nibble per piece in the order
+        //    of the squares (see put_position()), the rule 50 counter and the move number,
+        //  - the result of white (0 loss, 1 draw, 2 win) and the number of plies,
+        //  - for each ply the index of the move played in the legal moves ordered by raw(), and
+        //    the score of the search for the side to move, as a zigzag varint of its
+        //    difference to the negated score of the ply before.
+        constexpr char SfenMagic[8] = "FLSFEN1";
+
+        // Nibbles beyond the 12 pieces: the pawn that can be taken en passant, the rooks
+        // with a castling right, and the black king when black is to move.
+        enum : uint8_t {
+            EpPawn = 12,
+            CastlingRook = 13, // And 14 for black
+            BlackKingToMove = 15
+        };
+
+        template<typename T>
+        void put(std::vector<char>& buf, T v) {
+            for (size_t i = 0; i < sizeof(T); ++i)
+                buf.push_back(char(uint64_t(v) >> (8 * i)));
+        }
+
+        template<typename T>
+        T get(const char*& p) {
+            uint64_t v = 0;
+            for (size_t i = 0; i < sizeof(T); ++i)
+                v |= uint64_t(uint8_t(*p++)) << (8 * i);
+            return T(v);
+        }
+
+        void put_varint(std::vector<char>& buf, int v) {
+            for (uint32_t z = (uint32_t(v) << 1) ^ uint32_t(v >> 31); ; z >>= 7)
+                if (z < 0x80)
+                {
+                    buf.push_back(char(z));
+                    return;
+                }
+                else
+                    buf.push_back(char(z | 0x80));
+        }
+
+        int get_varint(const char*& p) {
+            uint32_t z = 0;
+            for (int shift = 0; ; shift += 7)
+            {
+                const uint8_t b = uint8_t(*p++);
+                z |= uint32_t(b & 0x7F) << shift;
+                if (b < 0x80)
+                    break;
+            }
+            return int(z >> 1) ^ -int(z & 1);
+        }
+
+        void put_position(std::vector<char>& buf, const Position& pos) {
+
+            const Color  us = pos.side_to_move();
+            const Square epPawn = pos.ep_square() != SQ_NONE ? pos.ep_square() + pawn_push(~us) : SQ_NONE;
+            uint8_t      nibbles[16] = {};
+            int          n = 0;
+
+            put<uint64_t>(buf, pos.pieces());
+            for (Bitboard b = pos.pieces(); b; ++n)
+            {
+                const Square s = pop_lsb(b);
+                const Piece  pc = pos.piece_on(s);
+                uint8_t      code = uint8_t(6 * color_of(pc) + type_of(pc) - 1);
+
+                if (s == epPawn)
+                    code = EpPawn;
+                else if (pc == B_KING && us == BLACK)
+                    code = BlackKingToMove;
+                else if (type_of(pc) == ROOK)
+                    for (CastlingRights cr : { WHITE_OO, WHITE_OOO, BLACK_OO, BLACK_OOO })
+                        if (pos.can_castle(cr) && pos.castling_rook_square(cr) == s)
+                            code = uint8_t(CastlingRook + int(color_of(pc)));
+
+                nibbles[n / 2] |= uint8_t(code << (4 * (n % 2)));
+            }
+
+            buf.insert(buf.end(), nibbles, nibbles + 16);
+            buf.push_back(char(std::min(pos.rule50_count(), 255)));
+            put<uint16_t>(buf, 1 + (pos.game_ply() - (us == BLACK)) / 2);
+        }
+
+        std::string get_position(const char*& p) {
+
+            const char* PieceChars = "PNBRQKpnbrqk";
+            char        board[SQUARE_NB] = {};
+            std::string castling, ep = "-";
+            Color       us = WHITE;
+
+            Bitboard      occupied = get<uint64_t>(p);
+            const uint8_t* nibbles = reinterpret_cast<const uint8_t*>(p);
+            p += 16;
+
+            for (int n = 0; occupied; ++n)
+            {
+                const Square  s = pop_lsb(occupied);
+                const uint8_t code = (nibbles[n / 2] >> (4 * (n % 2))) & 15;
+
+                if (code == EpPawn)
+                {
+                    const bool white = rank_of(s) == RANK_4;
+                    board[s] = white ? 'P' : 'p';
+                    ep = UCI::square(white ? s + SOUTH : s + NORTH);
+                }
+                else if (code == BlackKingToMove)
+                    board[s] = 'k', us = BLACK;
+                else if (code >= CastlingRook)
+                {
+                    const bool white = code == CastlingRook;
+                    board[s] = white ? 'R' : 'r';
+                    castling += char((white ? 'A' : 'a') + file_of(s));
+                }
+                else
+                    board[s] = PieceChars[code];
+            }
+
+            std::string fen;
+            for (Rank r = RANK_8; r >= RANK_1; --r)
+            {
+                for (File f = FILE_A; f <= FILE_H; ++f)
+                {
+                    int empty = 0;
+                    for (; f <= FILE_H && !board[make_square(f, r)]; ++f)
+                        ++empty;
+                    if (empty)
+                        fen += char('0' + empty);
+                    if (f <= FILE_H)
+                        fen += board[make_square(f, r)];
+                }
+                fen += r > RANK_1 ? "/" : "";
+            }
+
+            const int rule50 = uint8_t(*p++);
+            const int moveNumber = get<uint16_t>(p);
+
+            std::sort(castling.begin(), castling.end(), [](char a, char b) {
+                return std::isupper(a) != std::isupper(b) ? bool(std::isupper(a)) : a > b;
+                });
+
+            return fen + (us == WHITE ? " w " : " b ") + (castling.empty() ? "-" : castling) + " " + ep + " "
+                + std::to_string(rule50) + " " + std::to_string(moveNumber);
+        }
+
+        // The legal moves ordered by raw(), so that the index of a move does not depend on the
+        // order of the move generator
+        size_t sorted_legal(const Position& pos, Move* moves) {
+
+            const MoveList<LEGAL> legal(pos);
+            size_t                n = 0;
+            for (const auto& m : legal)
+                moves[n++] = m;
+            std::sort(moves, moves + n, [](Move a, Move b) { return a.raw() < b.raw(); });
+            return n;
+        }
+
+        // Collects the chains of the workers and writes them with a thread of its own,
+        // so that the workers do not wait for the disk
+        class ChainWriter {
+
+            static constexpr size_t FlushSize = 1 << 20;
+
+        public:
+            explicit ChainWriter(const std::string& fname) :
+                out(fname, std::ios::binary | std::ios::app) {
+
+                out.seekp(0, std::ios::end);
+                if (out && out.tellp() == 0)
+                    out.write(SfenMagic, sizeof(SfenMagic));
+
+                writer = std::thread([this] { write_loop(); });
+            }
+
+            ~ChainWriter() {
+                {
+                    std::lock_guard<std::mutex> lk(mutex);
+                    done = true;
+                }
+                cv.notify_one();
+                writer.join();
+            }
+
+            bool is_open() const { return bool(out); }
+
+            void push(const std::vector<char>& chain) {
+
+                std::lock_guard<std::mutex> lk(mutex);
+                pending.insert(pending.end(), chain.begin(), chain.end());
+                if (pending.size() >= FlushSize)
+                    cv.notify_one();
+            }
+
+        private:
+            void write_loop() {
+
+                std::vector<char> buf;
+                for (bool last = false; !last;)
+                {
+                    {
+                        std::unique_lock<std::mutex> lk(mutex);
+                        cv.wait(lk, [&] { return done || pending.size() >= FlushSize; });
+                        buf.swap(pending);
+                        last = done;
+                    }
+                    out.write(buf.data(), std::streamsize(buf.size()));
+                    buf.clear();
+                }
+                out.flush();
+            }
+
+            std::ofstream           out;
+            std::vector<char>       pending;
+            std::mutex              mutex;
+            std::condition_variable cv;
+            bool                    done = false;
+            std::thread             writer;
+        };
+
+        // Writes the positions of a training data file as text, a line per position with the
+        // FEN, the move played, the score and the result of the side to move.
+        void decode(const std::string& fname, const std::string& outName) {
+
+            std::ifstream in(fname, std::ios::binary);
+            std::string   data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            std::ofstream out(outName);
+
+            if (data.size() < sizeof(SfenMagic) || data.compare(0, sizeof(SfenMagic), SfenMagic, sizeof(SfenMagic)) || !out)
+            {
+                sync_cout << "info string gensfen: " << fname << " is no training data file or "
+                    << outName << " can not be written" << sync_endl;
+                return;
+            }
+
+            const bool  chess960 = Options["UCI_Chess960"];
+            const char* p = data.data() + sizeof(SfenMagic);
+            const char* end = data.data() + data.size();
+            size_t      positions = 0;
+            Move        moves[MAX_MOVES];
+
+            out << "FEN;Move;Score;Result\n";
+            while (end - p >= 27 + 3)
+            {
+                std::deque<StateInfo> states(1);
+                Position              pos;
+
+                pos.set(get_position(p), chess960, &states.back(), Threads.main());
+                const int result = int(uint8_t(*p++)) - 1;
+                const int plies = get<uint16_t>(p);
+                int       score = 0;
+
+                for (int i = 0; i < plies && p < end; ++i)
+                {
+                    const size_t idx = uint8_t(*p++);
+                    score = get_varint(p) - score;
+
+                    const size_t n = sorted_legal(pos, moves);
+                    if (idx >= n)
+                        return;
+
+                    out << pos.fen() << ';' << UCI::move(moves[idx], chess960) << ';' << score << ';'
+                        << (pos.side_to_move() == WHITE ? result : -result) << '\n';
+                    pos.do_move(moves[idx], states.emplace_back());
+                    ++positions;
+                }
+            }
+
+            sync_cout << "info string " << positions << " positions written to " << outName << sync_endl;
+        }
+
+    } // namespace
+
+
+    // 'selfplay [games n] [depth d] [nodes n] [movetime ms] [maxply n] [openings file|book]
+    // [bookply n] [pgn file]' plays the games on all search threads but the main one, a game
+    // per thread. A thread that finishes a game starts the next one.
+    void play(std::istream& args) {
+
+        std::string token, openingFile = "book", pgnFile = "selfplay.pgn";
+        Limits      limits;
+        size_t      games = 100;
+        int         bookPly = 8;
+
+        while (args >> token)
+            if (token == "games")
+                args >> games;
+            else if (token == "depth")
+                args >> limits.depth;
+            else if (token == "nodes")
+                args >> limits.nodes;
+            else if (token == "movetime")
+                args >> limits.movetime;
+            else if (token == "maxply")
+                args >> limits.maxPly;
+            else if (token == "openings")
+                args >> openingFile;
+            else if (token == "bookply")
+                args >> bookPly;
+            else if (token == "pgn")
+                args >> pgnFile;
+
+        if (!limits.depth && !limits.nodes && !limits.movetime)
+            limits.nodes = 20000;
+
+        const size_t workers = helper_threads("selfplay");
+        if (!workers)
+            return;
+
+        const bool chess960 = Options["UCI_Chess960"];
+
+        // Openings are drawn before the games start, only the caller uses the book
+        std::vector<Opening> openings;
+        if (openingFile == "book" && !Options["Use Book"])
+            sync_cout << "info string selfplay: the book is not loaded, set Use Book to play book openings"
+                << sync_endl;
+
+        if (openingFile == "book")
+            for (size_t i = 0; i < games; ++i)
+                openings.push_back(book_opening(bookPly, chess960, Threads.main()));
+        else
+            openings = read_openings(openingFile, chess960);
+
+        std::ofstream pgn(pgnFile, std::ios::app);
+        if (openings.empty() || !pgn)
+        {
+            sync_cout << "info string selfplay: no openings in " << openingFile << " or unable to write "
+                << pgnFile << sync_endl;
+            return;
+        }
+
+        new_game();
+
+        const std::string   date = pgn_date();
+        std::atomic<size_t> next = 0;
+        std::mutex          mutex;
+        size_t              finished = 0, wins = 0, draws = 0, losses = 0;
+        uint64_t            moves = 0;
+        const size_t        reportEvery = std::max(size_t(1), games / 10);
+        const TimePoint     start = now();
+
+        auto report = [&](const char* prefix) {
+            const TimePoint elapsed = now() - start + 1;
+            sync_cout << "info string " << prefix << finished << " of " << games << " games, +" << wins << " ="
+                << draws << " -" << losses << ", " << 3600000 * finished / elapsed << " games/hour, "
+                << 1000 * moves / elapsed << " moves/s" << sync_endl;
+            };
+
+        // Each worker plays with the tables and the histories of one of the helper threads
+        BS::thread_pool pool{ BS::concurrency_t(workers) };
+        for (size_t w = 0; w < workers; ++w)
+            pool.push_task([&, w] {
+                Thread* th = *(Threads.begin() + 1 + w);
+                for (size_t i; (i = next++) < games;)
+                {
+                    Game game;
+                    game.round = i + 1;
+                    game.opening = &openings[i % openings.size()];
+                    play_game(th, game, limits, chess960);
+
+                    std::lock_guard<std::mutex> lk(mutex);
+                    write_pgn(pgn, game, chess960, date);
+                    ++(game.result == "1-0" ? wins : game.result == "0-1" ? losses : draws);
+                    moves += game.moves.size();
+                    if (++finished % reportEvery == 0 && finished < games)
+                        report("selfplay ");
+                }
+                });
+        pool.wait_for_tasks();
+
+        report("selfplay finished, ");
+        sync_cout << "info string games written to " << pgnFile << sync_endl;
+    }
+
+
+    // 'gensfen [count n] [depth d] [nodes n] [randomply n] [bookply n] [evallimit n]
+    // [maxply n] [file f]' writes the positions of self-play games with the scores of their
+    // searches and the results as training data, see SfenMagic for the format. Games start
+    // with moves of the book and random moves, and end when the score of a search reaches
+    // the eval limit. 'gensfen decode <file> [out]' writes the positions of a file as text.
+    void gensfen(std::istream& args) {
+
+        std::string token, fname = "fluorine.sfen";
+        Limits      limits;
+        size_t      count = 100000;
+        int         randomPly = 8, bookPly = 8, evalLimit = 3000;
+
+        while (args >> token)
+            if (token == "decode")
+            {
+                std::string in, out;
+                args >> in;
+                if (!(args >> out))
+                    out = in + ".txt";
+                decode(in, out);
+                return;
+            }
+            else if (token == "count")
+                args >> count;
+            else if (token == "depth")
+                args >> limits.depth;
+            else if (token == "nodes")
+                args >> limits.nodes;
+            else if (token == "randomply")
+                args >> randomPly;
+            else if (token == "bookply")
+                args >> bookPly;
+            else if (token == "evallimit")
+                args >> evalLimit;
+            else if (token == "maxply")
+                args >> limits.maxPly;
+            else if (token == "file")
+                args >> fname;
+
+        if (!limits.depth && !limits.nodes)
+            limits.nodes = 5000;
+
+        const size_t workers = helper_threads("gensfen");
+        if (!workers)
+            return;
+
+        ChainWriter writer(fname);
+        if (!writer.is_open())
+        {
+            sync_cout << "info string gensfen: unable to write " << fname << sync_endl;
+            return;
+        }
+
+        // Unlike selfplay, the workers draw the openings themselves, the book is only read
+        const bool useBook = bookPly > 0 && Options["Use Book"];
+        const bool chess960 = Options["UCI_Chess960"];
+
+        new_game();
+
+        std::atomic<size_t> written = 0, games = 0;
+        std::atomic<size_t> nextReport = std::max(size_t(1), count / 10);
+        const TimePoint     start = now();
+
+        auto report = [&](const char* prefix) {
+            const TimePoint elapsed = now() - start + 1;
+            sync_cout << "info string " << prefix << std::min(size_t(written), count) << " of " << count << " positions, "
+                << games << " games, " << 1000 * written / elapsed << " positions/s" << sync_endl;
+            };
+
+        BS::thread_pool pool{ BS::concurrency_t(workers) };
+        for (size_t w = 0; w < workers; ++w)
+            pool.push_task([&, w] {
+                Thread* th = *(Threads.begin() + 1 + w);
+                PRNG    rng((uint64_t(now()) ^ ((w + 1) * 0x9E3779B97F4A7C15ULL)) | 1);
+                Move    moves[MAX_MOVES];
+
+                while (written < count)
+                {
+                    std::deque<StateInfo> states(1);
+                    Position              pos;
+                    Opening               o = useBook ? book_opening(bookPly, chess960, th) : Opening{ StartFEN, {} };
+
+                    pos.set(o.fen, chess960, &states.back(), th);
+                    for (Move m : o.moves)
+                        pos.do_move(m, states.emplace_back());
+
+                    for (int i = 0; i < randomPly; ++i)
+                        if (const size_t n = sorted_legal(pos, moves))
+                            pos.do_move(moves[rng.rand<uint64_t>() % n], states.emplace_back());
+
+                    std::vector<char> chain;
+                    put_position(chain, pos);
+                    const size_t header = chain.size();
+                    chain.resize(header + 3); // The result and the plies, known at the end
+
+                    Game game;
+                    int  ply = int(o.moves.size()) + randomPly, plies = 0, prevScore = 0;
+                    int  result = 1;
+                    while (!game_over(pos, ply++, limits.maxPly, game))
+                    {
+                        const Search::RootMove& rm = search(th, pos, limits);
+                        const int               score = rm.score;
+
+                        if (std::abs(score) >= evalLimit)
+                        {
+                            result = (score > 0) == (pos.side_to_move() == WHITE) ? 2 : 0;
+                            break;
+                        }
+
+                        const size_t n = sorted_legal(pos, moves);
+                        chain.push_back(char(std::find(moves, moves + n, rm.pv[0]) - moves));
+                        put_varint(chain, score + prevScore);
+                        prevScore = score;
+                        ++plies;
+
+                        pos.do_move(rm.pv[0], states.emplace_back());
+                    }
+
+                    if (game.result == "1-0" || game.result == "0-1")
+                        result = game.result == "1-0" ? 2 : 0;
+
+                    if (!plies)
+                        continue;
+
+                    chain[header] = char(result);
+                    chain[header + 1] = char(plies & 0xFF);
+                    chain[header + 2] = char(plies >> 8);
+                    writer.push(chain);
+                    ++games;
+
+                    const size_t total = written += size_t(plies);
+                    if (size_t r = nextReport; total >= r && total < count
+                        && nextReport.compare_exchange_strong(r, total + std::max(size_t(1), count / 10)))
+                        report("gensfen ");
+                }
+                });
+        pool.wait_for_tasks();
+
+        report("gensfen finished, ");
+        sync_cout << "info string positions written to " << fname << sync_endl;
+    }
+
+} // namespace Stockfish::SelfPlay
@@ -0,0 +1,36 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2024 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SELFPLAY_H_INCLUDED
+#define SELFPLAY_H_INCLUDED
+
+#include <iosfwd>
+
+namespace Stockfish::SelfPlay {
+
+    // 'selfplay' plays games of the engine against itself, several at the same time,
+    // each on a search thread of its own. The networks and the hash are shared.
+    void play(std::istream& args);
+
+    // 'gensfen' writes the positions of such games with the scores of their searches and
+    // their results, in a compact binary format, as training data for the networks.
+    void gensfen(std::istream& args);
+
+} // namespace Stockfish::SelfPlay
+
+#endif // #ifndef SELFPLAY_H_INCLUDED
@@ -0,0 +1,374 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2024 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "server.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <BS_thread_pool.hpp>
+
+#include "evaluate.h"
+#include "misc.h"
+#include "movegen.h"
+#include "position.h"
+#include "search.h"
+#include "thread.h"
+#include "types.h"
+#include "uci.h"
+
+namespace Stockfish::Server {
+
+    namespace {
+
+        const char* StartFEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+
+        // The limits of a 'go' of a session, zero for no limit
+        struct Request {
+            Depth     depth = 0;
+            uint64_t  nodes = 0;
+            TimePoint movetime = 0;
+        };
+
+        // A session keeps its position, the searches waiting for a thread and the one
+        // running, and what its searches have cost so far.
+        struct Session {
+            std::string          fen = StartFEN;
+            std::vector<Move>    moves;
+            bool                 chess960 = false;
+            std::deque<Request>  pending;
+            Thread*              running = nullptr;
+            uint64_t             maxNodes = 0;
+            TimePoint            stopTime = 0;
+            bool                 closed = false; // Removed when its search is finished
+            uint64_t             searches = 0, nodes = 0;
+            TimePoint            time = 0;
+        };
+
+        // The sessions, in the order they were opened. The threads take the searches in
+        // turn, starting after the session served last, so that a session asking for many
+        // searches does not keep the others waiting.
+        std::mutex                     mutex;
+        std::condition_variable        cv;
+        std::map<std::string, Session> sessions;
+        std::vector<std::string>       order;
+        size_t                         turn = 0;
+        bool                           exiting = false;
+
+        void remove(const std::string& id) {
+
+            sessions.erase(id);
+            order.erase(std::find(order.begin(), order.end(), id));
+        }
+
+        // Returns the next session with a search to run and no search running, if any.
+        // The sessions share the TT, so its generation is advanced once per round over
+        // the sessions, when the turn goes past the last one.
+        std::string* next_session() {
+
+            for (size_t i = 0; i < order.size(); ++i)
+            {
+                const size_t idx = (turn + i) % order.size();
+                Session&     s = sessions[order[idx]];
+                if (!s.running && !s.closed && !s.pending.empty())
+                {
+                    if (turn + i >= order.size())
+                        TT.new_search();
+                    turn = idx + 1;
+                    return &order[idx];
+                }
+            }
+
+            return nullptr;
+        }
+
+        // Sets up the position of a 'position' command, the same way as in the UCI loop.
+        // Returns false if the position is invalid, the moves are kept up to the first
+        // illegal one.
+        bool set_position(Session& s, std::istringstream& is) {
+
+            std::string token, fen;
+            is >> token;
+
+            if (token == "startpos")
+            {
+                fen = StartFEN;
+                is >> token;
+            }
+            else if (token == "fen")
+                while (is >> token && token != "moves")
+                    fen += token + " ";
+            else
+                return false;
+
+            StateListPtr states(new StateList(1));
+            Position     pos;
+            pos.set(fen, Options["UCI_Chess960"], &states->back(), Threads.main());
+
+            s.fen = fen;
+            s.chess960 = pos.is_chess960();
+            s.moves.clear();
+
+            Move m;
+            while (is >> token && (m = UCI::to_move(pos, token)))
+            {
+                s.moves.push_back(m);
+                pos.do_move(m, states->emplace_back());
+            }
+
+            return true;
+        }
+
+        // Runs the searches of the sessions on the thread until the server exits
+        void serve(Thread* th) {
+
+            std::unique_lock<std::mutex> lock(mutex);
+
+            while (true)
+            {
+                std::string* next = nullptr;
+                cv.wait(lock, [&] { return exiting || (next = next_session()); });
+                if (exiting)
+                    return;
+
+                const std::string id = *next;
+                Session&          s = sessions[id];
+                const Request     r = s.pending.front();
+                s.pending.pop_front();
+                s.running = th;
+                th->nodes = 0; // Watched from now on, see watch()
+                s.maxNodes = r.nodes;
+                s.stopTime = r.movetime ? now() + r.movetime : 0;
+                const bool chess960 = s.chess960;
+
+                StateListPtr states(new StateList(1));
+                Position     pos;
+                pos.set(s.fen, chess960, &states->back(), th);
+                for (Move m : s.moves)
+                    pos.do_move(m, states->emplace_back());
+
+                lock.unlock();
+
+                const TimePoint start = now();
+                std::string     bestmove = "(none)";
+
+                if (MoveList<LEGAL>(pos).size())
+                {
+                    th->ownReport = [&] {
+                        const Search::RootMove& rm = th->rootMoves[0];
+                        const TimePoint         elapsed = now() - start + 1;
+                        std::stringstream       ss;
+
+                        ss << id << " info depth " << th->completedDepth << " seldepth " << rm.selDepth
+                            << " score " << UCI::value(rm.score) << " nodes " << th->nodes
+                            << " nps " << th->nodes * 1000 / elapsed << " time " << elapsed << " pv";
+                        for (Move m : rm.pv)
+                            ss << " " << UCI::move(m, chess960);
+
+                        sync_cout << ss.str() << sync_endl;
+                    };
+
+                    const Search::RootMove& rm = th->search_alone(pos, r.depth, r.nodes, r.movetime);
+                    th->ownReport = nullptr;
+
+                    bestmove = UCI::move(rm.pv[0], chess960);
+                    if (rm.pv.size() > 1)
+                        bestmove += " ponder " + UCI::move(rm.pv[1], chess960);
+                }
+
+                sync_cout << id << " bestmove " << bestmove << sync_endl;
+
+                lock.lock();
+                s.running = nullptr;
+                th->ownStop = false;
+                ++s.searches;
+                s.nodes += th->nodes;
+                s.time += now() - start;
+                if (s.closed)
+                    remove(id);
+                cv.notify_all();
+            }
+        }
+
+        // Stops the searches that have reached their nodes or time, the searches check
+        // their limits themselves only between the iterations.
+        void watch() {
+
+            std::unique_lock<std::mutex> lock(mutex);
+
+            while (!exiting)
+            {
+                for (auto& [sessionId, s] : sessions)
+                    if (s.running
+                        && ((s.stopTime && now() >= s.stopTime) || (s.maxNodes && s.running->nodes >= s.maxNodes)))
+                        s.running->ownStop = true;
+
+                cv.wait_for(lock, std::chrono::milliseconds(2));
+            }
+        }
+
+        void print_stats() {
+
+            uint64_t  searches = 0, nodes = 0;
+            TimePoint time = 0;
+
+            for (const std::string& id : order)
+            {
+                const Session& s = sessions[id];
+                sync_cout << id << " stats searches " << s.searches << " nodes " << s.nodes << " time " << s.time
+                    << " nps " << s.nodes * 1000 / (s.time + 1) << (s.running ? " searching" : "")
+                    << sync_endl;
+                searches += s.searches, nodes += s.nodes, time += s.time;
+            }
+
+            sync_cout << "stats sessions " << order.size() << " searches " << searches << " nodes " << nodes
+                << " time " << time << sync_endl;
+        }
+
+    } // namespace
+
+    void run() {
+
+        Threads.main()->wait_for_search_finished();
+
+        const size_t workers = Threads.size() - 1;
+        if (!workers)
+        {
+            sync_cout << "info string server runs its searches on the threads but the main one, set Threads to 2 or more"
+                << sync_endl;
+            return;
+        }
+
+        if (!useClassic)
+            Eval::NNUE::verify();
+
+        // The global state of the search, shared by all sessions, has no limits
+        Search::LimitsType searchLimits;
+        searchLimits.startTime = now();
+        Search::Limits = searchLimits;
+        Threads.stop = false;
+        Threads.increaseDepth = true;
+        exiting = false;
+
+        BS::thread_pool pool{ BS::concurrency_t(workers + 1) };
+        for (size_t w = 0; w < workers; ++w)
+            pool.push_task([w] { serve(*(Threads.begin() + 1 + w)); });
+        pool.push_task(watch);
+
+        sync_cout << "info string server ready, " << workers << " searches at a time" << sync_endl;
+
+        std::string line, id, token;
+        while (UCI::read_line(line))
+        {
+            std::istringstream is(line);
+            if (!(is >> id))
+                continue;
+
+            if (id == "quit")
+                break;
+
+            std::lock_guard<std::mutex> lock(mutex);
+
+            if (id == "stats")
+            {
+                print_stats();
+                continue;
+            }
+
+            token.clear();
+            is >> token;
+
+            if (!sessions.count(id) && token != "position" && token != "go")
+            {
+                sync_cout << id << " info string no such session" << sync_endl;
+                continue;
+            }
+
+            if (!sessions.count(id))
+                order.push_back(id);
+
+            Session& s = sessions[id];
+            if (s.closed)
+            {
+                sync_cout << id << " info string the session is closing" << sync_endl;
+                continue;
+            }
+
+            if (token == "position")
+            {
+                if (!set_position(s, is))
+                    sync_cout << id << " info string invalid position" << sync_endl;
+            }
+            else if (token == "go")
+            {
+                Request r;
+                while (is >> token)
+                    if (token == "depth")
+                        is >> r.depth;
+                    else if (token == "nodes")
+                        is >> r.nodes;
+                    else if (token == "movetime")
+                        is >> r.movetime;
+
+                s.pending.push_back(r);
+                cv.notify_all();
+            }
+            else if (token == "stop" || token == "close")
+            {
+                s.pending.clear();
+                if (s.running)
+                    s.running->ownStop = true;
+
+                if (token == "close")
+                {
+                    if (s.running)
+                        s.closed = true;
+                    else
+                        remove(id);
+                }
+            }
+            else
+                sync_cout << id << " info string unknown command " << token << sync_endl;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            exiting = true;
+            for (auto& [sessionId, s] : sessions)
+                if (s.running)
+                    s.running->ownStop = true;
+            cv.notify_all();
+        }
+
+        pool.wait_for_tasks();
+
+        sessions.clear();
+        order.clear();
+        for (Thread* th : Threads)
+            th->ownStop = false;
+    }
+
+} // namespace Stockfish::Server
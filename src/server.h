@@ -0,0 +1,31 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2024 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SERVER_H_INCLUDED
+#define SERVER_H_INCLUDED
+
+namespace Stockfish::Server {
+
+    // 'server' serves analysis sessions from the standard input until 'quit', many at the
+    // same time. Each line starts with the id of its session, the searches of different
+    // sessions run side by side on the threads but the main one, see README.md.
+    void run();
+
+} // namespace Stockfish::Server
+
+#endif // #ifndef SERVER_H_INCLUDED
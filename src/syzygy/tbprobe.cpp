@@ -22,16 +22,19 @@
 #include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <chrono>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <deque>
 #include <fstream>
 #include <initializer_list>
+#include <iomanip>
 #include <iostream>
 #include <mutex>
 #include <sstream>
 #include <string_view>
+#include <thread>
 #include <type_traits>
 #include <utility>
 #include <vector>
@@ -47,6 +50,7 @@
 #ifndef _WIN32
     #include <fcntl.h>
     #include <sys/mman.h>
+    #include <sys/resource.h>
     #include <unistd.h>
 #else
     #define WIN32_LEAN_AND_MEAN
@@ -310,6 +314,26 @@ namespace Stockfish {
                 CloseHandle((HANDLE)mapping);
 #endif
             }
+
+            // Ask the OS to read the mapped file ahead, so that it is in the page
+            // cache before the search probes it.
+            static void prefetch(void* baseAddress, uint64_t mapping) {
+
+#ifndef _WIN32
+#if defined(MADV_WILLNEED)
+                madvise(baseAddress, mapping, MADV_WILLNEED);
+#endif
+#elif _WIN32_WINNT >= 0x0602
+                MEMORY_BASIC_INFORMATION info;
+                if (VirtualQuery(baseAddress, &info, sizeof(info)))
+                {
+                    WIN32_MEMORY_RANGE_ENTRY range{ baseAddress, info.RegionSize };
+                    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+                }
+#endif
+                (void)baseAddress;
+                (void)mapping;
+            }
         };
 
         std::string TBFile::Paths;
@@ -339,6 +363,28 @@ namespace Stockfish {
             uint16_t map_idx[4];              // WDLWin, WDLLoss, WDLCursedWin, WDLBlessedLoss (used in DTZ)
         };
 
+#ifdef TB_STATS
+        // Counters of a table, compiled in with 'make tbstats=yes'. 'bytes' are the compressed
+        // bytes read from the blocks, so with 'blocks' they tell how much of the file a probe
+        // touches, and 'time' includes the mapping of the file and any page faults.
+        struct TBStats {
+            std::atomic<uint64_t> probes, blocks, bytes, time; // Time in ns
+
+            // Counts a probe and its time from construction to destruction
+            struct Probe {
+                TBStats&                              stats;
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+                ~Probe() {
+                    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start);
+                    stats.probes.fetch_add(1, std::memory_order_relaxed);
+                    stats.time.fetch_add(uint64_t(ns.count()), std::memory_order_relaxed);
+                }
+            };
+        };
+#endif
+
         // struct TBTable contains indexing information to access the corresponding TBFile.
         // There are 2 types of TBTable, corresponding to a WDL or a DTZ file.
         // TBTable is populated at init time but the nested PairsData records are populated at
@@ -350,6 +396,8 @@ namespace Stockfish {
             static constexpr int Sides = Type == WDL ? 2 : 1;
 
             std::atomic_bool ready;
+            std::mutex       mutex; // Held while the file is mapped
+            std::string      code;  // Like "KRvK", the file name without extension
             void* baseAddress;
             uint8_t* map;
             uint64_t         mapping;
@@ -360,13 +408,16 @@ namespace Stockfish {
             bool             hasUniquePieces;
             uint8_t          pawnCount[2];    // [Lead color / other color]
             PairsData        items[Sides][4]; // [wtm / btm][FILE_A..FILE_D or 0]
+#ifdef TB_STATS
+            TBStats          stats;
+#endif
 
             PairsData* get(int stm, int f) { return &items[stm % Sides][hasPawns ? f : 0]; }
 
             TBTable() :
                 ready(false),
                 baseAddress(nullptr) {}
-            explicit TBTable(const std::string& code);
+            explicit TBTable(const std::string& materialCode);
             explicit TBTable(const TBTable<WDL>& wdl);
 
             ~TBTable() {
@@ -376,12 +427,13 @@ namespace Stockfish {
         };
 
         template<>
-        TBTable<WDL>::TBTable(const std::string& code) :
+        TBTable<WDL>::TBTable(const std::string& materialCode) :
             TBTable() {
 
             StateInfo st;
             Position  pos;
 
+            code = materialCode;
             key = pos.set(code, WHITE, &st).material_key();
             pieceCount = pos.count<ALL_PIECES>();
             hasPawns = pos.pieces(PAWN);
@@ -408,6 +460,7 @@ namespace Stockfish {
             TBTable() {
 
             // Use the corresponding WDL table to avoid recalculating all from scratch
+            code = wdl.code;
             key = wdl.key;
             key2 = wdl.key2;
             pieceCount = wdl.pieceCount;
@@ -417,6 +470,31 @@ namespace Stockfish {
             pawnCount[1] = wdl.pawnCount[1];
         }
 
+#ifdef TB_STATS
+        // Page faults of the process, from getrusage() where it is available
+        struct Faults {
+            int64_t major = 0, minor = 0;
+        };
+
+        Faults faults() {
+
+            Faults f;
+#ifndef _WIN32
+            rusage usage;
+            if (!getrusage(RUSAGE_SELF, &usage))
+                f.major = usage.ru_majflt, f.minor = usage.ru_minflt;
+#endif
+            return f;
+        }
+
+        // The totals of all tables at the start of the last search and their change over it
+        struct SearchDelta {
+            Faults   faults;
+            uint64_t probes = 0, time = 0;
+            bool     done = false;
+        } searchStart, lastSearch;
+#endif
+
         // class TBTables creates and keeps ownership of the TBTable objects, one for each TB file found.
         // It supports a fast, hash-based, table lookup. Populated at init time, accessed at probe time.
         class TBTables {
@@ -440,6 +518,11 @@ namespace Stockfish {
             std::deque<TBTable<WDL>> wdlTable;
             std::deque<TBTable<DTZ>> dtzTable;
 
+            // Background threads of preload(), each maps the next file not yet taken
+            std::vector<std::thread> preloaders;
+            std::atomic<size_t>      nextPreload, runningPreloaders;
+            std::atomic_bool         stopPreload;
+
             void insert(Key key, TBTable<WDL>* wdl, TBTable<DTZ>* dtz) {
                 uint32_t homeBucket = uint32_t(key) & (Size - 1);
                 Entry    entry{ key, wdl, dtz };
@@ -478,13 +561,27 @@ namespace Stockfish {
                 }
             }
 
+            ~TBTables() { stop_preload(); }
+
             void clear() {
+                stop_preload();
                 memset(hashTable, 0, sizeof(hashTable));
                 wdlTable.clear();
                 dtzTable.clear();
             }
             size_t size() const { return wdlTable.size(); }
             void   add(const std::vector<PieceType>& pieces);
+            void   preload(bool prefetch);
+            void   stop_preload();
+#ifdef TB_STATS
+            void   print_stats(std::ostream& os);
+            void   clear_stats();
+            void   search_started();
+            void   search_finished();
+
+        private:
+            SearchDelta totals() const;
+#endif
         };
 
         TBTables TBTables;
@@ -530,7 +627,8 @@ namespace Stockfish {
         // Huffman codes are the same for all blocks in the table. A non-symmetric pawnless TB file
         // will have one table for wtm and one for btm, a TB file with pawns will have tables per
         // file a,b,c,d also, in this case, one set for wtm and one for btm.
-        int decompress_pairs(PairsData* d, uint64_t idx) {
+        // The number of compressed bytes read from the block is returned in 'bytes'.
+        int decompress_pairs(PairsData* d, uint64_t idx, uint64_t& bytes) {
 
             // Special case where all table positions store the same value
             if (d->flags & TBFlag::SingleValue)
@@ -577,6 +675,7 @@ namespace Stockfish {
 
             // Finally, we find the start address of our block of canonical Huffman symbols
             uint32_t* ptr = (uint32_t*)(d->data + (uint64_t(block) * d->sizeofBlock));
+            uint32_t* blockStart = ptr;
 
             // Read the first 64 bits in our block, this is a (truncated) sequence of
             // unknown number of symbols of unknown length but we know the first one
@@ -622,6 +721,8 @@ namespace Stockfish {
                 }
             }
 
+            bytes = uint64_t(ptr - blockStart) * sizeof(uint32_t);
+
             // Now we have our symbol that expands into d->symlen[sym] + 1 symbols.
             // We binary-search for our value recursively expanding into the left and
             // right child symbols until we reach a leaf node where symlen[sym] + 1 == 1
@@ -907,7 +1008,17 @@ namespace Stockfish {
             }
 
             // Now that we have the index, decompress the pair and get the score
-            return map_score(entry, tbFile, decompress_pairs(d, idx), wdl);
+            uint64_t bytes = 0;
+            int      value = decompress_pairs(d, idx, bytes);
+
+#ifdef TB_STATS
+            if (bytes)
+            {
+                entry->stats.blocks.fetch_add(1, std::memory_order_relaxed);
+                entry->stats.bytes.fetch_add(bytes, std::memory_order_relaxed);
+            }
+#endif
+            return map_score(entry, tbFile, value, wdl);
         }
 
         // Group together pieces that will be encoded together.
@@ -1178,37 +1289,25 @@ namespace Stockfish {
                 }
         }
 
-        // If the TB file corresponding to the given position is already memory-mapped
-        // then return its base address, otherwise, try to memory map and init it. Called
-        // at every probe, memory map, and init only at first access. Function is thread
-        // safe and can be called concurrently.
+        // If the TB file of the given table is already memory-mapped then return its
+        // base address, otherwise, try to memory map and init it. Called at every probe,
+        // memory map, and init only at first access. Function is thread safe and can be
+        // called concurrently. The lock is the table's own, so a thread mapping a large
+        // file only holds up the threads that probe the same table.
         template<TBType Type>
-        void* mapped(TBTable<Type>& e, const Position& pos) {
-
-            static std::mutex mutex;
+        void* mapped(TBTable<Type>& e) {
 
             // Use 'acquire' to avoid a thread reading 'ready' == true while
             // another is still working (compiler reordering may cause this).
             if (e.ready.load(std::memory_order_acquire))
                 return e.baseAddress; // Could be nullptr if file does not exist
 
-            std::scoped_lock<std::mutex> lk(mutex);
+            std::scoped_lock<std::mutex> lk(e.mutex);
 
             if (e.ready.load(std::memory_order_relaxed)) // Recheck under lock
                 return e.baseAddress;
 
-            // Pieces strings in decreasing order for each color, like ("KPP","KR")
-            std::string fname, w, b;
-            for (PieceType pt = KING; pt >= PAWN; --pt)
-            {
-                w += std::string(popcount(pos.pieces(WHITE, pt)), PieceToChar[pt]);
-                b += std::string(popcount(pos.pieces(BLACK, pt)), PieceToChar[pt]);
-            }
-
-            fname =
-                (e.key == pos.material_key() ? w + 'v' + b : b + 'v' + w) + (Type == WDL ? ".rtbw" : ".rtbz");
-
-            uint8_t* data = TBFile(fname).map(&e.baseAddress, &e.mapping, Type);
+            uint8_t* data = TBFile(e.code + (Type == WDL ? ".rtbw" : ".rtbz")).map(&e.baseAddress, &e.mapping, Type);
 
             if (data)
                 set(e, data);
@@ -1217,6 +1316,181 @@ namespace Stockfish {
             return e.baseAddress;
         }
 
+        // Maps all the files from background threads, the WDL files first as they are
+        // probed during the search. With 'prefetch' the OS is also asked to read the
+        // files ahead. Probes of a table that is not mapped yet map it themselves.
+        void TBTables::preload(bool prefetch) {
+
+            const size_t count = wdlTable.size() + dtzTable.size();
+            const size_t threadCount = std::clamp<size_t>(std::thread::hardware_concurrency(), 1, 8);
+            auto         start = now();
+
+            nextPreload = 0;
+            runningPreloaders = threadCount;
+            stopPreload = false;
+
+            auto worker = [this, count, prefetch, start]() {
+                for (size_t i; !stopPreload && (i = nextPreload++) < count;)
+                {
+                    void* baseAddress = nullptr;
+                    uint64_t mapping = 0;
+
+                    if (i < wdlTable.size())
+                        baseAddress = mapped(wdlTable[i]), mapping = wdlTable[i].mapping;
+                    else
+                        baseAddress = mapped(dtzTable[i - wdlTable.size()]), mapping = dtzTable[i - wdlTable.size()].mapping;
+
+                    if (prefetch && baseAddress)
+                        TBFile::prefetch(baseAddress, mapping);
+                }
+
+                if (--runningPreloaders == 0 && !stopPreload)
+                    sync_cout << "info string Preloaded " << wdlTable.size() << " tablebases in "
+                    << now() - start << " ms" << sync_endl;
+            };
+
+            for (size_t i = 0; i < threadCount; ++i)
+                preloaders.emplace_back(worker);
+        }
+
+        void TBTables::stop_preload() {
+
+            stopPreload = true;
+            for (std::thread& th : preloaders)
+                th.join();
+            preloaders.clear();
+        }
+
+#ifdef TB_STATS
+        SearchDelta TBTables::totals() const {
+
+            SearchDelta t;
+            t.faults = faults();
+            for (const auto& e : wdlTable)
+                t.probes += e.stats.probes, t.time += e.stats.time;
+            for (const auto& e : dtzTable)
+                t.probes += e.stats.probes, t.time += e.stats.time;
+            return t;
+        }
+
+        void TBTables::search_started() { searchStart = totals(); }
+
+        void TBTables::search_finished() {
+
+            SearchDelta end = totals();
+            lastSearch.faults.major = end.faults.major - searchStart.faults.major;
+            lastSearch.faults.minor = end.faults.minor - searchStart.faults.minor;
+            lastSearch.probes = end.probes - searchStart.probes;
+            lastSearch.time = end.time - searchStart.time;
+            lastSearch.done = true;
+        }
+
+        // Prints the tables that have been probed, the most expensive first, with their totals
+        // and the probes and page faults of the last search.
+        void TBTables::print_stats(std::ostream& os) {
+
+            struct Line {
+                std::string name;
+                uint64_t    probes, blocks, bytes, time;
+            };
+
+            std::vector<Line> lines;
+            Line              total{ "Total", 0, 0, 0, 0 };
+
+            auto add = [&](const auto& e, const char* ext) {
+                if (e.stats.probes)
+                    lines.push_back({ e.code + ext, e.stats.probes, e.stats.blocks, e.stats.bytes, e.stats.time });
+            };
+
+            for (const auto& e : wdlTable)
+                add(e, ".rtbw");
+            for (const auto& e : dtzTable)
+                add(e, ".rtbz");
+
+            std::sort(lines.begin(), lines.end(), [](const Line& a, const Line& b) { return a.time > b.time; });
+
+            for (const Line& l : lines)
+                total.probes += l.probes, total.blocks += l.blocks, total.bytes += l.bytes, total.time += l.time;
+
+            auto print = [&](const Line& l) {
+                os << "\n" << std::left << std::setw(14) << l.name << std::right << std::setw(12) << l.probes
+                    << std::setw(12) << l.blocks << std::setw(12) << l.bytes / 1024 << std::setw(10)
+                    << l.time / 1000000 << std::setw(10) << (l.probes ? l.time / 1000.0 / l.probes : 0.0);
+            };
+
+            os << "\nTablebase statistics" << std::fixed << std::setprecision(2)
+                << "\nTable               probes      blocks     KB read   time ms  us/probe";
+
+            for (const Line& l : lines)
+                print(l);
+            print(total);
+
+            os << "\nProbe cache hits (last search): " << cache_hits();
+
+            if (lastSearch.done)
+                os << "\nLast search: probes " << lastSearch.probes << ", time " << lastSearch.time / 1000000
+                << " ms, major faults " << lastSearch.faults.major << ", minor faults " << lastSearch.faults.minor;
+
+            os << std::defaultfloat << std::setprecision(6) << std::endl;
+        }
+
+        void TBTables::clear_stats() {
+
+            auto clear = [](auto& e) { e.stats.probes = e.stats.blocks = e.stats.bytes = e.stats.time = 0; };
+
+            std::for_each(wdlTable.begin(), wdlTable.end(), clear);
+            std::for_each(dtzTable.begin(), dtzTable.end(), clear);
+            lastSearch = SearchDelta();
+        }
+#endif
+
+        // class ProbeCache keeps the results of probe_wdl() and probe_dtz(), which are probed
+        // again and again for the same positions during a search. It is shared by all threads
+        // and has no lock: an entry packs the upper 40 bits of the key, the probe state and the
+        // value into one word, so it is always read and written whole.
+        class ProbeCache {
+
+            static constexpr size_t   Size = 1 << 16; // 512 KB
+            static constexpr uint64_t KeyMask = ~0xFFFFFFULL;
+            static constexpr int      ValueBias = 1 << 19;
+
+            std::atomic<uint64_t> table[Size];
+
+        public:
+            bool probe(Key key, int& value, ProbeState& result) {
+
+                uint64_t e = table[key & (Size - 1)].load(std::memory_order_relaxed);
+
+                if (!e || (e & KeyMask) != (key & KeyMask))
+                    return false;
+
+                result = ProbeState(int((e >> 20) & 0xF) - 2);
+                value = int(e & 0xFFFFF) - ValueBias;
+                hits.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+
+            void save(Key key, int value, ProbeState result) {
+
+                assert(std::abs(value) < ValueBias);
+
+                // Failed probes are not kept, the value and state are never zero together
+                if (result != FAIL)
+                    table[key & (Size - 1)].store((key & KeyMask) | uint64_t(result + 2) << 20
+                        | uint64_t(value + ValueBias),
+                        std::memory_order_relaxed);
+            }
+
+            void clear() {
+                for (auto& e : table)
+                    e.store(0, std::memory_order_relaxed);
+            }
+
+            std::atomic<uint64_t> hits;
+        };
+
+        ProbeCache WDLCache, DTZCache;
+
         template<TBType Type, typename Ret = typename TBTable<Type>::Ret>
         Ret probe_table(const Position& pos, ProbeState* result, WDLScore wdl = WDLDraw) {
 
@@ -1225,7 +1499,13 @@ namespace Stockfish {
 
             TBTable<Type>* entry = TBTables.get<Type>(pos.material_key());
 
-            if (!entry || !mapped(*entry, pos))
+            if (!entry)
+                return *result = FAIL, Ret();
+
+#ifdef TB_STATS
+            TBStats::Probe counted{ entry->stats };
+#endif
+            if (!mapped(*entry))
                 return *result = FAIL, Ret();
 
             return do_probe_table(pos, entry, wdl, result);
@@ -1308,10 +1588,13 @@ namespace Stockfish {
 
 
     // Called at startup and after every change to "SyzygyPath" UCI option to (re)create the various tables.
-    // It is not thread safe, nor it needs to be.
-    void Tablebases::init(const std::string& paths) {
+    // It is not thread safe, nor it needs to be. With 'preload' set to "map" or "load" all the files are
+    // mapped in the background, "load" also reads them ahead into the page cache.
+    void Tablebases::init(const std::string& paths, const std::string& preload) {
 
         TBTables.clear();
+        WDLCache.clear();
+        DTZCache.clear();
         MaxCardinality = 0;
         TBFile::Paths = paths;
 
@@ -1452,6 +1735,9 @@ namespace Stockfish {
         }
 
         sync_cout << "info string Found " << TBTables.size() << " tablebases" << sync_endl;
+
+        if (preload == "map" || preload == "load")
+            TBTables.preload(preload == "load");
     }
 
     // Probe the WDL table for a particular position.
@@ -1464,10 +1750,81 @@ namespace Stockfish {
     //  2 : win
     WDLScore Tablebases::probe_wdl(Position& pos, ProbeState* result) {
 
+        int value;
+        if (WDLCache.probe(pos.state()->key, value, *result))
+            return WDLScore(value);
+
         *result = OK;
-        return search<false>(pos, result);
+        WDLScore wdl = search<false>(pos, result);
+        WDLCache.save(pos.state()->key, wdl, *result);
+        return wdl;
     }
 
+    namespace {
+
+        // Probes the DTZ table for a particular position, see probe_dtz() for the cache in front of it
+        int probe_dtz_uncached(Position& pos, ProbeState* result) {
+
+            *result = OK;
+            WDLScore wdl = search<true>(pos, result);
+
+            if (*result == FAIL || wdl == WDLDraw) // DTZ tables don't store draws
+                return 0;
+
+            // DTZ stores a 'don't care value in this case, or even a plain wrong
+            // one as in case the best move is a losing ep, so it cannot be probed.
+            if (*result == ZEROING_BEST_MOVE)
+                return dtz_before_zeroing(wdl);
+
+            int dtz = probe_table<DTZ>(pos, result, wdl);
+
+            if (*result == FAIL)
+                return 0;
+
+            if (*result != CHANGE_STM)
+                return (dtz + 100 * (wdl == WDLBlessedLoss || wdl == WDLCursedWin)) * sign_of(wdl);
+
+            // DTZ stores results for the other side, so we need to do a 1-ply search and find the winning move that minimizes DTZ.
+            StateInfo st;
+            int       minDTZ = 0xFFFF;
+
+            for (const Move move : MoveList<LEGAL>(pos))
+            {
+                bool zeroing = pos.capture(move) || type_of(pos.moved_piece(move)) == PAWN;
+
+                pos.do_move<true>(move, st);
+
+                // For zeroing moves we want the dtz of the move _before_ doing it,
+                // otherwise we will get the dtz of the next move sequence.
+                // Search the position after the move to get the score sign
+                // (because even in a winning position we could make a losing capture or go for a draw).
+                dtz = zeroing ? -dtz_before_zeroing(search<false>(pos, result)) : -probe_dtz(pos, result);
+
+                // If the move mates, force minDTZ to 1
+                if (dtz == 1 && pos.checkers() && MoveList<LEGAL>(pos).size() == 0)
+                    minDTZ = 1;
+
+                // Convert result from 1-ply search.
+                // Zeroing moves are already accounted by dtz_before_zeroing() that returns the DTZ of the previous move.
+                if (!zeroing)
+                    dtz += sign_of(dtz);
+
+                // Skip the draws and if we are winning only pick positive dtz
+                if (dtz < minDTZ && sign_of(dtz) == sign_of(wdl))
+                    minDTZ = dtz;
+
+                pos.undo_move<true>(move);
+
+                if (*result == FAIL)
+                    return 0;
+            }
+
+            // When there are no legal moves, the position is mate: we return -1
+            return minDTZ == 0xFFFF ? -1 : minDTZ;
+        }
+
+    } // namespace
+
     // Probe the DTZ table for a particular position.
     // If *result != FAIL, the probe was successful.
     // The return value is from the point of view of the side to move:
@@ -1496,63 +1853,36 @@ namespace Stockfish {
     // then do not accept moves leading to dtz + 50-move-counter == 100.
     int Tablebases::probe_dtz(Position& pos, ProbeState* result) {
 
-        *result = OK;
-        WDLScore wdl = search<true>(pos, result);
-
-        if (*result == FAIL || wdl == WDLDraw) // DTZ tables don't store draws
-            return 0;
-
-        // DTZ stores a 'don't care value in this case, or even a plain wrong
-        // one as in case the best move is a losing ep, so it cannot be probed.
-        if (*result == ZEROING_BEST_MOVE)
-            return dtz_before_zeroing(wdl);
-
-        int dtz = probe_table<DTZ>(pos, result, wdl);
-
-        if (*result == FAIL)
-            return 0;
-
-        if (*result != CHANGE_STM)
-            return (dtz + 100 * (wdl == WDLBlessedLoss || wdl == WDLCursedWin)) * sign_of(wdl);
-
-        // DTZ stores results for the other side, so we need to do a 1-ply search and find the winning move that minimizes DTZ.
-        StateInfo st;
-        int       minDTZ = 0xFFFF;
-
-        for (const Move move : MoveList<LEGAL>(pos))
-        {
-            bool zeroing = pos.capture(move) || type_of(pos.moved_piece(move)) == PAWN;
-
-            pos.do_move<true>(move, st);
+        int dtz;
+        if (DTZCache.probe(pos.state()->key, dtz, *result))
+            return dtz;
 
-            // For zeroing moves we want the dtz of the move _before_ doing it,
-            // otherwise we will get the dtz of the next move sequence.
-            // Search the position after the move to get the score sign
-            // (because even in a winning position we could make a losing capture or go for a draw).
-            dtz = zeroing ? -dtz_before_zeroing(search<false>(pos, result)) : -probe_dtz(pos, result);
-
-            // If the move mates, force minDTZ to 1
-            if (dtz == 1 && pos.checkers() && MoveList<LEGAL>(pos).size() == 0)
-                minDTZ = 1;
-
-            // Convert result from 1-ply search.
-            // Zeroing moves are already accounted by dtz_before_zeroing() that returns the DTZ of the previous move.
-            if (!zeroing)
-                dtz += sign_of(dtz);
+        dtz = probe_dtz_uncached(pos, result);
+        DTZCache.save(pos.state()->key, dtz, *result);
+        return dtz;
+    }
 
-            // Skip the draws and if we are winning only pick positive dtz
-            if (dtz < minDTZ && sign_of(dtz) == sign_of(wdl))
-                minDTZ = dtz;
+    // Number of probe_wdl() and probe_dtz() results found in the probe cache
+    uint64_t Tablebases::cache_hits() { return WDLCache.hits + DTZCache.hits; }
 
-            pos.undo_move<true>(move);
+    void Tablebases::clear_cache_hits() { WDLCache.hits = DTZCache.hits = 0; }
 
-            if (*result == FAIL)
-                return 0;
-        }
-
-        // When there are no legal moves, the position is mate: we return -1
-        return minDTZ == 0xFFFF ? -1 : minDTZ;
+    // 'tbstats' prints the probes, decompressed blocks, bytes read and time of each table
+    // since the last 'tbstats clear', and the page faults of the last search. The counters
+    // are only available in builds with 'make tbstats=yes'.
+#ifdef TB_STATS
+    void Tablebases::print_stats(std::ostream& os) { TBTables.print_stats(os); }
+    void Tablebases::clear_stats() { TBTables.clear_stats(); }
+    void Tablebases::search_started() { TBTables.search_started(); }
+    void Tablebases::search_finished() { TBTables.search_finished(); }
+#else
+    void Tablebases::print_stats(std::ostream& os) {
+        os << "Tablebase statistics are not compiled in, build with 'make tbstats=yes'" << std::endl;
     }
+    void Tablebases::clear_stats() {}
+    void Tablebases::search_started() {}
+    void Tablebases::search_finished() {}
+#endif
 
 
     // Use the DTZ tables to rank root moves.
@@ -19,6 +19,8 @@
 #ifndef TBPROBE_H
 #define TBPROBE_H
 
+#include <cstdint>
+#include <iosfwd>
 #include <string>
 
 #include "../search.h"
@@ -49,12 +51,18 @@ namespace Stockfish::Tablebases {
 
     extern int MaxCardinality;
 
-    void     init(const std::string& paths);
+    void     init(const std::string& paths, const std::string& preload = "none");
     WDLScore probe_wdl(Position& pos, ProbeState* result);
     int      probe_dtz(Position& pos, ProbeState* result);
     bool     root_probe(Position& pos, Search::RootMoves& rootMoves);
     bool     root_probe_wdl(Position& pos, Search::RootMoves& rootMoves);
     void     rank_root_moves(Position& pos, Search::RootMoves& rootMoves);
+    uint64_t cache_hits();
+    void     clear_cache_hits();
+    void     print_stats(std::ostream& os);
+    void     clear_stats();
+    void     search_started();
+    void     search_finished();
 
 } // namespace Stockfish::Tablebases
 
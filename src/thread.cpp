@@ -21,11 +21,14 @@
 #include <algorithm>
 #include <cassert>
 #include <cstdlib>
+#include <cstring>
 #include <deque>
 #include <initializer_list>
 #include <map>
 #include <memory>
+#include <new>
 #include <utility>
+#include <BS_thread_pool.hpp>
 
 #include "evaluate.h"
 #include "misc.h"
@@ -42,8 +45,9 @@ namespace Stockfish {
 
     // Constructor launches the thread and waits until it goes to sleep
     // in idle_loop(). Note that 'searching' and 'exit' should be already set.
-    Thread::Thread(size_t n) :
+    Thread::Thread(size_t n, int c) :
         idx(n),
+        cpu(c),
         stdThread(&Thread::idle_loop, this) {
 
         wait_for_search_finished();
@@ -62,14 +66,32 @@ namespace Stockfish {
     }
 
 
-    // Reset histories, usually before a new game
+    void* Thread::operator new(size_t size) {
+
+        void* mem = aligned_large_pages_alloc(size);
+        if (!mem)
+            throw std::bad_alloc();
+
+        return mem;
+    }
+
+
+    // Reset histories and tables, usually before a new game. Runs on the thread
+    // itself, see ThreadPool::clear().
     void Thread::clear() {
 
+        pawnsTable.resize(size_t(Options["Pawn Table"]) * 1024);
+        materialTable.resize(size_t(Options["Material Table"]) * 1024);
+        pawnsTable.clear();
+        materialTable.clear();
         counterMoves.fill(Move::none());
         mainHistory.fill(0);
         captureHistory.fill(0);
         pawnHistory.fill(0);
         correctionHistory.fill(0);
+        accumulatorCaches.big.netVersion = 0; // Entries are reset when used next time
+        accumulatorCaches.small.netVersion = 0;
+        evalHash.clear();
 
         for (bool inCheck : {false, true})
             for (StatsType c : {NoCaptures, Captures})
@@ -88,6 +110,55 @@ namespace Stockfish {
     }
 
 
+    // Wakes up the thread to run f instead of a search, wait_for_search_finished()
+    // returns when f has returned.
+    void Thread::run_custom_job(std::function<void()> f) {
+
+        {
+            std::unique_lock<std::mutex> lk(mutex);
+            cv.wait(lk, [&] { return !searching; });
+            jobFunc = std::move(f);
+            searching = true;
+        }
+        cv.notify_one();
+    }
+
+
+    // Searches the position with the thread alone on the calling thread, set up like
+    // start_thinking() sets up the threads of the pool, and returns the best root move.
+    // The position must have a legal move, its states must live until the search returns.
+    const Search::RootMove& Thread::search_alone(const Position& pos, Depth depth, uint64_t maxNodes, TimePoint movetime) {
+
+        nodes = tbHits = bestMoveChanges = 0ULL;
+        nmpMinPly = 0;
+        rootDepth = 0;
+        rootMoves.clear();
+        for (const auto& m : MoveList<LEGAL>(pos))
+            rootMoves.emplace_back(m);
+
+        assert(!rootMoves.empty());
+
+        rootPos.set(pos.fen(), pos.is_chess960(), &rootState, this);
+        rootState = *pos.state();
+        rootState.data = stateStack;
+        std::memset(rootState.nnueComputed, 0, sizeof(rootState.nnueComputed));
+        rootState.attacksComputed = false;
+        rootPos.sync_keys();
+        rootSimpleEval = Eval::simple_eval(pos, pos.side_to_move());
+
+        ownSearch = true;
+        ownDepth = depth;
+        ownNodes = maxNodes;
+        ownMovetime = movetime;
+        ownStart = now();
+        search();
+        ownSearch = false;
+        ownDepth = 0, ownNodes = 0, ownMovetime = 0;
+
+        return rootMoves[0];
+    }
+
+
     // Blocks on the condition variable until the thread has finished searching.
     void Thread::wait_for_search_finished() {
 
@@ -105,8 +176,17 @@ namespace Stockfish {
         // for instance in fishtest.
         // To make it simple, just check if running threads are below a threshold, in this case,
         // all this NUMA machinery is not needed.
-        if (Options["Threads"] > 8)
-            WinProcGroup::bindThisThread(idx);
+        if (cpu >= 0 || Options["Threads"] > 8)
+        {
+            if (cpu >= 0)
+                Affinity::bind_this_thread(cpu);
+            else
+                WinProcGroup::bindThisThread(idx);
+
+            // Move this thread, with all its tables, to its own NUMA node. Pages not yet
+            // touched will be allocated there by the first clear().
+            Numa::move_to_this_node(this, sizeof(*this));
+        }
 
         while (true)
         {
@@ -118,35 +198,89 @@ namespace Stockfish {
             if (exit)
                 return;
 
+            std::function<void()> job = std::move(jobFunc);
+            jobFunc = nullptr;
             lk.unlock();
 
-            search();
+            if (job)
+                job();
+            else
+                search();
         }
     }
 
     // Creates/destroys threads to match the requested number.
     // Created and launched threads will immediately go to sleep in idle_loop.
-    // Upon resizing, threads are recreated to allow for binding if necessary.
+    // Threads that remain keep their state, only the new ones are created and cleared.
+    // Threads bind themselves when they start, so if the binding changes all of them
+    // are recreated, together with the hash.
     void ThreadPool::set(size_t requested) {
 
-        if (threads.size() > 0) // destroy any existing thread(s)
+        const std::string binding = Options["Thread Binding"];
+        const bool        numaBinding = binding == "none" && Options["Threads"] > 8; // See idle_loop()
+
+        if (threads.size() > 0) // destroy the thread(s) not needed any more
         {
             main()->wait_for_search_finished();
 
-            while (threads.size() > 0)
+            const size_t keep = binding == boundBy && numaBinding == numaBound ? requested : 0;
+
+            while (threads.size() > keep)
                 delete threads.back(), threads.pop_back();
         }
 
+        boundBy = binding;
+        numaBound = numaBinding;
+
         if (requested > 0) // create new thread(s)
         {
-            threads.push_back(new MainThread(0));
+            const std::vector<int> cpus = Affinity::mapping(binding, requested);
+
+            if (binding != "none")
+            {
+                sync_cout << "info string Thread binding " << binding << (cpus.empty() ? " not supported" : ":");
+                for (int c : cpus)
+                    std::cout << ' ' << c;
+                std::cout << sync_endl;
+            }
+
+            const size_t first = threads.size();
+
+            if (threads.empty())
+                threads.push_back(new MainThread(0, cpus.empty() ? -1 : cpus[0]));
 
             while (threads.size() < requested)
-                threads.push_back(new Thread(threads.size()));
-            clear();
+                threads.push_back(new Thread(threads.size(), cpus.empty() ? -1 : cpus[threads.size()]));
+
+            if (first == 0)
+            {
+                clear();
 
-            // Reallocate the hash with the new threadpool size
-            TT.resize(size_t(Options["Hash"]));
+                // Reallocate the hash with the new threadpool size
+                TT.resize(size_t(Options["Hash"]));
+            }
+            else
+            {
+                // Only the new threads are cleared, in parallel
+                for (size_t i = first; i < threads.size(); ++i)
+                    threads[i]->run_custom_job([th = threads[i]]() { th->clear(); });
+
+                for (size_t i = first; i < threads.size(); ++i)
+                    threads[i]->wait_for_search_finished();
+            }
+
+            sync_cout << "info string NNUE accumulator caches " << requested * sizeof(Eval::NNUE::AccumulatorCaches) / 1024
+                << " KB, " << sizeof(Eval::NNUE::AccumulatorCaches) / 1024 << " KB per thread" << sync_endl;
+
+            // The tables of a thread, allocated with it or by its first clear()
+            const Thread& th = *threads.back();
+            const size_t histories = sizeof(th.counterMoves) + sizeof(th.mainHistory) + sizeof(th.captureHistory)
+                + sizeof(th.continuationHistory) + sizeof(th.pawnHistory) + sizeof(th.correctionHistory);
+            const size_t perThread = sizeof(Thread) + th.pawnsTable.size() * sizeof(Pawns::Entry)
+                + th.materialTable.size() * sizeof(Material::Entry);
+
+            sync_cout << "info string Thread memory " << requested * perThread / (1024 * 1024) << " MB, "
+                << perThread / 1024 << " KB per thread, of which histories " << histories / 1024 << " KB" << sync_endl;
 
             // Init thread number dependent search params.
             Search::init();
@@ -157,13 +291,27 @@ namespace Stockfish {
     // Sets threadPool data to initial values
     void ThreadPool::clear() {
 
+        // Every thread clears its own tables, in parallel
         for (Thread* th : threads)
-            th->clear();
+            th->run_custom_job([th]() { th->clear(); });
+
+        for (Thread* th : threads)
+            th->wait_for_search_finished();
 
         main()->callsCnt = 0;
         main()->bestPreviousScore = VALUE_INFINITE;
         main()->bestPreviousAverageScore = VALUE_INFINITE;
         main()->previousTimeReduction = 1.0;
+        main()->reuse = {};
+    }
+
+
+    // Hands back the state list given to the last search once the search is over, when it is
+    // the given list. So the position command can go on with it instead of replaying the game.
+    StateListPtr ThreadPool::reclaim_states(const StateList* states) {
+
+        main()->wait_for_search_finished();
+        return setupStates.get() == states ? std::move(setupStates) : nullptr;
     }
 
 
@@ -171,28 +319,57 @@ namespace Stockfish {
     // Main thread will wake up other threads and start the search.
     void ThreadPool::start_thinking(Position& pos, StateListPtr& states, const Search::LimitsType& limits, bool ponderMode) {
 
+        // The root moves only read the position, they are generated while the threads of
+        // a stopped search are still finishing
+        Search::RootMoves rootMoves;
+
+        for (const auto& m : MoveList<LEGAL>(pos))
+            if (limits.searchmoves.empty()
+                || std::count(limits.searchmoves.begin(), limits.searchmoves.end(), m))
+                rootMoves.emplace_back(m);
+
         main()->wait_for_search_finished();
 
         main()->stopOnPonderhit = stop = false;
+        main()->firstMateTime = -1;
         increaseDepth = true;
         main()->ponder = ponderMode;
         Search::Limits = limits;
-        Search::RootMoves rootMoves;
 
-        for (const auto& m : MoveList<LEGAL>(pos))
-            if (limits.searchmoves.empty()
-                || std::count(limits.searchmoves.begin(), limits.searchmoves.end(), m))
-                rootMoves.emplace_back(m);
+        Tablebases::clear_cache_hits();
+        Tablebases::search_started();
 
         if (!rootMoves.empty())
             Tablebases::rank_root_moves(pos, rootMoves);
 
+        // When the game continued along the PV of the last search, its move comes first with
+        // its score and the search resumes two plies below the depth it had reached
+        MainThread::Reuse& reuse = main()->reuse;
+        Depth              resumeDepth = 0;
+        if (reuse.depth > 1 && pos.key() == reuse.key && limits.use_time_management() && !limits.mate
+            && int(Options["MultiPV"]) == 1)
+        {
+            auto rm = std::find(rootMoves.begin(), rootMoves.end(), reuse.pv[0]);
+            if (rm != rootMoves.end() && rm->tbRank == rootMoves[0].tbRank)
+            {
+                std::rotate(rootMoves.begin(), rm, rm + 1);
+                rootMoves[0].pv = reuse.pv;
+                rootMoves[0].score = rootMoves[0].previousScore = reuse.score;
+                rootMoves[0].averageScore = rootMoves[0].uciScore = reuse.score;
+                resumeDepth = reuse.depth - 1; // The first iteration searches reuse.depth
+            }
+        }
+        reuse.depth = 0;
+
         // After ownership transfer 'states' becomes empty, so if we stop the search
         // and call 'go' again without setting a new position states.get() == nullptr.
         assert(states.get() || setupStates.get());
 
         if (states.get())
-            setupStates = std::move(states); // Ownership transfer, states is now empty
+        {
+            StatePool::release(std::move(setupStates)); // The previous search is over
+            setupStates = std::move(states);             // Ownership transfer, states is now empty
+        }
 
         // In mate search we split rootMoves into smaller packages and each thread receives its own package.
         // The more threads there are the smaller the packages.
@@ -230,10 +407,16 @@ namespace Stockfish {
         {
             th->nodes = th->tbHits = th->bestMoveChanges = 0ULL;
             th->nmpMinPly = 0;
-            th->rootDepth = 0;
+            th->rootDepth = resumeDepth;
+            if (resumeDepth)
+                th->completedDepth = resumeDepth;
             th->rootMoves = doSplit ? split[i++] : rootMoves;
             th->rootPos.set(pos.fen(), pos.is_chess960(), &th->rootState, th);
             th->rootState = setupStates->back();
+            th->rootState.data = th->stateStack; // Its own stack, nothing computed on it yet
+            std::memset(th->rootState.nnueComputed, 0, sizeof(th->rootState.nnueComputed));
+            th->rootState.attacksComputed = false;
+            th->rootPos.sync_keys();
             th->rootSimpleEval = Eval::simple_eval(pos, pos.side_to_move());
         }
 
@@ -242,39 +425,51 @@ namespace Stockfish {
 
     Thread* ThreadPool::get_best_thread() const {
 
-        Thread* bestThread = threads.front();
+        std::vector<RootVote> candidates;
+        for (Thread* th : threads)
+            candidates.push_back(
+                { th->rootMoves[0].pv[0], th->rootMoves[0].score, th->completedDepth, th->rootMoves[0].pv.size() });
+
+        return threads[best_vote(candidates)];
+    }
+
+
+    size_t best_vote(const std::vector<RootVote>& candidates) {
+
+        size_t best = 0;
         std::unordered_map<Move, int64_t, Move::MoveHash> votes;
         Value minScore = VALUE_NONE;
 
-        // Find the minimum score of all threads
-        for (Thread* th : threads)
-            minScore = std::min(minScore, th->rootMoves[0].score);
+        // Find the minimum score of all candidates
+        for (const RootVote& c : candidates)
+            minScore = std::min(minScore, c.score);
 
-        // Vote according to score and depth, and select the best thread
-        auto thread_value = [minScore](Thread* th) {
-            return (th->rootMoves[0].score - minScore + 14) * int(th->completedDepth);
-            };
+        // Vote according to score and depth, and select the best candidate
+        auto value = [minScore](const RootVote& c) { return (c.score - minScore + 14) * int(c.depth); };
 
-        for (Thread* th : threads)
-            votes[th->rootMoves[0].pv[0]] += thread_value(th);
+        for (const RootVote& c : candidates)
+            votes[c.move] += value(c);
 
-        for (Thread* th : threads)
-            if (std::abs(bestThread->rootMoves[0].score) >= VALUE_TB_WIN_IN_MAX_PLY)
+        for (size_t i = 0; i < candidates.size(); ++i)
+        {
+            const RootVote& c = candidates[i];
+            const RootVote& b = candidates[best];
+
+            if (std::abs(b.score) >= VALUE_TB_WIN_IN_MAX_PLY)
             {
                 // Make sure we pick the shortest mate / TB conversion or stave off mate the longest
-                if (th->rootMoves[0].score > bestThread->rootMoves[0].score)
-                    bestThread = th;
+                if (c.score > b.score)
+                    best = i;
             }
-            else if (th->rootMoves[0].score >= VALUE_TB_WIN_IN_MAX_PLY
-                || (th->rootMoves[0].score > VALUE_TB_LOSS_IN_MAX_PLY
-                    && (votes[th->rootMoves[0].pv[0]] > votes[bestThread->rootMoves[0].pv[0]]
-                        || (votes[th->rootMoves[0].pv[0]] == votes[bestThread->rootMoves[0].pv[0]]
-                            && thread_value(th) * int(th->rootMoves[0].pv.size() > 2)
-                                  > thread_value(bestThread)
-                            * int(bestThread->rootMoves[0].pv.size() > 2)))))
-                bestThread = th;
-
-        return bestThread;
+            else if (c.score >= VALUE_TB_WIN_IN_MAX_PLY
+                || (c.score > VALUE_TB_LOSS_IN_MAX_PLY
+                    && (votes[c.move] > votes[b.move]
+                        || (votes[c.move] == votes[b.move]
+                            && value(c) * int(c.pvSize > 2) > value(b) * int(b.pvSize > 2)))))
+                best = i;
+        }
+
+        return best;
     }
 
 
@@ -298,4 +493,74 @@ namespace Stockfish {
     }
 
 
+    namespace Tasks {
+
+        namespace {
+
+            std::unique_ptr<BS::thread_pool> pool;
+            std::atomic<size_t>              nextWorker = 0;
+            std::atomic_bool                 skipped = false;
+            thread_local size_t              workerIndex = SIZE_MAX;
+
+            // Workers get their index with their first task, so the pool is recreated with
+            // new threads when its size changes.
+            void resize() {
+
+                const size_t n = std::max(size_t(1), Threads.size());
+                if (pool && pool->get_thread_count() == n)
+                    return;
+
+                pool.reset();
+                nextWorker = 0;
+                pool = std::make_unique<BS::thread_pool>(BS::concurrency_t(n));
+            }
+        }
+
+        void start() {
+
+            Threads.main()->wait_for_search_finished();
+            Threads.stop = false;
+            resize();
+        }
+
+        // Both resize the pool, not only start(): 'go perft' splits into tasks without it, and
+        // the Threads option may have changed since the last command.
+        size_t workers() {
+
+            resize();
+            return pool->get_thread_count();
+        }
+
+        size_t worker() {
+
+            if (workerIndex == SIZE_MAX)
+                workerIndex = nextWorker++;
+            assert(workerIndex < Threads.size());
+            return workerIndex;
+        }
+
+        void submit(std::function<void()> task, bool cancellable) {
+
+            resize();
+
+            pool->push_task([task = std::move(task), cancellable] {
+                if (cancellable && Threads.stop)
+                    skipped = true;
+                else
+                    task();
+                });
+        }
+
+        bool wait() {
+
+            if (pool)
+                pool->wait_for_tasks();
+            return !skipped.exchange(false);
+        }
+
+        void exit() { pool.reset(); }
+
+    } // namespace Tasks
+
+
 } // namespace Stockfish
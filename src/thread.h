@@ -23,15 +23,21 @@
 #include <condition_variable>
 #include <cstddef>
 #include <cstdint>
+#include <functional>
 #include <mutex>
+#include <optional>
+#include <string>
 #include <vector>
 
 #include "material.h"
+#include "evalhash.h"
+#include "misc.h"
 #include "movepick.h"
 #include "pawns.h"
 #include "position.h"
 #include "search.h"
 #include "thread_win32_osx.h"
+#include "tt.h"
 #include "types.h"
 
 namespace Stockfish {
@@ -42,21 +48,35 @@ namespace Stockfish {
         std::mutex mutex;
         std::condition_variable cv;
         size_t idx;
+        int cpu; // Logical processor by the 'Thread Binding' option, -1 if not bound
         bool exit = false, searching = true; // Set before starting std::thread
+        std::function<void()> jobFunc;      // Run by idle_loop() instead of search()
         NativeThread stdThread;
 
+        template<SearchStyle Style>
+        void iterative_deepening(); // search() for one configuration, see search.cpp
+
     public:
-        explicit Thread(size_t);
+        explicit Thread(size_t, int cpu = -1);
         virtual ~Thread();
         virtual void search();
         void         clear();
         void         idle_loop();
         void         start_searching();
+        void         run_custom_job(std::function<void()> f);
         void         wait_for_search_finished();
         size_t       id() const { return idx; }
 
+        // A Thread holds all its tables, a few dozen MB. It is allocated as one block, on
+        // large pages where available, whose pages are first touched by clear() running
+        // on the thread itself.
+        static void* operator new(size_t size);
+        static void  operator delete(void* mem) { aligned_large_pages_free(mem); }
+
         Pawns::Table          pawnsTable;
         Material::Table       materialTable;
+        EvalHash::Table       evalHash;
+        Eval::NNUE::AccumulatorCaches accumulatorCaches;
         size_t                pvIdx, pvLast;
         RunningAverage        complexityAverage; // Classic
         std::atomic<uint64_t> nodes, tbHits, bestMoveChanges;
@@ -70,8 +90,54 @@ namespace Stockfish {
 
         Position              rootPos;
         StateInfo             rootState;
+
+        // The StateData of the positions of the thread, indexed by the ply since Position::set().
+        // Deeper than any search, it wraps around for long game histories.
+        static constexpr int StateStackSize = MAX_PLY + 10;
+        StateData            stateStack[StateStackSize];
+
+        StateData* next_state_data(const StateData* data) {
+            return data >= stateStack && data < stateStack + StateStackSize - 1
+                ? stateStack + (data - stateStack) + 1 : stateStack;
+        }
+
+        // Speculative prefetch, as early as possible, of the entries the search reads first
+        // in the position after the move: the TT and the eval hash, and the material and
+        // pawn tables of the classic eval or the correction history of the main search.
+        template<bool Classic, bool SearchMate = false>
+        void prefetch_after(const Position& pos, Move m) {
+
+            const Key key = pos.key_after(m);
+            prefetch(TT.first_entry(key));
+            if constexpr (Classic)
+            {
+                evalHash.prefetch(key ^ (SearchMate ? EvalHash::ClassicMateSalt : EvalHash::ClassicSalt));
+                materialTable.prefetch(pos.material_key_after(m));
+                pawnsTable.prefetch(pos.pawn_key_after(m));
+            }
+            else
+            {
+                evalHash.prefetch(key);
+                prefetch(&correctionHistory[~pos.side_to_move()]
+                                           [pos.pawn_key_after(m) & (CORRECTION_HISTORY_SIZE - 1)]);
+            }
+        }
+
         Search::RootMoves     rootMoves;
         Depth                 rootDepth, completedDepth;
+
+        // A search the thread runs on its own, like the moves of a 'selfplay' game or the
+        // searches of a 'server' session, see search_alone(). The depth, nodes and time are
+        // checked between the iterations, ownStop within the search like Threads.stop.
+        const Search::RootMove& search_alone(const Position& pos, Depth depth, uint64_t nodes, TimePoint movetime);
+        bool                    stop_requested() const;
+
+        bool                  ownSearch = false;
+        Depth                 ownDepth = 0;
+        uint64_t              ownNodes = 0;
+        TimePoint             ownMovetime = 0, ownStart = 0;
+        std::atomic_bool      ownStop = false;
+        std::function<void()> ownReport; // Called after each completed iteration, if set
         Depth                 previousDepth; // Classic
         int                   rootDelta;
         Value                 rootSimpleEval;
@@ -83,8 +149,9 @@ namespace Stockfish {
         CorrectionHistory     correctionHistory;
 
         // from Shashin begin
-        int8_t shashinWinProbabilityRange = 0;
-        int    shashinPly = 0;
+        int8_t  shashinWinProbabilityRange = 0;
+        uint8_t shashinStyle = 0; // Set with the range by setShashinRange()
+        int     shashinPly = 0;
         // from Shashin end
     };
 
@@ -104,16 +171,41 @@ namespace Stockfish {
         int              callsCnt;
         bool             stopOnPonderhit;
         std::atomic_bool ponder;
+        std::atomic<TimePoint> firstMateTime; // When any thread got a mate score first, -1 if none
+        TimePoint        ponderStopTime; // Of a 'go deadline' while pondering, armed on 'ponderhit'
+
+        // The PV of the last timed search from its third move, which the next search starts
+        // from when the game continued with the best and the ponder move, see start_thinking()
+        struct Reuse {
+            Key               key = 0; // Of the position after the first two moves
+            Depth             depth = 0;
+            Value             score = VALUE_NONE;
+            std::vector<Move> pv;
+        } reuse;
+    };
+
+
+    // The result at the root of a thread, or of another process sharing the hash,
+    // as far as it counts for the voting for the best move.
+    struct RootVote {
+        Move   move;
+        Value  score;
+        Depth  depth;
+        size_t pvSize;
     };
 
+    // Returns the index of the winner of the voting used by get_best_thread()
+    size_t best_vote(const std::vector<RootVote>& votes);
+
 
     // ThreadPool struct handles all the threads-related stuff like init, starting,
     // parking and, most importantly, launching a thread. All the access to threads
     // is done through this class.
     struct ThreadPool {
 
-        void start_thinking(Position&, StateListPtr&, const Search::LimitsType&, bool = false);
-        void clear();
+        void         start_thinking(Position&, StateListPtr&, const Search::LimitsType&, bool = false);
+        StateListPtr reclaim_states(const StateList* states);
+        void         clear();
         void set(size_t);
 
         MainThread* main() const { return static_cast<MainThread*>(threads.front()); }
@@ -134,6 +226,8 @@ namespace Stockfish {
 
     private:
         StateListPtr         setupStates;
+        std::string          boundBy;   // 'Thread Binding' when the threads were created
+        bool                 numaBound = false;
         std::vector<Thread*> threads;
 
         uint64_t accumulate(std::atomic<uint64_t> Thread::* member) const {
@@ -147,6 +241,72 @@ namespace Stockfish {
 
     extern ThreadPool Threads;
 
+    inline bool Thread::stop_requested() const {
+        return Threads.stop.load(std::memory_order_relaxed) || ownStop.load(std::memory_order_relaxed);
+    }
+
+
+    // Tasks is the pool of the batch commands, like 'test perft', 'evalbatch' or 'book
+    // import'. Its workers are threads of their own, as the search threads park in
+    // idle_loop(), and it has as many of them as the Threads option. The tasks of a command
+    // are queued all at once, smaller than the share of a worker, so a worker that is done
+    // takes the next one and the load is balanced. A task that has not started when
+    // Threads.stop is raised is skipped.
+    namespace Tasks {
+
+        void   start();   // Waits for the search, lowers Threads.stop and resizes the pool
+        size_t workers();
+        size_t worker();  // Index of the worker running the calling task, its search thread
+        void   submit(std::function<void()> task, bool cancellable = true); // Never skipped if not cancellable
+        bool   wait();    // Waits for all tasks, false if some have been skipped
+        void   exit();
+
+        // Runs produce(i) for all i below n on the pool and consume(i, result) on the caller,
+        // in the order of i as soon as all results before it are done, e.g. to write the
+        // output of a file in the order of its input. False if some tasks have been skipped,
+        // their results are not consumed.
+        template<typename T, typename Produce, typename Consume>
+        bool ordered(size_t n, const Produce& produce, const Consume& consume) {
+
+            std::vector<std::optional<T>> results(n);
+            std::vector<char>             done(n);
+            std::mutex                    mutex;
+            std::condition_variable       cv;
+
+            // The tasks check Threads.stop themselves, so that skipped ones are done as well
+            for (size_t i = 0; i < n; ++i)
+                submit([&, i] {
+                    std::optional<T> r;
+                    if (!Threads.stop)
+                        r = produce(i);
+
+                    std::lock_guard<std::mutex> lock(mutex);
+                    results[i] = std::move(r);
+                    done[i] = true;
+                    cv.notify_one();
+                    }, false);
+
+            bool complete = true;
+            for (size_t i = 0; i < n && complete; ++i)
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&] { return done[i]; });
+                complete = results[i].has_value();
+                if (complete)
+                {
+                    T r = std::move(*results[i]);
+                    results[i].reset();
+                    lock.unlock();
+                    consume(i, r);
+                }
+            }
+
+            wait();
+            return complete;
+        }
+
+    } // namespace Tasks
+
 } // namespace Stockfish
 
 #endif  // #ifndef THREAD_H_INCLUDED
@@ -19,7 +19,14 @@
 #include "timeman.h"
 
 #include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
 
 #include "search.h"
 #include "uci.h"
@@ -104,4 +111,118 @@ namespace Stockfish {
             optimumTime += optimumTime / 4;
     }
 
+
+    namespace Deadline {
+
+        namespace {
+
+            std::mutex              mutex;
+            std::condition_variable cv;
+            std::thread             timer;
+            TimePoint               armedStop = 0; // When the timer stops the search, 0 if not armed
+            TimePoint               fired = 0;
+            bool                    exiting = false;
+
+            // Per search: the best move was written that long after the deadline, negative
+            // if in time, and that long after the timer stopped the search
+            std::vector<TimePoint> overshoots, latencies;
+
+            void timer_loop() {
+
+                std::unique_lock<std::mutex> lk(mutex);
+                while (!exiting)
+                    if (!armedStop)
+                        cv.wait(lk);
+                    else if (now() < armedStop)
+                        cv.wait_until(lk, std::chrono::steady_clock::time_point(std::chrono::milliseconds(armedStop)));
+                    else
+                    {
+                        Threads.stop = true;
+                        fired = now();
+                        armedStop = 0;
+                    }
+            }
+
+            TimePoint percentile(const std::vector<TimePoint>& sorted, int p) {
+                return sorted[std::min(sorted.size() - 1, sorted.size() * p / 100)];
+            }
+
+            // Prints the distribution of the values, sorting them
+            void print_distribution(std::ostream& os, const char* title, std::vector<TimePoint>& v) {
+
+                std::sort(v.begin(), v.end());
+                double mean = 0;
+                for (TimePoint t : v)
+                    mean += double(t) / v.size();
+
+                os << "\n" << title << std::fixed << std::setprecision(1) << mean << " mean, " << v.front()
+                    << " min, " << percentile(v, 50) << " p50, " << percentile(v, 90) << " p90, "
+                    << percentile(v, 99) << " p99, " << v.back() << " max";
+            }
+        }
+
+        void arm(TimePoint stopTime) {
+
+            std::lock_guard<std::mutex> lk(mutex);
+            if (!timer.joinable())
+                timer = std::thread(timer_loop);
+
+            armedStop = std::max(stopTime, TimePoint(1));
+            fired = 0;
+            cv.notify_one();
+        }
+
+        TimePoint disarm() {
+
+            std::lock_guard<std::mutex> lk(mutex);
+            armedStop = 0;
+            return fired;
+        }
+
+        // Called by the output thread, right before the best move is written
+        void record(TimePoint deadline, TimePoint stopped, TimePoint written) {
+
+            std::lock_guard<std::mutex> lk(mutex);
+            overshoots.push_back(written - deadline);
+            if (stopped)
+                latencies.push_back(written - stopped);
+        }
+
+        void print_stats(std::ostream& os) {
+
+            std::lock_guard<std::mutex> lk(mutex);
+            size_t late = size_t(std::count_if(overshoots.begin(), overshoots.end(), [](TimePoint t) { return t > 0; }));
+
+            os << "\nDeadline statistics"
+                << "\nSearches              : " << overshoots.size()
+                << "\nLate                  : " << late;
+            if (!overshoots.empty())
+                print_distribution(os, "Overshoot (ms)        : ", overshoots);
+            if (!latencies.empty())
+            {
+                print_distribution(os, "Stop to best move (ms): ", latencies);
+                os << "\nMove Overhead for 99% : " << percentile(latencies, 99) + 1;
+            }
+            os << std::endl;
+        }
+
+        void clear_stats() {
+
+            std::lock_guard<std::mutex> lk(mutex);
+            overshoots.clear();
+            latencies.clear();
+        }
+
+        void exit() {
+
+            {
+                std::lock_guard<std::mutex> lk(mutex);
+                exiting = true;
+                cv.notify_one();
+            }
+            if (timer.joinable())
+                timer.join();
+        }
+    }
+
 } // namespace Stockfish
@@ -20,6 +20,7 @@
 #define TIMEMAN_H_INCLUDED
 
 #include <cstdint>
+#include <iosfwd>
 
 #include "misc.h"
 #include "search.h"
@@ -49,6 +50,18 @@ namespace Stockfish {
 
     extern TimeManagement Time;
 
+    // The hard wall-clock deadline of 'go deadline <ms>'. A timer thread of its own raises
+    // Threads.stop at the deadline minus 'Move Overhead', however fast the search counts its
+    // nodes, and the time the best move is written is recorded against the deadline.
+    namespace Deadline {
+        void      arm(TimePoint stopTime);
+        TimePoint disarm(); // Returns when the timer stopped the search, 0 if it did not
+        void      record(TimePoint deadline, TimePoint stopped, TimePoint written);
+        void      print_stats(std::ostream& os);
+        void      clear_stats();
+        void      exit();
+    }
+
 } // namespace Stockfish
 
 #endif  // #ifndef TIMEMAN_H_INCLUDED
@@ -18,13 +18,26 @@
 
 #include "tt.h"
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
+#include <fstream>
 #include <iostream>
+#include <new>
 #include <thread>
 #include <vector>
 
+#ifndef _WIN32
+    #include <cerrno>
+    #include <fcntl.h>
+    #include <signal.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
 #include "misc.h"
 #include "thread.h"
 #include "uci.h"
@@ -37,28 +50,33 @@ namespace Stockfish {
     // The update is not atomic and can be racy.
     void TTEntry::save(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev) {
 
-        // Preserve any existing move for the same position
 #ifdef HASH64
-        if (m || k != key64)
+        const bool otherKey = k != key64;
 #else
-        if (m || uint16_t(k) != key16)
+        uint16_t* keyHi = TT.key_hi(this); // Only with the buckets
+        const bool otherKey = uint16_t(k) != key16 || (keyHi && *keyHi != uint16_t(k >> 16));
 #endif
+
+        // Preserve any existing move for the same position
+        if (m || otherKey)
             move16 = m.raw();
 
         // Overwrite less valuable entries (cheapest checks first)
-#ifdef HASH64
-        if (b == BOUND_EXACT || k != key64 || d - DEPTH_OFFSET + 2 * pv > depth8 - 4)
-#else
-        if (b == BOUND_EXACT || uint16_t(k) != key16 || d - DEPTH_OFFSET + 2 * pv > depth8 - 4)
-#endif
+        if (b == BOUND_EXACT || otherKey || d - DEPTH_OFFSET + 2 * pv > depth8 - 4)
         {
             assert(d > DEPTH_OFFSET);
             assert(d < 256 + DEPTH_OFFSET);
 
+#ifdef TT_STATS
+            TT.record_save(this, k, otherKey);
+#endif
+
 #ifdef HASH64
             key64 = k;
 #else
             key16 = uint16_t(k);
+            if (keyHi)
+                *keyHi = uint16_t(k >> 16);
 #endif
             depth8 = uint8_t(d - DEPTH_OFFSET);
             genBound8 = uint8_t(TT.generation8 | uint8_t(pv) << 2 | b);
@@ -71,14 +89,40 @@ namespace Stockfish {
     // Sets the size of the transposition table, measured in megabytes.
     // Transposition table consists of a power of 2 number of clusters
     // and each cluster consists of ClusterSize number of TTEntry.
+    // With 'Hash Layout' set to buckets it is read as half as many buckets instead.
+    // With 'Hash Shared' the table is placed in shared memory instead, see map_shared().
     void TranspositionTable::resize(size_t mbSize) {
 
         Threads.main()->wait_for_search_finished();
 
-        aligned_large_pages_free(table);
+        free_table();
+
+#ifndef HASH64
+        bucketed = Options["Hash Layout"] == "buckets";
+#endif
+
+        const std::string name = Options["Hash Shared"];
+        if (name != "<empty>")
+        {
+            if (map_shared(name, mbSize))
+            {
+#ifdef TT_STATS
+                sampleKeys.assign((clusterCount / 2 + SampleRate - 1) / SampleRate * SlotsPerLine, 0);
+#endif
+                sync_cout << "info string Hash " << clusterCount * sizeof(Cluster) / (1024 * 1024) << " MB, shared as "
+                    << name << " by " << shared->users << " processes" << sync_endl;
+                return;
+            }
+
+            sync_cout << "info string Unable to share the hash as " << name << sync_endl;
+        }
 
         clusterCount = mbSize * 1024 * 1024 / sizeof(Cluster);
 
+#ifdef TT_STATS
+        sampleKeys.assign((clusterCount / 2 + SampleRate - 1) / SampleRate * SlotsPerLine, 0);
+#endif
+
         table = static_cast<Cluster*>(aligned_large_pages_alloc(clusterCount * sizeof(Cluster)));
         if (!table)
         {
@@ -86,7 +130,241 @@ namespace Stockfish {
             exit(EXIT_FAILURE);
         }
 
+        // Spread the table over all NUMA nodes, so that no node's memory bandwidth
+        // gets the bottleneck. This has to be done before the pages are touched.
+        const bool interleaved = Options["Interleave Hash"] && Numa::nodes() > 1;
+        if (interleaved)
+            Numa::interleave(table, clusterCount * sizeof(Cluster));
+
         clear();
+
+        std::string pages = large_pages_info(table, clusterCount * sizeof(Cluster));
+        sync_cout << "info string Hash " << mbSize << " MB"
+            << (bucketed ? ", buckets" : "")
+            << (pages.empty() ? "" : ", " + pages)
+            << (interleaved ? ", interleaved over " + std::to_string(Numa::nodes()) + " NUMA nodes" : "")
+            << sync_endl;
+    }
+
+
+    constexpr uint64_t SharedMagic = 0x3148535448544C46ULL; // "FLTTHSH1"
+
+
+#ifndef _WIN32
+
+    // Maps the table, behind a SharedHeader, from a POSIX shared memory object ('/name') or
+    // from a file, e.g. on a hugetlbfs mount. The first process creates and clears it, the
+    // next ones join it with the size it was created with. The processes then search like
+    // the threads of one process: entries are written without locks, a torn entry is as
+    // harmless as with threads, its move is checked for legality before it is used.
+    bool TranspositionTable::map_shared(const std::string& name, size_t mbSize) {
+
+        const bool isFile = name.find('/', 1) != std::string::npos;
+        const int  flags = O_RDWR | O_CREAT | O_EXCL;
+        constexpr size_t PageSize = 2 * 1024 * 1024; // Fits hugetlbfs mounts with 2MB pages
+
+        size_t size = (SharedHeaderSize + mbSize * 1024 * 1024 + PageSize - 1) / PageSize * PageSize;
+        bool   creator = true;
+
+        int fd = isFile ? open(name.c_str(), flags, 0600) : shm_open(name.c_str(), flags, 0600);
+        if (fd < 0 && errno == EEXIST)
+        {
+            creator = false;
+            fd = isFile ? open(name.c_str(), O_RDWR) : shm_open(name.c_str(), O_RDWR, 0600);
+        }
+        if (fd < 0)
+            return false;
+
+        auto remove = [&]() { isFile ? unlink(name.c_str()) : shm_unlink(name.c_str()); };
+
+        if (creator && ftruncate(fd, off_t(size)))
+        {
+            close(fd);
+            remove();
+            return false;
+        }
+
+        // Wait until the creator has set the size
+        struct stat st;
+        for (int i = 0; !creator && i < 500; ++i)
+        {
+            if (!fstat(fd, &st) && size_t(st.st_size) > SharedHeaderSize)
+            {
+                size = size_t(st.st_size);
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mem == MAP_FAILED)
+        {
+            if (creator)
+                remove();
+            return false;
+        }
+
+        SharedHeader* header = static_cast<SharedHeader*>(mem);
+        table = reinterpret_cast<Cluster*>(static_cast<char*>(mem) + SharedHeaderSize);
+
+        if (creator)
+        {
+#if defined(MADV_HUGEPAGE)
+            madvise(mem, size, MADV_HUGEPAGE);
+#endif
+            new (header) SharedHeader();
+            header->clusterCount = clusterCount = mbSize * 1024 * 1024 / sizeof(Cluster);
+            header->bucketed = bucketed;
+            header->users = 1;
+
+            if (Options["Interleave Hash"] && Numa::nodes() > 1)
+                Numa::interleave(table, clusterCount * sizeof(Cluster));
+
+            clear();
+            header->magic.store(SharedMagic, std::memory_order_release);
+        }
+        else
+        {
+            for (int i = 0; i < 1000 && header->magic.load(std::memory_order_acquire) != SharedMagic; ++i)
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+            if (header->magic != SharedMagic || header->bucketed != bucketed
+                || SharedHeaderSize + header->clusterCount * sizeof(Cluster) > size)
+            {
+                munmap(mem, size);
+                return false;
+            }
+
+            clusterCount = header->clusterCount;
+            ++header->users;
+        }
+
+        shared = header;
+        sharedSize = size;
+        sharedName = name;
+        generation8 = shared->generation8;
+
+        // Take a free result slot, or one of a process that has gone
+        for (SharedResult& r : shared->results)
+        {
+            int pid = r.pid;
+            if (pid && (!kill(pid, 0) || errno == EPERM))
+                continue;
+
+            if (r.pid.compare_exchange_strong(pid, int(getpid())))
+            {
+                r.depth = 0;
+                sharedResult = &r;
+                break;
+            }
+        }
+
+        return true;
+    }
+
+
+    void TranspositionTable::free_table() {
+
+        if (!shared)
+        {
+            aligned_large_pages_free(table);
+            table = nullptr;
+            return;
+        }
+
+        if (sharedResult)
+            sharedResult->pid = 0;
+
+        const bool last = --shared->users == 0;
+        munmap(shared, sharedSize);
+
+        // The last process removes the name, the memory is released with it
+        if (last)
+            sharedName.find('/', 1) != std::string::npos ? unlink(sharedName.c_str()) : shm_unlink(sharedName.c_str());
+
+        shared = nullptr;
+        sharedResult = nullptr;
+        table = nullptr;
+    }
+
+#else
+
+    bool TranspositionTable::map_shared(const std::string&, size_t) { return false; }
+
+    void TranspositionTable::free_table() {
+
+        aligned_large_pages_free(table);
+        table = nullptr;
+    }
+
+#endif
+
+
+    // Lower bits of generation8 are used for other things. Processes sharing the table share
+    // the generation, the first one to start a search increments it and the others adopt it.
+    void TranspositionTable::new_search() {
+
+        if (shared)
+        {
+            uint8_t g = generation8;
+            shared->generation8.compare_exchange_strong(g, uint8_t(g + GENERATION_DELTA));
+            generation8 = shared->generation8;
+        }
+        else
+            generation8 += GENERATION_DELTA;
+    }
+
+
+    // Publishes the result at the root of this process for 'tt shared' of the processes
+    // sharing the table. The fields are read without locking, they only feed a report.
+    void TranspositionTable::publish(Key rootKey, Move m, Value score, Depth depth, size_t pvSize, uint64_t nodes) {
+
+        if (!sharedResult)
+            return;
+
+        sharedResult->rootKey = rootKey;
+        sharedResult->move = m.raw();
+        sharedResult->score = score;
+        sharedResult->pvSize = int(pvSize);
+        sharedResult->nodes = nodes;
+        sharedResult->depth = depth;
+    }
+
+
+    // Lists the results of the processes sharing the table for the position with rootKey,
+    // the sum of their nodes and the best move voted like get_best_thread() does.
+    void TranspositionTable::print_shared(std::ostream& os, Key rootKey, bool chess960) const {
+
+        if (!shared)
+        {
+            os << "info string Hash not shared" << std::endl;
+            return;
+        }
+
+        std::vector<RootVote> votes;
+        uint64_t              nodes = 0;
+
+        for (const SharedResult& r : shared->results)
+            if (r.pid && r.rootKey == rootKey && r.depth > 0)
+            {
+                votes.push_back({ Move(r.move), r.score, r.depth, size_t(r.pvSize) });
+                nodes += r.nodes;
+                os << "info string Process " << r.pid << " depth " << r.depth << " score "
+                    << UCI::value(r.score) << " nodes " << r.nodes << " move " << UCI::move(Move(r.move), chess960)
+                    << "\n";
+            }
+
+        if (votes.empty())
+        {
+            os << "info string No shared results for this position" << std::endl;
+            return;
+        }
+
+        const RootVote& best = votes[best_vote(votes)];
+        os << "info string " << votes.size() << " processes, nodes " << nodes << ", best move "
+            << UCI::move(best.move, chess960) << " score " << UCI::value(best.score) << " depth " << best.depth
+            << std::endl;
     }
 
 
@@ -114,6 +392,10 @@ namespace Stockfish {
 
         for (std::thread& th : threads)
             th.join();
+
+#ifdef TT_STATS
+        std::fill(sampleKeys.begin(), sampleKeys.end(), 0);
+#endif
     }
 
 
@@ -124,29 +406,60 @@ namespace Stockfish {
     // TTEntry t1 is considered more valuable than TTEntry t2 if its replace value is greater than that of t2.
     TTEntry* TranspositionTable::probe(const Key key, bool& found) const {
 
-        TTEntry* const tte = first_entry(key);
+#ifndef HASH64
+        if (bucketed)
+        {
+            Bucket& b = buckets()[mul_hi64(key, clusterCount / 2)];
+            return probe<BucketSize>(b.entry, b.keyHi, key, found);
+        }
+#endif
+
+        return probe<ClusterSize>(first_entry(key), nullptr, key, found);
+    }
+
+    // The entries of a cluster or a bucket, keyHi holds the bits 16 to 31 of the keys of a bucket
+    template<int Size>
+    TTEntry* TranspositionTable::probe(TTEntry* const tte, [[maybe_unused]] const uint16_t* keyHi, const Key key,
+                                       bool& found) const {
+
 #ifdef HASH64
         Key key64 = key;
 #else
         uint16_t key16 = uint16_t(key); // Use the low 16 bits as key inside the cluster
 #endif
 
-        for (int i = 0; i < ClusterSize; ++i)
+#ifdef TT_STATS
+        stats.probes.fetch_add(1, std::memory_order_relaxed);
+#endif
+
+        for (int i = 0; i < Size; ++i)
 #ifdef HASH64
             if (tte[i].key64 == key64 || !tte[i].depth8)
 #else
-            if (tte[i].key16 == key16 || !tte[i].depth8)
+            if ((tte[i].key16 == key16 && (!keyHi || keyHi[i] == uint16_t(key >> 16))) || !tte[i].depth8)
 #endif
             {
                 tte[i].genBound8 =
                     uint8_t(generation8 | (tte[i].genBound8 & (GENERATION_DELTA - 1))); // Refresh
 
+#ifdef TT_STATS
+                if (tte[i].depth8)
+                {
+                    stats.hits.fetch_add(1, std::memory_order_relaxed);
+                    if (const Key* sk = sample_key(&tte[i]))
+                    {
+                        stats.sampledHits.fetch_add(1, std::memory_order_relaxed);
+                        if (*sk != key)
+                            stats.falseHits.fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+#endif
                 return found = bool(tte[i].depth8), &tte[i];
             }
 
         // Find an entry to be replaced according to the replacement strategy
         TTEntry* replace = tte;
-        for (int i = 1; i < ClusterSize; ++i)
+        for (int i = 1; i < Size; ++i)
             // Due to our packed storage format for generation and its cyclic
             // nature we add GENERATION_CYCLE (256 is the modulus, plus what
             // is needed to keep the unrelated lowest n bits from affecting
@@ -162,16 +475,218 @@ namespace Stockfish {
     }
 
 
+    // The entries of a cluster, or of a bucket
+    int TranspositionTable::cluster_size() const {
+#ifndef HASH64
+        if (bucketed)
+            return BucketSize;
+#endif
+        return ClusterSize;
+    }
+
+
+    // Header of a hash file written by save()
+    struct HashFileHeader {
+        char     magic[8];
+        uint64_t clusterCount;
+        uint32_t clusterSize; // Entries per cluster, differs with HASH64 and the buckets
+        uint8_t  generation8;
+        uint8_t  padding[3];
+    };
+
+    static_assert(sizeof(HashFileHeader) == 24);
+
+    constexpr char HashFileMagic[8] = "FLHASH1";
+
+    // Blocks of the table are written and read in chunks of this size
+    constexpr size_t HashFileChunk = 64 * 1024 * 1024;
+
+
+    // Saves the whole table with a small header to a file, streamed in large sequential
+    // chunks, so that even tables of many GB are written within seconds.
+    bool TranspositionTable::save(const std::string& fname) const {
+
+        Threads.main()->wait_for_search_finished();
+
+        std::ofstream os(fname, std::ios::binary);
+        if (!os)
+            return false;
+
+        HashFileHeader header = {};
+        std::memcpy(header.magic, HashFileMagic, sizeof(HashFileMagic));
+        header.clusterCount = clusterCount;
+        header.clusterSize = cluster_size();
+        header.generation8 = generation8;
+        os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        const char* data = reinterpret_cast<const char*>(table);
+        for (size_t done = 0, size = clusterCount * sizeof(Cluster); done < size && os; done += HashFileChunk)
+            os.write(data + done, std::streamsize(std::min(HashFileChunk, size - done)));
+
+        return bool(os);
+    }
+
+
+    // Loads a table written by save() with the same layout. A table of the same size is read
+    // directly. Otherwise the entries are reinserted through probe() and save(). The 16 bit
+    // keys (32 bit with the buckets) don't store the full position key, so for those it is
+    // rebuilt from the cluster index and some of the entries end up in clusters where they
+    // are no longer found.
+    bool TranspositionTable::load(const std::string& fname) {
+
+        Threads.main()->wait_for_search_finished();
+
+        std::ifstream is(fname, std::ios::binary);
+        HashFileHeader header;
+        if (!is.read(reinterpret_cast<char*>(&header), sizeof(header))
+            || std::memcmp(header.magic, HashFileMagic, sizeof(HashFileMagic))
+            || header.clusterSize != uint32_t(cluster_size()))
+            return false;
+
+        if (header.clusterCount == clusterCount)
+        {
+            char* data = reinterpret_cast<char*>(table);
+            for (size_t done = 0, size = clusterCount * sizeof(Cluster); done < size && is; done += HashFileChunk)
+                is.read(data + done, std::streamsize(std::min(HashFileChunk, size - done)));
+
+            generation8 = header.generation8;
+            return bool(is);
+        }
+
+        clear();
+        generation8 = header.generation8;
+
+        // idx is the middle of the cluster or the bucket, keyHi is set for a bucket
+        auto reinsert = [&](const TTEntry& e, [[maybe_unused]] double idx, [[maybe_unused]] const uint16_t* keyHi) {
+            if (!e.depth8)
+                return;
+#ifdef HASH64
+            Key key = e.key64;
+#else
+            // A key in the middle of the range of the cluster, first_entry() uses the high bits
+            Key key = Key(idx / header.clusterCount * 18446744073709551616.0);
+            key = keyHi ? (key & ~Key(0xFFFFFFFF)) | Key(*keyHi) << 16 | e.key16 : (key & ~Key(0xFFFF)) | e.key16;
+#endif
+            bool found;
+            TTEntry* tte = probe(key, found);
+            tte->save(key, e.value(), e.is_pv(), e.bound(), e.depth(), e.move(), e.eval());
+        };
+
+        std::vector<Cluster> clusters(HashFileChunk / sizeof(Cluster));
+        for (uint64_t idx = 0; idx < header.clusterCount;)
+        {
+            const size_t n = size_t(std::min(uint64_t(clusters.size()), header.clusterCount - idx));
+            if (!is.read(reinterpret_cast<char*>(clusters.data()), std::streamsize(n * sizeof(Cluster))))
+                return false;
+
+#ifndef HASH64
+            if (bucketed) // n is even, a bucket is a pair of clusters
+                for (size_t i = 0; i < n; i += 2, idx += 2)
+                {
+                    const Bucket& b = reinterpret_cast<const Bucket&>(clusters[i]);
+                    for (int j = 0; j < BucketSize; ++j)
+                        reinsert(b.entry[j], idx + 1.0, &b.keyHi[j]);
+                }
+            else
+#endif
+                for (size_t i = 0; i < n; ++i, ++idx)
+                    for (const TTEntry& e : clusters[i].entry)
+                        reinsert(e, idx + 0.5, nullptr);
+        }
+
+        return true;
+    }
+
+
+#ifdef TT_STATS
+
+    // Returns the full key stored for the entry, if its cluster is sampled
+    Key* TranspositionTable::sample_key(const TTEntry* tte) const {
+
+        const size_t offset = size_t(reinterpret_cast<const char*>(tte) - reinterpret_cast<const char*>(table));
+        const size_t line = offset / 64;
+        if (line % SampleRate)
+            return nullptr;
+
+        return const_cast<Key*>(&sampleKeys[line / SampleRate * SlotsPerLine + offset % 64 / sizeof(TTEntry)]);
+    }
+
+    // Counts what a save of a position overwrites, called before the entry is written
+    void TranspositionTable::record_save(const TTEntry* tte, Key k, bool otherKey) {
+
+        if (!tte->depth8)
+            stats.emptyInserts.fetch_add(1, std::memory_order_relaxed);
+        else if (otherKey && (tte->genBound8 & GENERATION_MASK) != generation8)
+            stats.ageReplacements.fetch_add(1, std::memory_order_relaxed);
+        else if (otherKey)
+            stats.depthReplacements.fetch_add(1, std::memory_order_relaxed);
+
+        if (Key* sk = sample_key(tte))
+            *sk = k;
+    }
+
+    void TranspositionTable::print_stats(std::ostream& os) const {
+
+        auto percent = [](uint64_t a, uint64_t b) { return b ? 100.0 * a / b : 0.0; };
+
+        const uint64_t probes = stats.probes, hits = stats.hits;
+        os << "\nTT statistics"
+            << "\nProbes                : " << probes
+            << "\nHits                  : " << hits << " (" << percent(hits, probes) << "%)"
+            << "\nEmpty slot inserts    : " << stats.emptyInserts
+            << "\nReplacements by age   : " << stats.ageReplacements
+            << "\nReplacements by depth : " << stats.depthReplacements
+#ifdef HASH64
+            << "\nFalse hits (sampled)  : " << stats.falseHits << " of " << stats.sampledHits << " (64 bit keys)"
+#else
+            << "\nFalse hits (sampled)  : " << stats.falseHits << " of " << stats.sampledHits
+            << " (" << percent(stats.falseHits, stats.sampledHits) << "%" << (bucketed ? ", buckets" : "") << ")"
+#endif
+            << std::endl;
+    }
+
+    void TranspositionTable::clear_stats() {
+
+        for (auto* c : { &stats.probes, &stats.hits, &stats.emptyInserts, &stats.ageReplacements,
+                         &stats.depthReplacements, &stats.sampledHits, &stats.falseHits })
+            *c = 0;
+    }
+
+#else
+
+    void TranspositionTable::print_stats(std::ostream& os) const {
+        os << "TT statistics are not compiled in, build with 'make ttstats=yes'" << std::endl;
+    }
+
+    void TranspositionTable::clear_stats() {}
+
+#endif
+
+
     // Returns an approximation of the hashtable occupation during a search.
     // The hash is x permill full, as per UCI protocol.
 
     int TranspositionTable::hashfull() const {
 
+        auto current = [&](const TTEntry& e) {
+            return e.depth8 && (e.genBound8 & GENERATION_MASK) == generation8;
+        };
+
         int cnt = 0;
+#ifndef HASH64
+        if (bucketed)
+        {
+            for (int i = 0; i < 1000; ++i)
+                for (int j = 0; j < BucketSize; ++j)
+                    cnt += current(buckets()[i].entry[j]);
+
+            return cnt / BucketSize;
+        }
+#endif
+
         for (int i = 0; i < 1000; ++i)
             for (int j = 0; j < ClusterSize; ++j)
-                cnt += table[i].entry[j].depth8
-                && (table[i].entry[j].genBound8 & GENERATION_MASK) == generation8;
+                cnt += current(table[i].entry[j]);
 
         return cnt / ClusterSize;
     }
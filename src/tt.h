@@ -19,8 +19,12 @@
 #ifndef TT_H_INCLUDED
 #define TT_H_INCLUDED
 
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
 
 #include "misc.h"
 #include "types.h"
@@ -89,6 +93,23 @@ namespace Stockfish {
 
         static_assert(sizeof(Cluster) == 32, "Unexpected Cluster size");
 
+#ifndef HASH64
+        // With 'Hash Layout' set to buckets, the table is an array of Bucket instead. A bucket
+        // fills a cache line with five entries and keeps the bits 16 to 31 of their keys beside
+        // them, so that an entry is only found by a key that matches in 32 bits, plus the high
+        // bits the bucket is indexed by. Five sixths of the entries per MB of the clusters,
+        // instead of two thirds with HASH64, nearly without false hits.
+        static constexpr int BucketSize = 5;
+
+        struct Bucket {
+            TTEntry  entry[BucketSize];
+            uint16_t keyHi[BucketSize];
+            char     padding[4]; // Pad to 64 bytes
+        };
+
+        static_assert(sizeof(Bucket) == 2 * sizeof(Cluster), "Unexpected Bucket size");
+#endif
+
         // Constants used to refresh the hash table periodically
         static constexpr unsigned GENERATION_BITS = 3; // nb of bits reserved for other things
         static constexpr int      GENERATION_DELTA =
@@ -98,13 +119,30 @@ namespace Stockfish {
             (0xFF << GENERATION_BITS) & 0xFF; // mask to pull out generation number
 
     public:
-        ~TranspositionTable() { aligned_large_pages_free(table); }
-        void new_search() { generation8 += GENERATION_DELTA; } // Lower bits are used for other things
+        // The result at the root published by an engine process sharing the table
+        struct SharedResult {
+            std::atomic<int>      pid; // 0 if the slot is free
+            std::atomic<Key>      rootKey;
+            std::atomic<uint64_t> nodes;
+            std::atomic<uint16_t> move;
+            std::atomic<int>      score, depth, pvSize;
+        };
+
+        ~TranspositionTable() { free_table(); }
+        void     new_search();
         TTEntry* probe(const Key key, bool& found) const;
         int      hashfull() const;
         void     resize(size_t mbSize);
         void     clear();
-
+        bool     save(const std::string& fname) const;
+        bool     load(const std::string& fname);
+        void     print_stats(std::ostream& os) const;
+        void     clear_stats();
+        void     publish(Key rootKey, Move m, Value score, Depth depth, size_t pvSize, uint64_t nodes);
+        void     print_shared(std::ostream& os, Key rootKey, bool chess960) const;
+
+        // The bucket of a key holds the two clusters of the same index, so this is the cache
+        // line to prefetch with either layout
         TTEntry* first_entry(const Key key) const {
             return &table[mul_hi64(key, clusterCount)].entry[0];
         }
@@ -112,9 +150,70 @@ namespace Stockfish {
     private:
         friend struct TTEntry;
 
-        size_t   clusterCount;
-        Cluster* table;
-        uint8_t  generation8; // Size must be not bigger than TTEntry::genBound8
+        // Placed in front of the table in shared memory, see resize()
+        struct SharedHeader {
+            static constexpr int MaxInstances = 64;
+
+            std::atomic<uint64_t> magic; // Set when the creator has cleared the table
+            uint64_t              clusterCount;
+            std::atomic<int>      users;
+            std::atomic<uint8_t>  generation8;
+            bool                  bucketed;
+            SharedResult          results[MaxInstances];
+        };
+
+        static constexpr size_t SharedHeaderSize = 4096;
+        static_assert(sizeof(SharedHeader) <= SharedHeaderSize);
+
+        bool map_shared(const std::string& name, size_t mbSize);
+        void free_table();
+        int  cluster_size() const;
+
+        template<int Size>
+        TTEntry* probe(TTEntry* tte, const uint16_t* keyHi, Key key, bool& found) const;
+
+#ifndef HASH64
+        Bucket* buckets() const { return reinterpret_cast<Bucket*>(table); }
+
+        // The key bits kept beside the entry, nullptr with the clusters
+        uint16_t* key_hi(const TTEntry* tte) const {
+
+            if (!bucketed)
+                return nullptr;
+
+            Bucket& b = buckets()[size_t(reinterpret_cast<const char*>(tte) - reinterpret_cast<const char*>(table))
+                                  / sizeof(Bucket)];
+            return &b.keyHi[tte - b.entry];
+        }
+#endif
+
+        size_t        clusterCount; // Also with the buckets, which are twice the size
+        Cluster*      table;
+        bool          bucketed = false; // 'Hash Layout', the buckets when set
+        uint8_t       generation8; // Size must be not bigger than TTEntry::genBound8
+        SharedHeader* shared = nullptr;
+        size_t        sharedSize;
+        std::string   sharedName;
+        SharedResult* sharedResult = nullptr; // The slot of this process
+
+#ifdef TT_STATS
+        // Usage counters, compiled in with 'make ttstats=yes'. To measure how often a
+        // key matches a different position, the full keys of the entries of every
+        // SampleRate-th cache line of the table are kept in sampleKeys.
+        static constexpr size_t SampleRate = 64;
+        static constexpr size_t SlotsPerLine = 64 / sizeof(TTEntry);
+
+        struct Stats {
+            std::atomic<uint64_t> probes, hits, emptyInserts, ageReplacements, depthReplacements,
+                sampledHits, falseHits;
+        };
+
+        mutable Stats    stats;
+        std::vector<Key> sampleKeys;
+
+        Key* sample_key(const TTEntry* tte) const;
+        void record_save(const TTEntry* tte, Key k, bool otherKey);
+#endif
     };
 
     extern TranspositionTable TT;
@@ -21,30 +21,49 @@
 #include <algorithm>
 #include <cassert>
 #include <cctype>
+#include <charconv>
 #include <cmath>
+#include <condition_variable>
 #include <cstdint>
+#include <cstdio>
 #include <cstdlib>
 #include <deque>
 #include <fstream>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "benchmark.h"
 #include "book.h"
+#include "evalhash.h"
 #include "evaluate.h"
+#include "material.h"
 #include "misc.h"
 #include "movegen.h"
 #include "nnue/evaluate_nnue.h"
+#include "pawns.h"
 #include "position.h"
 #include "san.h"
 #include "search.h"
+#include "searchstats.h"
+#include "selfplay.h"
+#include "server.h"
+#include "syzygy/tbprobe.h"
 #include "thread.h"
+#include "timeman.h"
 #include "tt.h"
 
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#endif
+
 namespace Stockfish {
 
     bool bUCI;
@@ -55,10 +74,110 @@ namespace Stockfish {
         const char* StartFEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
 
 
+        // The standard input is read by a thread of its own, so that 'stop', 'ponderhit' and
+        // 'isready' get their answer while the main thread is busy, e.g. with a 'go' that waits
+        // for the threads of the last search. The reader handles such a command itself when it
+        // cannot overtake a command before it: 'stop' when no 'go' is pending, 'isready' when
+        // only 'go' commands are, and 'ponderhit' when none is. All other lines are queued for
+        // the main thread, in the order they were read. The lines after 'server' are queued
+        // as they are, until the server returns.
+        class Input {
+
+        public:
+            enum Kind { Go, Other, Serve, Raw };
+
+            void start() { std::thread(&Input::read, this).detach(); }
+
+            // Takes the next line, false on end of file. done() follows once it is handled.
+            bool next(std::string& line, Kind& kind) {
+
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&] { return !queue.empty() || eof; });
+                if (queue.empty())
+                    return false;
+
+                line = std::move(queue.front().first);
+                kind = queue.front().second;
+                queue.pop_front();
+                return true;
+            }
+
+            void done(Kind kind) {
+
+                std::lock_guard<std::mutex> lock(mutex);
+                pendingGo -= kind == Go;
+                pendingOther -= kind == Other || kind == Serve;
+                raw &= kind != Serve;
+            }
+
+            // Leaves all further lines to the queue, the engine is about to exit
+            void close() {
+
+                std::lock_guard<std::mutex> lock(mutex);
+                raw = true;
+            }
+
+        private:
+            void read() {
+
+                std::string line, token;
+                while (std::getline(std::cin, line))
+                {
+                    std::istringstream is(line);
+                    token.clear();
+                    is >> std::skipws >> token;
+
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!raw && token == "stop" && !pendingGo)
+                        Threads.stop = true;
+                    else if (!raw && token == "isready" && !pendingOther)
+                        sync_cout << "readyok" << sync_endl;
+                    else if (!raw && token == "ponderhit" && !pendingGo && !pendingOther)
+                        Threads.main()->ponder = false;
+                    else
+                    {
+                        const Kind kind = raw ? Raw : token == "go" ? Go : token == "server" ? Serve : Other;
+                        pendingGo += kind == Go;
+                        pendingOther += kind == Other || kind == Serve;
+                        raw |= kind == Serve;
+                        queue.emplace_back(std::move(line), kind);
+                        cv.notify_one();
+                    }
+                }
+
+                std::lock_guard<std::mutex> lock(mutex);
+                eof = true;
+                cv.notify_one();
+            }
+
+            std::mutex                               mutex;
+            std::condition_variable                  cv;
+            std::deque<std::pair<std::string, Kind>> queue;
+            size_t                                   pendingGo = 0, pendingOther = 0; // Queued or running
+            bool                                     raw = false, eof = false;
+        };
+
+        Input& input = *new Input; // Never destroyed, the reader may still wait for a line at exit
+
+
+        // What the last position command set up, so that the next one only takes back and
+        // makes the moves that differ. Usually the game went on by a move or two.
+        struct LastPosition {
+            std::string              fen;
+            bool                     chess960 = false;
+            std::vector<std::string> tokens; // The moves that were made
+            std::vector<Move>        moves;
+            const StateList*         states = nullptr;
+            Key                      key = 0;
+        } last;
+
+
         // Called when the engine receives the "position" UCI command.
         // It sets up the position that is described in the given FEN string ("fen") or
         // the initial position ("startpos") and then makes the moves given in the following
-        // move list ("moves").
+        // move list ("moves"). When the position still is the one of the last command, set
+        // up from the same FEN string, only the moves after those both lists have in common
+        // are made: the states of the game are kept rather than replayed every time.
         void position(Position& pos, std::istringstream& is, StateListPtr& states) {
 
             Move        m;
@@ -77,18 +196,57 @@ namespace Stockfish {
             else
                 return;
 
-            states = StateListPtr(new std::deque<StateInfo>(1)); // Drop the old state and create a new one
-            pos.set(fen, Options["UCI_Chess960"], &states->back(), Threads.main());
+            std::vector<std::string> tokens;
+            while (is >> token)
+                tokens.push_back(token);
+
+            // The list of the last command went to the search, take it back once it is over
+            const bool chess960 = Options["UCI_Chess960"];
+            if (!states && last.states)
+                states = Threads.reclaim_states(last.states);
+
+            size_t common = 0;
+            if (states && states.get() == last.states && fen == last.fen && chess960 == last.chess960
+                && pos.state() == &states->back() && pos.key() == last.key && pos.this_thread() == Threads.main()
+                && states->size() == last.moves.size() + 1)
+            {
+                while (common < tokens.size() && common < last.tokens.size() && tokens[common] == last.tokens[common])
+                    ++common;
+
+                for (size_t i = last.moves.size(); i > common; --i)
+                {
+                    pos.undo_move(last.moves[i - 1]);
+                    states->pop_back();
+                }
+            }
+            else
+            {
+                StatePool::release(std::move(states)); // Drop the old state and take a new one
+                states = StatePool::acquire();
+                pos.set(fen, chess960, &states->back(), Threads.main());
+            }
+
+            last.tokens.resize(common);
+            last.moves.resize(common);
 
-            // Parse the move list, if any
-            while (is >> token && (m = UCI::to_move(pos, token)))
+            // Parse the rest of the move list, if any
+            for (size_t i = common; i < tokens.size() && (m = UCI::to_move(pos, tokens[i])); ++i)
+            {
                 pos.do_move(m, states->emplace_back());
+                last.tokens.push_back(tokens[i]);
+                last.moves.push_back(m);
+            }
+
+            last.fen = fen;
+            last.chess960 = chess960;
+            last.states = states.get();
+            last.key = pos.key();
         }
 
         // Prints the evaluation of the current position, consistent with the UCI options set so far.
         void trace_eval(Position& pos) {
 
-            StateListPtr states(new std::deque<StateInfo>(1));
+            StateListPtr states(new StateList(1));
             Position     p;
             p.set(pos.fen(), Options["UCI_Chess960"], &states->back(), Threads.main());
 
@@ -160,6 +318,8 @@ namespace Stockfish {
                     is >> limits.nodes;
                 else if (token == "movetime")
                     is >> limits.movetime;
+                else if (token == "deadline")
+                    is >> limits.deadline;
                 else if (token == "mate")
                     is >> limits.mate;
                 else if (token == "perft")
@@ -177,14 +337,50 @@ namespace Stockfish {
         // First, a list of UCI commands is set up according to the bench parameters,
         // then it is run one by one, printing a summary at the end.
 
-        void bench(Position& pos, std::istream& args, StateListPtr& states) {
+        // 'bench nnue [iterations] [fenFile]' times the layers of the network on the
+        // bench positions, or on those of a file, instead of searching them.
+        void bench_nnue(Position& pos, std::istream& args) {
 
-            std::string token;
-            uint64_t    num, nodes = 0, cnt = 1;
+            std::string iterations = "1000", fenFile = "default", token;
+            args >> iterations >> fenFile;
 
-            std::vector<std::string> list = setup_bench(pos, args);
+            std::size_t n = 0;
+            const auto [end, ec] = std::from_chars(iterations.data(), iterations.data() + iterations.size(), n);
+            if (ec != std::errc() || end != iterations.data() + iterations.size() || !n)
+            {
+                sync_cout << "ERROR: The iterations must be a positive number, not '" << iterations << "'" << sync_endl;
+                return;
+            }
+
+            std::istringstream       is("16 1 1 " + fenFile);
+            std::vector<std::string> fens;
+            for (const auto& cmd : setup_bench(pos, is))
+                if (cmd.find("position fen ") == 0)
+                    fens.push_back(cmd.substr(13, cmd.find(" moves") - 13));
+
+            if (!useClassic)
+                Eval::NNUE::verify();
 
-            num = count_if(list.begin(), list.end(),
+            Eval::NNUE::benchmark(fens, n);
+        }
+
+        // Nodes and time of the searched positions of one bench run
+        struct BenchRun {
+            std::vector<uint64_t>  nodes;
+            std::vector<TimePoint> time;
+            uint64_t               totalNodes = 0;
+            TimePoint              elapsed = 1;
+
+            double nps() const { return 1000.0 * totalNodes / elapsed; }
+        };
+
+        BenchRun run_bench(Position& pos, const std::vector<std::string>& list, StateListPtr& states,
+            std::vector<std::string>* fens) {
+
+            std::string token;
+            BenchRun    run;
+            uint64_t    cnt = 1;
+            const auto  num = count_if(list.begin(), list.end(),
                 [](const std::string& s) { return s.find("go ") == 0 || s.find("eval") == 0; });
 
             TimePoint elapsed = now();
@@ -198,14 +394,23 @@ namespace Stockfish {
                 {
                     std::cerr << "\nPosition: " << cnt++ << '/' << num << " (" << pos.fen() << ")"
                         << std::endl;
+                    if (fens)
+                        fens->push_back(pos.fen());
+
+                    TimePoint start = now();
+                    uint64_t  nodes = 0;
                     if (token == "go")
                     {
                         go(pos, is, states);
                         Threads.main()->wait_for_search_finished();
-                        nodes += Threads.nodes_searched();
+                        nodes = Threads.nodes_searched();
                     }
                     else
                         trace_eval(pos);
+
+                    run.nodes.push_back(nodes);
+                    run.time.push_back(now() - start);
+                    run.totalNodes += nodes;
                 }
                 else if (token == "setoption")
                     setoption(is);
@@ -218,13 +423,267 @@ namespace Stockfish {
                 } // Search::clear() may take a while
             }
 
-            elapsed = now() - elapsed + 1; // Ensure positivity to avoid a 'divide by zero'
+            run.elapsed = now() - elapsed + 1; // Ensure positivity to avoid a 'divide by zero'
+            return run;
+        }
+
+        // Runs of an instance started by 'bench instances', one line per run with the time,
+        // the nodes and then the nodes and time of every position.
+        std::string bench_instance_file(int i) { return "bench instance " + std::to_string(i) + ".txt"; }
+
+        void write_bench_runs(std::ostream& os, const std::vector<BenchRun>& runs) {
+
+            for (const BenchRun& r : runs)
+            {
+                os << r.elapsed << ' ' << r.totalNodes;
+                for (size_t i = 0; i < r.nodes.size(); ++i)
+                    os << ' ' << r.nodes[i] << ' ' << r.time[i];
+                os << '\n';
+            }
+        }
+
+        std::vector<BenchRun> read_bench_runs(std::istream& is) {
+
+            std::vector<BenchRun> runs;
+            std::string           line;
+            while (std::getline(is, line))
+            {
+                std::istringstream ss(line);
+                BenchRun           r;
+                uint64_t           n;
+                TimePoint          t;
+                if (!(ss >> r.elapsed >> r.totalNodes))
+                    continue;
+                while (ss >> n >> t)
+                    r.nodes.push_back(n), r.time.push_back(t);
+                runs.push_back(r);
+            }
+            return runs;
+        }
+
+        void write_bench_json(std::ostream& os, const std::vector<std::vector<BenchRun>>& instances,
+            const std::vector<std::string>& fens, const std::vector<std::string>& args,
+            uint64_t nodes, TimePoint elapsed, double mean, double stddev, double minNps, double maxNps) {
+
+            os << "{\"hash\":" << args[0] << ",\"threads\":" << args[1] << ",\"limit\":\"" << args[2]
+                << "\",\"limitType\":\"" << args[4] << "\",\"runs\":" << instances[0].size()
+                << ",\"instances\":" << instances.size() << ",\"nodes\":" << nodes << ",\"time\":" << elapsed
+                << ",\"nps\":{\"mean\":" << uint64_t(mean) << ",\"stddev\":" << uint64_t(stddev)
+                << ",\"min\":" << uint64_t(minNps) << ",\"max\":" << uint64_t(maxNps) << "},\"positions\":[";
+
+            for (size_t i = 0; i < fens.size(); ++i)
+                os << (i ? "," : "") << "\"" << fens[i] << "\"";
+
+            os << "],\"results\":[";
+            for (size_t i = 0; i < instances.size(); ++i)
+            {
+                os << (i ? "," : "") << "[";
+                for (size_t r = 0; r < instances[i].size(); ++r)
+                {
+                    const BenchRun& run = instances[i][r];
+                    os << (r ? "," : "") << "{\"nodes\":" << run.totalNodes << ",\"time\":" << run.elapsed
+                        << ",\"nps\":" << uint64_t(run.nps()) << ",\"positionNodes\":[";
+                    for (size_t p = 0; p < run.nodes.size(); ++p)
+                        os << (p ? "," : "") << run.nodes[p];
+                    os << "],\"positionTime\":[";
+                    for (size_t p = 0; p < run.time.size(); ++p)
+                        os << (p ? "," : "") << run.time[p];
+                    os << "]}";
+                }
+                os << "]";
+            }
+            os << "]}" << std::endl;
+        }
+
+        // 'bench [hash] [threads] [limit] [fenFile] [limitType]' may be followed by
+        // 'repeat n' to search the positions n times, each run from a cleared state,
+        // 'json file' to write all results to a JSON file ('-' for stdout), and
+        // 'instances n' to run n single threaded benches at once in engine processes
+        // of their own (0 for one per core), which shows the memory bandwidth contention.
+        void bench(Position& pos, std::istream& is, StateListPtr& states) {
+
+            std::string token;
+
+            std::string rest;
+            std::getline(is, rest);
+            std::istringstream args(rest);
+            if (args >> token && token == "nnue")
+                return bench_nnue(pos, args);
+
+            std::vector<std::string> positional;
+            std::string              jsonFile;
+            int                      repeat = 1, instances = 1, instance = -1;
+
+            args.clear();
+            args.seekg(0);
+            while (args >> token)
+                if (token == "repeat")
+                    args >> repeat;
+                else if (token == "json")
+                    args >> jsonFile;
+                else if (token == "instances")
+                    args >> instances;
+                else if (token == "instance")
+                    args >> instance;
+                else
+                    positional.push_back(token);
+
+            repeat = std::max(repeat, 1);
+            if (instances <= 0)
+                instances = std::max(1, int(std::thread::hardware_concurrency()));
+
+            const std::vector<std::string> defaults = { "16", "1", "13", "default", "depth" };
+            for (size_t i = positional.size(); i < defaults.size(); ++i)
+                positional.push_back(defaults[i]);
+
+            std::ostringstream joined;
+            for (const auto& a : positional)
+                joined << a << ' ';
+
+            std::vector<std::vector<BenchRun>> results;
+            std::vector<std::string>           fens;
+            TimePoint                          wall = now();
+
+            TT.clear_stats();
+            EvalHash::clear_stats();
+            Eval::NNUE::clear_stats();
+            SearchStats::clear();
+
+            if (instances > 1)
+            {
+                positional[1] = "1";
+                std::ostringstream cmd;
+                for (const auto& a : positional)
+                    cmd << a << ' ';
+
+                std::istringstream ss(cmd.str());
+                for (const auto& c : setup_bench(pos, ss))
+                    if (c.find("position fen ") == 0)
+                        fens.push_back(c.substr(13));
+
+                // Start one engine process per instance, each with its own TT, which searches
+                // the positions with one thread and writes its runs to a file of its own.
+                std::vector<FILE*> processes;
+                for (int i = 0; i < instances; ++i)
+                {
+                    const std::string log = "bench instance " + std::to_string(i) + ".log";
+                    FILE* p = popen(("\"" + CommandLine::argv0 + "\" > \"" + log + "\" 2>&1").c_str(), "w");
+                    if (!p)
+                    {
+                        std::cerr << "ERROR: Unable to start instance " << i << std::endl;
+                        continue;
+                    }
+
+                    // Without the log, trace and shared hash options, see setoption_commands()
+                    std::ostringstream cmds;
+                    cmds << setoption_commands(Options);
+                    if (positional[3] == "current")
+                        cmds << "position fen " << pos.fen() << "\n";
+                    cmds << "bench " << cmd.str() << "repeat " << repeat << " instance " << i << "\nquit\n";
+                    std::fputs(cmds.str().c_str(), p);
+                    std::fflush(p);
+                    processes.push_back(p);
+                }
+
+                for (FILE* p : processes)
+                    pclose(p);
+
+                for (int i = 0; i < instances; ++i)
+                {
+                    const std::string name = bench_instance_file(i);
+                    const std::string log = "bench instance " + std::to_string(i) + ".log";
+                    std::ifstream     in(name);
+                    auto              runs = read_bench_runs(in);
+                    in.close();
+                    std::remove(name.c_str());
+                    std::remove(log.c_str());
+
+                    if (int(runs.size()) == repeat)
+                        results.push_back(runs);
+                    else
+                        std::cerr << "ERROR: Instance " << i << " did not finish" << std::endl;
+                }
+
+                if (results.empty())
+                    return;
+            }
+            else
+            {
+                std::istringstream       ss(joined.str());
+                std::vector<std::string> list = setup_bench(pos, ss);
+
+                results.emplace_back();
+                for (int r = 0; r < repeat; ++r)
+                    results[0].push_back(run_bench(pos, list, states, r ? nullptr : &fens));
+            }
+
+            wall = now() - wall + 1;
+
+            if (instance >= 0)
+            {
+                std::ofstream out(bench_instance_file(instance));
+                write_bench_runs(out, results[0]);
+                return;
+            }
+
+            // The nodes per second of a run are summed over the instances
+            uint64_t            nodes = 0;
+            TimePoint           elapsed = 0;
+            std::vector<double> nps(repeat, 0.0);
+            for (const auto& runs : results)
+                for (int r = 0; r < repeat; ++r)
+                {
+                    nodes += runs[r].totalNodes;
+                    nps[r] += runs[r].nps();
+                    if (results.size() == 1)
+                        elapsed += runs[r].elapsed;
+                }
+
+            if (results.size() > 1)
+                elapsed = wall;
+
+            double mean = 0, var = 0;
+            for (double v : nps)
+                mean += v / repeat;
+            for (double v : nps)
+                var += (v - mean) * (v - mean) / repeat;
+            const auto [minNps, maxNps] = std::minmax_element(nps.begin(), nps.end());
 
             dbg_print();
 
+#ifdef TT_STATS
+            TT.print_stats(std::cerr);
+#endif
+#ifdef SEARCH_STATS
+            SearchStats::print(std::cerr);
+#endif
+#ifdef NNUE_STATS
+            Eval::NNUE::print_stats(std::cerr);
+#endif
+            if (results.size() == 1)
+                EvalHash::print_stats(std::cerr);
+
             std::cerr << "\n==========================="
                 << "\nTotal time (ms) : " << elapsed << "\nNodes searched  : " << nodes
-                << "\nNodes/second    : " << 1000 * nodes / elapsed << std::endl;
+                << "\nNodes/second    : " << (results.size() > 1 ? uint64_t(mean) : 1000 * nodes / elapsed)
+                << std::endl;
+
+            if (repeat > 1 || results.size() > 1)
+                std::cerr << "Runs            : " << repeat << "\nInstances       : " << results.size()
+                    << "\nNPS mean        : " << uint64_t(mean) << "\nNPS stddev      : " << uint64_t(std::sqrt(var))
+                    << "\nNPS min         : " << uint64_t(*minNps) << std::endl;
+
+            if (jsonFile.empty())
+                return;
+
+            std::ofstream out;
+            if (jsonFile != "-")
+                out.open(jsonFile);
+            if (jsonFile != "-" && !out)
+                std::cerr << "ERROR: Unable to write " << jsonFile << std::endl;
+            else
+                write_bench_json(jsonFile == "-" ? std::cout : out, results, fens, positional, nodes, elapsed,
+                    mean, std::sqrt(var), *minNps, *maxNps);
         }
 
         void fen(Position& pos, std::istringstream& is, StateListPtr& states) {
@@ -241,7 +700,8 @@ namespace Stockfish {
                     fen += token + " ";
             }
 
-            states = StateListPtr(new std::deque<StateInfo>(1)); // Drop the old state and create a new one
+            StatePool::release(std::move(states)); // Drop the old state and take a new one
+            states = StatePool::acquire();
             pos.set(fen, Options["UCI_Chess960"], &states->back(), Threads.main());
             Search::clear();
             std::cout << pos << std::endl;
@@ -252,7 +712,7 @@ namespace Stockfish {
             if (!pos.pos_is_ok())
                 return;
 
-            StateListPtr states(new std::deque<StateInfo>(1));
+            StateListPtr states(new StateList(1));
             Position p;
             p.set(pos.fen(), Options["UCI_Chess960"], &states->back(), Threads.main());
 
@@ -277,16 +737,19 @@ namespace Stockfish {
                 {
                     // Find opening
                     p.do_move<true>(move, states->emplace_back());
-                    const auto* entry = Book::find_opening(p);
-                    if (entry)
-                        std::cout << " " << entry->opening;
+                    const auto opening = Book::find_opening(p);
+                    if (!opening.empty())
+                        std::cout << " " << opening;
                     p.undo_move(move);
                     states->pop_back();
 
                     if (move.type_of() == EN_PASSANT)
                         std::cout << " (en passant)";
                     else if (p.capture(move))
-                        std::cout << (p.see_ge(move) ? " (good" : " (bad") << " capture)";
+                    {
+                        const int see = p.see(move);
+                        std::cout << (see >= 0 ? " (good" : " (bad") << " capture, SEE " << see << ")";
+                    }
                     if (move.type_of() == CASTLING)
                         std::cout << ((move.from_sq() > move.to_sq()) ? " (long" : " (short") << " castle)";
                     if (move.type_of() == PROMOTION)
@@ -306,65 +769,139 @@ namespace Stockfish {
 
             bUCI = false;
             Options["UCI_Chess960"] = false;
-            states = StateListPtr(new std::deque<StateInfo>(1));
+            StatePool::release(std::move(states));
+            states = StatePool::acquire();
             pos.set(StartFEN, false, &states->back(), Threads.main());
             Search::clear();
         }
 
-        void test_perft()
+        // A perft test of an EPD position with the expected node count at a depth
+        struct PerftTest {
+            std::string fen;
+            Depth       depth;
+            uint64_t    expected, nodes = 0;
+            TimePoint   time = 0;
+        };
+
+        // test_perft() runs the perft tests of fischer.epd or standard.epd. By default the
+        // tests are run one after another and each perft is split over all threads. With
+        // 'test perft multi' the positions are distributed over the threads instead.
+        // 'test perft hash <MB>' caches the counts of transposed subtrees. 'test perft fast'
+        // runs fast_perft(), which times the bare move generator on one thread per test.
+        void test_perft(std::istringstream& is)
         {
-            const char* filename = Options["UCI_Chess960"] ? "fischer.epd" : "standard.epd";
-            std::ifstream is(filename);
-            if (is)
+            bool multi = false, fast = false;
+            size_t hashSize = 0;
+            std::string token;
+            while (is >> token)
+                if (token == "multi")
+                    multi = true;
+                else if (token == "fast")
+                    fast = true;
+                else if (token == "hash")
+                    is >> hashSize;
+
+            const bool chess960 = Options["UCI_Chess960"];
+            const char* filename = chess960 ? "fischer.epd" : "standard.epd";
+            std::ifstream epd(filename);
+            if (!epd)
+                return;
+
+            // Lines look like "<fen> ;D1 20 ;D2 400 ;D3 8902"
+            std::vector<PerftTest> tests;
+            std::string line;
+            while (std::getline(epd, line))
             {
-                StateListPtr sp(new std::deque<StateInfo>(1));
-                Position pos;
-                std::string line;
-                while (!is.eof())
+                std::istringstream iss(line);
+                std::string fen, s;
+                std::getline(iss, fen, ';');
+                if (fen.empty())
+                    break;
+
+                while (std::getline(iss, s, ';') && !s.empty())
                 {
-                    std::getline(is, line);
-                    std::istringstream iss(line);
-                    std::string fen;
-                    std::getline(iss, fen, ';');
-                    if (fen.empty())
-                        break;
-
-                    pos.set(fen, Options["UCI_Chess960"], &sp->back(), nullptr);
-                    std::cout << pos << std::endl;
-                    while (true)
-                    {
-                        std::string s;
-                        std::getline(iss, s, ';');
-                        if (s.empty())
-                        {
-                            std::cout << std::endl;
-                            break;
-                        }
-                        std::istringstream iss1(s);
-
-                        char c1;
-                        int depth;
-                        uint64_t n;
-                        iss1 >> c1 >> depth >> n;
-                        std::cout << "Depth: " << depth << std::endl;
-
-                        TimePoint start_time = now();
-                        uint64_t nodes = perft<true, false>(pos, depth);
-                        TimePoint elapsed_time = now() - start_time;
-                        std::cout << "Nodes searched: " << nodes
-                            << "\nTime: " << elapsed_time / 1000.0
-                            << " s -> " << float(nodes) / float(elapsed_time) * 1000.0f << " nps\n";
-
-                        if (nodes == n) std::cout << "Passed!\n";
-                        else
-                        {
-                            std::cout << "ERROR: Expected number of moves was " << n << std::endl;
-                            return;
-                        }
+                    std::istringstream iss1(s);
+                    char c1;
+                    PerftTest& t = tests.emplace_back();
+                    t.fen = fen;
+                    iss1 >> c1 >> t.depth >> t.expected;
+                }
+            }
+
+            // A split test runs on the main thread and splits into tasks of its own, the
+            // others are tasks and use the tables of the search thread of their worker
+            auto run = [&](PerftTest& t, bool split) {
+                StateInfo st;
+                Position p;
+                p.set(t.fen, chess960, &st, split ? Threads.main() : *(Threads.begin() + Tasks::worker()));
+                TimePoint start_time = now();
+                t.nodes = fast ? fast_perft(p, t.depth)
+                        : split ? perft<true, false>(p, t.depth) : perft<false, false>(p, t.depth);
+                t.time = now() - start_time;
+            };
+
+            perft_hash(hashSize);
+            Tasks::start();
+
+            TimePoint start_time = now();
+            if (multi)
+            {
+                // Start with the deepest tests, they take by far the most time
+                std::vector<size_t> order(tests.size());
+                for (size_t i = 0; i < order.size(); ++i)
+                    order[i] = i;
+                std::stable_sort(order.begin(), order.end(),
+                    [&](size_t a, size_t b) { return tests[a].depth > tests[b].depth; });
+
+                for (size_t i : order)
+                    Tasks::submit([&, i] { run(tests[i], false); });
+                if (!Tasks::wait())
+                {
+                    perft_hash(0);
+                    return;
+                }
+            }
+
+            StateListPtr sp(new StateList(1));
+            Position pos;
+            uint64_t totalNodes = 0;
+            for (size_t i = 0; i < tests.size(); ++i)
+            {
+                PerftTest& t = tests[i];
+                if (i == 0 || t.fen != tests[i - 1].fen)
+                {
+                    if (i)
                         std::cout << std::endl;
-                    }
+                    pos.set(t.fen, chess960, &sp->back(), nullptr);
+                    std::cout << pos << std::endl;
                 }
+
+                if (!multi)
+                    run(t, true);
+                totalNodes += t.nodes;
+
+                std::cout << "Depth: " << t.depth << std::endl;
+                std::cout << "Nodes searched: " << t.nodes
+                    << "\nTime: " << t.time / 1000.0
+                    << " s -> " << float(t.nodes) / float(std::max(t.time, TimePoint(1))) * 1000.0f << " nps\n";
+
+                if (t.nodes == t.expected) std::cout << "Passed!\n";
+                else
+                {
+                    std::cout << "ERROR: Expected number of moves was " << t.expected << std::endl;
+                    perft_hash(0);
+                    return;
+                }
+                std::cout << std::endl;
             }
+
+            TimePoint elapsed_time = now() - start_time;
+            std::cout << "\nTotal nodes searched: " << totalNodes
+                << "\nTotal time: " << elapsed_time / 1000.0
+                << " s -> " << float(totalNodes) / float(std::max(elapsed_time, TimePoint(1))) * 1000.0f << " nps\n"
+                << std::endl;
+
+            perft_hash(0);
         }
 
         static std::string current_date() {
@@ -378,82 +915,297 @@ namespace Stockfish {
             return buf;
         }
 
+        // Result of one test mate position, written as a row of the CSV
+        struct MateResult {
+            unsigned    index;
+            std::string fen;
+            int         mate;
+            TimePoint   time;
+            uint64_t    nodes = 0;
+            Depth       depth = 0, selDepth = 0;
+            int         hashfull = 0;
+            TimePoint   firstMate = -1; // Time of the first mate score, -1 if there was none
+            std::string pv;             // Empty if the mate has not been found
+        };
+
+        const char* MateNotFound = "mate not found within time limit.";
+        const char* MateHeader = "Index;FEN;Mate in;Time [ms];Nodes;NPS;Depth;Seldepth;Hashfull;First mate [ms];PV";
+
+        void write_mate_result(std::ostream& os, const MateResult& r) {
+
+            os << r.index << ";" << r.fen << ";" << r.mate << ";" << r.time << ";" << r.nodes << ";"
+                << r.nodes * 1000 / std::max(r.time, TimePoint(1)) << ";" << r.depth << ";" << r.selDepth << ";"
+                << r.hashfull << ";" << r.firstMate << ";" << (r.pv.empty() ? MateNotFound : r.pv) << std::endl;
+        }
+
+        // Helper: parses a CSV row written by write_mate_result(), false for other lines.
+        // Rows of older logs with only index, FEN, mate in, time and PV are accepted as well.
+        bool read_mate_result(const std::string& line, MateResult& r) {
+
+            std::vector<std::string> fields;
+            std::istringstream is(line);
+            for (std::string field; std::getline(is, field, ';');)
+                fields.push_back(field);
+
+            if (fields.size() != 5 && fields.size() != 11)
+                return false;
+
+            r = MateResult();
+            r.index = unsigned(std::strtoul(fields[0].c_str(), nullptr, 10));
+            r.fen = fields[1];
+            r.mate = int(std::strtol(fields[2].c_str(), nullptr, 10));
+            r.time = TimePoint(std::strtoll(fields[3].c_str(), nullptr, 10));
+            r.pv = fields.back() == MateNotFound ? "" : fields.back();
+
+            if (fields.size() == 11)
+            {
+                r.nodes = std::strtoull(fields[4].c_str(), nullptr, 10);
+                r.depth = Depth(std::strtol(fields[6].c_str(), nullptr, 10));
+                r.selDepth = Depth(std::strtol(fields[7].c_str(), nullptr, 10));
+                r.hashfull = int(std::strtol(fields[8].c_str(), nullptr, 10));
+                r.firstMate = TimePoint(std::strtoll(fields[9].c_str(), nullptr, 10));
+            }
+            return r.index > 0;
+        }
+
+        // Writes the summary of a test mate session. The times are of the solved positions only.
+        void write_mate_summary(std::ostream& os, const std::vector<MateResult>& results, TimePoint elapsed) {
+
+            std::vector<TimePoint> times;
+            uint64_t nodes = 0;
+            double logSum = 0;
+            for (const auto& r : results)
+            {
+                nodes += r.nodes;
+                if (!r.pv.empty())
+                {
+                    times.push_back(r.time);
+                    logSum += std::log(double(std::max(r.time, TimePoint(1))));
+                }
+            }
+            std::sort(times.begin(), times.end());
+
+            TimePoint sum = 0;
+            for (TimePoint t : times)
+                sum += t;
+
+            os << "Positions;" << results.size()
+                << "\nSolved;" << times.size()
+                << "\nTotal nodes;" << nodes
+                << "\nPositions/hour;" << int64_t(results.size() * 3600000.0 / std::max(elapsed, TimePoint(1)))
+                << "\nMean time to mate [ms];" << (times.empty() ? 0 : sum / TimePoint(times.size()))
+                << "\nGeometric mean time to mate [ms];" << (times.empty() ? 0 : int64_t(std::exp(logSum / times.size())))
+                << "\nP95 time to mate [ms];" << (times.empty() ? 0 : times[(times.size() * 95 + 99) / 100 - 1])
+                << std::endl;
+        }
+
+        // Compares the results of this session with a previous CSV. Positions whose time changed
+        // by more than 10%, and positions solved by only one of the runs, are reported.
+        void compare_mate_results(const std::vector<MateResult>& results, const std::string& fname) {
+
+            std::ifstream in(fname);
+            if (!in)
+            {
+                std::cout << "Unable to open " << fname << std::endl;
+                return;
+            }
+
+            std::map<unsigned, MateResult> old;
+            std::string line;
+            MateResult r;
+            while (std::getline(in, line))
+                if (read_mate_result(line, r))
+                    old[r.index] = r;
+
+            std::cout << "Comparison with " << fname << std::endl;
+
+            int faster = 0, slower = 0, compared = 0;
+            double logSum = 0;
+            for (const auto& n : results)
+            {
+                auto it = old.find(n.index);
+                if (it == old.end() || it->second.fen != n.fen)
+                    continue;
+
+                const MateResult& o = it->second;
+                if (o.pv.empty() != n.pv.empty())
+                {
+                    std::cout << "Position #" << n.index << (n.pv.empty() ? ": no longer solved" : ": newly solved")
+                        << std::endl;
+                    continue;
+                }
+                if (n.pv.empty())
+                    continue;
+
+                double speedup = double(std::max(o.time, TimePoint(1))) / double(std::max(n.time, TimePoint(1)));
+                logSum += std::log(speedup);
+                compared++;
+
+                if (speedup > 1.1 || speedup < 1 / 1.1)
+                {
+                    (speedup > 1 ? faster : slower)++;
+                    std::cout << "Position #" << n.index << ": " << o.time << " ms -> " << n.time << " ms ("
+                        << (speedup > 1 ? "speedup " : "slowdown ") << (speedup > 1 ? speedup : 1 / speedup)
+                        << "x)" << std::endl;
+                }
+            }
+
+            std::cout << "Compared: " << compared << ", faster: " << faster << ", slower: " << slower
+                << ", geometric mean speedup: " << (compared ? std::exp(logSum / compared) : 1.0) << "x\n"
+                << std::endl;
+        }
+
+        // test_mate() solves the positions of matetrack.epd and logs the results in a dated CSV.
+        // Arguments:
+        //   movetime <s>  time limit per position, default none
+        //   count <n>     number of positions, default 100, 0 for all
+        //   groups <n>    solve n positions at the same time, each in an engine process of
+        //                 its own with a share of the threads and hash
+        //   group <i>     used by these processes: solve only every n-th position from the i-th
+        //   compare <csv> compare the results with a previous log, must be the last argument
         void test_mate(std::istringstream& is) {
 
+            Search::LimitsType limits;
+            limits.movetime = 0;
+            unsigned count = 100, groups = 1, group = 0;
+            bool isGroup = false;
+            std::string compareFile;
+
+            std::string token;
+            while (is >> token)
+                if (token == "movetime")
+                {
+                    is >> limits.movetime;
+                    limits.movetime *= 1000;
+                }
+                else if (token == "count")
+                    is >> count;
+                else if (token == "groups")
+                    is >> groups;
+                else if (token == "group")
+                    is >> group, isGroup = true;
+                else if (token == "compare")
+                    std::getline(is >> std::ws, compareFile);
+
+            groups = std::max(groups, 1u);
+
             std::ifstream epd("matetrack.epd");
-            if (epd)
-            {
-                StateListPtr sp;
-                Position pos;
-                std::string line;
-                unsigned posCount = 0;
-                std::ofstream csv("matelog " + current_date() + ".csv");
+            if (!epd)
+                return;
 
-                if (!csv)
-                    return;
+            const std::string csvName = isGroup ? "matelog group " + std::to_string(group) + ".csv"
+                                                : "matelog " + current_date() + ".csv";
+            std::ofstream csv(csvName);
+            if (!csv)
+                return;
 
-                csv << "Hash " << int(Options["Hash"]) << " MB;Threads " << int(Options["Threads"]) << std::endl;
-                csv << "Index;FEN;Mate in;Time [ms];PV" << std::endl;
+            csv << "Hash " << int(Options["Hash"]) << " MB;Threads " << int(Options["Threads"]) << std::endl;
+            csv << MateHeader << std::endl;
 
-                Search::LimitsType limits;
-                limits.movetime = 0;
+            std::cout << "Starting test mate session" << std::endl;
+            std::cout << "Number of threads: " << Threads.size() << std::endl;
+            std::cout << "Hash size: " << int(Options["Hash"]) << " MB" << std::endl;
+            std::cout << "Time limit: " << limits.movetime / 1000 << " seconds" << std::endl;
+            std::cout << "Method: " << (useShashin ? "Shashin" : "Normal") << std::endl;
+            if (groups > 1)
+                std::cout << (isGroup ? "Group " + std::to_string(group) + " of " : "Groups: ") << groups << std::endl;
+            std::cout << std::endl;
+
+            std::vector<MateResult> results;
+            TimePoint startTime = now();
 
-                try
+            if (groups > 1 && !isGroup)
+            {
+                // Start one engine process per group, each with its own threads and TT.
+                // They get the current options and write their results to their own CSV.
+                std::vector<FILE*> processes;
+                for (unsigned g = 0; g < groups; ++g)
                 {
-                    std::string movetime;
-                    is >> movetime;
-                    if (movetime == "movetime" && !is.eof())
+                    FILE* p = popen(("\"" + CommandLine::argv0 + "\"").c_str(), "w");
+                    if (!p)
                     {
-                        is >> movetime;
-                        std::cout << "ARG " << movetime << std::endl;
-                        if (!movetime.empty()) limits.movetime = std::stoi(movetime) * 1000;
+                        std::cout << "ERROR: Unable to start group " << g << std::endl;
+                        continue;
                     }
+
+                    std::ostringstream cmds;
+                    cmds << setoption_commands(Options)
+                        << "setoption name Threads value " << std::max(1, int(Options["Threads"]) / int(groups))
+                        << "\nsetoption name Hash value " << std::max(1, int(Options["Hash"]) / int(groups))
+                        << "\ntest mate movetime " << limits.movetime / 1000 << " count " << count
+                        << " groups " << groups << " group " << g << "\nquit\n";
+                    std::fputs(cmds.str().c_str(), p);
+                    std::fflush(p);
+                    processes.push_back(p);
                 }
-                catch (std::exception& e)
+
+                for (FILE* p : processes)
+                    pclose(p);
+
+                // Collect the results of all groups into the CSV of this session
+                for (unsigned g = 0; g < groups; ++g)
                 {
-                    std::cout << "ERROR: " << e.what() << std::endl;
+                    const std::string name = "matelog group " + std::to_string(g) + ".csv";
+                    std::ifstream in(name);
+                    std::string line;
+                    MateResult r;
+                    while (std::getline(in, line))
+                        if (read_mate_result(line, r))
+                            results.push_back(r);
+                    in.close();
+                    std::remove(name.c_str());
                 }
 
-                std::cout << "Starting test mate session" << std::endl;
-                std::cout << "Number of threads: " << Threads.size() << std::endl;
-                std::cout << "Hash size: " << int(Options["Hash"]) << " MB" << std::endl;
-                std::cout << "Time limit: " << limits.movetime / 1000 << " seconds" << std::endl;
-                std::cout << "Method: " << (useShashin ? "Shashin" : "Normal") << std::endl;
-                std::cout << std::endl;
+                std::sort(results.begin(), results.end(),
+                    [](const MateResult& a, const MateResult& b) { return a.index < b.index; });
+                for (const auto& r : results)
+                    write_mate_result(csv, r);
+            }
+            else
+            {
+                StateListPtr sp;
+                Position pos;
+                std::string line;
+                unsigned posCount = 0;
 
-                while (!epd.eof() && posCount < 100)
+                while (std::getline(epd, line) && (!count || posCount < count))
                 {
-                    std::getline(epd, line);
-
                     // Get the FEN.
                     auto npos = line.find("bm");
                     if (npos == std::string::npos) continue;
 
                     posCount++;
-                    std::string fen = line.substr(0, npos - 1);
-                    std::cout << "Position #" << posCount << ": " << fen << std::endl;
-                    csv << posCount << ";" << fen << ";";
+                    if ((posCount - 1) % groups != group)
+                        continue;
+
+                    MateResult& r = results.emplace_back();
+                    r.index = posCount;
+                    r.fen = line.substr(0, npos - 1);
+                    std::cout << "Position #" << posCount << ": " << r.fen << std::endl;
 
                     // Get the "mate in"
-                    int mateDepth = std::strtol(line.c_str() + npos + 4, 0, 10);
-                    std::cout << "Search for mate in " << mateDepth << std::endl;
-                    csv << mateDepth << ";";
-                    limits.mate = mateDepth;
+                    r.mate = std::strtol(line.c_str() + npos + 4, 0, 10);
+                    std::cout << "Search for mate in " << r.mate << std::endl;
+                    limits.mate = r.mate;
                     limits.startTime = now();
 
                     // Start the search
-                    sp = StateListPtr(new std::deque<StateInfo>(1));
-                    pos.set(fen, false, &sp->back(), Threads.main());
+                    sp = StatePool::acquire();
+                    pos.set(r.fen, false, &sp->back(), Threads.main());
                     TT.clear();
                     Threads.clear();
                     TimePoint time = now();
                     Threads.start_thinking(pos, sp, limits);
                     Threads.main()->wait_for_search_finished();
 
-                    TimePoint elapsed_time = now() - time;
-                    csv << elapsed_time << ";";
+                    r.time = now() - time;
 
                     Thread* bestThread = Threads.get_best_thread();
+                    r.nodes = Threads.nodes_searched();
+                    r.depth = bestThread->completedDepth;
+                    r.selDepth = bestThread->rootMoves[0].selDepth;
+                    r.hashfull = TT.hashfull();
+                    r.firstMate = Threads.main()->firstMateTime;
                     bool mate_found = false;
 
                     // Have we found a "mate in x"?
@@ -469,14 +1221,300 @@ namespace Stockfish {
                         mate_found = true;
 
                     if (mate_found)
-                        csv << SAN::to_san(pos, bestThread->rootMoves[0]);
-                    else
-                        csv << "mate not found within time limit.";
+                        r.pv = SAN::to_san(pos, bestThread->rootMoves[0]);
 
-                    csv << std::endl;
+                    write_mate_result(csv, r);
                     std::cout << std::endl;
                 }
             }
+
+            if (!isGroup)
+            {
+                std::ostringstream summary;
+                write_mate_summary(summary, results, now() - startTime);
+                csv << summary.str();
+                std::cout << summary.str() << std::endl;
+
+                if (!compareFile.empty())
+                    compare_mate_results(results, compareFile);
+            }
+        }
+
+        // The king squares of the piece placement of a FEN, as a number for the order of
+        // eval_batch(). Ranks count from the eighth like in the FEN, which is all the same.
+        int king_squares(const std::string& fen) {
+
+            int s = 0, white = 0, black = 0;
+            for (size_t i = 0; i < fen.size() && fen[i] != ' ' && s < 64; ++i)
+                if (fen[i] >= '1' && fen[i] <= '8')
+                    s += fen[i] - '0';
+                else if (fen[i] != '/')
+                {
+                    white = fen[i] == 'K' ? s : white;
+                    black = fen[i] == 'k' ? s : black;
+                    ++s;
+                }
+            return 64 * white + black;
+        }
+
+        // 'evalbatch <file> [bin] [block n]' evaluates the FEN or EPD positions of a file
+        // and writes the NNUE and the final evaluation of each position, from the point of view
+        // of the side to move, to "<file>.eval.csv" or, with bin, as two int16 per position to
+        // "<file>.eval.bin". The file is read in blocks of n positions (default 16384), every
+        // block is split into chunks for the Tasks pool. Positions in check get VALUE_NONE.
+        //
+        // The accumulator caches of a thread keep the features of the last position for each
+        // king square, so a refresh only updates the pieces that differ. The positions of a block
+        // are evaluated in the order of their king squares and piece placement, after which the
+        // next position mostly differs in a few pieces, like in a game. A shuffled file of
+        // training positions takes a third less time. The values do not depend on the order
+        // and are written in the order of the file.
+        void eval_batch(std::istringstream& is) {
+
+            std::string fname, token;
+            bool        binary = false;
+            size_t      blockSize = 16384;
+            is >> fname;
+            while (is >> token)
+                if (token == "bin")
+                    binary = true;
+                else if (token == "block")
+                    is >> blockSize;
+
+            std::ifstream in(fname);
+            if (!in || !blockSize)
+                return;
+
+            std::string   outName = fname + (binary ? ".eval.bin" : ".eval.csv");
+            std::ofstream out(outName, binary ? std::ios::binary : std::ios::out);
+            if (!out)
+                return;
+
+            Tasks::start();
+            if (!useClassic)
+                Eval::NNUE::verify();
+
+            if (!binary)
+                out << "FEN;NNUE;Eval\n";
+
+            using Values = std::vector<std::pair<Value, Value>>;
+            const bool chess960 = Options["UCI_Chess960"];
+            std::vector<std::string> fens;
+            std::vector<size_t>      order; // The positions of the block in the order they are evaluated
+            Values                   results;
+            size_t chunks = 0, count = 0;
+            TimePoint start = now();
+
+            // Each task evaluates a chunk of the block with the tables and caches of the search
+            // thread of its worker, their values are put in the order of the file.
+            auto evaluate = [&](size_t c) {
+                Thread* th = *(Threads.begin() + Tasks::worker());
+                th->bestValue = th->rootSimpleEval = VALUE_ZERO;
+                th->optimism[WHITE] = th->optimism[BLACK] = VALUE_ZERO;
+
+                StateInfo st;
+                Position  p;
+                Values    values;
+                for (size_t k = c * fens.size() / chunks; k < (c + 1) * fens.size() / chunks; ++k)
+                {
+                    const size_t i = order[k];
+                    p.set(fens[i], chess960, &st, th);
+                    values.push_back(p.checkers() ? std::make_pair(VALUE_NONE, VALUE_NONE)
+                        : useClassic ? std::make_pair(VALUE_NONE, Classic::Eval::evaluate<false>(p))
+                        : std::make_pair(Eval::NNUE::evaluate(p, false), Eval::evaluate(p)));
+                }
+                return values;
+                };
+
+            auto collect = [&](size_t c, const Values& values) {
+                const size_t first = c * fens.size() / chunks;
+                for (size_t k = 0; k < values.size(); ++k)
+                    results[order[first + k]] = values[k];
+                };
+
+            std::string line;
+            while (in)
+            {
+                fens.clear();
+                while (fens.size() < blockSize && std::getline(in, line))
+                {
+                    std::string fen = line.substr(0, line.find(';'));
+                    if (fen.find_first_not_of(" \t\r") != std::string::npos)
+                        fens.push_back(fen);
+                }
+
+                std::vector<int> kings(fens.size());
+                size_t           sameKings = 0;
+                for (size_t i = 0; i < fens.size(); ++i)
+                {
+                    kings[i] = king_squares(fens[i]);
+                    sameKings += i > 0 && kings[i] == kings[i - 1];
+                }
+
+                order.resize(fens.size());
+                for (size_t i = 0; i < order.size(); ++i)
+                    order[i] = i;
+
+                // Positions that mostly follow each other with the same kings are in the order of
+                // their games already, which is better still. Otherwise comparing the whole FENs
+                // is enough, the placement comes first.
+                if (2 * sameKings < fens.size())
+                    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+                        return kings[a] != kings[b] ? kings[a] < kings[b] : fens[a] < fens[b];
+                        });
+
+                results.resize(fens.size());
+                chunks = std::min(fens.size(), 8 * Tasks::workers());
+                if (!Tasks::ordered<Values>(chunks, evaluate, collect))
+                    break;
+
+                for (size_t i = 0; i < fens.size(); ++i)
+                    if (binary)
+                    {
+                        const int16_t v[2] = { int16_t(std::clamp(int(results[i].first), -32767, 32767)),
+                                               int16_t(results[i].second) };
+                        out.write(reinterpret_cast<const char*>(v), sizeof(v));
+                    }
+                    else
+                        out << fens[i] << ';' << results[i].first << ';' << results[i].second << '\n';
+
+                count += fens.size();
+            }
+
+            TimePoint elapsed = now() - start + 1;
+            sync_cout << "info string " << count << " positions evaluated in " << elapsed << " ms ("
+                << 1000 * count / elapsed << " positions/s), written to " << outName << sync_endl;
+        }
+
+        // 'savehash <file>' writes the transposition table to a file and 'loadhash <file>'
+        // reads it back, e.g. to continue a long analysis after a restart of the engine.
+        void hash_file(const std::string& cmd, std::istringstream& is) {
+
+            std::string fname;
+            std::getline(is >> std::ws, fname);
+            if (fname.empty())
+                return;
+
+            TimePoint start = now();
+            bool save = cmd == "savehash";
+            if (save ? TT.save(fname) : TT.load(fname))
+                sync_cout << "info string Hash " << (save ? "saved to " : "loaded from ") << fname << " in "
+                << now() - start << " ms" << sync_endl;
+            else
+                sync_cout << "info string Unable to " << (save ? "save hash to " : "load hash from ") << fname
+                << sync_endl;
+        }
+
+        // 'tt stats' prints the transposition table counters collected since the last
+        // 'tt stats clear', they are only available in builds with 'make ttstats=yes'.
+        // 'tt shared' lists the results of the processes sharing the hash for the current
+        // position, with their nodes and the best move voted over all of them.
+        void tt(Position& pos, std::istringstream& is) {
+
+            std::string token;
+            if (!(is >> token) || (token != "stats" && token != "shared"))
+                return;
+
+            if (token == "shared")
+            {
+                TT.print_shared(std::cout, pos.key(), pos.is_chess960());
+                return;
+            }
+
+            if (is >> token && token == "clear")
+                TT.clear_stats();
+            else
+                TT.print_stats(std::cout);
+        }
+
+        // 'evalhash stats' prints the probes and hits of the eval hash tables of all threads
+        // since the last 'evalhash stats clear'.
+        void eval_hash(std::istringstream& is) {
+
+            std::string token;
+            if (!(is >> token) || token != "stats")
+                return;
+
+            if (is >> token && token == "clear")
+                EvalHash::clear_stats();
+            else
+                EvalHash::print_stats(std::cout);
+        }
+
+        // 'deadline stats' prints how late the best moves of 'go deadline' searches were written
+        void deadline(std::istringstream& is) {
+
+            std::string token;
+            if (!(is >> token) || token != "stats")
+                return;
+
+            if (is >> token && token == "clear")
+                Deadline::clear_stats();
+            else
+                Deadline::print_stats(std::cout);
+        }
+
+        // 'searchstats' prints how often each pruning step of the search has been tried and
+        // cut, in total and per depth, since the last 'searchstats clear'. The counters are
+        // only available in builds with 'make searchstats=yes'.
+        void search_stats(std::istringstream& is) {
+
+            std::string token;
+            if (is >> token && token == "clear")
+                SearchStats::clear();
+            else
+                SearchStats::print(std::cout);
+        }
+
+        // 'tablestats' prints the probes and hits of the pawn and material tables of all
+        // threads, and of the shared pawn table, since the last 'tablestats clear'.
+        void table_stats(std::istringstream& is) {
+
+            std::string token;
+            if (is >> token && token == "clear")
+            {
+                Pawns::clear_stats();
+                Material::clear_stats();
+            }
+            else
+            {
+                Pawns::print_stats(std::cout);
+                Material::print_stats(std::cout);
+            }
+        }
+
+        // 'tbstats' prints the counters of the tablebase probes, per table, since the last
+        // 'tbstats clear'. They are only available in builds with 'make tbstats=yes'.
+        void tb_stats(std::istringstream& is) {
+
+            std::string token;
+            if (is >> token && token == "clear")
+                Tablebases::clear_stats();
+            else
+                Tablebases::print_stats(std::cout);
+        }
+
+        // book() handles the opening book commands. 'book build [file]' converts eco.txt
+        // into the binary book, which is memory mapped at startup instead of parsing the text.
+        // 'book import <pgn> [maxply] [mingames] [file]' builds the binary book from the games
+        // of a PGN file instead: the moves of the first maxply plies (default 20) that were
+        // played in at least mingames games (default 3), with their results.
+        void book(std::istringstream& is) {
+
+            std::string token, fname = "eco.bin";
+            is >> token;
+            if (token == "build")
+            {
+                is >> fname;
+                Book::build(fname);
+            }
+            else if (token == "import")
+            {
+                std::string pgn, maxPly, minGames;
+                is >> pgn >> maxPly >> minGames >> fname;
+                Book::import(pgn, maxPly.empty() ? 20 : std::atoi(maxPly.c_str()),
+                    minGames.empty() ? 3 : std::atoi(minGames.c_str()), fname);
+            }
         }
 
         void test(std::istringstream& is) {
@@ -484,7 +1522,7 @@ namespace Stockfish {
             std::string token;
             is >> token;
             if (token == "perft")
-                test_perft();
+                test_perft(is);
             else if (token == "mate")
                 test_mate(is);
         }
@@ -527,16 +1565,20 @@ namespace Stockfish {
 
         Position     pos;
         std::string  token, cmd;
-        StateListPtr states(new std::deque<StateInfo>(1));
+        StateListPtr states(new StateList(1));
 
         pos.set(StartFEN, false, &states->back(), Threads.main());
 
         for (int i = 1; i < argc; ++i)
             cmd += std::string(argv[i]) + " ";
 
+        if (argc == 1)
+            input.start();
+
+        Input::Kind kind = Input::Other;
         do
         {
-            if (argc == 1 && !getline(std::cin, cmd)) // Wait for an input or an end-of-file (EOF) indication
+            if (argc == 1 && !input.next(cmd, kind)) // Wait for an input or an end-of-file (EOF) indication
                 cmd = "quit";
 
             std::istringstream is(cmd);
@@ -585,9 +1627,16 @@ namespace Stockfish {
             {
                 std::optional<std::string> filename;
                 std::string                f;
-                if (is >> std::skipws >> f)
-                    filename = f;
-                Eval::NNUE::save_eval(filename);
+                bool                       mapped = false;
+                Eval::NNUE::NetSize        netSize = Eval::NNUE::Big;
+                while (is >> std::skipws >> f)
+                    if (f == "mapped")
+                        mapped = true;
+                    else if (f == "small")
+                        netSize = Eval::NNUE::Small;
+                    else if (!filename)
+                        filename = f;
+                Eval::NNUE::save_eval(filename, netSize, mapped);
             }
             else if (token == "--help" || token == "help" || token == "--license" || token == "license")
                 sync_cout
@@ -608,6 +1657,30 @@ namespace Stockfish {
                 new_game(pos, states);
             else if (token == "test")
                 test(is);
+            else if (token == "evalbatch")
+                eval_batch(is);
+            else if (token == "selfplay")
+                SelfPlay::play(is);
+            else if (token == "gensfen")
+                SelfPlay::gensfen(is);
+            else if (token == "server")
+                Server::run();
+            else if (token == "savehash" || token == "loadhash")
+                hash_file(token, is);
+            else if (token == "tt")
+                tt(pos, is);
+            else if (token == "evalhash")
+                eval_hash(is);
+            else if (token == "deadline")
+                deadline(is);
+            else if (token == "searchstats")
+                search_stats(is);
+            else if (token == "tbstats")
+                tb_stats(is);
+            else if (token == "tablestats")
+                table_stats(is);
+            else if (token == "book")
+                book(is);
             else if (SAN::is_ok(token))
             {
                 Move move = SAN::algebraic_to_move(pos, token);
@@ -622,7 +1695,21 @@ namespace Stockfish {
             else if (!token.empty() && token[0] != '#')
                 sync_cout << "Unknown command: '" << cmd << "'. Type help for more information." << sync_endl;
 
+            if (argc == 1)
+                input.done(kind);
+
         } while (token != "quit" && argc == 1); // The command-line arguments are one-shot
+
+        input.close();
+    }
+
+
+    // Reads the next line of the standard input for a command that reads its own input,
+    // like 'server'. False on end of file.
+    bool UCI::read_line(std::string& line) {
+
+        Input::Kind kind;
+        return input.next(line, kind);
     }
 
 
@@ -20,6 +20,7 @@
 #define UCI_H_INCLUDED
 
 #include <cstddef>
+#include <functional>
 #include <iosfwd>
 #include <map>
 #include <string>
@@ -73,6 +74,7 @@ namespace Stockfish {
 
         private:
             friend std::ostream& operator<<(std::ostream&, const OptionsMap&);
+            friend std::string   setoption_commands(const OptionsMap&);
 
             std::string defaultValue, currentValue, type;
             int         min, max;
@@ -81,12 +83,14 @@ namespace Stockfish {
         };
 
         void        init(OptionsMap&);
+        std::string setoption_commands(const OptionsMap&);
         void        loop(int argc, char* argv[]);
+        bool        read_line(std::string& line);
         int         to_cp(Value v);
         std::string value(Value v);
         std::string square(Square s);
         std::string move(Move m, bool chess960);
-        std::string pv(const Position& pos, Depth depth);
+        std::function<std::string()> pv(const Position& pos, Depth depth);
         std::string wdl(Value v, int ply);
         Move        to_move(const Position& pos, std::string& str);
         std::string pv_to_string(const Position& pos, const Move* pv, bool isSAN);
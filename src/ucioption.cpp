@@ -26,10 +26,12 @@
 #include <ostream>
 #include <sstream>
 #include <string>
+#include <string_view>
 
 #include "book.h"
 #include "evaluate.h"
 #include "misc.h"
+#include "pawns.h"
 #include "search.h"
 #include "syzygy/tbprobe.h"
 #include "thread.h"
@@ -49,12 +51,26 @@ namespace Stockfish {
         // 'On change' actions, triggered by an option's value change
         static void on_clear_hash(const Option&) { Search::clear(); }
         static void on_hash_size(const Option& o) { TT.resize(size_t(o)); }
+        static void on_interleave_hash(const Option&) { TT.resize(size_t(Options["Hash"])); }
+        static void on_hash_shared(const Option&) { TT.resize(size_t(Options["Hash"])); }
+        static void on_hash_layout(const Option&) { TT.resize(size_t(Options["Hash"])); }
         static void on_logger(const Option& o) { start_logger(o); }
+        static void on_info_interval(const Option& o) { AsyncOut::set_interval(o); }
+        static void on_search_trace(const Option& o) { Search::set_trace_file(o); }
         static void on_threads(const Option& o) { Threads.set(size_t(o)); }
-        static void on_tb_path(const Option& o) { Tablebases::init(o); }
+        static void on_thread_binding(const Option&) { Threads.set(size_t(Options["Threads"])); }
+        static void on_tb_path(const Option&) { Tablebases::init(Options["SyzygyPath"], Options["SyzygyPreload"]); }
         static void on_eval_file(const Option& o) { Eval::NNUE::init(); }
         static void on_use_shashin(const Option& o) { useShashin = o; }
         static void on_use_book(const Option& o) { Book::init(); }
+        static void on_eval_tables(const Option&) {
+            Threads.main()->wait_for_search_finished();
+            Threads.clear();
+        }
+        static void on_pawn_table_shared(const Option& o) {
+            Threads.main()->wait_for_search_finished();
+            Pawns::set_shared(size_t(o) * 1024);
+        }
         static void on_use_classic(const Option& o) {
             useClassic = o;
             Search::init();
@@ -75,12 +91,22 @@ namespace Stockfish {
 
             o["Debug Log File"] << Option("", on_logger);
             o["Threads"] << Option(1, 1, 1024, on_threads);
+            o["Thread Binding"] << Option("none var none var compact var scatter var physical-cores-first", "none", on_thread_binding);
             o["Hash"] << Option(16, 1, MaxHashMB, on_hash_size);
+            o["Interleave Hash"] << Option(false, on_interleave_hash);
+            o["Hash Shared"] << Option("<empty>", on_hash_shared);
+#ifndef HASH64
+            o["Hash Layout"] << Option("clusters var clusters var buckets", "clusters", on_hash_layout);
+#endif
             o["Clear Hash"] << Option(on_clear_hash);
             o["Ponder"] << Option(false);
             o["MultiPV"] << Option(1, 1, MAX_MOVES);
+            o["MultiPV Fast"] << Option(false);
+            o["Mate Prover"] << Option(0, 0, 20);
+            o["Info Interval"] << Option(0, 0, 5000, on_info_interval);
             o["Skill Level"] << Option(20, 0, 20);
             o["Move Overhead"] << Option(10, 0, 5000);
+            o["Search Trace File"] << Option("<empty>", on_search_trace);
             o["nodestime"] << Option(0, 0, 10000);
             o["UCI_Chess960"] << Option(false);
             o["UCI_LimitStrength"] << Option(false);
@@ -90,9 +116,14 @@ namespace Stockfish {
             o["SyzygyProbeDepth"] << Option(1, 1, 100);
             o["Syzygy50MoveRule"] << Option(true);
             o["SyzygyProbeLimit"] << Option(7, 0, 7);
+            o["SyzygyPreload"] << Option("none var none var map var load", "none", on_tb_path);
             o["EvalFile"] << Option(EvalFileDefaultName, on_eval_file);
+            o["EvalFileSmall"] << Option("<empty>", on_eval_file);
             o["Use Book"] << Option(false, on_use_book);
             o["Use Classic"] << Option(false, on_use_classic);
+            o["Pawn Table"] << Option(128, 1, 65536, on_eval_tables);
+            o["Material Table"] << Option(8, 1, 4096, on_eval_tables);
+            o["Pawn Table Shared"] << Option(0, 0, 1048576, on_pawn_table_shared);
 
             // from Shashin begin
             o["Use Shashin"] << Option(false, on_use_shashin);
@@ -132,6 +163,25 @@ namespace Stockfish {
         }
 
 
+        // Returns the 'setoption' commands that give another engine instance the
+        // current values of all options, e.g. the processes of 'test mate groups' and
+        // 'bench instances'.
+        // The options that name a file or shared memory of this process are left out,
+        // the other instance runs at the same time and would open them as well.
+        std::string setoption_commands(const OptionsMap& om) {
+
+            constexpr std::string_view OwnOptions[] = { "Debug Log File", "Search Trace File", "Hash Shared" };
+
+            std::ostringstream ss;
+            for (const auto& it : om)
+                if (it.second.type != "button"
+                    && std::find(std::begin(OwnOptions), std::end(OwnOptions), it.first) == std::end(OwnOptions))
+                    ss << "setoption name " << it.first << " value " << it.second.currentValue << "\n";
+
+            return ss.str();
+        }
+
+
         // Option class constructors and conversion operators
 
         Option::Option(const char* v, OnChange f) :
@@ -179,7 +229,7 @@ namespace Stockfish {
         }
 
         Option::operator std::string() const {
-            assert(type == "string");
+            assert(type == "string" || type == "combo");
             return currentValue;
         }
 